@@ -53,6 +53,7 @@ ORIGINAL FILE: src/Body/ConstraintForceSolver.h
 #include <boost/make_shared.hpp>
 #include <boost/bind.hpp>
 #include <limits>
+#include <algorithm>
 
 #include <fstream>
 #include <iomanip>
@@ -60,6 +61,12 @@ ORIGINAL FILE: src/Body/ConstraintForceSolver.h
 
 #include "BCCoreSiconos.h"
 #include "BCCoreQMR.h"
+#include "BCCoreBlockGS.h"
+#include "BCSparseMatrix.h"
+#include "BCPackedSymmetricMatrix.h"
+#include "BCThreadPool.h"
+#include "BCTreeLTDL.h"
+#include "BCGeometryPairTable.h"
 
 using namespace std;
 using namespace cnoid;
@@ -87,7 +94,34 @@ static const bool ENABLE_TRUE_FRICTION_CONE =
     (true && ONLY_STATIC_FRICTION_FORMULATION && STATIC_FRICTION_BY_TWO_CONSTRAINTS);
 
 static const bool SKIP_REDUNDANT_ACCEL_CALC = true;
-static const bool ASSUME_SYMMETRIC_MATRIX = false;
+
+// The normal and the two friction test forces of a constraint point are propagated
+// through an articulated body at once as the columns of fixed-size matrices
+static const bool USE_BATCHED_ABM_TEST_FORCES = true;
+static const int ABM_BATCH_SIZE = 3;
+
+// The elements given by the bodies solved by ForwardDynamicsCBM are calculated for all
+// their test forces at once with the factorized inertia of the unknown root DOFs
+// instead of calling ForwardDynamicsCBM::solveUnknownAccels for each test force
+static const bool USE_BATCHED_CBM_TEST_FORCES = true;
+
+// The articulated inertia of a free root link, which is constant in a step, is factorized
+// once per step by the Cholesky decomposition. The column-pivoting QR decomposition is used
+// instead when the ratio of the smallest to the largest pivot is below the following value.
+static const double ROOT_INERTIA_MIN_PIVOT_RATIO = 1.0e-12;
+
+// The matrix assembled in half in the symmetric matrix mode is compared with the full
+// assembly at the following interval of steps (0: no check). The elements of the sampled
+// columns must agree within the tolerance relative to the largest element.
+static const int SYMMETRIC_MATRIX_CHECK_INTERVAL = 1000;
+static const int SYMMETRIC_MATRIX_CHECK_NUM_COLUMNS = 8;
+static const double SYMMETRIC_MATRIX_CHECK_TOLERANCE = 1.0e-6;
+
+// The matrix of the Jacobian assembly is compared with the assembly by the test forces at
+// the following interval of steps (0: no check). The elements must agree within the
+// tolerance relative to the largest element.
+static const int JACOBIAN_ASSEMBLY_CHECK_INTERVAL = 1000;
+static const double JACOBIAN_ASSEMBLY_CHECK_TOLERANCE = 1.0e-6;
 
 static const int DEFAULT_MAX_NUM_GAUSS_SEIDEL_ITERATION = 1000;
 
@@ -102,6 +136,11 @@ static const double THRESH_TO_SWITCH_REL_ERROR = 1.0e-8;
 
 static const bool USE_PREVIOUS_LCP_SOLUTION = true;
 
+// The previous solution is given to the constraint points of the same geometry pair
+// which are nearer than the following distance to the previous points
+static const bool USE_CONTACT_IDENTITY_WARM_START = (true && USE_PREVIOUS_LCP_SOLUTION);
+static const double WARM_START_POINT_MATCHING_DISTANCE = 0.005;
+
 static const bool ENABLE_CONTACT_DEPTH_CORRECTION = true;
 
 // normal setting
@@ -113,6 +152,36 @@ static const double DEFAULT_CONTACT_CORRECTION_VELOCITY_RATIO = 1.0;
 static const double DEFAULT_CONTACT_CULLING_DISTANCE = 0.005;
 static const double DEFAULT_CONTACT_CULLING_DEPTH = 0.05;
 
+// The link pairs of the geometry pairs which have not collided for the following number of
+// steps are removed from geometryPairToLinkPairMap (0: never removed until initialize())
+static const int DEFAULT_LINK_PAIR_EVICTION_STEPS = 1000;
+
+// In the patch contact mode, the contact points of a link pair whose normals are within the
+// following angle of their mean are replaced by one point at their centroid, which has the
+// torsional friction around the normal and the tilting moments around the axes of the patch.
+// The patches narrower than the minimum moment arm are kept as the points.
+static const double PATCH_CONTACT_MAX_NORMAL_ANGLE = 0.1;
+static const int PATCH_CONTACT_MIN_NUM_POINTS = 3;
+static const double PATCH_CONTACT_MIN_MOMENT_ARM = 1.0e-4;
+
+// The penalty forces of the link pairs are calculated in parallel when the number of the
+// penalty-based link pairs is at least the following value
+static const int PENALTY_PARALLEL_MIN_NUM_PAIRS = 256;
+// In the penalty implicit mode, the forces of the link pairs are iterated the following
+// number of times, where each iteration uses the forces of the other pairs of the previous one
+static const int PENALTY_IMPLICIT_NUM_ITERATIONS = 4;
+
+// When the number of the contact constraints or the time of the constraint solution of the
+// previous step exceeds its budget, the least important contact link pairs are moved to the
+// penalty-based contacts for the step. The importance is m (|v| + AUTO_PENALTY_REFERENCE_SPEED)
+// / (1 + d / AUTO_PENALTY_REFERENCE_DISTANCE) with the largest mass m of the moving links, the
+// largest relative speed |v| of the points and the distance d from the articulated bodies.
+static const double AUTO_PENALTY_REFERENCE_SPEED = 0.1;
+static const double AUTO_PENALTY_REFERENCE_DISTANCE = 1.0;
+// the number of the constraints allowed by the solution time grows by the following ratio
+// per step while the time is within the budget
+static const double AUTO_PENALTY_SIZE_GROWTH_RATIO = 1.1;
+
 
 // test for mobile robots with wheels
 //static const double DEFAULT_CONTACT_CORRECTION_DEPTH = 0.005;
@@ -163,20 +232,184 @@ public:
         
     struct ConstraintPoint {
         int globalIndex;
-        Vector3 point;
-        Vector3 normalTowardInside[2];
-        Vector3 defaultAccel[2];
+        int index; // index in contactPoints, which holds the vectors of the point
         double normalProjectionOfRelVelocityOn0;
         double depth; // position error in the case of a connection point
 
         double mu;
-        Vector3 relVelocityOn0;
         int globalFrictionIndex;
         int numFrictionVectors;
-        Vector3 frictionVector[4][2];
+
+        // rows of a contact patch following the friction rows (see ContactPointStore::momentVector)
+        int numMomentVectors;
+        double momentArms[3];
     };
     typedef std::vector<ConstraintPoint> ConstraintPointArray;
 
+    /**
+       Vectors of the constraint points of a step in the structure of arrays, in the order in
+       which the points are added. The points of a link pair are contiguous, so the per-point
+       calculations of a pair run over the columns of Eigen::Map<Matrix3Xd>.
+       Only normalTowardInside[1] and the first friction vector of each tangent direction are
+       stored because the others are their negations.
+    */
+    struct ContactPointStore {
+        typedef std::vector<Vector3> Vector3Array;
+        Vector3Array points;
+        Vector3Array normals;       // normalTowardInside[1]
+        Vector3Array tangents[2];   // frictionVector[0][0] and frictionVector[1][0]
+        Vector3Array relVelocities; // relVelocityOn0
+        Vector3Array defaultAccels[2];
+        Vector3Array patchAxes[2];            // tilting axes of a contact patch
+        Vector3Array defaultAngularAccels[2]; // of a contact patch
+
+        int size() const { return points.size(); }
+
+        void clear() {
+            points.clear();
+            normals.clear();
+            relVelocities.clear();
+            for(int i=0; i < 2; ++i){
+                tangents[i].clear();
+                defaultAccels[i].clear();
+                patchAxes[i].clear();
+                defaultAngularAccels[i].clear();
+            }
+        }
+
+        int add() {
+            const int index = points.size();
+            const Vector3 zero(Vector3::Zero());
+            points.push_back(zero);
+            normals.push_back(zero);
+            relVelocities.push_back(zero);
+            for(int i=0; i < 2; ++i){
+                tangents[i].push_back(zero);
+                defaultAccels[i].push_back(zero);
+                patchAxes[i].push_back(zero);
+                defaultAngularAccels[i].push_back(zero);
+            }
+            return index;
+        }
+
+        void move(int from, int to) {
+            if(from != to){
+                points[to] = points[from];
+                normals[to] = normals[from];
+                relVelocities[to] = relVelocities[from];
+                for(int i=0; i < 2; ++i){
+                    tangents[i][to] = tangents[i][from];
+                    defaultAccels[i][to] = defaultAccels[i][from];
+                    patchAxes[i][to] = patchAxes[i][from];
+                    defaultAngularAccels[i][to] = defaultAngularAccels[i][from];
+                }
+            }
+        }
+
+        void resize(int n) {
+            points.resize(n);
+            normals.resize(n);
+            relVelocities.resize(n);
+            for(int i=0; i < 2; ++i){
+                tangents[i].resize(n);
+                defaultAccels[i].resize(n);
+                patchAxes[i].resize(n);
+                defaultAngularAccels[i].resize(n);
+            }
+        }
+
+        void removeLast() {
+            points.pop_back();
+            normals.pop_back();
+            relVelocities.pop_back();
+            for(int i=0; i < 2; ++i){
+                tangents[i].pop_back();
+                defaultAccels[i].pop_back();
+                patchAxes[i].pop_back();
+                defaultAngularAccels[i].pop_back();
+            }
+        }
+
+        static Eigen::Map<Eigen::Matrix3Xd> columns(Vector3Array& array, int begin, int n) {
+            return Eigen::Map<Eigen::Matrix3Xd>(array[begin].data(), 3, n);
+        }
+
+        Vector3& point(const ConstraintPoint& c) { return points[c.index]; }
+        const Vector3& point(const ConstraintPoint& c) const { return points[c.index]; }
+        Vector3& relVelocityOn0(const ConstraintPoint& c) { return relVelocities[c.index]; }
+        Vector3& defaultAccel(const ConstraintPoint& c, int which) { return defaultAccels[which][c.index]; }
+        Vector3& defaultAngularAccel(const ConstraintPoint& c, int which) { return defaultAngularAccels[which][c.index]; }
+
+        Vector3 normalTowardInside(const ConstraintPoint& c, int which) const {
+            return which ? normals[c.index] : Vector3(-normals[c.index]);
+        }
+
+        // frictionVector[j][which]; the vectors of j = 2, 3 are the negations of j = 0, 1
+        Vector3 frictionVector(const ConstraintPoint& c, int j, int which) const {
+            const Vector3& t = tangents[j & 1][c.index];
+            return ((j >> 1) == which) ? t : Vector3(-t);
+        }
+
+        /**
+           momentVector[i][which] of a contact patch, which is the torque given by the unit solution
+           of the moment row i: the torsion around the normal for i = 0 and the tilting moment around
+           patchAxes[i - 1] otherwise. The rows are scaled by the moment arms so that the bound
+           mu * fn of the friction rows limits the torsion to mu * momentArms[0] * fn and the tilting
+           moments to momentArms[i] * fn, which keeps the center of pressure in the patch.
+        */
+        Vector3 momentVector(const ConstraintPoint& c, int i, int which) const {
+            const Vector3& axis = (i == 0) ? normals[c.index] : patchAxes[i - 1][c.index];
+            const double scale = (i == 0) ? c.momentArms[0] : (c.momentArms[i] / c.mu);
+            return which ? Vector3(scale * axis) : Vector3(-scale * axis);
+        }
+
+        //! Gives the pair of the normal vectors when l < 0, or that of the friction vector l otherwise
+        void getDirections(const ConstraintPoint& c, int l, Vector3* v) const {
+            if(l < 0){
+                v[0] = normalTowardInside(c, 0);
+                v[1] = normalTowardInside(c, 1);
+            } else {
+                v[0] = frictionVector(c, l, 0);
+                v[1] = frictionVector(c, l, 1);
+            }
+        }
+    };
+
+    // solution of a constraint point kept for the warm start of the next step
+    struct WarmStartPoint {
+        Vector3 point;
+        double normalForce;
+        Vector3 frictionForce; // sum of the friction forces along frictionVector[j][1]
+        Vector3 frictionBase;  // frictionVector[0][0] of the static friction
+        bool hasFrictionBase;
+        Vector3 moment;        // sum of the moments along momentVector[i][1] of a contact patch
+    };
+    typedef std::vector<WarmStartPoint> WarmStartPointArray;
+
+    // contact point before the manifold reduction and the patch merge
+    struct RawContactPoint {
+        Vector3 point;
+        Vector3 normal;
+        double depth;
+    };
+    typedef std::vector<RawContactPoint> RawContactPointArray;
+
+    // columns of the test forces of a batch
+    typedef Eigen::Matrix<double, 3, ABM_BATCH_SIZE> Vector3Batch;
+    typedef Eigen::Matrix<double, 1, ABM_BATCH_SIZE> ScalarBatch;
+
+    typedef Eigen::Matrix<double, 6, 6> Matrix6;
+
+    // shared by the copies of the scratch data, which only read it
+    struct RootInertiaFactorization
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Eigen::LLT<Matrix6> llt;
+        Eigen::ColPivHouseholderQR<Matrix6> qr;
+        bool isLLTUsed;
+    };
+    typedef boost::shared_ptr<RootInertiaFactorization> RootInertiaFactorizationPtr;
+
     struct LinkData
     {
         Vector3 dvo;
@@ -186,10 +419,17 @@ public:
         double uu;
         double uu0;
         double ddq;
+        Vector3Batch dvoBatch;
+        Vector3Batch dwBatch;
+        ScalarBatch duuBatch;
         int numberToCheckAccelCalcSkip;
         int parentIndex;
         DyLink* link;
 /*BC*/  int penaltySpringCount;  
+/*BC*/  bool isPenaltyBased;
+/*BC*/  double penaltyMinSize; // smallest extent of the bounding box of the shape
+/*BC*/  Vector3 penaltyForce;  // sums of the penalty forces and their torques around the origin
+/*BC*/  Vector3 penaltyTorque; // in an iteration of the implicit mode
     };
     typedef std::vector<LinkData> LinkDataArray;
 
@@ -197,6 +437,7 @@ public:
     {
         DyBodyPtr body;
         bool isStatic;
+/*BC*/  bool isPenaltyBased;
         bool hasConstrainedLinks;
         bool isTestForceBeingApplied;
         int geometryId;
@@ -204,6 +445,8 @@ public:
 
         Vector3 dpf;
         Vector3 dptau;
+        Vector3Batch dpfBatch;
+        Vector3Batch dptauBatch;
 
         /**
            If the body includes high-gain mode joints,
@@ -212,6 +455,20 @@ public:
            the forward dynamics is calculated by ABM.
         */
         ForwardDynamicsCBMPtr forwardDynamicsCBM;
+
+        // joint-space inertia for the Jacobian-based assembly of Mlcp
+        std::vector<int> linkToDof; // DOF of the joint of each link, -1 if it is not a DOF of the inertia
+        int numRootDofs;            // 6 if the root is a free joint, otherwise 0
+        BCTreeLTDL jointSpaceInertia;
+
+        // factorization of the articulated inertia of the free root link in the current step
+        RootInertiaFactorizationPtr rootInertia;
+        // counts in the current step, which are kept in each copy of the scratch data
+        int numRootInertiaFactorizations;
+        int numRootInertiaSolves;
+
+        // step at which the accelerations of the links were given in the fused ABM mode
+        int articulatedAccelerationStep;
     };
 
     std::vector<BodyData> bodiesData;
@@ -219,6 +476,7 @@ public:
     class LinkPair
     {
     public:
+        LinkPair() : isAutoPenaltyBased(false), warmStartStep(-1) { }
         virtual ~LinkPair() { }
         bool isSameBodyPair;
         int bodyIndex[2];
@@ -233,14 +491,23 @@ public:
         double contactCullingDepth;
         double epsilon;
 /*BC*/  bool   isPenaltyBased;
+/*BC*/  bool   isAutoPenaltyBased; // moved to the penalty-based contacts by the budget in the step
+/*BC*/  RawContactPointArray rawContactPoints; // kept for the automatic switching to the penalty-based contacts
+        WarmStartPointArray warmStartPoints;
+        int warmStartStep; // step at which warmStartPoints were stored
+        // spatial hash of warmStartPoints, whose cells are the cubes with the edge of
+        // WARM_START_POINT_MATCHING_DISTANCE
+        std::vector<int> warmStartGridHeads;
+        std::vector<int> warmStartGridNext; // indexed by the position in warmStartPoints
     };
     typedef boost::shared_ptr<LinkPair> LinkPairPtr;
 
     CollisionDetectorPtr collisionDetector;
     vector<int> geometryIdToBodyIndexMap;
     //typedef std::map<IdPair<>, LinkPairPtr> GeometryPairToLinkPairMap;
-    typedef std::map<IdPair<>, LinkPair> GeometryPairToLinkPairMap;
+    typedef BCGeometryPairTable<LinkPair> GeometryPairToLinkPairMap;
     GeometryPairToLinkPairMap geometryPairToLinkPairMap;
+    int linkPairEvictionSteps;
         
     double defaultStaticFriction;
     double defaultSlipFriction;
@@ -258,6 +525,7 @@ public:
     vector<ExtraJointLinkPairPtr> extraJointLinkPairs;
 
     bool is2Dmode;
+    bool isStableFrictionBasisMode;
     DyBodyPtr bodyFor2dConstraint;
     BodyData bodyDataFor2dConstraint;
 
@@ -274,6 +542,8 @@ public:
 
     int globalNumConstraintVectors;
 
+    ContactPointStore contactPoints;
+
     int globalNumContactNormalVectors;
     int globalNumFrictionVectors;
 
@@ -282,6 +552,54 @@ public:
 
     bool areThereImpacts;
     int numUnconverged;
+    int numBlockGaussSeidelUnconverged;
+    int stepCount;
+
+    int numWarmStartedPoints;
+    int numColdStartedPoints;
+    long totalNumWarmStartedPoints;
+    long totalNumColdStartedPoints;
+
+    // uniform spatial hash of the contact points kept in the link pair being extracted,
+    // whose cells are the cubes with the edge of the culling distance
+    std::vector<int> cullingGridHeads;
+    std::vector<int> cullingGridNext; // indexed by the position in LinkPair::constraintPoints
+    int cullingGridMask;
+    double cullingGridInvCellSize;
+
+    // collision points given by the collision detector and those added to the constraints
+    int numRawContactPointsInStep;
+    int numKeptContactPointsInStep;
+    long totalNumRawContactPoints;
+    long totalNumKeptContactPoints;
+
+    // zero for no limit
+    int maxNumContactPointsPerLinkPair;
+    int maxNumContactPointsPerStep;
+    // buffers of the contact manifold reduction
+    std::vector<Vector3> manifoldPositions;
+    std::vector<double> manifoldDistances;
+    std::vector<char> isManifoldPointSelected;
+    std::vector<int> manifoldSelection;
+    std::vector< std::pair<double, int> > contactDepthOrder;
+
+    // the patch contact mode is only active with the dense projected Gauss-Seidel solvers
+    bool isPatchContactMode;
+    bool isPatchContactActive;
+    std::vector<char> isMomentFrictionRow; // indexed by the friction rows
+    int numContactPatchesInStep;
+    long totalNumContactPatches;
+
+    // budgets of the automatic switching to the penalty-based contacts (zero for no limit)
+    int autoPenaltyMaxNumConstraints;
+    double autoPenaltyMaxSolutionTime;
+    double autoPenaltyTimeLimitedSize; // number of the constraints allowed by the solution time
+    TimeMeasure solutionTimer;
+    double solutionTime; // of the contact constraints in the last step
+    std::vector<Vector3> articulatedBodyPositions;
+    std::vector< std::pair<double, int> > autoPenaltyOrder; // importances and indices of the link pairs
+    int numAutoPenaltyLinkPairsInStep;
+    long totalNumAutoPenaltyLinkPairs;
 
     typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> MatrixX;
     typedef VectorXd VectorX;
@@ -290,6 +608,31 @@ public:
 
     MatrixX Mlcp;
 
+    // used instead of Mlcp in the sparse matrix mode, which is also used in the island mode
+    // so that the blocks of the islands are copied from the nonzero elements
+    bool isSparseMatrixMode;
+    bool isSparseMatrixActive;
+    BCSparseMatrix sparseMlcp;
+    std::vector<int> sparseRowToGroup;
+    std::vector< std::vector<int> > sparseGroupColumns;
+    // link pairs of each non-static body, where the index numBodies is used for the body of the 2D constraint
+    std::vector< std::vector<int> > bodyToLinkPairIndices;
+
+    /**
+       used instead of Mlcp in the symmetric matrix mode.
+       A test force only gives the rows of the constraint points up to its own point, and the
+       rows of each point are ordered as its normal vector followed by its friction vectors
+       in symmetricMlcp, so the calculated elements cover the upper triangle of symmetricMlcp.
+    */
+    bool isSymmetricMatrixMode;
+    bool isSymmetricMatrixActive; // in the current step
+    bool isSymmetricMatrixUnsafe; // found by the sampled check
+    BCPackedSymmetricMatrix symmetricMlcp;
+    std::vector<int> symmetricMlcpOrder;
+    int numSymmetricMatrixChecks;
+    int numSymmetricMatrixFallbacks;
+    double maxSymmetricMatrixError;
+
     // constant acceleration term when no external force is applied
     VectorX an0;
     VectorX at0;
@@ -308,6 +651,142 @@ public:
     VectorX contactIndexToMu;
     VectorX mcpHi;
 
+    // sizes and friction data of the MCP given to the projected Gauss-Seidel method
+    struct MCPLayout
+    {
+        MCPLayout(int numContactNormalVectors, int numConstraintVectors, int numFrictionVectors,
+                  const VectorX& contactIndexToMu, VectorX& mcpHi, const std::vector<int>& frictionIndexToContactIndex)
+            : numContactNormalVectors(numContactNormalVectors),
+              numConstraintVectors(numConstraintVectors),
+              numFrictionVectors(numFrictionVectors),
+              contactIndexToMu(contactIndexToMu),
+              mcpHi(mcpHi),
+              frictionIndexToContactIndex(frictionIndexToContactIndex),
+              isMomentRow(0),
+              isColored(false) { }
+        const int numContactNormalVectors;
+        const int numConstraintVectors;
+        const int numFrictionVectors;
+        const VectorX& contactIndexToMu;
+        VectorX& mcpHi;
+        const std::vector<int>& frictionIndexToContactIndex;
+        // the moment rows of the contact patches are not projected onto the friction cone (null if none)
+        const std::vector<char>* isMomentRow;
+        // rows are updated color by color using constrainedLinkPairs and colorClasses
+        bool isColored;
+    };
+
+    /**
+       A set of link pairs whose constraints are not coupled with the other constraints.
+       The rows of an island keep the order of the global MCP, so the island MCP has
+       the same layout (contact normals, bilateral constraints, then friction).
+    */
+    class Island
+    {
+    public:
+        Island() : coreBufferSize(0) { }
+        std::vector<int> linkPairIndices;
+        std::vector<int> rows; // island row -> global row
+        int numContactNormalVectors;
+        int numConstraintVectors;
+        int numFrictionVectors;
+        BCSparseMatrix sparseMlcp;
+        std::vector<int> sparseRowToGroup;
+        std::vector< std::vector<int> > sparseGroupColumns;
+        VectorX b;
+        VectorX solution;
+        VectorX contactIndexToMu;
+        VectorX mcpHi;
+        std::vector<int> frictionIndexToContactIndex;
+        boost::shared_ptr<BCCoreSiconos> siconosCore;
+        boost::shared_ptr<BCCoreQMR> qmrCore;
+        boost::shared_ptr<BCCoreBlockGS> blockGSCore;
+        int coreBufferSize;
+        bool isConverged;
+        bool isBlockGaussSeidelConverged;
+        int size() const { return rows.size(); }
+    };
+
+    typedef boost::shared_ptr<Island> IslandPtr;
+
+    bool isIslandMode;
+    std::vector<IslandPtr> islands;
+    int numIslands;
+    int maxNumIslands;
+    std::vector<int> islandOrder;
+    std::vector<int> bodyToIslandRoot;
+    std::vector<int> islandIndexOfRoot;
+    std::vector<int> globalRowToIslandRow;
+    std::vector<int> linkPairToIslandGroup;
+    BCThreadPool threadPool;
+
+    /**
+       The matrix-free Gauss-Seidel solver does not form Mlcp. The constraint forces
+       are accumulated in the ABM force elements of the bodies, and each row update
+       reads the current accelerations of the two links of the row.
+       This mode is not available when a constrained body is solved by ForwardDynamicsCBM.
+    */
+    bool isMatrixFreeMode;
+    VectorX matrixFreeDiagonal;
+
+    /**
+       Mlcp is given by J H^-1 J^T of each body instead of the test forces, where H is the
+       joint-space inertia factorized by BCTreeLTDL. The high-gain mode joints are not the
+       DOFs of H because their accelerations are not changed by the constraint forces.
+    */
+    bool isJacobianAssemblyMode;
+    bool isJacobianAssemblyUnsafe; // found by the check
+    int numJacobianAssemblyChecks;
+    double maxJacobianAssemblyError;
+    // spatial inertia about the world origin: [m, -hat(h); hat(h), Io]
+    struct CompositeInertia {
+        double m;
+        Vector3 h;
+        Matrix3 Io;
+    };
+    std::vector<CompositeInertia> compositeInertias;
+    std::vector<int> jacobianRows;
+    MatrixX rowJacobian;
+    std::vector<bool> isPathLink;
+    std::vector<int> pathDofs;
+    MatrixX halfJacobian;
+    MatrixX pathHalfJacobian;
+    MatrixX bodyAccelerationMatrix;
+
+    // true when the test forces to the ForwardDynamicsCBM bodies are batched in the current step
+    bool areCBMTestForcesBatched;
+
+    // the test forces of the link pairs are applied in parallel with the scratch data of each worker
+    bool isParallelAssemblyMode;
+    std::vector< std::vector<BodyData> > assemblyScratchBodiesData;
+
+    TimeMeasure assemblyTimer;
+    double totalAssemblyTime;
+    int numAssemblies;
+    int numParallelAssemblies;
+
+    int numRootInertiaFactorizationsInStep;
+    int numRootInertiaSolvesInStep;
+    long totalNumRootInertiaFactorizations;
+    long totalNumRootInertiaSolves;
+    int numRootInertiaQRFallbacks;
+
+    /**
+       In the fused ABM mode, the accelerations of the links of each constrained body are
+       given by the ABM force elements of this solver with the constraint forces committed,
+       so BCForwardDynamicsABM does not repeat the bottom-up sweep with the same forces.
+    */
+    bool isFusedABMMode;
+    long totalNumFusedABMLinks;
+
+    // graph coloring for the parallel projected Gauss-Seidel method
+    std::vector<int> linkPairColors;
+    std::vector< std::vector<int> > colorClasses;
+    std::vector<int> colorUsedStamp;
+    int numColors;
+    int maxNumColors;
+    int maxColorClassSize;
+
     int  maxNumGaussSeidelIteration;
     int  numGaussSeidelInitialIteration;
     double gaussSeidelErrorCriterion;
@@ -323,46 +802,241 @@ public:
     void init2Dconstraint(int bodyIndex);
     void setConstraintPoints();
     void extractConstraintPoints(const CollisionPair& collisionPair);
+    void initContactCullingGrid(const LinkPair& linkPair, int numCollisions);
+    static void getSpatialHashCell(const Vector3& point, double invCellSize, int* cell);
+    static int spatialHashBucket(int x, int y, int z, int mask);
     bool setContactConstraintPoint(LinkPair& linkPair, const Collision& collision);
-    void setFrictionVectors(ConstraintPoint& constraintPoint);
+    void reduceContactManifold(LinkPair& linkPair);
+    void selectManifoldPoint(int index);
+    void mergeContactPatch(LinkPair& linkPair);
+    size_t linkPairCacheMemoryUsage();
+    void limitContactPointsOfStep();
+    void switchLinkPairsToPenalty();
+    void storeRawContactPoints(LinkPair& linkPair);
+    void restoreRawContactPoints(LinkPair& linkPair);
+    double calcLinkPairImportance(LinkPair& linkPair);
+    void setRelVelocitiesOfContactPoints(LinkPair& linkPair);
+    void setFrictionOfContactPoints(LinkPair& linkPair);
+    void setFrictionVectors(ConstraintPoint& constraintPoint, const Vector3* prevFrictionBase = 0);
     void setExtraJointConstraintPoints(const ExtraJointLinkPairPtr& linkPair);
     void set2dConstraintPoints(const Constrain2dLinkPairPtr& linkPair);
     void putContactPoints();
     void solveImpactConstraints();
     void initMatrices();
+    void initBodyToLinkPairIndices();
+    void initSparseMatrixStructure();
+    void initLinkPairColoring();
+    int constraintBodyIndex(const LinkPair& linkPair, int which) const {
+        return (linkPair.bodyIndex[which] >= 0) ? linkPair.bodyIndex[which] : bodiesData.size();
+    }
+    int findIslandRoot(int bodyIndex);
+    void initIslands();
+    void solveIslands();
+    void solveIsland(int task, int worker);
+    void setIslandMatrix(Island& island);
     void setAccelCalcSkipInformation();
     void setDefaultAccelerationVector();
     void setAccelerationMatrix();
+    void setAccelerationMatrixByTestForces();
+    void setAccelerationMatrixColumns(LinkPair& linkPair, std::vector<BodyData>& bodies);
+    void setAccelerationMatrixColumnsOfMoments(LinkPair& linkPair, ConstraintPoint& constraint, std::vector<BodyData>& bodies);
+    void setAccelerationMatrixColumnsByWorker(int linkPairIndex, int worker);
+    bool isParallelAssemblyAvailable() const;
+    void copyAssemblyScratch(std::vector<BodyData>& bodies);
+    void calcDefaultAccelsOfBody(int bodyIndex, bool skipCBM);
+    void setDefaultAccelsOfLinkPair(int linkPairIndex);
+    void initJointSpaceInertia(BodyData& bodyData);
+    void getDofAxis(const BodyData& bodyData, int linkIndex, int localDof, int& out_dof, Vector3& out_sv, Vector3& out_sw);
+    bool calcJointSpaceInertia(BodyData& bodyData);
+    void addJacobianRow(const BodyData& bodyData, DyLink* link, const Vector3& point, const Vector3& f, MatrixX& J, int row) {
+        addWrenchJacobianRow(bodyData, link, f, point.cross(f), J, row);
+    }
+    void addWrenchJacobianRow(const BodyData& bodyData, DyLink* link, const Vector3& f, const Vector3& tau, MatrixX& J, int row);
+    void setAccelerationMatrixByJacobians();
+    void checkJacobianAssembly();
+    void addBodyAccelerationMatrix(int bodyIndex);
+    bool factorizeInertiasOfCBMBodies();
+
+    // the test forces to the ForwardDynamicsCBM bodies are given by addBodyAccelerationMatrix when they are batched
+    bool isTestForceTarget(const BodyData& bodyData) const {
+        return !bodyData.isStatic && !(areCBMTestForcesBatched && bodyData.forwardDynamicsCBM);
+    }
     void initABMForceElementsWithNoExtForce(BodyData& bodyData);
     void calcABMForceElementsWithTestForce(BodyData& bodyData, DyLink* linkToApplyForce, const Vector3& f, const Vector3& tau);
     void calcAccelsABM(BodyData& bodyData, int constraintIndex);
+    void factorizeRootInertia(BodyData& bodyData);
+    void collectRootInertiaCounts();
+
+    // f is overwritten by the accelerations of the root
+    template<class Derived> void solveRootInertia(BodyData& bodyData, Eigen::MatrixBase<Derived>& f) {
+        const RootInertiaFactorization& root = *bodyData.rootInertia;
+        if(root.isLLTUsed){
+            root.llt.solveInPlace(f);
+        } else {
+            typename Derived::PlainObject a(root.qr.solve(f));
+            f = a;
+        }
+        ++bodyData.numRootInertiaSolves;
+    }
+    bool isBatchedTestForceAvailable(LinkPair& linkPair, const ConstraintPoint& constraint, std::vector<BodyData>& bodies);
+    void setAccelerationMatrixColumnsByBatch(LinkPair& linkPair, ConstraintPoint& constraint, std::vector<BodyData>& bodies);
+    void calcABMForceElementsWithTestForceBatch
+    (BodyData& bodyData, DyLink* linkToApplyForce, const Vector3Batch& f, const Vector3Batch& tau);
+    void calcAccelsABMBatch(BodyData& bodyData, int constraintIndex);
+    void setAccelsOfBatchColumn(BodyData& bodyData, int column, int constraintIndex);
     void calcAccelsMM(BodyData& bodyData, int constraintIndex);
 
+    double& accelerationMatrixElement(int row, int col) {
+        if(isSparseMatrixActive){
+            return sparseMlcp.coeffRef(row, col);
+        }
+        return isSymmetricMatrixActive ? symmetricMlcp.coeffRef(row, col) : Mlcp(row, col);
+    }
+
+    BodyData& bodyDataOf(LinkPair& linkPair, int which, std::vector<BodyData>& bodies) {
+        return (linkPair.bodyIndex[which] >= 0) ? bodies[linkPair.bodyIndex[which]] : *linkPair.bodyData[which];
+    }
+    LinkData& linkDataOf(LinkPair& linkPair, int which, std::vector<BodyData>& bodies) {
+        return bodyDataOf(linkPair, which, bodies).linksData[linkPair.link[which]->index()];
+    }
+
     void extractRelAccelsOfConstraintPoints
-    (Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, int testForceIndex, int constraintIndex);
+    (LinkPair& testLinkPair, int testForceColumn, int constraintIndex, std::vector<BodyData>& bodies);
 
     void extractRelAccelsFromLinkPairCase1
-    (Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, LinkPair& linkPair, int testForceIndex, int constraintIndex);
+    (LinkPair& linkPair, int testForceColumn, int constraintIndex, std::vector<BodyData>& bodies);
     void extractRelAccelsFromLinkPairCase2
-    (Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, LinkPair& linkPair, int iTestForce, int iDefault, int testForceIndex, int constraintIndex);
-    void extractRelAccelsFromLinkPairCase3
-    (Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, LinkPair& linkPair, int testForceIndex, int constraintIndex);
+    (LinkPair& linkPair, int iTestForce, int iDefault, int testForceColumn, int constraintIndex, std::vector<BodyData>& bodies);
 
-    void copySymmetricElementsOfAccelerationMatrix
-    (Eigen::Block<MatrixX>& Knn, Eigen::Block<MatrixX>& Ktn, Eigen::Block<MatrixX>& Knt, Eigen::Block<MatrixX>& Ktt);
+    bool isSymmetricMatrixAvailable();
+    void initSymmetricMatrixOrder();
+    void checkSymmetricMatrix();
 
     void clearSingularPointConstraintsOfClosedLoopConnections();
+    void clearSingularPointConstraintsOfSparseMatrix();
+    void clearSingularPointConstraintsOfSymmetricMatrix();
 		
     void setConstantVectorAndMuBlock();
+    const WarmStartPoint* findWarmStartPoint(const LinkPair& linkPair, const Vector3& point) const;
+    void setWarmStartSolution();
+    void storeWarmStartSolution();
     void addConstraintForceToLinks();
     void addConstraintForceToLink(LinkPair* linkPair, int ipair);
 
-    void solveMCPByProjectedGaussSeidel
-    (const MatrixX& M, const VectorX& b, VectorX& x);
-    void solveMCPByProjectedGaussSeidelMainStep
-    (const MatrixX& M, const VectorX& b, VectorX& x);
-    void solveMCPByProjectedGaussSeidelInitial
-    (const MatrixX& M, const VectorX& b, VectorX& x, const int numIteration);
+    Vector3 calcCurrentAccelOfConstraintPoint(LinkPair& linkPair, int which, const ConstraintPoint& constraint);
+    void applyForceToABMForceElements
+    (LinkPair& linkPair, const Vector3& point, const Vector3* f, double scale, bool doCommit, const Vector3* tau = 0);
+    void updateAccelsOfLinkPairBodies(LinkPair& linkPair);
+    void setMatrixFreeDiagonal();
+    void commitSolutionToABMForceElements(const VectorX& x);
+    void calcAccelsOfABMBodies();
+    void setArticulatedAccelerations();
+    void solveMCPByMatrixFreeGaussSeidel(VectorX& x, MCPLayout& layout);
+    void solveLinkPairByMatrixFreeGaussSeidel(LinkPair& linkPair, VectorX& x, MCPLayout& layout);
+
+    MCPLayout globalMCPLayout() {
+        MCPLayout layout(globalNumContactNormalVectors, globalNumConstraintVectors, globalNumFrictionVectors,
+                         contactIndexToMu, mcpHi, frictionIndexToContactIndex);
+        if(isPatchContactActive){
+            layout.isMomentRow = &isMomentFrictionRow;
+        }
+        return layout;
+    }
+    template<class TMatrix> void solveMCPByProjectedGaussSeidel
+    (const TMatrix& M, const VectorX& b, VectorX& x, MCPLayout& layout);
+    template<class TMatrix> void solveMCPByProjectedGaussSeidelMainStep
+    (const TMatrix& M, const VectorX& b, VectorX& x, MCPLayout& layout);
+    template<class TMatrix> void solveMCPByProjectedGaussSeidelInitial
+    (const TMatrix& M, const VectorX& b, VectorX& x, const int numIteration, MCPLayout& layout);
+
+    // sum of M(j, k) * x(k) for k != j
+    static double calcOffDiagonalRowProduct(const MatrixX& M, int j, const VectorX& x, int size) {
+        double sum = 0.0;
+        for(int k=0; k < j; ++k){
+            sum += M(j, k) * x(k);
+        }
+        for(int k = j + 1; k < size; ++k){
+            sum += M(j, k) * x(k);
+        }
+        return sum;
+    }
+    static double calcOffDiagonalRowProduct(const BCSparseMatrix& M, int j, const VectorX& x, int size) {
+        return M.calcOffDiagonalRowProduct(j, x);
+    }
+    static double calcOffDiagonalRowProduct(const BCPackedSymmetricMatrix& M, int j, const VectorX& x, int size) {
+        return M.calcOffDiagonalRowProduct(j, x);
+    }
+
+    // same as calcOffDiagonalRowProduct, but only the columns of the coupled constraints are visited
+    double calcCoupledRowProduct(const MatrixX& M, int j, const VectorX& x) const {
+        const std::vector<int>& columns = sparseGroupColumns[sparseRowToGroup[j]];
+        double sum = 0.0;
+        for(size_t k=0; k < columns.size(); ++k){
+            if(columns[k] != j){
+                sum += M(j, columns[k]) * x(columns[k]);
+            }
+        }
+        return sum;
+    }
+    double calcCoupledRowProduct(const BCSparseMatrix& M, int j, const VectorX& x) const {
+        return M.calcOffDiagonalRowProduct(j, x);
+    }
+    double calcCoupledRowProduct(const BCPackedSymmetricMatrix& M, int j, const VectorX& x) const {
+        const std::vector<int>& columns = sparseGroupColumns[sparseRowToGroup[j]];
+        double sum = 0.0;
+        for(size_t k=0; k < columns.size(); ++k){
+            if(columns[k] != j){
+                sum += M.coeff(j, columns[k]) * x(columns[k]);
+            }
+        }
+        return sum;
+    }
+
+    static void setContactNormalSolution(VectorX& x, int j, double xx, MCPLayout& layout) {
+        if(xx < 0.0){
+            x(j) = 0.0;
+        } else {
+            x(j) = xx;
+        }
+        layout.mcpHi[j] = layout.contactIndexToMu[j] * x(j);
+    }
+
+    static void projectOntoFrictionCone(double fmax, double fx0, double fy0, double& fx, double& fy) {
+        const double fmax2 = fmax * fmax;
+        const double fmag2 = fx0 * fx0 + fy0 * fy0;
+        if(fmag2 > fmax2){
+            const double s = fmax / sqrt(fmag2);
+            fx = s * fx0;
+            fy = s * fy0;
+        } else {
+            fx = fx0;
+            fy = fy0;
+        }
+    }
+
+    static void setFrictionSolution(VectorX& x, int j, double xx, double fmax) {
+        const double fmin = (STATIC_FRICTION_BY_TWO_CONSTRAINTS ? -fmax : 0.0);
+        if(xx < fmin){
+            x(j) = fmin;
+        } else if(xx > fmax){
+            x(j) = fmax;
+        } else {
+            x(j) = xx;
+        }
+    }
+
+    template<class TMatrix> void solveMCPByProjectedGaussSeidelStep
+    (const TMatrix& M, const VectorX& b, VectorX& x, MCPLayout& layout) {
+        if(layout.isColored){
+            solveMCPByColoredGaussSeidelStep(M, b, x, layout);
+        } else {
+            solveMCPByProjectedGaussSeidelMainStep(M, b, x, layout);
+        }
+    }
+    template<class TMatrix> void solveMCPByColoredGaussSeidelStep
+    (const TMatrix& M, const VectorX& b, VectorX& x, MCPLayout& layout);
+    template<class TMatrix> void solveColorChunkByGaussSeidel
+    (const TMatrix& M, const VectorX& b, VectorX& x, MCPLayout& layout, int color, int chunkSize, int chunk);
 
     void checkLCPResult(MatrixX& M, VectorX& b, VectorX& x);
     void checkMCPResult(MatrixX& M, VectorX& b, VectorX& x);
@@ -421,9 +1095,13 @@ public:
   /*****ADDED ****v**/
   /*BC*/  BCCoreSiconos* pSNSCore; 
   /*BC*/  BCCoreQMR    * pQMRCore; 
+  /*BC*/  BCCoreBlockGS* pBGSCore; 
   /*BC*/  double penaltyKpCoef;
   /*BC*/  double penaltyKvCoef;
   /*BC*/  double penaltySizeRatio;
+  /*BC*/  bool isPenaltyImplicitMode;
+  /*BC*/  long totalNumImplicitPenaltyLinkPairs;
+  /*BC*/  std::vector<std::string> penaltyBodyNames;
   /*BC*/  int    solverID;
   /*BC*/  static Vector3 kkwsat(double a, const Vector3& x)
   /*BC*/  {
@@ -436,7 +1114,18 @@ public:
   /*BC*/  static double kkwmax(double a, double b){if(a<b) return b; return a;}
   /*BC*/  static double kkwmin(Vector3 a){return kkwmin(kkwmin(a(0),a(1)),a(2));}
   /*BC*/  void addPenaltyForceToLinks();
-  /*BC*/  void addPenaltyForceToLink(LinkPair* linkPair, int ipair);
+  /*BC*/  void calcPenaltyForcesOfChunk(int chunk, int chunkSize);
+  /*BC*/  void calcPenaltyForcesOfLinkPair(int pairIndex);
+  /*BC*/  bool isPenaltyImplicitAvailable(const LinkPair& linkPair) const;
+  /*BC*/  // penalty-based link pairs of a step and the first column of each pair in the buffers
+  /*BC*/  std::vector<LinkPair*> penaltyLinkPairs;
+  /*BC*/  std::vector<int> penaltyPairColumns;
+  /*BC*/  Eigen::Matrix3Xd penaltyForces; // to the link 1
+  /*BC*/  Eigen::RowVectorXd penaltyDepths;
+  /*BC*/  Eigen::RowVectorXd penaltyNormalVelocities;
+  /*BC*/  Eigen::RowVectorXd penaltyNormalForces;
+  /*BC*/  std::vector<Vector3> penaltyPairForces;
+  /*BC*/  std::vector<Vector3> penaltyPairTorques;
   /*****ADDED ****v**/
 };
 /*
@@ -466,12 +1155,37 @@ BCCFSImpl::BCCFSImpl(WorldBase& world) :
 
     isConstraintForceOutputMode = false;
     is2Dmode = false;
+    isSparseMatrixMode = false;
+    isSparseMatrixActive = false;
+    isSymmetricMatrixMode = false;
+    isSymmetricMatrixActive = false;
+    isIslandMode = false;
+    maxNumContactPointsPerLinkPair = 0;
+    maxNumContactPointsPerStep = 0;
+    isPatchContactMode = false;
+    isPatchContactActive = false;
+    linkPairEvictionSteps = DEFAULT_LINK_PAIR_EVICTION_STEPS;
+    autoPenaltyMaxNumConstraints = 0;
+    autoPenaltyMaxSolutionTime = 0.0;
+    isStableFrictionBasisMode = false;
+    isMatrixFreeMode = false;
+    isJacobianAssemblyMode = false;
+    isParallelAssemblyMode = false;
+    isFusedABMMode = false;
+    areCBMTestForcesBatched = false;
+    numIslands = 0;
+    maxNumIslands = 0;
+    numColors = 0;
+    maxNumColors = 0;
+    maxColorClassSize = 0;
 
     /*BC*/ penaltyKpCoef = 1.;
     /*BC*/ penaltyKvCoef = 1.;
     /*BC*/ penaltySizeRatio = 0.05;
+    /*BC*/ isPenaltyImplicitMode = false;
     /*BC*/ pSNSCore = new BCCoreSiconos(maxNumGaussSeidelIteration, gaussSeidelErrorCriterion);
     /*BC*/ pQMRCore = new BCCoreQMR    (maxNumGaussSeidelIteration, gaussSeidelErrorCriterion);
+    /*BC*/ pBGSCore = new BCCoreBlockGS(maxNumGaussSeidelIteration, gaussSeidelErrorCriterion);
 }
 
 
@@ -479,6 +1193,7 @@ BCCFSImpl::~BCCFSImpl()
 {
     /*BC*/ delete pSNSCore;
     /*BC*/ delete pQMRCore;
+    /*BC*/ delete pBGSCore;
     if(CFS_DEBUG){
         os.close();
     }
@@ -493,6 +1208,13 @@ void BCCFSImpl::initBody(const DyBodyPtr& body, BodyData& bodyData)
     bodyData.hasConstrainedLinks = false;
     bodyData.isTestForceBeingApplied = false;
     bodyData.isStatic = body->isStaticModel();
+    bodyData.articulatedAccelerationStep = -1;
+
+    // the penalty-based contacts are resolved here so that no link pair inspects the names or the shapes
+/*BC*/ const std::string& name = body->name();
+/*BC*/ bodyData.isPenaltyBased =
+/*BC*/     (name.compare(0, 3, "PEN") == 0) ||
+/*BC*/     (std::find(penaltyBodyNames.begin(), penaltyBodyNames.end(), name) != penaltyBodyNames.end());
 
     LinkDataArray& linksData = bodyData.linksData;
     const int n = body->numLinks();
@@ -501,6 +1223,9 @@ void BCCFSImpl::initBody(const DyBodyPtr& body, BodyData& bodyData)
         linksData[link->index()].link = link;
         linksData[link->index()].parentIndex = link->parent() ? link->parent()->index() : -1;
  /*BC*/ linksData[link->index()].penaltySpringCount = 0;
+ /*BC*/ linksData[link->index()].isPenaltyBased = bodyData.isPenaltyBased;
+ /*BC*/ linksData[link->index()].penaltyMinSize =
+ /*BC*/     link->shape() ? kkwmin(Vector3(link->shape()->boundingBox().max() - link->shape()->boundingBox().min())) : 0.0;
     }
 }
 
@@ -542,6 +1267,7 @@ void BCCFSImpl::initExtraJoints(int bodyIndex)
             for(int k=0; k < numConstraints; ++k){
                 ConstraintPoint& constraint = linkPair->constraintPoints[k];
                 constraint.numFrictionVectors = 0;
+                constraint.numMomentVectors = 0;
                 constraint.globalFrictionIndex = numeric_limits<int>::max();
             }
             for(int k=0; k < 2; ++k){
@@ -582,6 +1308,7 @@ void BCCFSImpl::init2Dconstraint(int bodyIndex)
     for(int i=0; i < 3; ++i){
         ConstraintPoint& constraint = linkPair->constraintPoints[i];
         constraint.numFrictionVectors = 0;
+        constraint.numMomentVectors = 0;
         constraint.globalFrictionIndex = numeric_limits<int>::max();
         linkPair->globalYpositions[i] = (rootLink->R() * local2dConstraintPoints[i] + rootLink->p()).y();
     }
@@ -626,6 +1353,10 @@ void BCCFSImpl::initialize(void)
     }
     geometryIdToBodyIndexMap.clear();
     geometryPairToLinkPairMap.clear();
+    islands.clear();
+    maxNumIslands = 0;
+    maxNumColors = 0;
+    maxColorClassSize = 0;
 
     extraJointLinkPairs.clear();
     constrain2dLinkPairs.clear();
@@ -653,6 +1384,7 @@ void BCCFSImpl::initialize(void)
         geometryIdToBodyIndexMap.resize(collisionDetector->numGeometries(), bodyIndex);
 
         initExtraJoints(bodyIndex);
+        initJointSpaceInertia(bodyData);
 
         if(is2Dmode && !body->isStaticModel()){
             init2Dconstraint(bodyIndex);
@@ -661,9 +1393,57 @@ void BCCFSImpl::initialize(void)
 
     collisionDetector->makeReady();
 
+    isMatrixFreeMode = (solverID == 5);
+    isSparseMatrixActive = isSparseMatrixMode || (isIslandMode && !isMatrixFreeMode);
+    for(int bodyIndex=0; bodyIndex < numBodies; ++bodyIndex){
+        const BodyData& bodyData = bodiesData[bodyIndex];
+        if(!bodyData.isStatic && bodyData.forwardDynamicsCBM){
+            isMatrixFreeMode = false;
+        }
+    }
+
+    isPatchContactActive =
+        isPatchContactMode && solverID == 0 && !isMatrixFreeMode && !isSymmetricMatrixMode &&
+        !isIslandMode && !isJacobianAssemblyMode && !usePivotingLCP;
+
     prevGlobalNumConstraintVectors = 0;
     prevGlobalNumFrictionVectors = 0;
     numUnconverged = 0;
+    numBlockGaussSeidelUnconverged = 0;
+    stepCount = 0;
+    numWarmStartedPoints = 0;
+    numColdStartedPoints = 0;
+    totalNumWarmStartedPoints = 0;
+    totalNumColdStartedPoints = 0;
+    numRawContactPointsInStep = 0;
+    numKeptContactPointsInStep = 0;
+    totalNumRawContactPoints = 0;
+    totalNumKeptContactPoints = 0;
+    numContactPatchesInStep = 0;
+    totalNumContactPatches = 0;
+    autoPenaltyTimeLimitedSize = numeric_limits<int>::max();
+    solutionTime = 0.0;
+    numAutoPenaltyLinkPairsInStep = 0;
+    totalNumAutoPenaltyLinkPairs = 0;
+    totalNumImplicitPenaltyLinkPairs = 0;
+    totalAssemblyTime = 0.0;
+    numAssemblies = 0;
+    numParallelAssemblies = 0;
+    numRootInertiaFactorizationsInStep = 0;
+    numRootInertiaSolvesInStep = 0;
+    totalNumRootInertiaFactorizations = 0;
+    totalNumRootInertiaSolves = 0;
+    numRootInertiaQRFallbacks = 0;
+    totalNumFusedABMLinks = 0;
+    isSymmetricMatrixActive = false;
+    isSymmetricMatrixUnsafe = false;
+    symmetricMlcp.clear();
+    numSymmetricMatrixChecks = 0;
+    numSymmetricMatrixFallbacks = 0;
+    maxSymmetricMatrixError = 0.0;
+    isJacobianAssemblyUnsafe = false;
+    numJacobianAssemblyChecks = 0;
+    maxJacobianAssemblyError = 0.0;
 
     randomAngle.engine().seed();
 
@@ -685,6 +1465,8 @@ void BCCFSImpl::solve()
         os << "Time: " << world.currentTime() << std::endl;
     }
 
+    ++stepCount;
+
     for(size_t i=0; i < bodiesData.size(); ++i){
         BodyData& data = bodiesData[i];
         data.hasConstrainedLinks = false;
@@ -702,14 +1484,31 @@ void BCCFSImpl::solve()
     globalNumFrictionVectors = 0;
     areThereImpacts = false;
     constrainedLinkPairs.clear();
+    contactPoints.clear();
+    numRawContactPointsInStep = 0;
+    numKeptContactPointsInStep = 0;
+    numContactPatchesInStep = 0;
+    numAutoPenaltyLinkPairsInStep = 0;
+
+    // the link pairs of this step are found or inserted after this
+    if(linkPairEvictionSteps > 0 && stepCount % linkPairEvictionSteps == 0){
+        geometryPairToLinkPairMap.evict(stepCount, linkPairEvictionSteps);
+    }
 
     setConstraintPoints();
 
+    totalNumRawContactPoints += numRawContactPointsInStep;
+    totalNumKeptContactPoints += numKeptContactPointsInStep;
+    totalNumContactPatches += numContactPatchesInStep;
+    totalNumAutoPenaltyLinkPairs += numAutoPenaltyLinkPairsInStep;
+
     if(CFS_PUT_NUM_CONTACT_POINTS){
         cout << globalNumContactNormalVectors;
     }
      /*BC*/  addPenaltyForceToLinks();
 
+    solutionTimer.begin();
+
     if(globalNumConstraintVectors > 0){
 
         if(CFS_DEBUG){
@@ -720,9 +1519,37 @@ void BCCFSImpl::solve()
         const bool constraintsSizeChanged = ((globalNumFrictionVectors   != prevGlobalNumFrictionVectors) ||
                                              (globalNumConstraintVectors != prevGlobalNumConstraintVectors));
 
-        if(constraintsSizeChanged){
+        // whether the test forces of a ForwardDynamicsCBM body are solved at once is known
+        // before the symmetric matrix mode is decided, which depends on it
+        areCBMTestForcesBatched = USE_BATCHED_CBM_TEST_FORCES && !isMatrixFreeMode && factorizeInertiasOfCBMBodies();
+
+        const bool wasSymmetricMatrixActive = isSymmetricMatrixActive;
+        isSymmetricMatrixActive = isSymmetricMatrixAvailable();
+
+        if(constraintsSizeChanged || isSymmetricMatrixActive != wasSymmetricMatrixActive){
             initMatrices();
         }
+        if(isSymmetricMatrixActive){
+            initSymmetricMatrixOrder();
+        }
+
+        // the coloring also uses the coupling pattern of the sparse matrix
+        const bool isColoredGaussSeidelMode = (solverID == 4 && !isIslandMode);
+
+        if(!isMatrixFreeMode){
+            initBodyToLinkPairIndices();
+            if(isSparseMatrixActive || isColoredGaussSeidelMode){
+                initSparseMatrixStructure();
+            }
+        }
+
+        if(isColoredGaussSeidelMode){
+            initLinkPairColoring();
+        }
+
+        if(isIslandMode && !isMatrixFreeMode){
+            initIslands();
+        }
 
         if(areThereImpacts){
             solveImpactConstraints();
@@ -733,45 +1560,97 @@ void BCCFSImpl::solve()
         }
 
         setDefaultAccelerationVector();
-        setAccelerationMatrix();
 
-        clearSingularPointConstraintsOfClosedLoopConnections();
+        if(!isMatrixFreeMode){
+            assemblyTimer.begin();
+            setAccelerationMatrix();
+            assemblyTimer.end();
+            totalAssemblyTime += assemblyTimer.time();
+            ++numAssemblies;
+            clearSingularPointConstraintsOfClosedLoopConnections();
+        }
 		
         setConstantVectorAndMuBlock();
 
         if(CFS_DEBUG_VERBOSE){
             debugPutVector(an0, "an0");
             debugPutVector(at0, "at0");
-            debugPutMatrix(Mlcp, "Mlcp");
+            if(!isSparseMatrixActive && !isMatrixFreeMode && !isSymmetricMatrixActive){
+                debugPutMatrix(Mlcp, "Mlcp");
+            }
             debugPutVector(b.head(globalNumConstraintVectors), "b1");
             debugPutVector(b.segment(globalNumConstraintVectors, globalNumFrictionVectors), "b2");
         }
 
+        if(USE_CONTACT_IDENTITY_WARM_START){
+            setWarmStartSolution();
+        } else if(!USE_PREVIOUS_LCP_SOLUTION || constraintsSizeChanged){
+            solution.setZero();
+        }
+
         bool isConverged;
 #ifdef USE_PIVOTING_LCP
         isConverged = callPathLCPSolver(Mlcp, b, solution);
 #else
-/*BC*/if(solverID == 0)  // ProjectedGaussSeidel 
+/*BC*/if(isMatrixFreeMode)
+/*BC*/{
+/*BC*/    MCPLayout layout = globalMCPLayout();
+/*BC*/    solveMCPByMatrixFreeGaussSeidel(solution, layout);
+/*BC*/    isConverged = true;
+/*BC*/}
+/*BC*/else if(isIslandMode)
+/*BC*/{
+/*BC*/    solveIslands();
+/*BC*/    isConverged = true;
+/*BC*/}
+/*BC*/else if(solverID == 0 || solverID == 4 || solverID == 5 || (solverID == 3 && !ENABLE_TRUE_FRICTION_CONE))  // ProjectedGaussSeidel 
 /*BC*/ {
-/*BC*/    if(!USE_PREVIOUS_LCP_SOLUTION || constraintsSizeChanged){
-/*BC*/        solution.setZero();
+/*BC*/    MCPLayout layout = globalMCPLayout();
+/*BC*/    layout.isColored = isColoredGaussSeidelMode;
+/*BC*/    if(isSparseMatrixActive){
+/*BC*/        solveMCPByProjectedGaussSeidel(sparseMlcp, b, solution, layout);
+/*BC*/    } else if(isSymmetricMatrixActive){
+/*BC*/        solveMCPByProjectedGaussSeidel(symmetricMlcp, b, solution, layout);
+/*BC*/    } else {
+/*BC*/        solveMCPByProjectedGaussSeidel(Mlcp, b, solution, layout);
 /*BC*/    }
-/*BC*/    solveMCPByProjectedGaussSeidel(Mlcp, b, solution);
 /*BC*/    isConverged = true;
 /*BC*/}
 /*BC*/else if(solverID == 1) // Siconos 
 /*BC*/{
-/*BC*/    if(!USE_PREVIOUS_LCP_SOLUTION || constraintsSizeChanged){
-/*BC*/        solution.setZero();
+/*BC*/    if(isSparseMatrixActive){
+/*BC*/        isConverged = pSNSCore->callSolver(sparseMlcp, b, solution,contactIndexToMu, os);
+/*BC*/    } else if(isSymmetricMatrixActive){
+/*BC*/        isConverged = pSNSCore->callSolver(symmetricMlcp, b, solution,contactIndexToMu, os);
+/*BC*/    } else {
+/*BC*/        isConverged = pSNSCore->callSolver(Mlcp, b, solution,contactIndexToMu, os);
+/*BC*/    }
+/*BC*/}
+/*BC*/else if(solverID == 3) // Block GaussSeidel 
+/*BC*/{
+/*BC*/    if(isSparseMatrixActive){
+/*BC*/        isConverged = pBGSCore->callSolver(sparseMlcp, b, solution,contactIndexToMu, os);
+/*BC*/    } else if(isSymmetricMatrixActive){
+/*BC*/        isConverged = pBGSCore->callSolver(symmetricMlcp, b, solution,contactIndexToMu, os);
+/*BC*/    } else {
+/*BC*/        isConverged = pBGSCore->callSolver(Mlcp, b, solution,contactIndexToMu, os);
+/*BC*/    }
+/*BC*/    if(!pBGSCore->isConverged()){
+/*BC*/        ++numBlockGaussSeidelUnconverged;
+/*BC*/    }
+/*BC*/    if(CFS_MCP_DEBUG){
+/*BC*/        os << "Block GS iterations: " << pBGSCore->numIterations() << endl;
 /*BC*/    }
-/*BC*/    isConverged = pSNSCore->callSolver(Mlcp, b, solution,contactIndexToMu, os);
 /*BC*/}
 /*BC*/else  // ProjectedQMR 
 /*BC*/{
-/*BC*/    if(!USE_PREVIOUS_LCP_SOLUTION || constraintsSizeChanged){
-/*BC*/        solution.setZero();
+/*BC*/    if(isSparseMatrixActive){
+/*BC*/        isConverged = pQMRCore->callSolver(sparseMlcp, b, solution,contactIndexToMu, os);
+/*BC*/    } else if(isSymmetricMatrixActive){
+/*BC*/        isConverged = pQMRCore->callSolver(symmetricMlcp, b, solution,contactIndexToMu, os);
+/*BC*/    } else {
+/*BC*/        isConverged = pQMRCore->callSolver(Mlcp, b, solution,contactIndexToMu, os);
 /*BC*/    }
-/*BC*/    isConverged = pQMRCore->callSolver(Mlcp, b, solution,contactIndexToMu, os);
 /*BC*/}
 #endif
 
@@ -782,15 +1661,38 @@ void BCCFSImpl::solve()
         } else {
             if(CFS_DEBUG)
                 os << "LCP converged" << std::endl;
-            if(CFS_DEBUG_LCPCHECK){
+            if(CFS_DEBUG_LCPCHECK && !isMatrixFreeMode){
                 // checkLCPResult(Mlcp, b, solution);
-                checkMCPResult(Mlcp, b, solution);
+                if(isSparseMatrixActive){
+                    MatrixX M;
+                    sparseMlcp.copyTo(M);
+                    checkMCPResult(M, b, solution);
+                } else if(isSymmetricMatrixActive){
+                    MatrixX M;
+                    symmetricMlcp.copyTo(M);
+                    checkMCPResult(M, b, solution);
+                } else {
+                    checkMCPResult(Mlcp, b, solution);
+                }
             }
 
             addConstraintForceToLinks();
+
+            if(isFusedABMMode && isMatrixFreeMode){
+                setArticulatedAccelerations();
+            }
+
+            if(USE_CONTACT_IDENTITY_WARM_START || isStableFrictionBasisMode){
+                storeWarmStartSolution();
+            }
         }
     }
 
+    solutionTimer.end();
+    solutionTime = solutionTimer.time();
+
+    collectRootInertiaCounts();
+
     prevGlobalNumConstraintVectors = globalNumConstraintVectors;
     prevGlobalNumFrictionVectors = globalNumFrictionVectors;
 }
@@ -804,6 +1706,14 @@ void BCCFSImpl::setConstraintPoints()
 
     collisionDetector->detectCollisions(boost::bind(&BCCFSImpl::extractConstraintPoints, this, _1));
 
+    if(autoPenaltyMaxNumConstraints > 0 || autoPenaltyMaxSolutionTime > 0.0){
+        switchLinkPairsToPenalty();
+    }
+
+    if(maxNumContactPointsPerStep > 0 && globalNumConstraintVectors > maxNumContactPointsPerStep){
+        limitContactPointsOfStep();
+    }
+
 #ifdef ENABLE_SIMULATION_PROFILING
         collisionTime = timer.measure();
 #endif
@@ -822,36 +1732,33 @@ void BCCFSImpl::setConstraintPoints()
 
 void BCCFSImpl::extractConstraintPoints(const CollisionPair& collisionPair)
 {
-    LinkPair* pLinkPair;
-    
     const IdPair<> idPair(collisionPair.geometryId);
-    GeometryPairToLinkPairMap::iterator p = geometryPairToLinkPairMap.find(idPair);
+    LinkPair* pLinkPair = geometryPairToLinkPairMap.find(idPair(0), idPair(1), stepCount);
     
-    if(p != geometryPairToLinkPairMap.end()){
-        pLinkPair = &p->second;
+    if(pLinkPair){
         pLinkPair->constraintPoints.clear();
+        pLinkPair->rawContactPoints.clear();
+/*BC*/  if(pLinkPair->isAutoPenaltyBased){
+/*BC*/      pLinkPair->isPenaltyBased = false;
+/*BC*/      pLinkPair->isAutoPenaltyBased = false;
+/*BC*/  }
     } else {
-        LinkPair& linkPair = geometryPairToLinkPairMap.insert(make_pair(idPair, LinkPair())).first->second;
+        LinkPair& linkPair = geometryPairToLinkPairMap.insert(idPair(0), idPair(1), stepCount);
 /*BC*/  linkPair.isPenaltyBased = false; 
         for(int i=0; i < 2; ++i){
             const int id = collisionPair.geometryId[i];
             const int bodyIndex = geometryIdToBodyIndexMap[id];
             linkPair.bodyIndex[i] = bodyIndex;
             BodyData& bodyData = bodiesData[bodyIndex];
-/*BC*/      const char * tmp = bodyData.body->name().c_str();
-/*BC*/      if( tmp[0]=='P' && tmp[1]=='E' && tmp[2]=='N' ) linkPair.isPenaltyBased = true;
             linkPair.bodyData[i] = &bodyData;
             const int linkIndex = id - bodyData.geometryId;
             linkPair.link[i] = bodyData.body->link(linkIndex);
             linkPair.linkData[i] = &bodyData.linksData[linkIndex];
+/*BC*/      if(linkPair.linkData[i]->isPenaltyBased) linkPair.isPenaltyBased = true;
         }
  /*BC*/ if(linkPair.isPenaltyBased)
  /*BC*/ {
- /*BC*/   Vector3 sz0 = linkPair.linkData[0]->link->shape()->boundingBox().max()
- /*BC*/                -linkPair.linkData[0]->link->shape()->boundingBox().min() ;
- /*BC*/   Vector3 sz1 = linkPair.linkData[1]->link->shape()->boundingBox().max()
- /*BC*/                -linkPair.linkData[1]->link->shape()->boundingBox().min() ;
- /*BC*/   double minsize = kkwmin(kkwmin(sz0),kkwmin(sz1));
+ /*BC*/   double minsize = kkwmin(linkPair.linkData[0]->penaltyMinSize, linkPair.linkData[1]->penaltyMinSize);
  /*BC*/   const vector<Collision>& collisions = collisionPair.collisions;
  /*BC*/   for(size_t j=0; j < collisions.size(); ++j){
  /*BC*/     if(penaltySizeRatio * minsize < collisions[j].depth ) linkPair.isPenaltyBased = false;
@@ -876,15 +1783,44 @@ void BCCFSImpl::extractConstraintPoints(const CollisionPair& collisionPair)
     pLinkPair->bodyData[1]->hasConstrainedLinks = true;
 /*BC*/  }
     const vector<Collision>& collisions = collisionPair.collisions;
+    initContactCullingGrid(*pLinkPair, collisions.size());
     for(size_t i=0; i < collisions.size(); ++i){
         setContactConstraintPoint(*pLinkPair, collisions[i]);
     }
     if(!pLinkPair->constraintPoints.empty()){
+/*BC*/  if(!pLinkPair->isPenaltyBased){
+            if((autoPenaltyMaxNumConstraints > 0 || autoPenaltyMaxSolutionTime > 0.0) &&
+               (maxNumContactPointsPerLinkPair > 0 || isPatchContactActive)){
+                storeRawContactPoints(*pLinkPair);
+            }
+            reduceContactManifold(*pLinkPair);
+            if(isPatchContactActive){
+                mergeContactPatch(*pLinkPair);
+            }
+/*BC*/  }
+        setRelVelocitiesOfContactPoints(*pLinkPair);
+        setFrictionOfContactPoints(*pLinkPair);
         constrainedLinkPairs.push_back(pLinkPair);
     }
 }
 
 
+// bytes of geometryPairToLinkPairMap including the arrays of the link pairs
+size_t BCCFSImpl::linkPairCacheMemoryUsage()
+{
+    size_t bytes = geometryPairToLinkPairMap.memoryUsage();
+    const int poolSize = geometryPairToLinkPairMap.poolSize();
+    for(int i=0; i < poolSize; ++i){
+        const LinkPair& linkPair = geometryPairToLinkPairMap.valueAt(i);
+        bytes += linkPair.constraintPoints.capacity() * sizeof(ConstraintPoint)
+            + linkPair.warmStartPoints.capacity() * sizeof(WarmStartPoint)
+            + (linkPair.warmStartGridHeads.capacity() + linkPair.warmStartGridNext.capacity()) * sizeof(int)
+            + linkPair.rawContactPoints.capacity() * sizeof(RawContactPoint);
+    }
+    return bytes;
+}
+
+
 CollisionLinkPairListPtr BCCFSImpl::getCollisions()
 {
     CollisionLinkPairListPtr collisionPairs = boost::make_shared<CollisionLinkPairList>();
@@ -897,8 +1833,8 @@ CollisionLinkPairListPtr BCCFSImpl::getCollisions()
             ConstraintPoint& constraint = source.constraintPoints[j];
             dest->collisions.push_back(Collision());
             Collision& col = dest->collisions.back();
-            col.point = constraint.point;
-            col.normal = constraint.normalTowardInside[1];
+            col.point = contactPoints.point(constraint);
+            col.normal = contactPoints.normalTowardInside(constraint, 1);
             col.depth = constraint.depth;
         }
         for(int j=0; j<2; j++){
@@ -912,11 +1848,55 @@ CollisionLinkPairListPtr BCCFSImpl::getCollisions()
 }
 
 
+/**
+   Empties the grid for the collisions of a link pair. The number of the buckets is
+   a power of two which is at least twice the number of the collisions.
+*/
+void BCCFSImpl::initContactCullingGrid(const LinkPair& linkPair, int numCollisions)
+{
+    int numBuckets = 16;
+    while(numBuckets < 2 * numCollisions){
+        numBuckets *= 2;
+    }
+    cullingGridHeads.assign(numBuckets, -1);
+    cullingGridNext.resize(numCollisions);
+    cullingGridMask = numBuckets - 1;
+    cullingGridInvCellSize =
+        (linkPair.contactCullingDistance > 0.0) ? (1.0 / linkPair.contactCullingDistance) : 0.0;
+}
+
+
+/**
+   Cell of the uniform spatial hashes of the contact culling and the warm start
+*/
+void BCCFSImpl::getSpatialHashCell(const Vector3& point, double invCellSize, int* cell)
+{
+    // the cells far from the origin are merged, which only adds the candidates to check
+    static const double maxCoordinate = 1.0e9;
+    for(int i=0; i < 3; ++i){
+        const double c = floor(point[i] * invCellSize);
+        cell[i] = static_cast<int>(std::max(-maxCoordinate, std::min(maxCoordinate, c)));
+    }
+}
+
+
+int BCCFSImpl::spatialHashBucket(int x, int y, int z, int mask)
+{
+    const unsigned int h =
+        (static_cast<unsigned int>(x) * 73856093u) ^
+        (static_cast<unsigned int>(y) * 19349663u) ^
+        (static_cast<unsigned int>(z) * 83492791u);
+    return h & mask;
+}
+
+
 /**
    @retuen true if the point is actually added to the constraints
 */
 bool BCCFSImpl::setContactConstraintPoint(LinkPair& linkPair, const Collision& collision)
 {
+    ++numRawContactPointsInStep;
+
     // skip the contact which has too much depth
 /*BC*/ if(!linkPair.isPenaltyBased) {
 	    if(collision.depth > linkPair.contactCullingDepth){
@@ -924,139 +1904,693 @@ bool BCCFSImpl::setContactConstraintPoint(LinkPair& linkPair, const Collision& c
 	    }
 /*BC*/ }
     ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
-    constraintPoints.push_back(ConstraintPoint());
-    ConstraintPoint& contact = constraintPoints.back();
 
-    contact.point = collision.point;
-
-    // dense contact points are eliminated
-    int nPrevPoints = constraintPoints.size() - 1;
-    for(int i=0; i < nPrevPoints; ++i){
-        if((constraintPoints[i].point - contact.point).norm() < linkPair.contactCullingDistance){
-            constraintPoints.pop_back();
-            return false;
+    // dense contact points are eliminated.
+    // the points closer than the culling distance are in the neighboring cells of the grid
+    const bool doCulling = (linkPair.contactCullingDistance > 0.0);
+    int cell[3];
+    if(doCulling){
+        getSpatialHashCell(collision.point, cullingGridInvCellSize, cell);
+        for(int dx=-1; dx <= 1; ++dx){
+            for(int dy=-1; dy <= 1; ++dy){
+                for(int dz=-1; dz <= 1; ++dz){
+                    const int bucket = spatialHashBucket(cell[0] + dx, cell[1] + dy, cell[2] + dz, cullingGridMask);
+                    for(int i = cullingGridHeads[bucket]; i >= 0; i = cullingGridNext[i]){
+                        if((contactPoints.point(constraintPoints[i]) - collision.point).norm() < linkPair.contactCullingDistance){
+                            return false;
+                        }
+                    }
+                }
+            }
         }
+        const int bucket = spatialHashBucket(cell[0], cell[1], cell[2], cullingGridMask);
+        cullingGridNext[constraintPoints.size()] = cullingGridHeads[bucket];
+        cullingGridHeads[bucket] = constraintPoints.size();
     }
+    ++numKeptContactPointsInStep;
 
-    contact.normalTowardInside[1] = collision.normal;
-    contact.normalTowardInside[0] = -contact.normalTowardInside[1];
+    constraintPoints.push_back(ConstraintPoint());
+    ConstraintPoint& contact = constraintPoints.back();
+    contact.index = contactPoints.add();
+    contactPoints.point(contact) = collision.point;
+    contactPoints.normals[contact.index] = collision.normal;
     contact.depth = collision.depth;
 /*BC*/contact.globalIndex = -1; 
 /*BC*/if(!linkPair.isPenaltyBased)  contact.globalIndex = globalNumConstraintVectors++;
 
-    // check velocities
-    Vector3 v[2];
-    for(int k=0; k < 2; ++k){
-        DyLink* link = linkPair.link[k];
-        if(link->isRoot() && link->isFixedJoint()){
-            v[k].setZero();
-        } else {
-            v[k] = link->vo() + link->w().cross(contact.point);
-            if (link->jointType() == Link::CRAWLER_JOINT){
-                // tentative
-                // invalid depths should be fixed
-/*BC*/          if(!linkPair.isPenaltyBased) {
-                if (contact.depth > contactCorrectionDepth * 2.0){
-                    contact.depth = contactCorrectionDepth * 2.0;
-                }
-/*BC*/          }
-                Vector3 axis = link->R() * link->a();
-                Vector3 n(collision.normal);
-                Vector3 dir = axis.cross(n);
-                if (k) dir *= -1.0;
-                dir.normalize();
-                v[k] += link->u() * dir;
-            }
-        }
+    return true;
+}
+
+
+/**
+   Keeps at most maxNumContactPointsPerLinkPair contact points of a link pair. The deepest
+   point is kept first. The next ones enlarge the support polygon on the contact plane: the
+   farthest point from the deepest one, the point making the largest triangle with the two,
+   and the largest triangle on the other side of their edge. The rest are chosen by the
+   farthest point sampling. The points of the pair must be the last ones in contactPoints
+   and in the global indices.
+*/
+void BCCFSImpl::reduceContactManifold(LinkPair& linkPair)
+{
+    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int n = constraintPoints.size();
+    const int maxNumPoints = maxNumContactPointsPerLinkPair;
+    if(maxNumPoints <= 0 || n <= maxNumPoints){
+        return;
     }
-    contact.relVelocityOn0 = v[1] - v[0];
-/*BC*/ if(linkPair.isPenaltyBased){contact.globalFrictionIndex = -1;return true; }
+    const int begin = constraintPoints.front().index;
 
-    contact.normalProjectionOfRelVelocityOn0 = contact.normalTowardInside[1].dot(contact.relVelocityOn0);
+    Vector3 normal = Vector3::Zero();
+    for(int i=0; i < n; ++i){
+        normal += contactPoints.normals[begin + i];
+    }
+    const double norm = normal.norm();
+    normal = (norm > 1.0e-9) ? Vector3(normal / norm) : contactPoints.normals[begin];
 
-    if(!areThereImpacts){
-        if(contact.normalProjectionOfRelVelocityOn0 < -1.0e-6){
-            areThereImpacts = true;
+    manifoldPositions.resize(n);
+    int deepest = 0;
+    for(int i=0; i < n; ++i){
+        const Vector3& p = contactPoints.points[begin + i];
+        manifoldPositions[i] = p - p.dot(normal) * normal;
+        if(constraintPoints[i].depth > constraintPoints[deepest].depth){
+            deepest = i;
         }
     }
-    
-    Vector3 v_tangent =
-        contact.relVelocityOn0 - contact.normalProjectionOfRelVelocityOn0 * contact.normalTowardInside[1];
-    
-    contact.globalFrictionIndex = globalNumFrictionVectors;
-    
-    double vt_square = v_tangent.squaredNorm();
-    static const double vsqrthresh = VEL_THRESH_OF_DYNAMIC_FRICTION * VEL_THRESH_OF_DYNAMIC_FRICTION;
-    bool isSlipping = (vt_square > vsqrthresh);
-    contact.mu = isSlipping ? linkPair.muDynamic : linkPair.muStatic;
-    
-    if( !ONLY_STATIC_FRICTION_FORMULATION && isSlipping){
-        contact.numFrictionVectors = 1;
-        double vt_mag = sqrt(vt_square);
-        Vector3 t1 = v_tangent / vt_mag;
-        Vector3 t2 = contact.normalTowardInside[1].cross(t1);
-        Vector3 t3 = t2.cross(contact.normalTowardInside[1]);
-        contact.frictionVector[0][0] = t3.normalized();
-        contact.frictionVector[0][1] = -contact.frictionVector[0][0];
-        
-        // proportional dynamic friction near zero velocity
-        if(PROPORTIONAL_DYNAMIC_FRICTION){
-            vt_mag *= 10000.0;
-            if(vt_mag < contact.mu){
-                contact.mu = vt_mag;
+    manifoldDistances.assign(n, numeric_limits<double>::max());
+    isManifoldPointSelected.assign(n, false);
+    manifoldSelection.clear();
+
+    selectManifoldPoint(deepest);
+
+    if(maxNumPoints >= 3){
+        const int first = deepest;
+        int second = -1;
+        for(int i=0; i < n; ++i){
+            if(!isManifoldPointSelected[i] && (second < 0 || manifoldDistances[i] > manifoldDistances[second])){
+                second = i;
             }
         }
-    } else {
-        if(ENABLE_STATIC_FRICTION){
-            contact.numFrictionVectors = (STATIC_FRICTION_BY_TWO_CONSTRAINTS ? 2 : 4);
-            setFrictionVectors(contact);
-        } else {
-            contact.numFrictionVectors = 0;
+        selectManifoldPoint(second);
+
+        const Vector3 edge = manifoldPositions[second] - manifoldPositions[first];
+        int third = -1;
+        double thirdArea = 0.0;
+        for(int i=0; i < n; ++i){
+            if(!isManifoldPointSelected[i]){
+                const double area = edge.cross(manifoldPositions[i] - manifoldPositions[first]).dot(normal);
+                if(third < 0 || fabs(area) > fabs(thirdArea)){
+                    third = i;
+                    thirdArea = area;
+                }
+            }
+        }
+        selectManifoldPoint(third);
+
+        if(maxNumPoints >= 4){
+            int fourth = -1;
+            double fourthArea = 0.0;
+            for(int i=0; i < n; ++i){
+                if(!isManifoldPointSelected[i]){
+                    const double area = edge.cross(manifoldPositions[i] - manifoldPositions[first]).dot(normal);
+                    if(area * thirdArea < 0.0 && fabs(area) > fabs(fourthArea)){
+                        fourth = i;
+                        fourthArea = area;
+                    }
+                }
+            }
+            if(fourth >= 0){
+                selectManifoldPoint(fourth);
+            }
         }
     }
-    globalNumFrictionVectors += contact.numFrictionVectors;
-
-    return true;
-}
-
 
-void BCCFSImpl::setFrictionVectors(ConstraintPoint& contact)
+    while((int)manifoldSelection.size() < maxNumPoints){
+        int farthest = -1;
+        for(int i=0; i < n; ++i){
+            if(!isManifoldPointSelected[i] && (farthest < 0 || manifoldDistances[i] > manifoldDistances[farthest])){
+                farthest = i;
+            }
+        }
+        selectManifoldPoint(farthest);
+    }
+
+    // the kept points are packed in the original order
+    std::sort(manifoldSelection.begin(), manifoldSelection.end());
+    const int firstGlobalIndex = constraintPoints.front().globalIndex;
+    for(int i=0; i < maxNumPoints; ++i){
+        const int j = manifoldSelection[i];
+        contactPoints.move(begin + j, begin + i);
+        constraintPoints[i] = constraintPoints[j];
+        constraintPoints[i].index = begin + i;
+        constraintPoints[i].globalIndex = firstGlobalIndex + i;
+    }
+    constraintPoints.resize(maxNumPoints);
+    contactPoints.resize(begin + maxNumPoints);
+    globalNumConstraintVectors = firstGlobalIndex + maxNumPoints;
+    numKeptContactPointsInStep -= n - maxNumPoints;
+}
+
+
+// the distances of the other points to the selected ones are updated
+void BCCFSImpl::selectManifoldPoint(int index)
+{
+    isManifoldPointSelected[index] = true;
+    manifoldSelection.push_back(index);
+    const Vector3& q = manifoldPositions[index];
+    const int n = manifoldPositions.size();
+    for(int i=0; i < n; ++i){
+        const double d = (manifoldPositions[i] - q).squaredNorm();
+        if(d < manifoldDistances[i]){
+            manifoldDistances[i] = d;
+        }
+    }
+}
+
+
+/**
+   Replaces the contact points of a link pair by one point at their centroid with the mean
+   normal and the mean depth when the points form a flat patch. The principal axes of the
+   points on the contact plane are the tilting axes of the patch. The moment arm of the torsion
+   is the mean distance of the points from the centroid, and that of the tilting moment around
+   an axis is the shorter extent of the points from the centroid along the other axis.
+   The points of the pair must be the last ones in contactPoints and in the global indices.
+*/
+void BCCFSImpl::mergeContactPatch(LinkPair& linkPair)
+{
+    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int n = constraintPoints.size();
+    if(n < PATCH_CONTACT_MIN_NUM_POINTS || linkPair.isNonContactConstraint || !(linkPair.muStatic > 0.0) ||
+       !ENABLE_STATIC_FRICTION || !ONLY_STATIC_FRICTION_FORMULATION || !STATIC_FRICTION_BY_TWO_CONSTRAINTS){
+        return;
+    }
+    const int begin = constraintPoints.front().index;
+    Eigen::Map<Eigen::Matrix3Xd> points = ContactPointStore::columns(contactPoints.points, begin, n);
+    Eigen::Map<Eigen::Matrix3Xd> normals = ContactPointStore::columns(contactPoints.normals, begin, n);
+
+    Vector3 normal = normals.rowwise().sum();
+    const double norm = normal.norm();
+    if(norm < 1.0e-9){
+        return;
+    }
+    normal /= norm;
+    if((normal.transpose() * normals).minCoeff() < cos(PATCH_CONTACT_MAX_NORMAL_ANGLE)){
+        return;
+    }
+
+    // offsets of the points from the centroid on the contact plane
+    const Vector3 center = points.rowwise().mean();
+    Eigen::Matrix3Xd offsets = points.colwise() - center;
+    offsets -= normal * (normal.transpose() * offsets);
+
+    // principal axes of the 2x2 covariance in the basis (e0, e1) of the plane
+    const Vector3 e0 = normal.unitOrthogonal();
+    const Vector3 e1 = normal.cross(e0);
+    const Eigen::RowVectorXd x = e0.transpose() * offsets;
+    const Eigen::RowVectorXd y = e1.transpose() * offsets;
+    const double angle = 0.5 * atan2(2.0 * x.dot(y), x.squaredNorm() - y.squaredNorm());
+    const Vector3 axis0 = cos(angle) * e0 + sin(angle) * e1;
+    const Vector3 axis1 = normal.cross(axis0);
+
+    const Eigen::RowVectorXd s0 = axis0.transpose() * offsets;
+    const Eigen::RowVectorXd s1 = axis1.transpose() * offsets;
+    double arms[3];
+    arms[0] = offsets.colwise().norm().mean();
+    arms[1] = std::min(s1.maxCoeff(), -s1.minCoeff()); // tilting around axis0
+    arms[2] = std::min(s0.maxCoeff(), -s0.minCoeff()); // tilting around axis1
+    for(int i=0; i < 3; ++i){
+        if(arms[i] < PATCH_CONTACT_MIN_MOMENT_ARM){
+            return;
+        }
+    }
+
+    double depth = 0.0;
+    for(int i=0; i < n; ++i){
+        depth += constraintPoints[i].depth;
+    }
+
+    ConstraintPoint& patch = constraintPoints.front();
+    contactPoints.point(patch) = center;
+    contactPoints.normals[patch.index] = normal;
+    contactPoints.patchAxes[0][patch.index] = axis0;
+    contactPoints.patchAxes[1][patch.index] = axis1;
+    patch.depth = depth / n;
+    patch.numMomentVectors = 3;
+    for(int i=0; i < 3; ++i){
+        patch.momentArms[i] = arms[i];
+    }
+    constraintPoints.resize(1);
+    contactPoints.resize(begin + 1);
+    globalNumConstraintVectors = patch.globalIndex + 1;
+    numKeptContactPointsInStep -= n - 1;
+    ++numContactPatchesInStep;
+}
+
+
+/**
+   Removes the shallowest contact points so that the number of the contact points of the step
+   is maxNumContactPointsPerStep. The vectors of the remaining points are packed in contactPoints,
+   and the global indices and the friction indices are given again in the same order.
+*/
+void BCCFSImpl::limitContactPointsOfStep()
+{
+    const int numContacts = globalNumConstraintVectors;
+    const int maxNumContacts = maxNumContactPointsPerStep;
+
+    // the deepest points come first, and the ties are broken by the global indices
+    contactDepthOrder.resize(numContacts);
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+/*BC*/  if(linkPair.isPenaltyBased) continue;
+        const ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            const ConstraintPoint& constraint = constraintPoints[j];
+            contactDepthOrder[constraint.globalIndex] = make_pair(-constraint.depth, constraint.globalIndex);
+        }
+    }
+    std::nth_element(contactDepthOrder.begin(), contactDepthOrder.begin() + maxNumContacts, contactDepthOrder.end());
+    std::vector<char> isKept(numContacts, false);
+    for(int i=0; i < maxNumContacts; ++i){
+        isKept[contactDepthOrder[i].second] = true;
+    }
+
+    int numPoints = 0;
+    int numConstraints = 0;
+    int numFrictionVectors = 0;
+    size_t numLinkPairs = 0;
+    areThereImpacts = false;
+
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+        LinkPair* linkPair = constrainedLinkPairs[i];
+        ConstraintPointArray& constraintPoints = linkPair->constraintPoints;
+        size_t numKeptPoints = 0;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            ConstraintPoint constraint = constraintPoints[j];
+/*BC*/      if(!linkPair->isPenaltyBased){
+                if(!isKept[constraint.globalIndex]){
+                    continue;
+                }
+                constraint.globalIndex = numConstraints++;
+                constraint.globalFrictionIndex = numFrictionVectors;
+                numFrictionVectors += constraint.numFrictionVectors + constraint.numMomentVectors;
+                if(constraint.normalProjectionOfRelVelocityOn0 < -1.0e-6){
+                    areThereImpacts = true;
+                }
+/*BC*/      }
+            contactPoints.move(constraint.index, numPoints);
+            constraint.index = numPoints++;
+            constraintPoints[numKeptPoints++] = constraint;
+        }
+        constraintPoints.resize(numKeptPoints);
+        if(numKeptPoints > 0){
+            constrainedLinkPairs[numLinkPairs++] = linkPair;
+        }
+    }
+    constrainedLinkPairs.resize(numLinkPairs);
+    contactPoints.resize(numPoints);
+
+    numKeptContactPointsInStep -= numContacts - numConstraints;
+    globalNumConstraintVectors = numConstraints;
+    globalNumFrictionVectors = numFrictionVectors;
+}
+
+
+/**
+   Moves the least important contact link pairs to the penalty-based contacts so that the
+   number of the contact constraints of the step is within the budget. The budget is the
+   smaller one of autoPenaltyMaxNumConstraints and the number allowed by the solution time of
+   the previous step, which grows again while the time is within autoPenaltyMaxSolutionTime.
+   Only the pairs whose depths satisfy penaltySizeRatio are moved, and the global indices and
+   the friction indices of the remaining constraints are given again in the same order.
+   A moved pair gets back its points before the manifold reduction and the patch merge, and
+   the bodies without the remaining constraints are excluded from the constraint calculation.
+   The moved pairs are restored to the constraints at their next extraction.
+*/
+void BCCFSImpl::switchLinkPairsToPenalty()
+{
+    double maxNumConstraints = numeric_limits<int>::max();
+    if(autoPenaltyMaxNumConstraints > 0){
+        maxNumConstraints = autoPenaltyMaxNumConstraints;
+    }
+    if(autoPenaltyMaxSolutionTime > 0.0){
+        if(solutionTime > autoPenaltyMaxSolutionTime && prevGlobalNumConstraintVectors > 0){
+            autoPenaltyTimeLimitedSize = prevGlobalNumConstraintVectors * autoPenaltyMaxSolutionTime / solutionTime;
+        } else {
+            autoPenaltyTimeLimitedSize = std::min(
+                std::max(autoPenaltyTimeLimitedSize * AUTO_PENALTY_SIZE_GROWTH_RATIO, autoPenaltyTimeLimitedSize + 1.0),
+                static_cast<double>(numeric_limits<int>::max()));
+        }
+        maxNumConstraints = std::min(maxNumConstraints, autoPenaltyTimeLimitedSize);
+    }
+    if(globalNumConstraintVectors <= maxNumConstraints){
+        return;
+    }
+
+    articulatedBodyPositions.clear();
+    for(size_t i=0; i < bodiesData.size(); ++i){
+        const BodyData& bodyData = bodiesData[i];
+        if(!bodyData.isStatic && bodyData.body->numLinks() > 1){
+            articulatedBodyPositions.push_back(bodyData.body->rootLink()->p());
+        }
+    }
+
+    autoPenaltyOrder.clear();
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        if(linkPair.isPenaltyBased || linkPair.isSameBodyPair){
+            continue;
+        }
+        const double maxDepth = penaltySizeRatio *
+            kkwmin(linkPair.linkData[0]->penaltyMinSize, linkPair.linkData[1]->penaltyMinSize);
+        bool isShallow = true;
+        if(!linkPair.rawContactPoints.empty()){
+            const RawContactPointArray& rawContactPoints = linkPair.rawContactPoints;
+            for(size_t j=0; j < rawContactPoints.size() && isShallow; ++j){
+                isShallow = (rawContactPoints[j].depth <= maxDepth);
+            }
+        } else {
+            const ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+            for(size_t j=0; j < constraintPoints.size() && isShallow; ++j){
+                isShallow = (constraintPoints[j].depth <= maxDepth);
+            }
+        }
+        if(isShallow){
+            autoPenaltyOrder.push_back(make_pair(calcLinkPairImportance(linkPair), static_cast<int>(i)));
+        }
+    }
+    // the ties are broken by the order of the link pairs
+    std::sort(autoPenaltyOrder.begin(), autoPenaltyOrder.end());
+
+    int numConstraints = globalNumConstraintVectors;
+    for(size_t i=0; i < autoPenaltyOrder.size() && numConstraints > maxNumConstraints; ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[autoPenaltyOrder[i].second];
+        linkPair.isPenaltyBased = true;
+        linkPair.isAutoPenaltyBased = true;
+        linkPair.linkData[0]->penaltySpringCount++;
+        linkPair.linkData[1]->penaltySpringCount++;
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            constraintPoints[j].globalIndex = -1;
+            constraintPoints[j].globalFrictionIndex = -1;
+        }
+        numConstraints -= constraintPoints.size();
+        ++numAutoPenaltyLinkPairsInStep;
+        if(!linkPair.rawContactPoints.empty()){
+            restoreRawContactPoints(linkPair);
+        }
+        linkPair.bodyData[0]->hasConstrainedLinks = false;
+        linkPair.bodyData[1]->hasConstrainedLinks = false;
+    }
+    if(numConstraints == globalNumConstraintVectors){
+        return;
+    }
+
+    numConstraints = 0;
+    int numFrictionVectors = 0;
+    areThereImpacts = false;
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        if(linkPair.isPenaltyBased){
+            continue;
+        }
+        linkPair.bodyData[0]->hasConstrainedLinks = true;
+        linkPair.bodyData[1]->hasConstrainedLinks = true;
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            ConstraintPoint& constraint = constraintPoints[j];
+            constraint.globalIndex = numConstraints++;
+            constraint.globalFrictionIndex = numFrictionVectors;
+            numFrictionVectors += constraint.numFrictionVectors + constraint.numMomentVectors;
+            if(constraint.normalProjectionOfRelVelocityOn0 < -1.0e-6){
+                areThereImpacts = true;
+            }
+        }
+    }
+    globalNumConstraintVectors = numConstraints;
+    globalNumFrictionVectors = numFrictionVectors;
+}
+
+
+void BCCFSImpl::storeRawContactPoints(LinkPair& linkPair)
+{
+    const ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    RawContactPointArray& rawContactPoints = linkPair.rawContactPoints;
+    rawContactPoints.resize(constraintPoints.size());
+    for(size_t i=0; i < constraintPoints.size(); ++i){
+        const ConstraintPoint& contact = constraintPoints[i];
+        RawContactPoint& raw = rawContactPoints[i];
+        raw.point = contactPoints.point(contact);
+        raw.normal = contactPoints.normals[contact.index];
+        raw.depth = contact.depth;
+    }
+}
+
+
+/**
+   Replaces the points of a link pair moved to the penalty-based contacts by its points before
+   the manifold reduction and the patch merge. The points are added at the end of contactPoints,
+   so they are contiguous, and the entries of the replaced points are left unused.
+*/
+void BCCFSImpl::restoreRawContactPoints(LinkPair& linkPair)
+{
+    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const RawContactPointArray& rawContactPoints = linkPair.rawContactPoints;
+
+    for(size_t i=0; i < constraintPoints.size(); ++i){
+        if(constraintPoints[i].numMomentVectors > 0){
+            --numContactPatchesInStep;
+        }
+    }
+    numKeptContactPointsInStep += rawContactPoints.size() - constraintPoints.size();
+
+    constraintPoints.resize(rawContactPoints.size());
+    for(size_t i=0; i < rawContactPoints.size(); ++i){
+        const RawContactPoint& raw = rawContactPoints[i];
+        ConstraintPoint& contact = constraintPoints[i];
+        contact.index = contactPoints.add();
+        contactPoints.point(contact) = raw.point;
+        contactPoints.normals[contact.index] = raw.normal;
+        contact.depth = raw.depth;
+        contact.globalIndex = -1;
+        contact.globalFrictionIndex = -1;
+        contact.numFrictionVectors = 0;
+        contact.numMomentVectors = 0;
+    }
+    setRelVelocitiesOfContactPoints(linkPair);
+}
+
+
+double BCCFSImpl::calcLinkPairImportance(LinkPair& linkPair)
+{
+    double mass = 0.0;
+    double distance = numeric_limits<double>::max();
+    for(int k=0; k < 2; ++k){
+        DyLink* link = linkPair.link[k];
+        if(linkPair.bodyData[k]->isStatic || (link->isRoot() && link->isFixedJoint())){
+            continue;
+        }
+        mass = std::max(mass, link->m());
+        if(linkPair.bodyData[k]->body->numLinks() > 1){
+            distance = 0.0;
+        }
+    }
+    if(articulatedBodyPositions.empty()){
+        distance = 0.0;
+    }
+
+    const ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int n = constraintPoints.size();
+    const int begin = constraintPoints.front().index;
+    Eigen::Map<Eigen::Matrix3Xd> relVelocities = ContactPointStore::columns(contactPoints.relVelocities, begin, n);
+    const double speed = relVelocities.colwise().norm().maxCoeff();
+
+    const Vector3 point = contactPoints.point(constraintPoints.front());
+    for(size_t i=0; i < articulatedBodyPositions.size() && distance > 0.0; ++i){
+        distance = std::min(distance, (articulatedBodyPositions[i] - point).norm());
+    }
+
+    return mass * (speed + AUTO_PENALTY_REFERENCE_SPEED) / (1.0 + distance / AUTO_PENALTY_REFERENCE_DISTANCE);
+}
+
+
+/**
+   Calculates the relative velocities of all the contact points of a link pair at once.
+   The points of the pair are contiguous in contactPoints.
+*/
+void BCCFSImpl::setRelVelocitiesOfContactPoints(LinkPair& linkPair)
+{
+    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int n = constraintPoints.size();
+    const int begin = constraintPoints.front().index;
+    Eigen::Map<Eigen::Matrix3Xd> points = ContactPointStore::columns(contactPoints.points, begin, n);
+    Eigen::Map<Eigen::Matrix3Xd> relVelocities = ContactPointStore::columns(contactPoints.relVelocities, begin, n);
+
+    // v[1] - v[0] = (vo[1] - vo[0]) + (w[1] - w[0]) x p
+    Vector3 dvo = Vector3::Zero();
+    Vector3 dw = Vector3::Zero();
+    for(int k=0; k < 2; ++k){
+        DyLink* link = linkPair.link[k];
+        if(!(link->isRoot() && link->isFixedJoint())){
+            const double sign = k ? 1.0 : -1.0;
+            dvo += sign * link->vo();
+            dw  += sign * link->w();
+        }
+    }
+    relVelocities = -points.colwise().cross(dw);
+    relVelocities.colwise() += dvo;
+
+    for(int k=0; k < 2; ++k){
+        DyLink* link = linkPair.link[k];
+        if(link->jointType() == Link::CRAWLER_JOINT && !(link->isRoot() && link->isFixedJoint())){
+            const Vector3 axis = link->R() * link->a();
+            for(int i=0; i < n; ++i){
+                ConstraintPoint& contact = constraintPoints[i];
+                // tentative
+                // invalid depths should be fixed
+/*BC*/          if(!linkPair.isPenaltyBased) {
+                if (contact.depth > contactCorrectionDepth * 2.0){
+                    contact.depth = contactCorrectionDepth * 2.0;
+                }
+/*BC*/          }
+                Vector3 dir = axis.cross(contactPoints.normals[contact.index]);
+                if (k) dir *= -1.0;
+                dir.normalize();
+                if (k) {
+                    relVelocities.col(i) += link->u() * dir;
+                } else {
+                    relVelocities.col(i) -= link->u() * dir;
+                }
+            }
+        }
+    }
+}
+
+
+/**
+   Sets the friction of the contact points of a link pair. The normal and tangential
+   components of the relative velocities are calculated for all the points at once.
+*/
+void BCCFSImpl::setFrictionOfContactPoints(LinkPair& linkPair)
 {
-    Vector3 u = Vector3::Zero();
-    int minAxis = 0;
-    Vector3& normal = contact.normalTowardInside[0];
+    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int n = constraintPoints.size();
+
+/*BC*/ if(linkPair.isPenaltyBased){
+/*BC*/     for(int i=0; i < n; ++i){ constraintPoints[i].globalFrictionIndex = -1; }
+/*BC*/     return;
+/*BC*/ }
+
+    const int begin = constraintPoints.front().index;
+    Eigen::Map<Eigen::Matrix3Xd> normals = ContactPointStore::columns(contactPoints.normals, begin, n);
+    Eigen::Map<Eigen::Matrix3Xd> relVelocities = ContactPointStore::columns(contactPoints.relVelocities, begin, n);
+
+    const Eigen::RowVectorXd normalProjections = normals.cwiseProduct(relVelocities).colwise().sum();
+    const Eigen::Matrix3Xd tangentVelocities = relVelocities - normals * normalProjections.asDiagonal();
+    const Eigen::RowVectorXd vtSquares = tangentVelocities.colwise().squaredNorm();
+
+    static const double vsqrthresh = VEL_THRESH_OF_DYNAMIC_FRICTION * VEL_THRESH_OF_DYNAMIC_FRICTION;
+
+    for(int i=0; i < n; ++i){
+        ConstraintPoint& contact = constraintPoints[i];
+
+        contact.normalProjectionOfRelVelocityOn0 = normalProjections(i);
+
+        if(!areThereImpacts){
+            if(contact.normalProjectionOfRelVelocityOn0 < -1.0e-6){
+                areThereImpacts = true;
+            }
+        }
+
+        contact.globalFrictionIndex = globalNumFrictionVectors;
+
+        double vt_square = vtSquares(i);
+        bool isSlipping = (vt_square > vsqrthresh);
+        contact.mu = isSlipping ? linkPair.muDynamic : linkPair.muStatic;
+
+        if( !ONLY_STATIC_FRICTION_FORMULATION && isSlipping){
+            contact.numFrictionVectors = 1;
+            double vt_mag = sqrt(vt_square);
+            const Vector3 normal = normals.col(i);
+            Vector3 t1 = tangentVelocities.col(i) / vt_mag;
+            Vector3 t2 = normal.cross(t1);
+            Vector3 t3 = t2.cross(normal);
+            contactPoints.tangents[0][contact.index] = t3.normalized();
+
+            // proportional dynamic friction near zero velocity
+            if(PROPORTIONAL_DYNAMIC_FRICTION){
+                vt_mag *= 10000.0;
+                if(vt_mag < contact.mu){
+                    contact.mu = vt_mag;
+                }
+            }
+        } else {
+            if(ENABLE_STATIC_FRICTION){
+                contact.numFrictionVectors = (STATIC_FRICTION_BY_TWO_CONSTRAINTS ? 2 : 4);
+                const Vector3* prevFrictionBase = 0;
+                if(isStableFrictionBasisMode){
+                    const WarmStartPoint* prev = findWarmStartPoint(linkPair, contactPoints.point(contact));
+                    if(prev && prev->hasFrictionBase){
+                        prevFrictionBase = &prev->frictionBase;
+                    }
+                }
+                setFrictionVectors(contact, prevFrictionBase);
+            } else {
+                contact.numFrictionVectors = 0;
+            }
+        }
+        if(contact.numFrictionVectors != 2){
+            contact.numMomentVectors = 0;
+        }
+        globalNumFrictionVectors += contact.numFrictionVectors + contact.numMomentVectors;
+    }
+}
 
-    for(int i=1; i < 3; i++){
-        if(fabs(normal(i)) < fabs(normal(minAxis))){
-            minAxis = i;
+
+/**
+   Sets the tangent vectors of a static friction contact. The other friction vectors of
+   the point are the negations of the tangent vectors (see ContactPointStore::frictionVector).
+*/
+void BCCFSImpl::setFrictionVectors(ConstraintPoint& contact, const Vector3* prevFrictionBase)
+{
+    const Vector3 normal = contactPoints.normalTowardInside(contact, 0);
+    Vector3 t1;
+
+    // the previous base projected onto the current tangent plane keeps the base continuous
+    bool isBaseProjected = false;
+    if(prevFrictionBase){
+        const Vector3 t = *prevFrictionBase - prevFrictionBase->dot(normal) * normal;
+        const double tnorm = t.norm();
+        if(tnorm > 1.0e-6){
+            t1 = t / tnorm;
+            isBaseProjected = true;
         }
     }
-    u(minAxis) = 1.0;
 
-    Vector3 t1 = normal.cross(u).normalized();
+    if(!isBaseProjected){
+        Vector3 u = Vector3::Zero();
+        int minAxis = 0;
+
+        for(int i=1; i < 3; i++){
+            if(fabs(normal(i)) < fabs(normal(minAxis))){
+                minAxis = i;
+            }
+        }
+        u(minAxis) = 1.0;
+
+        t1 = normal.cross(u).normalized();
+    }
     Vector3 t2 = normal.cross(t1).normalized();
 
-    if(ENABLE_RANDOM_STATIC_FRICTION_BASE){
+    Vector3& tangent0 = contactPoints.tangents[0][contact.index];
+    Vector3& tangent1 = contactPoints.tangents[1][contact.index];
+
+    if(ENABLE_RANDOM_STATIC_FRICTION_BASE && !isBaseProjected){
         double theta = randomAngle();
-        contact.frictionVector[0][0] = cos(theta) * t1 + sin(theta) * t2;
+        tangent0 = cos(theta) * t1 + sin(theta) * t2;
         theta += PI_2;
-        contact.frictionVector[1][0] = cos(theta) * t1 + sin(theta) * t2;
+        tangent1 = cos(theta) * t1 + sin(theta) * t2;
     } else {
-        contact.frictionVector[0][0] = t1;
-        contact.frictionVector[1][0] = t2;
-    }
-
-    if(STATIC_FRICTION_BY_TWO_CONSTRAINTS){
-        contact.frictionVector[0][1] = -contact.frictionVector[0][0];
-        contact.frictionVector[1][1] = -contact.frictionVector[1][0];
-    } else {
-        contact.frictionVector[2][0] = -contact.frictionVector[0][0];
-        contact.frictionVector[3][0] = -contact.frictionVector[1][0];
-
-        contact.frictionVector[0][1] = contact.frictionVector[2][0];
-        contact.frictionVector[1][1] = contact.frictionVector[3][0];
-        contact.frictionVector[2][1] = contact.frictionVector[0][0];
-        contact.frictionVector[3][1] = contact.frictionVector[1][0];
+        tangent0 = t1;
+        tangent1 = t2;
     }
 }
 
@@ -1096,12 +2630,12 @@ void BCCFSImpl::setExtraJointConstraintPoints(const ExtraJointLinkPairPtr& linkP
     for(int i=0; i < n; ++i){
         ConstraintPoint& constraint = constraintPoints[i];
         const Vector3 axis = link0->R() * linkPair->jointConstraintAxes[i];
-        constraint.point = midPoint;
-        constraint.normalTowardInside[0] =  axis;
-        constraint.normalTowardInside[1] = -axis;
+        constraint.index = contactPoints.add();
+        contactPoints.point(constraint) = midPoint;
+        contactPoints.normals[constraint.index] = -axis;
         constraint.depth = axis.dot(error);
         constraint.globalIndex = globalNumConstraintVectors++;
-        constraint.normalProjectionOfRelVelocityOn0 = constraint.normalTowardInside[1].dot(relVelocityOn0);
+        constraint.normalProjectionOfRelVelocityOn0 = -axis.dot(relVelocityOn0);
     }
     linkPair->bodyData[0]->hasConstrainedLinks = true;
     linkPair->bodyData[1]->hasConstrainedLinks = true;
@@ -1122,9 +2656,9 @@ void BCCFSImpl::set2dConstraintPoints(const Constrain2dLinkPairPtr& linkPair)
         Vector3 point1 = link1->p() + link1->R() * local2dConstraintPoints[i];
         Vector3 relVelocityOn0 = link1->vo() + link1->w().cross(point1);
         ConstraintPoint& constraint = constraintPoints[i];
-        constraint.point = point1;
-        constraint.normalTowardInside[0] =  yAxis;
-        constraint.normalTowardInside[1] = -yAxis;
+        constraint.index = contactPoints.add();
+        contactPoints.point(constraint) = point1;
+        contactPoints.normals[constraint.index] = -yAxis;
         constraint.depth = point1.y() - linkPair->globalYpositions[i];
         constraint.globalIndex = globalNumConstraintVectors++;
         constraint.normalProjectionOfRelVelocityOn0 = -(link1->vo() + link1->w().cross(point1)).y();
@@ -1156,18 +2690,18 @@ void BCCFSImpl::putContactPoints()
             for(size_t j=0; j < constraintPoints.size(); ++j){
                 ConstraintPoint& contact = constraintPoints[j];
                 os << " index " << contact.globalIndex;
-                os << " point: " << contact.point;
-                os << " normal: " << contact.normalTowardInside[1];
-                os << " defaultAccel[0]: " << contact.defaultAccel[0];
-                os << " defaultAccel[1]: " << contact.defaultAccel[1];
+                os << " point: " << contactPoints.point(contact);
+                os << " normal: " << contactPoints.normalTowardInside(contact, 1);
+                os << " defaultAccel[0]: " << contactPoints.defaultAccel(contact, 0);
+                os << " defaultAccel[1]: " << contactPoints.defaultAccel(contact, 1);
                 os << " normal projectionOfRelVelocityOn0" << contact.normalProjectionOfRelVelocityOn0;
                 os << " depth" << contact.depth;
                 os << " mu" << contact.mu;
-                os << " rel velocity: " << contact.relVelocityOn0;
-                os << " friction[0][0]: " << contact.frictionVector[0][0];
-                os << " friction[0][1]: " << contact.frictionVector[0][1];
-                os << " friction[1][0]: " << contact.frictionVector[1][0];
-                os << " friction[1][1]: " << contact.frictionVector[1][1];
+                os << " rel velocity: " << contactPoints.relVelocityOn0(contact);
+                os << " friction[0][0]: " << contactPoints.frictionVector(contact, 0, 0);
+                os << " friction[0][1]: " << contactPoints.frictionVector(contact, 0, 1);
+                os << " friction[1][0]: " << contactPoints.frictionVector(contact, 1, 0);
+                os << " friction[1][1]: " << contactPoints.frictionVector(contact, 1, 1);
                 os << "\n";
             }
         }
@@ -1191,7 +2725,17 @@ void BCCFSImpl::initMatrices()
 
     const int dimLCP = usePivotingLCP ? (n + m + m) : (n + m);
 
-    Mlcp.resize(dimLCP, dimLCP);
+    if(isSparseMatrixActive || isMatrixFreeMode || isSymmetricMatrixActive){
+        Mlcp.resize(0, 0);
+    } else {
+        Mlcp.resize(dimLCP, dimLCP);
+    }
+    if(!isSymmetricMatrixActive){
+        symmetricMlcp.clear();
+    }
+    if(isMatrixFreeMode){
+        matrixFreeDiagonal.resize(dimLCP);
+    }
     b.resize(dimLCP);
     solution.resize(dimLCP);
 
@@ -1211,1230 +2755,3529 @@ void BCCFSImpl::initMatrices()
 
     an0.resize(n);
     at0.resize(m);
+/*BC*/ if(isMatrixFreeMode) return;
 /*BC*/ pSNSCore->DeleteBuffer();
-/*BC*/ pSNSCore->NewBuffer(Mlcp.rows());
+/*BC*/ pSNSCore->NewBuffer(dimLCP, !isSparseMatrixActive && !isSymmetricMatrixActive);
 /*BC*/ pQMRCore->DeleteBuffer();
-/*BC*/ pQMRCore->NewBuffer(Mlcp.rows());
+/*BC*/ pQMRCore->NewBuffer(dimLCP);
+/*BC*/ pBGSCore->DeleteBuffer();
+/*BC*/ pBGSCore->NewBuffer(dimLCP);
 }
 
 
-void BCCFSImpl::setAccelCalcSkipInformation()
+bool BCCFSImpl::isSymmetricMatrixAvailable()
 {
-    // clear skip check numbers
-    for(size_t i=0; i < bodiesData.size(); ++i){
-        BodyData& bodyData = bodiesData[i];
-        if(bodyData.hasConstrainedLinks){
-            LinkDataArray& linksData = bodyData.linksData;
-            for(size_t j=0; j < linksData.size(); ++j){
-                linksData[j].numberToCheckAccelCalcSkip = numeric_limits<int>::max();
-            }
-        }
+    if(!isSymmetricMatrixMode || isSymmetricMatrixUnsafe || isSparseMatrixActive ||
+       isMatrixFreeMode || isJacobianAssemblyMode){
+        return false;
     }
 
-    // add the number of contact points to skip check numbers of the links from a contact target to the root
-    int numLinkPairs = constrainedLinkPairs.size();
-    for(int i=0; i < numLinkPairs; ++i){
-        LinkPair* linkPair = constrainedLinkPairs[i];
-/*BC*/  if(linkPair->isPenaltyBased)continue;
-        int constraintIndex = linkPair->constraintPoints.front().globalIndex;
-        for(int j=0; j < 2; ++j){
-            LinkDataArray& linksData = linkPair->bodyData[j]->linksData;
-            int linkIndex = linkPair->link[j]->index();
-            while(linkIndex >= 0){
-                LinkData& linkData = linksData[linkIndex];
-                if(linkData.numberToCheckAccelCalcSkip < constraintIndex){
-                    break;
-                }
-                linkData.numberToCheckAccelCalcSkip = constraintIndex;
-                linkIndex = linkData.parentIndex;
-            }
+    // the test forces applied one by one by ForwardDynamicsCBM do not give the elements of the same body pairs correctly
+    for(size_t i=0; !areCBMTestForcesBatched && i < constrainedLinkPairs.size(); ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+/*BC*/  if(linkPair.isPenaltyBased) continue;
+        if(linkPair.bodyIndex[0] == linkPair.bodyIndex[1] &&
+           !linkPair.bodyData[0]->isStatic && linkPair.bodyData[0]->forwardDynamicsCBM){
+            ++numSymmetricMatrixFallbacks;
+            return false;
         }
     }
+    return true;
 }
 
 
-void BCCFSImpl::setDefaultAccelerationVector()
+void BCCFSImpl::initSymmetricMatrixOrder()
 {
-    // calculate accelerations with no constraint force
-    for(size_t i=0; i < bodiesData.size(); ++i){
-        BodyData& bodyData = bodiesData[i];
-        if(bodyData.hasConstrainedLinks && ! bodyData.isStatic){
-
-            if(bodyData.forwardDynamicsCBM){
-                bodyData.forwardDynamicsCBM->sumExternalForces();
-                bodyData.forwardDynamicsCBM->solveUnknownAccels();
-                calcAccelsMM(bodyData, numeric_limits<int>::max());
-
-            } else {
-                initABMForceElementsWithNoExtForce(bodyData);
-                calcAccelsABM(bodyData, numeric_limits<int>::max());
-            }
-        }
-    }
+    const int n = globalNumConstraintVectors;
+    symmetricMlcpOrder.resize(n + globalNumFrictionVectors);
 
-    // extract accelerations
+    // the number of the friction vectors of each point is temporarily stored in the normal rows
     for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
-
         LinkPair& linkPair = *constrainedLinkPairs[i];
-/*BC*/  if(linkPair.isPenaltyBased)continue;
+/*BC*/  if(linkPair.isPenaltyBased) continue;
         ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
-
         for(size_t j=0; j < constraintPoints.size(); ++j){
-            ConstraintPoint& constraint = constraintPoints[j];
-
-            for(int k=0; k < 2; ++k){
-                if(linkPair.bodyData[k]->isStatic){
-                    constraint.defaultAccel[k].setZero();
-                } else {
-                    DyLink* link = linkPair.link[k];
-                    LinkData* linkData = linkPair.linkData[k];
-                    constraint.defaultAccel[k] =
-                        linkData->dvo - constraint.point.cross(linkData->dw) +
-                        link->w().cross(link->vo() + link->w().cross(constraint.point));
-                }
-            }
-
-            Vector3 relDefaultAccel(constraint.defaultAccel[1] - constraint.defaultAccel[0]);
-            an0[constraint.globalIndex] = constraint.normalTowardInside[1].dot(relDefaultAccel);
-
+            symmetricMlcpOrder[constraintPoints[j].globalIndex] = constraintPoints[j].numFrictionVectors;
+        }
+    }
+    int position = 0;
+    for(int i=0; i < n; ++i){
+        const int numFrictionVectors = symmetricMlcpOrder[i];
+        symmetricMlcpOrder[i] = position;
+        position += 1 + numFrictionVectors;
+    }
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+/*BC*/  if(linkPair.isPenaltyBased) continue;
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            ConstraintPoint& constraint = constraintPoints[j];
             for(int k=0; k < constraint.numFrictionVectors; ++k){
-                at0[constraint.globalFrictionIndex + k] = constraint.frictionVector[k][1].dot(relDefaultAccel);
+                symmetricMlcpOrder[n + constraint.globalFrictionIndex + k] = symmetricMlcpOrder[constraint.globalIndex] + 1 + k;
             }
         }
     }
+
+    symmetricMlcp.setOrder(symmetricMlcpOrder);
 }
 
 
-void BCCFSImpl::setAccelerationMatrix()
+void BCCFSImpl::initBodyToLinkPairIndices()
 {
-    const int n = globalNumConstraintVectors;
-    const int m = globalNumFrictionVectors;
-
-    Eigen::Block<MatrixX> Knn = Mlcp.block(0, 0, n, n);
-    Eigen::Block<MatrixX> Ktn = Mlcp.block(0, n, n, m);
-    Eigen::Block<MatrixX> Knt = Mlcp.block(n, 0, m, n);
-    Eigen::Block<MatrixX> Ktt = Mlcp.block(n, n, m, m);
-
-    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+    const int numLinkPairs = constrainedLinkPairs.size();
 
+    // index numBodies is used for the body of the 2D constraint
+    const int numBodies = bodiesData.size();
+    bodyToLinkPairIndices.resize(numBodies + 1);
+    for(int i=0; i <= numBodies; ++i){
+        bodyToLinkPairIndices[i].clear();
+    }
+    for(int i=0; i < numLinkPairs; ++i){
         LinkPair& linkPair = *constrainedLinkPairs[i];
-/*BC*/  if(linkPair.isPenaltyBased) continue;/***/
-        int numConstraintsInPair = linkPair.constraintPoints.size();
+        if(linkPair.isPenaltyBased) continue;
+        for(int k=0; k < 2; ++k){
+            if(!linkPair.bodyData[k]->isStatic){
+                if(k == 1 && linkPair.bodyIndex[1] == linkPair.bodyIndex[0]) break;
+                int bodyIndex = constraintBodyIndex(linkPair, k);
+                bodyToLinkPairIndices[bodyIndex].push_back(i);
+            }
+        }
+    }
+}
 
-        for(int j=0; j < numConstraintsInPair; ++j){
 
-            ConstraintPoint& constraint = linkPair.constraintPoints[j];
-            int constraintIndex = constraint.globalIndex;
+/**
+   Two constraints are coupled only when their link pairs share a non-static body,
+   which is also the condition for extractRelAccelsOfConstraintPoints to write a
+   non-zero element. The rows of a link pair therefore share the same columns.
+*/
+void BCCFSImpl::initSparseMatrixStructure()
+{
+    const int n = globalNumConstraintVectors;
+    const int numLinkPairs = constrainedLinkPairs.size();
 
-            // apply test normal force
-            for(int k=0; k < 2; ++k){
-                BodyData& bodyData = *linkPair.bodyData[k];
-                if(!bodyData.isStatic){
+    sparseRowToGroup.resize(n + globalNumFrictionVectors);
+    sparseGroupColumns.resize(numLinkPairs);
 
-                    bodyData.isTestForceBeingApplied = true;
-                    const Vector3& f = constraint.normalTowardInside[k];
+    for(int i=0; i < numLinkPairs; ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        std::vector<int>& columns = sparseGroupColumns[i];
+        columns.clear();
+        if(linkPair.isPenaltyBased) continue;
 
-                    if(bodyData.forwardDynamicsCBM){
-                        //! \todo This code does not work correctly when the links are in the same body. Fix it.
-                        Vector3 arm = constraint.point - bodyData.body->rootLink()->p();
-                        Vector3 tau = arm.cross(f);
-                        Vector3 tauext = constraint.point.cross(f);
-                        bodyData.forwardDynamicsCBM->solveUnknownAccels(linkPair.link[k], f, tauext, f, tau);
-                        calcAccelsMM(bodyData, constraintIndex);
-                    } else {
-                        Vector3 tau = constraint.point.cross(f);
-                        calcABMForceElementsWithTestForce(bodyData, linkPair.link[k], f, tau);
-                        if(!linkPair.isSameBodyPair || (k > 0)){
-                            calcAccelsABM(bodyData, constraintIndex);
-                        }
-                    }
-                }
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            ConstraintPoint& constraint = constraintPoints[j];
+            sparseRowToGroup[constraint.globalIndex] = i;
+            for(int l=0; l < constraint.numFrictionVectors + constraint.numMomentVectors; ++l){
+                sparseRowToGroup[n + constraint.globalFrictionIndex + l] = i;
             }
-            extractRelAccelsOfConstraintPoints(Knn, Knt, constraintIndex, constraintIndex);
+        }
 
-            // apply test friction force
-            for(int l=0; l < constraint.numFrictionVectors; ++l){
-                for(int k=0; k < 2; ++k){
-                    BodyData& bodyData = *linkPair.bodyData[k];
-                    if(!bodyData.isStatic){
-                        const Vector3& f = constraint.frictionVector[l][k];
-
-                        if(bodyData.forwardDynamicsCBM){
-                            //! \todo This code does not work correctly when the links are in the same body. Fix it.
-                            Vector3 arm = constraint.point - bodyData.body->rootLink()->p();
-                            Vector3 tau = arm.cross(f);
-                            Vector3 tauext = constraint.point.cross(f);
-                            bodyData.forwardDynamicsCBM->solveUnknownAccels(linkPair.link[k], f, tauext, f, tau);
-                            calcAccelsMM(bodyData, constraintIndex);
-                        } else {
-                            Vector3 tau = constraint.point.cross(f);
-                            calcABMForceElementsWithTestForce(bodyData, linkPair.link[k], f, tau);
-                            if(!linkPair.isSameBodyPair || (k > 0)){
-                                calcAccelsABM(bodyData, constraintIndex);
-                            }
-                        }
+        for(int k=0; k < 2; ++k){
+            if(linkPair.bodyData[k]->isStatic) continue;
+            if(k == 1 && linkPair.bodyIndex[1] == linkPair.bodyIndex[0]) break;
+            int bodyIndex = constraintBodyIndex(linkPair, k);
+            const std::vector<int>& linkPairIndices = bodyToLinkPairIndices[bodyIndex];
+            for(size_t l=0; l < linkPairIndices.size(); ++l){
+                ConstraintPointArray& coupledPoints = constrainedLinkPairs[linkPairIndices[l]]->constraintPoints;
+                for(size_t p=0; p < coupledPoints.size(); ++p){
+                    ConstraintPoint& constraint = coupledPoints[p];
+                    columns.push_back(constraint.globalIndex);
+                    for(int q=0; q < constraint.numFrictionVectors + constraint.numMomentVectors; ++q){
+                        columns.push_back(n + constraint.globalFrictionIndex + q);
                     }
                 }
-                extractRelAccelsOfConstraintPoints(Ktn, Ktt, constraint.globalFrictionIndex + l, constraintIndex);
             }
-
-            linkPair.bodyData[0]->isTestForceBeingApplied = false;
-            linkPair.bodyData[1]->isTestForceBeingApplied = false;
         }
+        std::sort(columns.begin(), columns.end());
+        columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
     }
 
-    if(ASSUME_SYMMETRIC_MATRIX){
-        copySymmetricElementsOfAccelerationMatrix(Knn, Ktn, Knt, Ktt);
+    if(isSparseMatrixActive){
+        sparseMlcp.setStructure(n + globalNumFrictionVectors, sparseRowToGroup, sparseGroupColumns);
+
+        if(CFS_DEBUG){
+            os << "Sparse Mlcp: " << sparseMlcp.nonZeros() << " non-zero elements of "
+               << sparseMlcp.rows() << " x " << sparseMlcp.rows() << std::endl;
+        }
     }
 }
 
 
-void BCCFSImpl::initABMForceElementsWithNoExtForce(BodyData& bodyData)
+/**
+   Greedy coloring of the link pairs. Two link pairs get different colors when they
+   share a non-static body, which is the condition for their rows to be coupled.
+*/
+void BCCFSImpl::initLinkPairColoring()
 {
-    bodyData.dpf.setZero();
-    bodyData.dptau.setZero();
-
-    std::vector<LinkData>& linksData = bodyData.linksData;
-    const LinkTraverse& traverse = bodyData.body->linkTraverse();
-    const int n = traverse.numLinks();
-
-    for(int i = n-1; i >= 0; --i){
-        DyLink* link = static_cast<DyLink*>(traverse[i]);
-        LinkData& data = linksData[i];
-
-        /*
-          data.pf0   = link->pf;
-          data.ptau0 = link->ptau;
-        */
-        data.pf0   = link->pf() - link->f_ext();
-        data.ptau0 = link->ptau() - link->tau_ext();
-
-        for(DyLink* child = link->child(); child; child = child->sibling()){
+    const int numLinkPairs = constrainedLinkPairs.size();
 
-            LinkData& childData = linksData[child->index()];
-
-            data.pf0   += childData.pf0;
-            data.ptau0 += childData.ptau0;
+    linkPairColors.assign(numLinkPairs, -1);
+    colorUsedStamp.clear();
+    numColors = 0;
+    int largestColorClassSize = 0;
 
-            if(!child->isFixedJoint()){
-                double uu_dd = childData.uu0 / child->dd();
-                data.pf0   += uu_dd * child->hhv();
-                data.ptau0 += uu_dd * child->hhw();
+    for(int i=0; i < numLinkPairs; ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        if(linkPair.isPenaltyBased) continue;
+
+        for(int k=0; k < 2; ++k){
+            if(linkPair.bodyData[k]->isStatic) continue;
+            const std::vector<int>& coupledLinkPairs = bodyToLinkPairIndices[constraintBodyIndex(linkPair, k)];
+            for(size_t l=0; l < coupledLinkPairs.size(); ++l){
+                const int color = linkPairColors[coupledLinkPairs[l]];
+                if(color >= 0){
+                    colorUsedStamp[color] = i;
+                }
             }
         }
-
-        if(i > 0){
-            if(!link->isFixedJoint()){
-                data.uu0  = link->uu() + link->u() - (link->sv().dot(data.pf0) + link->sw().dot(data.ptau0));
-                data.uu = data.uu0;
+        int color = 0;
+        while(color < numColors && colorUsedStamp[color] == i){
+            ++color;
+        }
+        if(color == numColors){
+            ++numColors;
+            colorUsedStamp.push_back(-1);
+            if(static_cast<int>(colorClasses.size()) < numColors){
+                colorClasses.resize(numColors);
             }
+            colorClasses[color].clear();
         }
+        linkPairColors[i] = color;
+        colorClasses[color].push_back(i);
+        largestColorClassSize = std::max(largestColorClassSize, static_cast<int>(colorClasses[color].size()));
     }
-}
 
+    maxNumColors = std::max(maxNumColors, numColors);
+    maxColorClassSize = std::max(maxColorClassSize, largestColorClassSize);
 
-void BCCFSImpl::calcABMForceElementsWithTestForce
-(BodyData& bodyData, DyLink* linkToApplyForce, const Vector3& f, const Vector3& tau)
-{
-    std::vector<LinkData>& linksData = bodyData.linksData;
+    if(CFS_DEBUG){
+        os << "Num colors: " << numColors << ", largest color class: " << largestColorClassSize << std::endl;
+    }
+}
 
-    Vector3 dpf   = -f;
-    Vector3 dptau = -tau;
 
-    DyLink* link = linkToApplyForce;
-    while(link->parent()){
-        if(!link->isFixedJoint()){
-            LinkData& data = linksData[link->index()];
-            double duu = -(link->sv().dot(dpf) + link->sw().dot(dptau));
-            data.uu += duu;
-            double duudd = duu / link->dd();
-            dpf   += duudd * link->hhv();
-            dptau += duudd * link->hhw();
-        }
-        link = link->parent();
+int BCCFSImpl::findIslandRoot(int bodyIndex)
+{
+    int root = bodyIndex;
+    while(bodyToIslandRoot[root] != root){
+        root = bodyToIslandRoot[root];
     }
-
-    bodyData.dpf   += dpf;
-    bodyData.dptau += dptau;
+    while(bodyToIslandRoot[bodyIndex] != root){
+        int next = bodyToIslandRoot[bodyIndex];
+        bodyToIslandRoot[bodyIndex] = root;
+        bodyIndex = next;
+    }
+    return root;
 }
 
 
-void BCCFSImpl::calcAccelsABM(BodyData& bodyData, int constraintIndex)
+/**
+   Islands are the connected components of the graph whose nodes are the non-static
+   bodies and whose edges are the constrained link pairs.
+*/
+void BCCFSImpl::initIslands()
 {
-    std::vector<LinkData>& linksData = bodyData.linksData;
-    LinkData& rootData = linksData[0];
-    DyLink* rootLink = rootData.link;
+    const int n = globalNumConstraintVectors;
+    const int numLinkPairs = constrainedLinkPairs.size();
+    const int numBodies = bodiesData.size();
 
-    if(rootLink->isFreeJoint()){
+    // index numBodies is used for the body of the 2D constraint
+    bodyToIslandRoot.resize(numBodies + 1);
+    for(int i=0; i <= numBodies; ++i){
+        bodyToIslandRoot[i] = i;
+    }
+    for(int i=0; i < numLinkPairs; ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        if(linkPair.isPenaltyBased) continue;
+        if(!linkPair.bodyData[0]->isStatic && !linkPair.bodyData[1]->isStatic){
+            int root0 = findIslandRoot(constraintBodyIndex(linkPair, 0));
+            int root1 = findIslandRoot(constraintBodyIndex(linkPair, 1));
+            if(root0 != root1){
+                bodyToIslandRoot[root1] = root0;
+            }
+        }
+    }
 
-        Eigen::Matrix<double, 6, 6> M;
-        M << rootLink->Ivv(), rootLink->Iwv().transpose(),
-            rootLink->Iwv(), rootLink->Iww();
+    islandIndexOfRoot.assign(numBodies + 1, -1);
+    linkPairToIslandGroup.resize(numLinkPairs);
+    numIslands = 0;
 
-        Eigen::Matrix<double, 6, 1> f;
-        f << (rootData.pf0   + bodyData.dpf),
-            (rootData.ptau0 + bodyData.dptau);
-        f *= -1.0;
+    for(int i=0; i < numLinkPairs; ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        if(linkPair.isPenaltyBased) continue;
+        const int k = linkPair.bodyData[0]->isStatic ? 1 : 0;
+        int& islandIndex = islandIndexOfRoot[findIslandRoot(constraintBodyIndex(linkPair, k))];
+        if(islandIndex < 0){
+            islandIndex = numIslands++;
+            if(islandIndex == static_cast<int>(islands.size())){
+                islands.push_back(boost::make_shared<Island>());
+            }
+            islands[islandIndex]->linkPairIndices.clear();
+            islands[islandIndex]->rows.clear();
+        }
+        Island& island = *islands[islandIndex];
+        linkPairToIslandGroup[i] = island.linkPairIndices.size();
+        island.linkPairIndices.push_back(i);
 
-        Eigen::Matrix<double, 6, 1> a(M.colPivHouseholderQr().solve(f));
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            ConstraintPoint& constraint = constraintPoints[j];
+            island.rows.push_back(constraint.globalIndex);
+            for(int l=0; l < constraint.numFrictionVectors; ++l){
+                island.rows.push_back(n + constraint.globalFrictionIndex + l);
+            }
+        }
+    }
 
-        rootData.dvo = a.head<3>();
-        rootData.dw  = a.tail<3>();
+    globalRowToIslandRow.resize(n + globalNumFrictionVectors);
+    std::vector< std::pair<int, int> > sizeAndIndex(numIslands);
+
+    for(int i=0; i < numIslands; ++i){
+        Island& island = *islands[i];
+        std::vector<int>& rows = island.rows;
+        std::sort(rows.begin(), rows.end());
+        island.numContactNormalVectors =
+            std::lower_bound(rows.begin(), rows.end(), globalNumContactNormalVectors) - rows.begin();
+        island.numConstraintVectors = std::lower_bound(rows.begin(), rows.end(), n) - rows.begin();
+        island.numFrictionVectors = rows.size() - island.numConstraintVectors;
+        for(size_t j=0; j < rows.size(); ++j){
+            globalRowToIslandRow[rows[j]] = j;
+        }
+        sizeAndIndex[i] = std::make_pair(-island.size(), i);
+    }
 
-    } else {
-        rootData.dw .setZero();
-        rootData.dvo.setZero();
+    // larger islands are dealt to the threads first
+    std::sort(sizeAndIndex.begin(), sizeAndIndex.end());
+    islandOrder.resize(numIslands);
+    for(int i=0; i < numIslands; ++i){
+        islandOrder[i] = sizeAndIndex[i].second;
     }
 
-    // reset
-    bodyData.dpf  .setZero();
-    bodyData.dptau.setZero();
+    maxNumIslands = std::max(maxNumIslands, numIslands);
 
-    int skipCheckNumber = ASSUME_SYMMETRIC_MATRIX ? constraintIndex : (numeric_limits<int>::max() - 1);
-    int n = linksData.size();
-    for(int linkIndex = 1; linkIndex < n; ++linkIndex){
+    if(CFS_DEBUG){
+        os << "Num islands: " << numIslands << std::endl;
+    }
+}
 
-        LinkData& linkData = linksData[linkIndex];
 
-        if(!SKIP_REDUNDANT_ACCEL_CALC || linkData.numberToCheckAccelCalcSkip <= skipCheckNumber){
+/**
+   Copies the rows and the columns of an island from the matrix and the vectors of the step.
+   The global matrix is assembled as in the other modes, so the memory and the assembly time
+   are those of the whole step, and only the solution is split into the islands.
+*/
+void BCCFSImpl::setIslandMatrix(Island& island)
+{
+    const std::vector<int>& rows = island.rows;
+    const int size = island.size();
+    const int nc = island.numContactNormalVectors;
+    const int nf = island.numFrictionVectors;
 
-            DyLink* link = linkData.link;
-            LinkData& parentData = linksData[linkData.parentIndex];
+    island.b.resize(size);
+    island.solution.resize(size);
+    for(int i=0; i < size; ++i){
+        island.b(i) = b(rows[i]);
+        island.solution(i) = solution(rows[i]);
+    }
 
-            if(!link->isFixedJoint()){
-                linkData.ddq = (linkData.uu - (link->hhv().dot(parentData.dvo) + link->hhw().dot(parentData.dw))) / link->dd();
-                linkData.dvo = parentData.dvo + link->cv() + link->sv() * linkData.ddq;
-                linkData.dw  = parentData.dw  + link->cw() + link->sw() * linkData.ddq;
-            }else{
-                linkData.ddq = 0.0;
-                linkData.dvo = parentData.dvo;
-                linkData.dw  = parentData.dw;
-            }
+    island.contactIndexToMu.resize(nc);
+    island.mcpHi.resize(nc);
+    for(int i=0; i < nc; ++i){
+        island.contactIndexToMu(i) = contactIndexToMu(rows[i]);
+    }
+    island.frictionIndexToContactIndex.resize(nf);
+    for(int i=0; i < nf; ++i){
+        const int frictionIndex = rows[island.numConstraintVectors + i] - globalNumConstraintVectors;
+        island.frictionIndexToContactIndex[i] = globalRowToIslandRow[frictionIndexToContactIndex[frictionIndex]];
+    }
 
-            // reset
-            linkData.uu = linkData.uu0;
+    // the global matrix is sparse in the island mode, so the block of an island is copied from its nonzero elements
+    island.sparseRowToGroup.resize(size);
+    for(int i=0; i < size; ++i){
+        island.sparseRowToGroup[i] = linkPairToIslandGroup[sparseRowToGroup[rows[i]]];
+    }
+    const int numGroups = island.linkPairIndices.size();
+    island.sparseGroupColumns.resize(numGroups);
+    for(int i=0; i < numGroups; ++i){
+        const std::vector<int>& columns = sparseGroupColumns[island.linkPairIndices[i]];
+        std::vector<int>& islandColumns = island.sparseGroupColumns[i];
+        islandColumns.resize(columns.size());
+        for(size_t j=0; j < columns.size(); ++j){
+            islandColumns[j] = globalRowToIslandRow[columns[j]];
+        }
+    }
+    island.sparseMlcp.setStructure(size, island.sparseRowToGroup, island.sparseGroupColumns);
+
+    // the row order is kept, so the elements of a row appear in the same order
+    for(int i=0; i < size; ++i){
+        int k = sparseMlcp.rowBegin(rows[i]);
+        const int end = island.sparseMlcp.rowEnd(i);
+        for(int l = island.sparseMlcp.rowBegin(i); l < end; ++l, ++k){
+            island.sparseMlcp.valueRef(l) = sparseMlcp.value(k);
         }
     }
 }
 
 
-void BCCFSImpl::calcAccelsMM(BodyData& bodyData, int constraintIndex)
+void BCCFSImpl::solveIslands()
 {
-    std::vector<LinkData>& linksData = bodyData.linksData;
-
-    LinkData& rootData = linksData[0];
-    DyLink* rootLink = rootData.link;
-    rootData.dvo = rootLink->dvo();
-    rootData.dw  = rootLink->dw();
-
-    const int skipCheckNumber = ASSUME_SYMMETRIC_MATRIX ? constraintIndex : (numeric_limits<int>::max() - 1);
-    const int n = linksData.size();
-
-    for(int linkIndex = 1; linkIndex < n; ++linkIndex){
-
-        LinkData& linkData = linksData[linkIndex];
-
-        if(!SKIP_REDUNDANT_ACCEL_CALC || linkData.numberToCheckAccelCalcSkip <= skipCheckNumber){
+    if(solverID == 1){
+        // the Siconos solvers are called from one thread
+        for(int i=0; i < numIslands; ++i){
+            solveIsland(i, 0);
+        }
+    } else {
+        threadPool.run(numIslands, boost::bind(&BCCFSImpl::solveIsland, this, _1, _2));
+    }
 
-            DyLink* link = linkData.link;
-            LinkData& parentData = linksData[linkData.parentIndex];
-            if(!link->isFixedJoint()){
-                linkData.dvo = parentData.dvo + link->cv() + link->ddq() * link->sv();
-                linkData.dw  = parentData.dw  + link->cw() + link->ddq() * link->sw();
-            }else{
-                linkData.dvo = parentData.dvo;
-                linkData.dw  = parentData.dw;
-            }
+    for(int i=0; i < numIslands; ++i){
+        if(!islands[i]->isConverged){
+            ++numUnconverged;
+            if(CFS_DEBUG)
+                os << "LCP of island " << i << " didn't converge" << std::endl;
+        }
+        if(!islands[i]->isBlockGaussSeidelConverged){
+            ++numBlockGaussSeidelUnconverged;
         }
     }
 }
 
 
-void BCCFSImpl::extractRelAccelsOfConstraintPoints
-(Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, int testForceIndex, int constraintIndex)
+void BCCFSImpl::solveIsland(int task, int worker)
 {
-    int maxConstraintIndexToExtract = ASSUME_SYMMETRIC_MATRIX ? constraintIndex : globalNumConstraintVectors;
-
+    Island& island = *islands[islandOrder[task]];
+    const int size = island.size();
+    island.isBlockGaussSeidelConverged = true;
+
+    setIslandMatrix(island);
+
+    // the islands are already solved in parallel, so they are not colored
+    if(solverID == 0 || solverID == 4 || solverID == 5 || (solverID == 3 && !ENABLE_TRUE_FRICTION_CONE)){
+        MCPLayout layout(island.numContactNormalVectors, island.numConstraintVectors, island.numFrictionVectors,
+                         island.contactIndexToMu, island.mcpHi, island.frictionIndexToContactIndex);
+        solveMCPByProjectedGaussSeidel(island.sparseMlcp, island.b, island.solution, layout);
+        island.isConverged = true;
+
+    } else if(solverID == 1){
+        if(!island.siconosCore){
+            island.siconosCore = boost::make_shared<BCCoreSiconos>(maxNumGaussSeidelIteration, gaussSeidelErrorCriterion);
+            island.coreBufferSize = 0;
+        }
+        BCCoreSiconos& core = *island.siconosCore;
+        if(island.coreBufferSize != size){
+            core.DeleteBuffer();
+            core.NewBuffer(size, false);
+            island.coreBufferSize = size;
+        }
+        core.setGaussSeidelErrorCriterion(gaussSeidelErrorCriterion);
+        core.setGaussSeidelMaxNumIterations(maxNumGaussSeidelIteration);
+        island.isConverged = core.callSolver(island.sparseMlcp, island.b, island.solution, island.contactIndexToMu, os);
+
+    } else if(solverID == 3){
+        if(!island.blockGSCore){
+            island.blockGSCore = boost::make_shared<BCCoreBlockGS>(maxNumGaussSeidelIteration, gaussSeidelErrorCriterion);
+            island.coreBufferSize = 0;
+        }
+        BCCoreBlockGS& core = *island.blockGSCore;
+        if(island.coreBufferSize != size){
+            core.DeleteBuffer();
+            core.NewBuffer(size);
+            island.coreBufferSize = size;
+        }
+        core.setGaussSeidelErrorCriterion(gaussSeidelErrorCriterion);
+        core.setGaussSeidelMaxNumIterations(maxNumGaussSeidelIteration);
+        island.isConverged = core.callSolver(island.sparseMlcp, island.b, island.solution, island.contactIndexToMu, os);
+        island.isBlockGaussSeidelConverged = core.isConverged();
 
-    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+    } else {
+        if(!island.qmrCore){
+            island.qmrCore = boost::make_shared<BCCoreQMR>(maxNumGaussSeidelIteration, gaussSeidelErrorCriterion);
+            island.coreBufferSize = 0;
+        }
+        BCCoreQMR& core = *island.qmrCore;
+        if(island.coreBufferSize != size){
+            core.DeleteBuffer();
+            core.NewBuffer(size);
+            island.coreBufferSize = size;
+        }
+        core.setGaussSeidelMaxNumIterations(maxNumGaussSeidelIteration);
+        island.isConverged = core.callSolver(island.sparseMlcp, island.b, island.solution, island.contactIndexToMu, os);
+    }
 
-        LinkPair& linkPair = *constrainedLinkPairs[i];
-/*BC*/  if(linkPair.isPenaltyBased) continue;
+    // the forces of an unconverged island are not applied
+    for(int i=0; i < size; ++i){
+        solution(island.rows[i]) = island.isConverged ? island.solution(i) : 0.0;
+    }
+}
 
-        BodyData& bodyData0 = *linkPair.bodyData[0];
-        BodyData& bodyData1 = *linkPair.bodyData[1];
 
-        if(bodyData0.isTestForceBeingApplied){
-            if(bodyData1.isTestForceBeingApplied){
-                extractRelAccelsFromLinkPairCase1(Kxn, Kxt, linkPair, testForceIndex, maxConstraintIndexToExtract);
-            } else {
-                extractRelAccelsFromLinkPairCase2(Kxn, Kxt, linkPair, 0, 1, testForceIndex, maxConstraintIndexToExtract);
-            }
-        } else {
-            if(bodyData1.isTestForceBeingApplied){
-                extractRelAccelsFromLinkPairCase2(Kxn, Kxt, linkPair, 1, 0, testForceIndex, maxConstraintIndexToExtract);
-            } else {
-                extractRelAccelsFromLinkPairCase3(Kxn, Kxt, linkPair, testForceIndex, maxConstraintIndexToExtract);
+void BCCFSImpl::setAccelCalcSkipInformation()
+{
+    // clear skip check numbers
+    for(size_t i=0; i < bodiesData.size(); ++i){
+        BodyData& bodyData = bodiesData[i];
+        if(bodyData.hasConstrainedLinks){
+            LinkDataArray& linksData = bodyData.linksData;
+            for(size_t j=0; j < linksData.size(); ++j){
+                linksData[j].numberToCheckAccelCalcSkip = numeric_limits<int>::max();
             }
         }
     }
-}
 
+    // add the number of contact points to skip check numbers of the links from a contact target to the root
+    int numLinkPairs = constrainedLinkPairs.size();
+    for(int i=0; i < numLinkPairs; ++i){
+        LinkPair* linkPair = constrainedLinkPairs[i];
+/*BC*/  if(linkPair->isPenaltyBased)continue;
+        int constraintIndex = linkPair->constraintPoints.front().globalIndex;
+        for(int j=0; j < 2; ++j){
+            LinkDataArray& linksData = linkPair->bodyData[j]->linksData;
+            int linkIndex = linkPair->link[j]->index();
+            while(linkIndex >= 0){
+                LinkData& linkData = linksData[linkIndex];
+                if(linkData.numberToCheckAccelCalcSkip < constraintIndex){
+                    break;
+                }
+                linkData.numberToCheckAccelCalcSkip = constraintIndex;
+                linkIndex = linkData.parentIndex;
+            }
+        }
+    }
+}
 
-void BCCFSImpl::extractRelAccelsFromLinkPairCase1
-(Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt,
- LinkPair& linkPair, int testForceIndex, int maxConstraintIndexToExtract)
-{
-/*BC*/  if(linkPair.isPenaltyBased) return;
-    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
-
-    for(size_t i=0; i < constraintPoints.size(); ++i){
 
-        ConstraintPoint& constraint = constraintPoints[i];
-        int constraintIndex = constraint.globalIndex;
+void BCCFSImpl::setDefaultAccelerationVector()
+{
+    const bool isParallel = isParallelAssemblyMode && (threadPool.numThreads() > 1);
 
-        if(ASSUME_SYMMETRIC_MATRIX && constraintIndex > maxConstraintIndexToExtract){
-            break;
+    // calculate accelerations with no constraint force
+    if(isParallel){
+        // the ABM passes of the bodies do not share any data
+        for(size_t i=0; i < bodiesData.size(); ++i){
+            if(bodiesData[i].forwardDynamicsCBM){
+                calcDefaultAccelsOfBody(i, false);
+            }
         }
+        threadPool.run(bodiesData.size(), boost::bind(&BCCFSImpl::calcDefaultAccelsOfBody, this, _1, true));
+    } else {
+        for(size_t i=0; i < bodiesData.size(); ++i){
+            calcDefaultAccelsOfBody(i, false);
+        }
+    }
 
-        DyLink* link0 = linkPair.link[0];
-        DyLink* link1 = linkPair.link[1];
-        LinkData* linkData0 = linkPair.linkData[0];
-        LinkData* linkData1 = linkPair.linkData[1];
-
-        //! \todo Can the follwoing equations be simplified ?
-        Vector3 dv0 =
-            linkData0->dvo - constraint.point.cross(linkData0->dw) +
-            link0->w().cross(link0->vo() + link0->w().cross(constraint.point));
+    // extract accelerations
+    if(isParallel){
+        threadPool.run(constrainedLinkPairs.size(), boost::bind(&BCCFSImpl::setDefaultAccelsOfLinkPair, this, _1));
+    } else {
+        for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+            setDefaultAccelsOfLinkPair(i);
+        }
+    }
+}
 
-        Vector3 dv1 =
-            linkData1->dvo - constraint.point.cross(linkData1->dw) +
-            link1->w().cross(link1->vo() + link1->w().cross(constraint.point));
 
-        Vector3 relAccel = dv1 - dv0;
+void BCCFSImpl::calcDefaultAccelsOfBody(int bodyIndex, bool skipCBM)
+{
+    BodyData& bodyData = bodiesData[bodyIndex];
+    if(bodyData.hasConstrainedLinks && ! bodyData.isStatic){
 
-        Kxn(constraintIndex, testForceIndex) = constraint.normalTowardInside[1].dot(relAccel) - an0(constraintIndex);
+        if(bodyData.forwardDynamicsCBM){
+            if(skipCBM){
+                return;
+            }
+            bodyData.forwardDynamicsCBM->sumExternalForces();
+            bodyData.forwardDynamicsCBM->solveUnknownAccels();
+            calcAccelsMM(bodyData, numeric_limits<int>::max());
 
-        for(int j=0; j < constraint.numFrictionVectors; ++j){
-            const int index = constraint.globalFrictionIndex + j;
-            Kxt(index, testForceIndex) = constraint.frictionVector[j][1].dot(relAccel) - at0(index);
+        } else {
+            initABMForceElementsWithNoExtForce(bodyData);
+            factorizeRootInertia(bodyData);
+            calcAccelsABM(bodyData, numeric_limits<int>::max());
         }
     }
 }
 
 
-void BCCFSImpl::extractRelAccelsFromLinkPairCase2
-(Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt,
- LinkPair& linkPair, int iTestForce, int iDefault, int testForceIndex, int maxConstraintIndexToExtract)
+void BCCFSImpl::setDefaultAccelsOfLinkPair(int linkPairIndex)
 {
-/*BC*/   if(linkPair.isPenaltyBased) return;
+    LinkPair& linkPair = *constrainedLinkPairs[linkPairIndex];
+/*BC*/  if(linkPair.isPenaltyBased) return;
     ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int n = constraintPoints.size();
+    if(n == 0){
+        return;
+    }
+    const int begin = constraintPoints.front().index;
+    Eigen::Map<Eigen::Matrix3Xd> points = ContactPointStore::columns(contactPoints.points, begin, n);
 
-    for(size_t i=0; i < constraintPoints.size(); ++i){
-
-        ConstraintPoint& constraint = constraintPoints[i];
-        int constraintIndex = constraint.globalIndex;
-
-        if(ASSUME_SYMMETRIC_MATRIX && constraintIndex > maxConstraintIndexToExtract){
-            break;
+    // dvo - p x dw + w x (vo + w x p) of all the points at once
+    for(int k=0; k < 2; ++k){
+        Eigen::Map<Eigen::Matrix3Xd> defaultAccels = ContactPointStore::columns(contactPoints.defaultAccels[k], begin, n);
+        if(linkPair.bodyData[k]->isStatic){
+            defaultAccels.setZero();
+        } else {
+            DyLink* link = linkPair.link[k];
+            LinkData* linkData = linkPair.linkData[k];
+            const Vector3 w = link->w();
+            defaultAccels = points.colwise().cross(w).colwise().cross(w) - points.colwise().cross(linkData->dw);
+            defaultAccels.colwise() += linkData->dvo + w.cross(link->vo());
         }
+    }
 
-        DyLink* link = linkPair.link[iTestForce];
-        LinkData* linkData = linkPair.linkData[iTestForce];
+    for(int j=0; j < n; ++j){
+        const ConstraintPoint& constraint = constraintPoints[j];
 
-        Vector3 dv(linkData->dvo - constraint.point.cross(linkData->dw) + link->w().cross(link->vo() + link->w().cross(constraint.point)));
+        Vector3 relDefaultAccel(contactPoints.defaultAccel(constraint, 1) - contactPoints.defaultAccel(constraint, 0));
+        an0[constraint.globalIndex] = contactPoints.normalTowardInside(constraint, 1).dot(relDefaultAccel);
 
-        if(CFS_DEBUG_VERBOSE_2){
-            os << "dv " << constraintIndex << " = " << dv << "\n";
+        for(int k=0; k < constraint.numFrictionVectors; ++k){
+            at0[constraint.globalFrictionIndex + k] = contactPoints.frictionVector(constraint, k, 1).dot(relDefaultAccel);
         }
 
-        Vector3 relAccel = constraint.defaultAccel[iDefault] - dv;
+        if(constraint.numMomentVectors > 0){
+            for(int k=0; k < 2; ++k){
+                contactPoints.defaultAngularAccel(constraint, k) =
+                    linkPair.bodyData[k]->isStatic ? Vector3(Vector3::Zero()) : linkPair.linkData[k]->dw;
+            }
+            const Vector3 relDefaultAngularAccel(
+                contactPoints.defaultAngularAccel(constraint, 1) - contactPoints.defaultAngularAccel(constraint, 0));
+            const int top = constraint.globalFrictionIndex + constraint.numFrictionVectors;
+            for(int k=0; k < constraint.numMomentVectors; ++k){
+                at0[top + k] = contactPoints.momentVector(constraint, k, 1).dot(relDefaultAngularAccel);
+            }
+        }
+    }
+}
 
-        Kxn(constraintIndex, testForceIndex) = constraint.normalTowardInside[iDefault].dot(relAccel) - an0(constraintIndex);
 
-        for(int j=0; j < constraint.numFrictionVectors; ++j){
-            const int index = constraint.globalFrictionIndex + j;
-            Kxt(index, testForceIndex) = constraint.frictionVector[j][iDefault].dot(relAccel) - at0(index);
+void BCCFSImpl::setAccelerationMatrix()
+{
+    if(!isJacobianAssemblyMode || isJacobianAssemblyUnsafe){
+        setAccelerationMatrixByTestForces();
+        if(isSymmetricMatrixActive && SYMMETRIC_MATRIX_CHECK_INTERVAL > 0 &&
+           (numSymmetricMatrixChecks == 0 || stepCount % SYMMETRIC_MATRIX_CHECK_INTERVAL == 0)){
+            checkSymmetricMatrix();
         }
+        return;
+    }
+
+    setAccelerationMatrixByJacobians();
 
+    if(JACOBIAN_ASSEMBLY_CHECK_INTERVAL > 0 &&
+       (numJacobianAssemblyChecks == 0 || stepCount % JACOBIAN_ASSEMBLY_CHECK_INTERVAL == 0)){
+        checkJacobianAssembly();
     }
 }
 
 
-void BCCFSImpl::extractRelAccelsFromLinkPairCase3
-(Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, LinkPair& linkPair, int testForceIndex, int maxConstraintIndexToExtract)
+/**
+   Mlcp of the Jacobian assembly is compared with the assembly by the test forces, which is
+   kept for the step. When they do not agree, the test forces are used for the rest of the
+   simulation.
+*/
+void BCCFSImpl::checkJacobianAssembly()
 {
-/*BC*/  if(linkPair.isPenaltyBased) return;
-    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
-
-    for(size_t i=0; i < constraintPoints.size(); ++i){
-
-        ConstraintPoint& constraint = constraintPoints[i];
-        int constraintIndex = constraint.globalIndex;
+    const int size = globalNumConstraintVectors + globalNumFrictionVectors;
 
-        if(ASSUME_SYMMETRIC_MATRIX && constraintIndex > maxConstraintIndexToExtract){
-            break;
-        }
+    MatrixX M;
+    if(isSparseMatrixActive){
+        sparseMlcp.copyTo(M);
+    } else {
+        M = Mlcp.topLeftCorner(size, size);
+    }
+    setAccelerationMatrixByTestForces();
+    MatrixX M2;
+    if(isSparseMatrixActive){
+        sparseMlcp.copyTo(M2);
+    } else {
+        M2 = Mlcp.topLeftCorner(size, size);
+    }
 
-        Kxn(constraintIndex, testForceIndex) = 0.0;
+    const double maxError = (M.topLeftCorner(size, size) - M2.topLeftCorner(size, size)).cwiseAbs().maxCoeff();
+    const double maxElement = M2.topLeftCorner(size, size).cwiseAbs().maxCoeff();
+    ++numJacobianAssemblyChecks;
+    if(maxElement > 0.0){
+        maxJacobianAssemblyError = std::max(maxJacobianAssemblyError, maxError / maxElement);
+    }
 
-        for(int j=0; j < constraint.numFrictionVectors; ++j){
-            Kxt(constraint.globalFrictionIndex + j, testForceIndex) = 0.0;
+    if(maxError > JACOBIAN_ASSEMBLY_CHECK_TOLERANCE * maxElement){
+        if(CFS_DEBUG){
+            os << "The Jacobian assembly is disabled: error = " << maxError << ", max element = " << maxElement << std::endl;
         }
+        isJacobianAssemblyUnsafe = true;
     }
 }
 
 
-void BCCFSImpl::copySymmetricElementsOfAccelerationMatrix
-(Eigen::Block<MatrixX>& Knn, Eigen::Block<MatrixX>& Ktn, Eigen::Block<MatrixX>& Knt, Eigen::Block<MatrixX>& Ktt)
+/**
+   The sampled columns of symmetricMlcp are compared with the full assembly, which gives
+   Mlcp of the step. When they do not agree, Mlcp is used for the rest of the simulation.
+*/
+void BCCFSImpl::checkSymmetricMatrix()
 {
-    for(size_t linkPairIndex=0; linkPairIndex < constrainedLinkPairs.size(); ++linkPairIndex){
-/*BC*/    if(constrainedLinkPairs[linkPairIndex]->isPenaltyBased ) continue;
-        ConstraintPointArray& constraintPoints = constrainedLinkPairs[linkPairIndex]->constraintPoints;
+    const int size = globalNumConstraintVectors + globalNumFrictionVectors;
 
-        for(size_t localConstraintIndex = 0; localConstraintIndex < constraintPoints.size(); ++localConstraintIndex){
+    isSymmetricMatrixActive = false;
+    Mlcp.resize(size, size);
+    setAccelerationMatrixByTestForces();
+
+    const int numColumns = std::min(SYMMETRIC_MATRIX_CHECK_NUM_COLUMNS, size);
+    double maxError = 0.0;
+    double maxElement = 0.0;
+    for(int i=0; i < numColumns; ++i){
+        // the sampled columns are shifted in each check
+        const int col = (i * size / numColumns + numSymmetricMatrixChecks) % size;
+        for(int row=0; row < size; ++row){
+            const double v = symmetricMlcp.coeff(row, col);
+            maxError = std::max(maxError, std::max(fabs(v - Mlcp(row, col)), fabs(v - Mlcp(col, row))));
+            maxElement = std::max(maxElement, fabs(Mlcp(row, col)));
+        }
+    }
+    ++numSymmetricMatrixChecks;
+    if(maxElement > 0.0){
+        maxSymmetricMatrixError = std::max(maxSymmetricMatrixError, maxError / maxElement);
+    }
 
-            ConstraintPoint& constraint = constraintPoints[localConstraintIndex];
+    if(maxError > SYMMETRIC_MATRIX_CHECK_TOLERANCE * maxElement){
+        if(CFS_DEBUG){
+            os << "The symmetric matrix mode is disabled: error = " << maxError << ", max element = " << maxElement << std::endl;
+        }
+        isSymmetricMatrixUnsafe = true;
+        // Mlcp keeps the elements because its size is not changed
+        initMatrices();
+    } else {
+        Mlcp.resize(0, 0);
+        isSymmetricMatrixActive = true;
+    }
+}
 
-            int constraintIndex = constraint.globalIndex;
-            int nextConstraintIndex = constraintIndex + 1;
-            for(int i = nextConstraintIndex; i < globalNumConstraintVectors; ++i){
-                Knn(i, constraintIndex) = Knn(constraintIndex, i);
-            }
-            int frictionTopOfNextConstraint = constraint.globalFrictionIndex + constraint.numFrictionVectors;
-            for(int i = frictionTopOfNextConstraint; i < globalNumFrictionVectors; ++i){
-                Knt(i, constraintIndex) = Ktn(constraintIndex, i);
-            }
 
-            for(int localFrictionIndex=0; localFrictionIndex < constraint.numFrictionVectors; ++localFrictionIndex){
+void BCCFSImpl::setAccelerationMatrixByTestForces()
+{
+    const int n = globalNumConstraintVectors;
+    const int m = globalNumFrictionVectors;
 
-                int frictionIndex = constraint.globalFrictionIndex + localFrictionIndex;
+    // areCBMTestForcesBatched has been set by solve() for the step
+    // the elements of the link pairs which do not share a body with the test force
+    if(isSymmetricMatrixActive){
+        symmetricMlcp.setZero();
+    } else if(!isSparseMatrixActive){
+        Mlcp.topLeftCorner(n + m, n + m).setZero();
+    }
 
-                for(int i = nextConstraintIndex; i < globalNumConstraintVectors; ++i){
-                    Ktn(i, frictionIndex) = Knt(frictionIndex, i);
-                }
-                for(int i = frictionTopOfNextConstraint; i < globalNumFrictionVectors; ++i){
-                    Ktt(i, frictionIndex) = Ktt(frictionIndex, i);
+    if(isParallelAssemblyAvailable()){
+        const int numWorkers = threadPool.numThreads();
+        assemblyScratchBodiesData.resize(numWorkers);
+        for(int i=0; i < numWorkers; ++i){
+            copyAssemblyScratch(assemblyScratchBodiesData[i]);
+        }
+        threadPool.run(constrainedLinkPairs.size(),
+                       boost::bind(&BCCFSImpl::setAccelerationMatrixColumnsByWorker, this, _1, _2));
+        ++numParallelAssemblies;
+        for(int i=0; i < numWorkers; ++i){
+            const std::vector<BodyData>& scratch = assemblyScratchBodiesData[i];
+            for(size_t j=0; j < bodiesData.size(); ++j){
+                if(bodiesData[j].hasConstrainedLinks && !bodiesData[j].isStatic){
+                    bodiesData[j].numRootInertiaSolves += scratch[j].numRootInertiaSolves;
                 }
             }
         }
+    } else {
+        for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+            LinkPair& linkPair = *constrainedLinkPairs[i];
+/*BC*/      if(linkPair.isPenaltyBased) continue;/***/
+            setAccelerationMatrixColumns(linkPair, bodiesData);
+        }
+    }
+
+    if(areCBMTestForcesBatched){
+        for(size_t i=0; i < bodiesData.size(); ++i){
+            const BodyData& bodyData = bodiesData[i];
+            if(bodyData.hasConstrainedLinks && !bodyData.isStatic && bodyData.forwardDynamicsCBM){
+                addBodyAccelerationMatrix(i);
+            }
+        }
     }
 }
 
 
-void BCCFSImpl::clearSingularPointConstraintsOfClosedLoopConnections()
+/**
+   Factorizes the root inertias of the ForwardDynamicsCBM bodies, whose other joints
+   are in the high-gain mode, so that all the test forces of such a body are solved
+   at once by addBodyAccelerationMatrix.
+*/
+bool BCCFSImpl::factorizeInertiasOfCBMBodies()
 {
-    for(int i = 0; i < Mlcp.rows(); ++i){
-        if(Mlcp(i, i) < 1.0e-4){
-            for(int j=0; j < Mlcp.rows(); ++j){
-                Mlcp(j, i) = 0.0;
+    for(size_t i=0; i < bodiesData.size(); ++i){
+        BodyData& bodyData = bodiesData[i];
+        if(bodyData.hasConstrainedLinks && !bodyData.isStatic && bodyData.forwardDynamicsCBM){
+            if(!calcJointSpaceInertia(bodyData)){
+                return false;
             }
-            Mlcp(i, i) = numeric_limits<double>::max();
         }
     }
+    return true;
 }
 
 
-void BCCFSImpl::setConstantVectorAndMuBlock()
+/**
+   Sets the columns of the test forces of the constraint points of the link pair.
+   The scratch data of the ABM calculation, which are LinkData::dvo, dw and uu and
+   BodyData::dpf, dptau and isTestForceBeingApplied, are given by bodies. They are
+   restored to the state after setDefaultAccelerationVector for each column, so the
+   columns do not depend on the order or the thread in which they are calculated.
+*/
+void BCCFSImpl::setAccelerationMatrixColumns(LinkPair& linkPair, std::vector<BodyData>& bodies)
 {
-    double dtinv = 1.0 / world.timeStep();
-    const int block2 = globalNumConstraintVectors;
-    const int block3 = globalNumConstraintVectors + globalNumFrictionVectors;
-
-    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
-
-        LinkPair& linkPair = *constrainedLinkPairs[i];
-/*BC*/   if(linkPair.isPenaltyBased) continue;/***/
-        int numConstraintsInPair = linkPair.constraintPoints.size();
-
-        for(int j=0; j < numConstraintsInPair; ++j){
-            ConstraintPoint& constraint = linkPair.constraintPoints[j];
-            int globalIndex = constraint.globalIndex;
+    const int n = globalNumConstraintVectors;
+    int numConstraintsInPair = linkPair.constraintPoints.size();
 
-            // set constant vector of LCP
+    for(int j=0; j < numConstraintsInPair; ++j){
 
-            // constraints for normal acceleration
+        ConstraintPoint& constraint = linkPair.constraintPoints[j];
+        int constraintIndex = constraint.globalIndex;
 
-            if(linkPair.isNonContactConstraint){
-                // connection constraint
+        if(USE_BATCHED_ABM_TEST_FORCES && isBatchedTestForceAvailable(linkPair, constraint, bodies)){
+            setAccelerationMatrixColumnsByBatch(linkPair, constraint, bodies);
+            if(constraint.numMomentVectors > 0){
+                setAccelerationMatrixColumnsOfMoments(linkPair, constraint, bodies);
+            }
+            continue;
+        }
 
-                const double& error = constraint.depth;
-                double v;
-                if(error >= 0){
-                    v = 0.1 * (-1.0 + exp(-error * 20.0));
+        // apply test normal force
+        for(int k=0; k < 2; ++k){
+            BodyData& bodyData = bodyDataOf(linkPair, k, bodies);
+            if(isTestForceTarget(bodyData)){
+
+                bodyData.isTestForceBeingApplied = true;
+                const Vector3& f = contactPoints.normalTowardInside(constraint, k);
+
+                if(bodyData.forwardDynamicsCBM){
+                    //! \todo This code does not work correctly when the links are in the same body. Fix it.
+                    Vector3 arm = contactPoints.point(constraint) - bodyData.body->rootLink()->p();
+                    Vector3 tau = arm.cross(f);
+                    Vector3 tauext = contactPoints.point(constraint).cross(f);
+                    bodyData.forwardDynamicsCBM->solveUnknownAccels(linkPair.link[k], f, tauext, f, tau);
+                    calcAccelsMM(bodyData, constraintIndex);
                 } else {
-                    v = 0.1 * ( 1.0 - exp( error * 20.0));
+                    Vector3 tau = contactPoints.point(constraint).cross(f);
+                    calcABMForceElementsWithTestForce(bodyData, linkPair.link[k], f, tau);
+                    if(!linkPair.isSameBodyPair || (k > 0)){
+                        calcAccelsABM(bodyData, constraintIndex);
+                    }
                 }
-					
-                b(globalIndex) = an0(globalIndex) + (constraint.normalProjectionOfRelVelocityOn0 + v) * dtinv;
+            }
+        }
+        extractRelAccelsOfConstraintPoints(linkPair, constraintIndex, constraintIndex, bodies);
 
-            } else {
-                // contact constraint
-                if(ENABLE_CONTACT_DEPTH_CORRECTION){
-                    double velOffset;
-                    const double depth = constraint.depth - contactCorrectionDepth;
-                    if(depth <= 0.0){
-                        velOffset = contactCorrectionVelocityRatio * depth;
+        // apply test friction force
+        for(int l=0; l < constraint.numFrictionVectors; ++l){
+            for(int k=0; k < 2; ++k){
+                BodyData& bodyData = bodyDataOf(linkPair, k, bodies);
+                if(isTestForceTarget(bodyData)){
+                    const Vector3& f = contactPoints.frictionVector(constraint, l, k);
+
+                    if(bodyData.forwardDynamicsCBM){
+                        //! \todo This code does not work correctly when the links are in the same body. Fix it.
+                        Vector3 arm = contactPoints.point(constraint) - bodyData.body->rootLink()->p();
+                        Vector3 tau = arm.cross(f);
+                        Vector3 tauext = contactPoints.point(constraint).cross(f);
+                        bodyData.forwardDynamicsCBM->solveUnknownAccels(linkPair.link[k], f, tauext, f, tau);
+                        calcAccelsMM(bodyData, constraintIndex);
                     } else {
-                        velOffset = contactCorrectionVelocityRatio * (-1.0 / (depth + 1.0) + 1.0);
+                        Vector3 tau = contactPoints.point(constraint).cross(f);
+                        calcABMForceElementsWithTestForce(bodyData, linkPair.link[k], f, tau);
+                        if(!linkPair.isSameBodyPair || (k > 0)){
+                            calcAccelsABM(bodyData, constraintIndex);
+                        }
                     }
-                    b(globalIndex) = an0(globalIndex) + (constraint.normalProjectionOfRelVelocityOn0 - velOffset) * dtinv;
-                } else {
-                    b(globalIndex) = an0(globalIndex) + constraint.normalProjectionOfRelVelocityOn0 * dtinv;
                 }
+            }
+            extractRelAccelsOfConstraintPoints(linkPair, n + constraint.globalFrictionIndex + l, constraintIndex, bodies);
+        }
 
-                contactIndexToMu[globalIndex] = constraint.mu;
+        if(constraint.numMomentVectors > 0){
+            setAccelerationMatrixColumnsOfMoments(linkPair, constraint, bodies);
+        }
 
-                int globalFrictionIndex = constraint.globalFrictionIndex;
-                for(int k=0; k < constraint.numFrictionVectors; ++k){
+        for(int k=0; k < 2; ++k){
+            BodyData& bodyData = bodyDataOf(linkPair, k, bodies);
+            if(isTestForceTarget(bodyData)){
+                bodyData.isTestForceBeingApplied = false;
+            }
+        }
+    }
+}
 
-                    // constraints for tangent acceleration
-                    double tangentProjectionOfRelVelocity = constraint.frictionVector[k][1].dot(constraint.relVelocityOn0);
 
-                    b(block2 + globalFrictionIndex) = at0(globalFrictionIndex);
-                    if( !IGNORE_CURRENT_VELOCITY_IN_STATIC_FRICTION || constraint.numFrictionVectors == 1){
-                        b(block2 + globalFrictionIndex) += tangentProjectionOfRelVelocity * dtinv;
-                    }
+/**
+   The test forces of the moment rows of a contact patch are the pure torques momentVector[i][k].
+*/
+void BCCFSImpl::setAccelerationMatrixColumnsOfMoments(LinkPair& linkPair, ConstraintPoint& constraint, std::vector<BodyData>& bodies)
+{
+    const int top = globalNumConstraintVectors + constraint.globalFrictionIndex + constraint.numFrictionVectors;
+    const int constraintIndex = constraint.globalIndex;
+    const Vector3 f = Vector3::Zero();
 
-                    if(usePivotingLCP){
-                        // set mu (coefficients of friction)
-                        Mlcp(block3 + globalFrictionIndex, globalIndex) = constraint.mu;
-                    } else {
-                        // for iterative solver
-                        frictionIndexToContactIndex[globalFrictionIndex] = globalIndex;
-                    }
+    for(int i=0; i < constraint.numMomentVectors; ++i){
+        for(int k=0; k < 2; ++k){
+            BodyData& bodyData = bodyDataOf(linkPair, k, bodies);
+            if(isTestForceTarget(bodyData)){
 
-                    ++globalFrictionIndex;
+                bodyData.isTestForceBeingApplied = true;
+                const Vector3 tau = contactPoints.momentVector(constraint, i, k);
+
+                if(bodyData.forwardDynamicsCBM){
+                    bodyData.forwardDynamicsCBM->solveUnknownAccels(linkPair.link[k], f, tau, f, tau);
+                    calcAccelsMM(bodyData, constraintIndex);
+                } else {
+                    calcABMForceElementsWithTestForce(bodyData, linkPair.link[k], f, tau);
+                    if(!linkPair.isSameBodyPair || (k > 0)){
+                        calcAccelsABM(bodyData, constraintIndex);
+                    }
                 }
             }
         }
+        extractRelAccelsOfConstraintPoints(linkPair, top + i, constraintIndex, bodies);
+    }
+
+    for(int k=0; k < 2; ++k){
+        BodyData& bodyData = bodyDataOf(linkPair, k, bodies);
+        if(isTestForceTarget(bodyData)){
+            bodyData.isTestForceBeingApplied = false;
+        }
     }
 }
 
 
-void BCCFSImpl::addConstraintForceToLinks()
+void BCCFSImpl::setAccelerationMatrixColumnsByWorker(int linkPairIndex, int worker)
 {
-    int n = constrainedLinkPairs.size();
-    for(int i=0; i < n; ++i){
-        LinkPair* linkPair = constrainedLinkPairs[i];
-/*BC*/    if(linkPair->isPenaltyBased) continue;
-        for(int j=0; j < 2; ++j){
-            // if(!linkPair->link[j]->isRoot() || linkPair->link[j]->jointType != Link::FIXED_JOINT){
-            addConstraintForceToLink(linkPair, j);
-            // }
+    LinkPair& linkPair = *constrainedLinkPairs[linkPairIndex];
+/*BC*/  if(linkPair.isPenaltyBased) return;
+    setAccelerationMatrixColumns(linkPair, assemblyScratchBodiesData[worker]);
+}
+
+
+bool BCCFSImpl::isBatchedTestForceAvailable(LinkPair& linkPair, const ConstraintPoint& constraint, std::vector<BodyData>& bodies)
+{
+    if(constraint.numFrictionVectors + 1 != ABM_BATCH_SIZE){
+        return false;
+    }
+    for(int k=0; k < 2; ++k){
+        BodyData& bodyData = bodyDataOf(linkPair, k, bodies);
+        if(!bodyData.isStatic && bodyData.forwardDynamicsCBM && !areCBMTestForcesBatched){
+            return false;
         }
     }
+    return true;
 }
 
 
-void BCCFSImpl::addConstraintForceToLink(LinkPair* linkPair, int ipair)
+/**
+   Same as the test forces of a constraint point in setAccelerationMatrixColumns, but the
+   normal and friction test forces are propagated through the bodies as one batch, and
+   the accelerations of each column are extracted from the batch.
+*/
+void BCCFSImpl::setAccelerationMatrixColumnsByBatch(LinkPair& linkPair, ConstraintPoint& constraint, std::vector<BodyData>& bodies)
 {
-/*BC*/   if(linkPair->isPenaltyBased) return;
-    Vector3 f_total   = Vector3::Zero();
-    Vector3 tau_total = Vector3::Zero();
+    const int n = globalNumConstraintVectors;
+    const int constraintIndex = constraint.globalIndex;
 
-    ConstraintPointArray& constraintPoints = linkPair->constraintPoints;
-    int numConstraintPoints = constraintPoints.size();
-    DyLink* link = linkPair->link[ipair];
+    for(int k=0; k < 2; ++k){
+        BodyData& bodyData = bodyDataOf(linkPair, k, bodies);
+        if(isTestForceTarget(bodyData)){
 
-    for(int i=0; i < numConstraintPoints; ++i){
+            bodyData.isTestForceBeingApplied = true;
 
-        ConstraintPoint& constraint = constraintPoints[i];
-        int globalIndex = constraint.globalIndex;
-
-        Vector3 f = solution(globalIndex) * constraint.normalTowardInside[ipair];
-
-        for(int j=0; j < constraint.numFrictionVectors; ++j){
-            f += solution(globalNumConstraintVectors + constraint.globalFrictionIndex + j) * constraint.frictionVector[j][ipair];
+            Vector3Batch f;
+            Vector3Batch tau;
+            f.col(0) = contactPoints.normalTowardInside(constraint, k);
+            for(int l=1; l < ABM_BATCH_SIZE; ++l){
+                f.col(l) = contactPoints.frictionVector(constraint, l - 1, k);
+            }
+            for(int l=0; l < ABM_BATCH_SIZE; ++l){
+                tau.col(l) = contactPoints.point(constraint).cross(f.col(l));
+            }
+            calcABMForceElementsWithTestForceBatch(bodyData, linkPair.link[k], f, tau);
+            if(!linkPair.isSameBodyPair || (k > 0)){
+                calcAccelsABMBatch(bodyData, constraintIndex);
+            }
         }
+    }
 
-        f_total   += f;
-        tau_total += constraint.point.cross(f);
-
-        if(isConstraintForceOutputMode){
-            link->constraintForces().push_back(DyLink::ConstraintForce(constraint.point, f));
+    for(int l=0; l < ABM_BATCH_SIZE; ++l){
+        for(int k=0; k < 2; ++k){
+            BodyData& bodyData = bodyDataOf(linkPair, k, bodies);
+            if(isTestForceTarget(bodyData)){
+                setAccelsOfBatchColumn(bodyData, l, constraintIndex);
+            }
         }
+        const int testForceColumn = (l == 0) ? constraintIndex : (n + constraint.globalFrictionIndex + l - 1);
+        extractRelAccelsOfConstraintPoints(linkPair, testForceColumn, constraintIndex, bodies);
     }
-    
-    link->f_ext()   += f_total;
-    link->tau_ext() += tau_total;
 
-
-    if(CFS_DEBUG){
-        os << "Constraint force to " << link->name() << ": f = " << f_total << ", tau = " << tau_total << std::endl;
+    for(int k=0; k < 2; ++k){
+        BodyData& bodyData = bodyDataOf(linkPair, k, bodies);
+        if(isTestForceTarget(bodyData)){
+            bodyData.isTestForceBeingApplied = false;
+        }
     }
 }
 
 
-
-void BCCFSImpl::solveMCPByProjectedGaussSeidel(const MatrixX& M, const VectorX& b, VectorX& x)
+bool BCCFSImpl::isParallelAssemblyAvailable() const
 {
-    static const int loopBlockSize = DEFAULT_NUM_GAUSS_SEIDEL_ITERATION_BLOCK;
-
-    if(numGaussSeidelInitialIteration > 0){
-        solveMCPByProjectedGaussSeidelInitial(M, b, x, numGaussSeidelInitialIteration);
+    if(!isParallelAssemblyMode || threadPool.numThreads() <= 1){
+        return false;
     }
-
-    int numBlockLoops = maxNumGaussSeidelIteration / loopBlockSize;
-    if(numBlockLoops==0){
-        numBlockLoops = 1;
+    // ForwardDynamicsCBM keeps the test force in itself and the links
+    for(size_t i=0; i < bodiesData.size(); ++i){
+        const BodyData& bodyData = bodiesData[i];
+        if(bodyData.hasConstrainedLinks && !bodyData.isStatic && bodyData.forwardDynamicsCBM && !areCBMTestForcesBatched){
+            return false;
+        }
     }
+    return true;
+}
 
-    if(CFS_MCP_DEBUG){
-        os << "Iteration ";
+
+/**
+   The buffers of a worker are kept over the steps, and only the elements which the test
+   forces read or update are copied: the accelerations, the ABM elements of the step and
+   the skip numbers of the links. The batch elements are cleared as the serial path does
+   at the start of the step, and the factorization of the root inertia is shared because
+   it is only read.
+*/
+void BCCFSImpl::copyAssemblyScratch(std::vector<BodyData>& bodies)
+{
+    bodies.resize(bodiesData.size());
+    for(size_t i=0; i < bodiesData.size(); ++i){
+        const BodyData& bodyData = bodiesData[i];
+        BodyData& scratch = bodies[i];
+        scratch.isStatic = bodyData.isStatic;
+        scratch.isTestForceBeingApplied = false;
+        if(bodyData.hasConstrainedLinks && !bodyData.isStatic){
+            scratch.body = bodyData.body;
+            scratch.forwardDynamicsCBM = bodyData.forwardDynamicsCBM;
+            const LinkDataArray& linksData = bodyData.linksData;
+            const int n = linksData.size();
+            scratch.linksData.resize(n);
+            for(int j=0; j < n; ++j){
+                const LinkData& data = linksData[j];
+                LinkData& scratchData = scratch.linksData[j];
+                scratchData.link = data.link;
+                scratchData.parentIndex = data.parentIndex;
+                scratchData.numberToCheckAccelCalcSkip = data.numberToCheckAccelCalcSkip;
+                scratchData.dvo = data.dvo;
+                scratchData.dw = data.dw;
+                scratchData.uu = data.uu;
+                scratchData.uu0 = data.uu0;
+                scratchData.pf0 = data.pf0;
+                scratchData.ptau0 = data.ptau0;
+                scratchData.duuBatch.setZero();
+            }
+            scratch.dpf = bodyData.dpf;
+            scratch.dptau = bodyData.dptau;
+            scratch.dpfBatch.setZero();
+            scratch.dptauBatch.setZero();
+            scratch.rootInertia = bodyData.rootInertia;
+            scratch.numRootInertiaSolves = 0;
+        }
     }
+}
 
-    double error = 0.0;
-    VectorXd x0;
-    int i = 0;
-    while(i < numBlockLoops){
-        i++;
 
-        for(int j=0; j < loopBlockSize - 1; ++j){
-            solveMCPByProjectedGaussSeidelMainStep(M, b, x);
-        }
+void BCCFSImpl::initJointSpaceInertia(BodyData& bodyData)
+{
+    LinkDataArray& linksData = bodyData.linksData;
+    const int n = linksData.size();
+    std::vector<int> parents;
 
-        x0 = x;
-        solveMCPByProjectedGaussSeidelMainStep(M, b, x);
+    bodyData.linkToDof.assign(n, -1);
+    bodyData.numRootDofs = 0;
 
-        if(true){
-            double n = x.norm();
-            if(n > THRESH_TO_SWITCH_REL_ERROR){
-                error = (x - x0).norm() / x.norm();
-            } else {
-                error = (x - x0).norm();
-            }
-        } else {
-            error = 0.0;
-            for(int j=0; j < x.size(); ++j){
-                double d = fabs(x(j) - x0(j));
-                if(d > THRESH_TO_SWITCH_REL_ERROR){
-                    d /= x(j);
-                }
-                if(d > error){
-                    error = d;
-                }
+    if(!bodyData.isStatic){
+        if(linksData[0].link->isFreeJoint()){
+            bodyData.numRootDofs = 6;
+            for(int i=0; i < 6; ++i){
+                parents.push_back(i - 1);
             }
         }
-
-        if(error < gaussSeidelErrorCriterion){
-            if(CFS_MCP_DEBUG_SHOW_ITERATION_STOP){
-                os << "stopped at " << (i * loopBlockSize) << ", error = " << error << endl;
+        if(!bodyData.forwardDynamicsCBM){
+            for(int i=1; i < n; ++i){
+                if(!linksData[i].link->isFixedJoint()){
+                    int parentDof = -1;
+                    for(int j = linksData[i].parentIndex; j >= 0; j = linksData[j].parentIndex){
+                        if(j == 0){
+                            parentDof = bodyData.numRootDofs - 1;
+                            break;
+                        } else if(bodyData.linkToDof[j] >= 0){
+                            parentDof = bodyData.linkToDof[j];
+                            break;
+                        }
+                    }
+                    bodyData.linkToDof[i] = parents.size();
+                    parents.push_back(parentDof);
+                }
             }
-            break;
         }
     }
 
-    if(CFS_MCP_DEBUG){
+    bodyData.jointSpaceInertia.setParents(parents);
+}
 
-        if(i == numBlockLoops){
-            os << "not stopped" << ", error = " << error << endl;
+
+/**
+   The axis of a DOF as the spatial velocity about the world origin, which is the same
+   as sv and sw of the joint. The DOFs of a free root are the elements of vo and w.
+*/
+void BCCFSImpl::getDofAxis
+(const BodyData& bodyData, int linkIndex, int localDof, int& out_dof, Vector3& out_sv, Vector3& out_sw)
+{
+    if(linkIndex == 0){
+        out_dof = localDof;
+        out_sv.setZero();
+        out_sw.setZero();
+        if(localDof < 3){
+            out_sv(localDof) = 1.0;
+        } else {
+            out_sw(localDof - 3) = 1.0;
         }
-        
-        int n = loopBlockSize * i;
-        numGaussSeidelTotalLoops += n;
-        numGaussSeidelTotalCalls++;
-        numGaussSeidelTotalLoopsMax = std::max(numGaussSeidelTotalLoopsMax, n);
-        os << ", avarage = " << (numGaussSeidelTotalLoops / numGaussSeidelTotalCalls);
-        os << ", max = " << numGaussSeidelTotalLoopsMax;
-        os << endl;
+    } else {
+        DyLink* link = bodyData.linksData[linkIndex].link;
+        out_dof = bodyData.linkToDof[linkIndex];
+        out_sv = link->sv();
+        out_sw = link->sw();
     }
 }
 
 
-void BCCFSImpl::solveMCPByProjectedGaussSeidelMainStep(const MatrixX& M, const VectorX& b, VectorX& x)
+/**
+   Composite rigid body algorithm with the spatial quantities about the world origin.
+   Only the elements of H used by BCTreeLTDL are calculated.
+*/
+bool BCCFSImpl::calcJointSpaceInertia(BodyData& bodyData)
 {
-    const int size = globalNumConstraintVectors + globalNumFrictionVectors;
+    BCTreeLTDL& ltdl = bodyData.jointSpaceInertia;
+    if(ltdl.size() == 0){
+        return true;
+    }
 
-    for(int j=0; j < globalNumContactNormalVectors; ++j){
+    LinkDataArray& linksData = bodyData.linksData;
+    const int n = linksData.size();
+    compositeInertias.resize(n);
 
-        double xx;
-        if(M(j,j) == numeric_limits<double>::max()){
-            xx=0.0;
-        } else {
-            double sum = -M(j, j) * x(j);
-            for(int k=0; k < size; ++k){
-                sum += M(j, k) * x(k);
-            }
-            xx = (-b(j) - sum) / M(j, j);
-        }
-        if(xx < 0.0){
-            x(j) = 0.0;
-        } else {
-            x(j) = xx;
-        }
-        mcpHi[j] = contactIndexToMu[j] * x(j);
+    for(int i=0; i < n; ++i){
+        DyLink* link = linksData[i].link;
+        CompositeInertia& inertia = compositeInertias[i];
+        const Vector3 c = link->p() + link->R() * link->c();
+        const Matrix3 C = hat(c);
+        inertia.m  = link->m();
+        inertia.h  = link->m() * c;
+        inertia.Io = link->R() * link->I() * link->R().transpose() - link->m() * C * C;
     }
-    
-    for(int j=globalNumContactNormalVectors; j < globalNumConstraintVectors; ++j){
-        
-        if(M(j,j) == numeric_limits<double>::max()){
-            x(j)=0.0;
-        } else {
-            double sum = -M(j, j) * x(j);
-            for(int k=0; k < size; ++k){
-                sum += M(j, k) * x(k);
-            }
-            x(j) = (-b(j) - sum) / M(j, j);
-        }
+    for(int i = n - 1; i > 0; --i){
+        const CompositeInertia& inertia = compositeInertias[i];
+        CompositeInertia& parentInertia = compositeInertias[linksData[i].parentIndex];
+        parentInertia.m  += inertia.m;
+        parentInertia.h  += inertia.h;
+        parentInertia.Io += inertia.Io;
     }
-    
-    
-    if(ENABLE_TRUE_FRICTION_CONE){
 
-        int contactIndex = 0;
-        for(int j=globalNumConstraintVectors; j < size; ++j, ++contactIndex){
-            
-            double fx0;
-            if(M(j,j) == numeric_limits<double>::max()) {
-                fx0 = 0.0;
-            } else {
-                double sum = -M(j, j) * x(j);
-                for(int k=0; k < size; ++k){
-                    sum += M(j, k) * x(k);
-                }
-                fx0 = (-b(j) - sum) / M(j, j);
+    BCTreeLTDL::MatrixX& H = ltdl.matrix();
+
+    for(int i=0; i < n; ++i){
+
+        const int numDofs = (i == 0) ? bodyData.numRootDofs : ((bodyData.linkToDof[i] >= 0) ? 1 : 0);
+        const CompositeInertia& inertia = compositeInertias[i];
+
+        for(int a=0; a < numDofs; ++a){
+            int dof;
+            Vector3 sv, sw;
+            getDofAxis(bodyData, i, a, dof, sv, sw);
+
+            // force to move the composite body along the DOF
+            const Vector3 f   = inertia.m * sv - inertia.h.cross(sw);
+            const Vector3 tau = inertia.h.cross(sv) + inertia.Io * sw;
+
+            int dof2;
+            Vector3 sv2, sw2;
+            for(int b=0; b <= a; ++b){
+                getDofAxis(bodyData, i, b, dof2, sv2, sw2);
+                H(dof, dof2) = sv2.dot(f) + sw2.dot(tau);
             }
-            double& fx = x(j);
-            
-            ++j;
-            
-            double fy0;
-            if(M(j,j) == numeric_limits<double>::max()) {
-                fy0=0.0;
-            } else {
-                double sum = -M(j, j) * x(j);
-                for(int k=0; k < size; ++k){
-                    sum += M(j, k) * x(k);
-                }
-                fy0 = (-b(j) - sum) / M(j, j);
+            if(i > 0){
+                H(dof, dof) += linksData[i].link->Jm2();
             }
-            double& fy = x(j);
-            
-            const double fmax = mcpHi[contactIndex];
-            const double fmax2 = fmax * fmax;
-            const double fmag2 = fx0 * fx0 + fy0 * fy0;
-
-            if(fmag2 > fmax2){
-                const double s = fmax / sqrt(fmag2);
-                fx = s * fx0;
-                fy = s * fy0;
-            } else {
-                fx = fx0;
-                fy = fy0;
+            for(int j = linksData[i].parentIndex; j >= 0; j = linksData[j].parentIndex){
+                const int numDofs2 = (j == 0) ? bodyData.numRootDofs : ((bodyData.linkToDof[j] >= 0) ? 1 : 0);
+                for(int b=0; b < numDofs2; ++b){
+                    getDofAxis(bodyData, j, b, dof2, sv2, sw2);
+                    H(dof, dof2) = sv2.dot(f) + sw2.dot(tau);
+                }
             }
         }
-        
-    } else {
+    }
 
-        int frictionIndex = 0;
-        for(int j=globalNumConstraintVectors; j < size; ++j, ++frictionIndex){
+    return ltdl.factorize();
+}
 
-            double xx;
-            if(M(j,j) == numeric_limits<double>::max()) {
-                xx=0.0;
-            } else {
-                double sum = -M(j, j) * x(j);
-                for(int k=0; k < size; ++k){
-                    sum += M(j, k) * x(k);
+
+/**
+   Adds the generalized force of the force f and the torque tau around the origin on the link
+   to the row of J. For tau = p x f, this is also the row of the velocity of the point p along f.
+*/
+void BCCFSImpl::addWrenchJacobianRow
+(const BodyData& bodyData, DyLink* link, const Vector3& f, const Vector3& tau, MatrixX& J, int row)
+{
+    for(int i = link->index(); i >= 0; i = bodyData.linksData[i].parentIndex){
+        if(i == 0){
+            if(bodyData.numRootDofs == 6){
+                for(int a=0; a < 3; ++a){
+                    J(row, a)     += f(a);
+                    J(row, a + 3) += tau(a);
                 }
-                xx = (-b(j) - sum) / M(j, j);
             }
-            
-            const int contactIndex = frictionIndexToContactIndex[frictionIndex];
-            const double fmax = mcpHi[contactIndex];
-            const double fmin = (STATIC_FRICTION_BY_TWO_CONSTRAINTS ? -fmax : 0.0);
-            
-            if(xx < fmin){
-                x(j) = fmin;
-            } else if(xx > fmax){
-                x(j) = fmax;
-            } else {
-                x(j) = xx;
+        } else {
+            const int dof = bodyData.linkToDof[i];
+            if(dof >= 0){
+                DyLink* jointLink = bodyData.linksData[i].link;
+                J(row, dof) += jointLink->sv().dot(f) + jointLink->sw().dot(tau);
             }
         }
     }
 }
 
 
-void BCCFSImpl::solveMCPByProjectedGaussSeidelInitial
-(const MatrixX& M, const VectorX& b, VectorX& x, const int numIteration)
+/**
+   The rows of Mlcp are the relative accelerations along normalTowardInside[1] and
+   frictionVector[j][1] as in extractRelAccelsFromLinkPairCase1, and the columns are
+   the forces normalTowardInside[k] and frictionVector[j][k] applied to the link k.
+*/
+void BCCFSImpl::setAccelerationMatrixByJacobians()
 {
+    const int numBodies = bodiesData.size();
+    const int n = globalNumConstraintVectors;
     const int size = globalNumConstraintVectors + globalNumFrictionVectors;
 
-    const double rstep = 1.0 / (numIteration * size);
-    double r = 0.0;
-
-    for(int i=0; i < numIteration; ++i){
-
-        for(int j=0; j < globalNumContactNormalVectors; ++j){
-
-            double xx;
-            if(M(j,j)==numeric_limits<double>::max()){
-                xx=0.0;
-            } else {
-                double sum = -M(j, j) * x(j);
-                for(int k=0; k < size; ++k){
-                    sum += M(j, k) * x(k);
+    for(int i=0; i < numBodies; ++i){
+        BodyData& bodyData = bodiesData[i];
+        // the inertias of the ForwardDynamicsCBM bodies have been factorized by solve() when it succeeded
+        if(bodyData.hasConstrainedLinks && !bodyData.isStatic && !(bodyData.forwardDynamicsCBM && areCBMTestForcesBatched)){
+            if(!calcJointSpaceInertia(bodyData)){
+                if(CFS_DEBUG){
+                    os << "The joint-space inertia of " << bodyData.body->name() << " is not positive definite" << std::endl;
                 }
-                xx = (-b(j) - sum) / M(j, j);
-            }
-            if(xx < 0.0){
-                x(j) = 0.0;
-            } else {
-                x(j) = r * xx;
+                setAccelerationMatrixByTestForces();
+                return;
             }
-            r += rstep;
-            mcpHi[j] = contactIndexToMu[j] * x(j);
         }
+    }
 
-        for(int j=globalNumContactNormalVectors; j < globalNumConstraintVectors; ++j){
+    if(isSparseMatrixActive){
+        sparseMlcp.setZero();
+    } else {
+        Mlcp.topLeftCorner(size, size).setZero();
+    }
 
-            if(M(j,j)==numeric_limits<double>::max()){
-                x(j) = 0.0;
-            } else {
-                double sum = -M(j, j) * x(j);
-                for(int k=0; k < size; ++k){
-                    sum += M(j, k) * x(k);
-                }
-                x(j) = r * (-b(j) - sum) / M(j, j);
+    for(int i=0; i < numBodies; ++i){
+        addBodyAccelerationMatrix(i);
+    }
+}
+
+
+/**
+   Adds J H^-1 J^T of the body to the elements of the constraints of the body,
+   where H must be factorized by calcJointSpaceInertia. The directions of a constraint
+   to the link 0 are the negations of those to the link 1, so J is also the Jacobian of
+   the forces. J H^-1 J^T is Y^T Y with Y = D^-1/2 L^-T J^T, which is zero except in the
+   DOFs on the paths from the constrained links to the root.
+*/
+void BCCFSImpl::addBodyAccelerationMatrix(int bodyIndex)
+{
+    const int n = globalNumConstraintVectors;
+
+    const BodyData& bodyData = bodiesData[bodyIndex];
+    const std::vector<int>& linkPairIndices = bodyToLinkPairIndices[bodyIndex];
+    const int numDofs = bodyData.jointSpaceInertia.size();
+    if(linkPairIndices.empty() || numDofs == 0){
+        return;
+    }
+
+    jacobianRows.clear();
+    for(size_t i=0; i < linkPairIndices.size(); ++i){
+        const ConstraintPointArray& constraintPoints = constrainedLinkPairs[linkPairIndices[i]]->constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            const ConstraintPoint& constraint = constraintPoints[j];
+            jacobianRows.push_back(constraint.globalIndex);
+            for(int l=0; l < constraint.numFrictionVectors + constraint.numMomentVectors; ++l){
+                jacobianRows.push_back(n + constraint.globalFrictionIndex + l);
             }
-            r += rstep;
         }
+    }
+    const int numRows = jacobianRows.size();
 
-        if(ENABLE_TRUE_FRICTION_CONE){
-
-            int contactIndex = 0;
-            for(int j=globalNumConstraintVectors; j < size; ++j, ++contactIndex){
+    rowJacobian.setZero(numRows, numDofs);
 
-                double fx0;
-                if(M(j,j)==numeric_limits<double>::max())
-                    fx0 = 0.0;
-                else{
-                    double sum = -M(j, j) * x(j);
-                    for(int k=0; k < size; ++k){
-                        sum += M(j, k) * x(k);
+    int row = 0;
+    for(size_t i=0; i < linkPairIndices.size(); ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[linkPairIndices[i]];
+        const ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            const ConstraintPoint& constraint = constraintPoints[j];
+            for(int l=-1; l < constraint.numFrictionVectors; ++l){
+                Vector3 v[2];
+                contactPoints.getDirections(constraint, l, v);
+                for(int k=0; k < 2; ++k){
+                    if(linkPair.bodyIndex[k] == bodyIndex){
+                        DyLink* link = linkPair.link[k];
+                        addJacobianRow(bodyData, link, contactPoints.point(constraint), (k == 1) ? v[1] : Vector3(-v[1]), rowJacobian, row);
                     }
-                    fx0 = (-b(j) - sum) / M(j, j);
                 }
-                double& fx = x(j);
-
-                ++j;
-
-                double fy0;
-                if(M(j,j)==numeric_limits<double>::max())
-                    fy0 = 0.0;
-                else{
-                    double sum = -M(j, j) * x(j);
-                    for(int k=0; k < size; ++k){
-                        sum += M(j, k) * x(k);
+                ++row;
+            }
+            for(int l=0; l < constraint.numMomentVectors; ++l){
+                for(int k=0; k < 2; ++k){
+                    if(linkPair.bodyIndex[k] == bodyIndex){
+                        DyLink* link = linkPair.link[k];
+                        const Vector3 f = Vector3::Zero();
+                        const Vector3 m = contactPoints.momentVector(constraint, l, 1);
+                        addWrenchJacobianRow(bodyData, link, f, (k == 1) ? m : Vector3(-m), rowJacobian, row);
                     }
-                    fy0 = (-b(j) - sum) / M(j, j);
                 }
-                double& fy = x(j);
-
-                const double fmax = mcpHi[contactIndex];
-                const double fmax2 = fmax * fmax;
-                const double fmag2 = fx0 * fx0 + fy0 * fy0;
+                ++row;
+            }
+        }
+    }
 
-                if(fmag2 > fmax2){
-                    const double s = r * fmax / sqrt(fmag2);
-                    fx = s * fx0;
-                    fy = s * fy0;
-                } else {
-                    fx = r * fx0;
-                    fy = r * fy0;
+    // the DOFs on the paths in descending order, where the ancestors of a DOF follow it
+    const LinkDataArray& linksData = bodyData.linksData;
+    isPathLink.assign(linksData.size(), false);
+    for(size_t i=0; i < linkPairIndices.size(); ++i){
+        const LinkPair& linkPair = *constrainedLinkPairs[linkPairIndices[i]];
+        for(int k=0; k < 2; ++k){
+            if(linkPair.bodyIndex[k] == bodyIndex){
+                for(int j = linkPair.link[k]->index(); j >= 0 && !isPathLink[j]; j = linksData[j].parentIndex){
+                    isPathLink[j] = true;
                 }
-                r += (rstep + rstep);
             }
+        }
+    }
+    pathDofs.clear();
+    for(int i = linksData.size() - 1; i > 0; --i){
+        if(isPathLink[i] && bodyData.linkToDof[i] >= 0){
+            pathDofs.push_back(bodyData.linkToDof[i]);
+        }
+    }
+    for(int i = bodyData.numRootDofs - 1; i >= 0; --i){
+        pathDofs.push_back(i);
+    }
+
+    halfJacobian = rowJacobian.transpose();
+    bodyData.jointSpaceInertia.solveHalf(halfJacobian, pathDofs);
+    pathHalfJacobian.resize(pathDofs.size(), numRows);
+    for(size_t i=0; i < pathDofs.size(); ++i){
+        pathHalfJacobian.row(i) = halfJacobian.row(pathDofs[i]);
+    }
+    bodyAccelerationMatrix.noalias() = pathHalfJacobian.transpose() * pathHalfJacobian;
+
+    for(int i=0; i < numRows; ++i){
+        // the elements (i, j) and (j, i) are one element of symmetricMlcp
+        const int numColumns = isSymmetricMatrixActive ? (i + 1) : numRows;
+        for(int j=0; j < numColumns; ++j){
+            accelerationMatrixElement(jacobianRows[i], jacobianRows[j]) += bodyAccelerationMatrix(i, j);
+        }
+    }
+}
+
+
+void BCCFSImpl::initABMForceElementsWithNoExtForce(BodyData& bodyData)
+{
+    bodyData.dpf.setZero();
+    bodyData.dptau.setZero();
+    bodyData.dpfBatch.setZero();
+    bodyData.dptauBatch.setZero();
+
+    std::vector<LinkData>& linksData = bodyData.linksData;
+    const LinkTraverse& traverse = bodyData.body->linkTraverse();
+    const int n = traverse.numLinks();
+
+    for(int i = n-1; i >= 0; --i){
+        DyLink* link = static_cast<DyLink*>(traverse[i]);
+        LinkData& data = linksData[i];
+
+        /*
+          data.pf0   = link->pf;
+          data.ptau0 = link->ptau;
+        */
+        data.pf0   = link->pf() - link->f_ext();
+        data.ptau0 = link->ptau() - link->tau_ext();
+
+        for(DyLink* child = link->child(); child; child = child->sibling()){
+
+            LinkData& childData = linksData[child->index()];
+
+            data.pf0   += childData.pf0;
+            data.ptau0 += childData.ptau0;
+
+            if(!child->isFixedJoint()){
+                double uu_dd = childData.uu0 / child->dd();
+                data.pf0   += uu_dd * child->hhv();
+                data.ptau0 += uu_dd * child->hhw();
+            }
+        }
+
+        if(i > 0){
+            if(!link->isFixedJoint()){
+                data.uu0  = link->uu() + link->u() - (link->sv().dot(data.pf0) + link->sw().dot(data.ptau0));
+                data.uu = data.uu0;
+                data.duuBatch.setZero();
+            }
+        }
+    }
+}
+
+
+void BCCFSImpl::calcABMForceElementsWithTestForce
+(BodyData& bodyData, DyLink* linkToApplyForce, const Vector3& f, const Vector3& tau)
+{
+    std::vector<LinkData>& linksData = bodyData.linksData;
+
+    Vector3 dpf   = -f;
+    Vector3 dptau = -tau;
+
+    DyLink* link = linkToApplyForce;
+    while(link->parent()){
+        if(!link->isFixedJoint()){
+            LinkData& data = linksData[link->index()];
+            double duu = -(link->sv().dot(dpf) + link->sw().dot(dptau));
+            data.uu += duu;
+            double duudd = duu / link->dd();
+            dpf   += duudd * link->hhv();
+            dptau += duudd * link->hhw();
+        }
+        link = link->parent();
+    }
+
+    bodyData.dpf   += dpf;
+    bodyData.dptau += dptau;
+}
+
+
+void BCCFSImpl::calcAccelsABM(BodyData& bodyData, int constraintIndex)
+{
+    std::vector<LinkData>& linksData = bodyData.linksData;
+    LinkData& rootData = linksData[0];
+    DyLink* rootLink = rootData.link;
+
+    if(rootLink->isFreeJoint()){
+
+        Eigen::Matrix<double, 6, 1> a;
+        a << (rootData.pf0   + bodyData.dpf),
+            (rootData.ptau0 + bodyData.dptau);
+        a *= -1.0;
+
+        solveRootInertia(bodyData, a);
+
+        rootData.dvo = a.head<3>();
+        rootData.dw  = a.tail<3>();
+
+    } else {
+        rootData.dw .setZero();
+        rootData.dvo.setZero();
+    }
+
+    // reset
+    bodyData.dpf  .setZero();
+    bodyData.dptau.setZero();
+
+    int skipCheckNumber = isSymmetricMatrixActive ? constraintIndex : (numeric_limits<int>::max() - 1);
+    int n = linksData.size();
+    for(int linkIndex = 1; linkIndex < n; ++linkIndex){
+
+        LinkData& linkData = linksData[linkIndex];
+
+        if(!SKIP_REDUNDANT_ACCEL_CALC || linkData.numberToCheckAccelCalcSkip <= skipCheckNumber){
+
+            DyLink* link = linkData.link;
+            LinkData& parentData = linksData[linkData.parentIndex];
+
+            if(!link->isFixedJoint()){
+                linkData.ddq = (linkData.uu - (link->hhv().dot(parentData.dvo) + link->hhw().dot(parentData.dw))) / link->dd();
+                linkData.dvo = parentData.dvo + link->cv() + link->sv() * linkData.ddq;
+                linkData.dw  = parentData.dw  + link->cw() + link->sw() * linkData.ddq;
+            }else{
+                linkData.ddq = 0.0;
+                linkData.dvo = parentData.dvo;
+                linkData.dw  = parentData.dw;
+            }
+
+            // reset
+            linkData.uu = linkData.uu0;
+        }
+    }
+}
+
+
+void BCCFSImpl::factorizeRootInertia(BodyData& bodyData)
+{
+    bodyData.numRootInertiaFactorizations = 0;
+    bodyData.numRootInertiaSolves = 0;
+
+    DyLink* rootLink = bodyData.linksData[0].link;
+    if(!rootLink->isFreeJoint()){
+        return;
+    }
+    if(!bodyData.rootInertia){
+        bodyData.rootInertia.reset(new RootInertiaFactorization);
+    }
+    RootInertiaFactorization& root = *bodyData.rootInertia;
+
+    Matrix6 M;
+    M << rootLink->Ivv(), rootLink->Iwv().transpose(),
+        rootLink->Iwv(), rootLink->Iww();
+
+    root.llt.compute(M);
+    root.isLLTUsed = false;
+    if(root.llt.info() == Eigen::Success){
+        const Eigen::Matrix<double, 6, 1> pivots = root.llt.matrixLLT().diagonal();
+        root.isLLTUsed = (pivots.minCoeff() >= ROOT_INERTIA_MIN_PIVOT_RATIO * pivots.maxCoeff());
+    }
+    if(!root.isLLTUsed){
+        root.qr.compute(M);
+    }
+    ++bodyData.numRootInertiaFactorizations;
+}
+
+
+void BCCFSImpl::collectRootInertiaCounts()
+{
+    numRootInertiaFactorizationsInStep = 0;
+    numRootInertiaSolvesInStep = 0;
+
+    if(globalNumConstraintVectors > 0){
+        for(size_t i=0; i < bodiesData.size(); ++i){
+            const BodyData& bodyData = bodiesData[i];
+            if(bodyData.hasConstrainedLinks && !bodyData.isStatic && !bodyData.forwardDynamicsCBM){
+                numRootInertiaFactorizationsInStep += bodyData.numRootInertiaFactorizations;
+                numRootInertiaSolvesInStep += bodyData.numRootInertiaSolves;
+                if(bodyData.numRootInertiaFactorizations > 0 && !bodyData.rootInertia->isLLTUsed){
+                    ++numRootInertiaQRFallbacks;
+                }
+            }
+        }
+    }
+    totalNumRootInertiaFactorizations += numRootInertiaFactorizationsInStep;
+    totalNumRootInertiaSolves += numRootInertiaSolvesInStep;
+
+    if(CFS_DEBUG){
+        os << "Root inertia factorizations: " << numRootInertiaFactorizationsInStep
+           << ", solves: " << numRootInertiaSolvesInStep << std::endl;
+    }
+}
+
+
+void BCCFSImpl::calcABMForceElementsWithTestForceBatch
+(BodyData& bodyData, DyLink* linkToApplyForce, const Vector3Batch& f, const Vector3Batch& tau)
+{
+    std::vector<LinkData>& linksData = bodyData.linksData;
+
+    Vector3Batch dpf   = -f;
+    Vector3Batch dptau = -tau;
+
+    DyLink* link = linkToApplyForce;
+    while(link->parent()){
+        if(!link->isFixedJoint()){
+            LinkData& data = linksData[link->index()];
+            ScalarBatch duu = -(link->sv().transpose() * dpf + link->sw().transpose() * dptau);
+            data.duuBatch += duu;
+            ScalarBatch duudd = duu / link->dd();
+            dpf   += link->hhv() * duudd;
+            dptau += link->hhw() * duudd;
+        }
+        link = link->parent();
+    }
+
+    bodyData.dpfBatch   += dpf;
+    bodyData.dptauBatch += dptau;
+}
+
+
+void BCCFSImpl::calcAccelsABMBatch(BodyData& bodyData, int constraintIndex)
+{
+    std::vector<LinkData>& linksData = bodyData.linksData;
+    LinkData& rootData = linksData[0];
+    DyLink* rootLink = rootData.link;
+
+    if(rootLink->isFreeJoint()){
+
+        Eigen::Matrix<double, 6, ABM_BATCH_SIZE> a;
+        a.topRows<3>()    = bodyData.dpfBatch.colwise()   + rootData.pf0;
+        a.bottomRows<3>() = bodyData.dptauBatch.colwise() + rootData.ptau0;
+        a *= -1.0;
+
+        solveRootInertia(bodyData, a);
+
+        rootData.dvoBatch = a.topRows<3>();
+        rootData.dwBatch  = a.bottomRows<3>();
+
+    } else {
+        rootData.dvoBatch.setZero();
+        rootData.dwBatch .setZero();
+    }
+
+    // reset
+    bodyData.dpfBatch  .setZero();
+    bodyData.dptauBatch.setZero();
+
+    const int skipCheckNumber = isSymmetricMatrixActive ? constraintIndex : (numeric_limits<int>::max() - 1);
+    const int n = linksData.size();
+    for(int linkIndex = 1; linkIndex < n; ++linkIndex){
+
+        LinkData& linkData = linksData[linkIndex];
+
+        if(!SKIP_REDUNDANT_ACCEL_CALC || linkData.numberToCheckAccelCalcSkip <= skipCheckNumber){
+
+            DyLink* link = linkData.link;
+            LinkData& parentData = linksData[linkData.parentIndex];
+
+            if(!link->isFixedJoint()){
+                ScalarBatch ddq =
+                    ((linkData.duuBatch.array() + linkData.uu0) -
+                     (link->hhv().transpose() * parentData.dvoBatch + link->hhw().transpose() * parentData.dwBatch).array())
+                    / link->dd();
+                linkData.dvoBatch = (parentData.dvoBatch + link->sv() * ddq).colwise() + link->cv();
+                linkData.dwBatch  = (parentData.dwBatch  + link->sw() * ddq).colwise() + link->cw();
+            }else{
+                linkData.dvoBatch = parentData.dvoBatch;
+                linkData.dwBatch  = parentData.dwBatch;
+            }
+
+            // reset
+            linkData.duuBatch.setZero();
+        }
+    }
+}
+
+
+void BCCFSImpl::setAccelsOfBatchColumn(BodyData& bodyData, int column, int constraintIndex)
+{
+    std::vector<LinkData>& linksData = bodyData.linksData;
+
+    linksData[0].dvo = linksData[0].dvoBatch.col(column);
+    linksData[0].dw  = linksData[0].dwBatch.col(column);
+
+    const int skipCheckNumber = isSymmetricMatrixActive ? constraintIndex : (numeric_limits<int>::max() - 1);
+    const int n = linksData.size();
+    for(int linkIndex = 1; linkIndex < n; ++linkIndex){
+        LinkData& linkData = linksData[linkIndex];
+        if(!SKIP_REDUNDANT_ACCEL_CALC || linkData.numberToCheckAccelCalcSkip <= skipCheckNumber){
+            linkData.dvo = linkData.dvoBatch.col(column);
+            linkData.dw  = linkData.dwBatch.col(column);
+        }
+    }
+}
+
+
+void BCCFSImpl::calcAccelsMM(BodyData& bodyData, int constraintIndex)
+{
+    std::vector<LinkData>& linksData = bodyData.linksData;
+
+    LinkData& rootData = linksData[0];
+    DyLink* rootLink = rootData.link;
+    rootData.dvo = rootLink->dvo();
+    rootData.dw  = rootLink->dw();
+
+    const int skipCheckNumber = isSymmetricMatrixActive ? constraintIndex : (numeric_limits<int>::max() - 1);
+    const int n = linksData.size();
+
+    for(int linkIndex = 1; linkIndex < n; ++linkIndex){
+
+        LinkData& linkData = linksData[linkIndex];
+
+        if(!SKIP_REDUNDANT_ACCEL_CALC || linkData.numberToCheckAccelCalcSkip <= skipCheckNumber){
+
+            DyLink* link = linkData.link;
+            LinkData& parentData = linksData[linkData.parentIndex];
+            if(!link->isFixedJoint()){
+                linkData.dvo = parentData.dvo + link->cv() + link->ddq() * link->sv();
+                linkData.dw  = parentData.dw  + link->cw() + link->ddq() * link->sw();
+            }else{
+                linkData.dvo = parentData.dvo;
+                linkData.dw  = parentData.dw;
+            }
+        }
+    }
+}
+
+
+/**
+   Only the link pairs sharing a body with the test force are visited.
+   The elements of the other link pairs are zero, which are set before the assembly,
+   and the elements given by the batched ForwardDynamicsCBM bodies are added after it.
+*/
+void BCCFSImpl::extractRelAccelsOfConstraintPoints
+(LinkPair& testLinkPair, int testForceColumn, int constraintIndex, std::vector<BodyData>& bodies)
+{
+    int maxConstraintIndexToExtract = isSymmetricMatrixActive ? constraintIndex : globalNumConstraintVectors;
+
+    const bool isBody0Tested = bodyDataOf(testLinkPair, 0, bodies).isTestForceBeingApplied;
+
+    for(int k=0; k < 2; ++k){
+
+        if(!bodyDataOf(testLinkPair, k, bodies).isTestForceBeingApplied) continue;
+        if(k == 1 && testLinkPair.bodyIndex[1] == testLinkPair.bodyIndex[0]) break;
+
+        const std::vector<int>& linkPairIndices = bodyToLinkPairIndices[constraintBodyIndex(testLinkPair, k)];
+
+        for(size_t i=0; i < linkPairIndices.size(); ++i){
+
+            LinkPair& linkPair = *constrainedLinkPairs[linkPairIndices[i]];
+
+            // the link pairs also sharing the body 0 of the test force have been visited
+            if(k == 1 && isBody0Tested &&
+               (linkPair.bodyIndex[0] == testLinkPair.bodyIndex[0] || linkPair.bodyIndex[1] == testLinkPair.bodyIndex[0])){
+                continue;
+            }
+
+            BodyData& bodyData0 = bodyDataOf(linkPair, 0, bodies);
+            BodyData& bodyData1 = bodyDataOf(linkPair, 1, bodies);
+
+            if(bodyData0.isTestForceBeingApplied){
+                if(bodyData1.isTestForceBeingApplied){
+                    extractRelAccelsFromLinkPairCase1(linkPair, testForceColumn, maxConstraintIndexToExtract, bodies);
+                } else {
+                    extractRelAccelsFromLinkPairCase2(linkPair, 0, 1, testForceColumn, maxConstraintIndexToExtract, bodies);
+                }
+            } else if(bodyData1.isTestForceBeingApplied){
+                extractRelAccelsFromLinkPairCase2(linkPair, 1, 0, testForceColumn, maxConstraintIndexToExtract, bodies);
+            }
+        }
+    }
+}
+
+
+void BCCFSImpl::extractRelAccelsFromLinkPairCase1
+(LinkPair& linkPair, int testForceColumn, int maxConstraintIndexToExtract, std::vector<BodyData>& bodies)
+{
+/*BC*/  if(linkPair.isPenaltyBased) return;
+    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int frictionTop = globalNumConstraintVectors;
+
+    for(size_t i=0; i < constraintPoints.size(); ++i){
+
+        ConstraintPoint& constraint = constraintPoints[i];
+        int constraintIndex = constraint.globalIndex;
+
+        if(isSymmetricMatrixActive && constraintIndex > maxConstraintIndexToExtract){
+            break;
+        }
+
+        DyLink* link0 = linkPair.link[0];
+        DyLink* link1 = linkPair.link[1];
+        LinkData* linkData0 = &linkDataOf(linkPair, 0, bodies);
+        LinkData* linkData1 = &linkDataOf(linkPair, 1, bodies);
+
+        const Vector3& point = contactPoints.point(constraint);
+
+        //! \todo Can the follwoing equations be simplified ?
+        Vector3 dv0 =
+            linkData0->dvo - point.cross(linkData0->dw) +
+            link0->w().cross(link0->vo() + link0->w().cross(point));
+
+        Vector3 dv1 =
+            linkData1->dvo - point.cross(linkData1->dw) +
+            link1->w().cross(link1->vo() + link1->w().cross(point));
+
+        Vector3 relAccel = dv1 - dv0;
+
+        accelerationMatrixElement(constraintIndex, testForceColumn) =
+            contactPoints.normalTowardInside(constraint, 1).dot(relAccel) - an0(constraintIndex);
+
+        for(int j=0; j < constraint.numFrictionVectors; ++j){
+            const int index = constraint.globalFrictionIndex + j;
+            accelerationMatrixElement(frictionTop + index, testForceColumn) =
+                contactPoints.frictionVector(constraint, j, 1).dot(relAccel) - at0(index);
+        }
+
+        if(constraint.numMomentVectors > 0){
+            const Vector3 relAngularAccel(linkData1->dw - linkData0->dw);
+            for(int j=0; j < constraint.numMomentVectors; ++j){
+                const int index = constraint.globalFrictionIndex + constraint.numFrictionVectors + j;
+                accelerationMatrixElement(frictionTop + index, testForceColumn) =
+                    contactPoints.momentVector(constraint, j, 1).dot(relAngularAccel) - at0(index);
+            }
+        }
+    }
+}
+
+
+void BCCFSImpl::extractRelAccelsFromLinkPairCase2
+(LinkPair& linkPair, int iTestForce, int iDefault, int testForceColumn, int maxConstraintIndexToExtract, std::vector<BodyData>& bodies)
+{
+/*BC*/   if(linkPair.isPenaltyBased) return;
+    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int frictionTop = globalNumConstraintVectors;
+
+    for(size_t i=0; i < constraintPoints.size(); ++i){
+
+        ConstraintPoint& constraint = constraintPoints[i];
+        int constraintIndex = constraint.globalIndex;
+
+        if(isSymmetricMatrixActive && constraintIndex > maxConstraintIndexToExtract){
+            break;
+        }
+
+        DyLink* link = linkPair.link[iTestForce];
+        LinkData* linkData = &linkDataOf(linkPair, iTestForce, bodies);
+
+        const Vector3& point = contactPoints.point(constraint);
+        Vector3 dv(linkData->dvo - point.cross(linkData->dw) + link->w().cross(link->vo() + link->w().cross(point)));
+
+        if(CFS_DEBUG_VERBOSE_2){
+            os << "dv " << constraintIndex << " = " << dv << "\n";
+        }
+
+        Vector3 relAccel = contactPoints.defaultAccel(constraint, iDefault) - dv;
+
+        accelerationMatrixElement(constraintIndex, testForceColumn) =
+            contactPoints.normalTowardInside(constraint, iDefault).dot(relAccel) - an0(constraintIndex);
+
+        for(int j=0; j < constraint.numFrictionVectors; ++j){
+            const int index = constraint.globalFrictionIndex + j;
+            accelerationMatrixElement(frictionTop + index, testForceColumn) =
+                contactPoints.frictionVector(constraint, j, iDefault).dot(relAccel) - at0(index);
+        }
+
+        if(constraint.numMomentVectors > 0){
+            const Vector3 relAngularAccel(contactPoints.defaultAngularAccel(constraint, iDefault) - linkData->dw);
+            for(int j=0; j < constraint.numMomentVectors; ++j){
+                const int index = constraint.globalFrictionIndex + constraint.numFrictionVectors + j;
+                accelerationMatrixElement(frictionTop + index, testForceColumn) =
+                    contactPoints.momentVector(constraint, j, iDefault).dot(relAngularAccel) - at0(index);
+            }
+        }
+    }
+}
+
+
+void BCCFSImpl::clearSingularPointConstraintsOfClosedLoopConnections()
+{
+    if(isSparseMatrixActive){
+        clearSingularPointConstraintsOfSparseMatrix();
+        return;
+    }
+    if(isSymmetricMatrixActive){
+        clearSingularPointConstraintsOfSymmetricMatrix();
+        return;
+    }
+    for(int i = 0; i < Mlcp.rows(); ++i){
+        if(Mlcp(i, i) < 1.0e-4){
+            for(int j=0; j < Mlcp.rows(); ++j){
+                Mlcp(j, i) = 0.0;
+            }
+            Mlcp(i, i) = numeric_limits<double>::max();
+        }
+    }
+}
+
+
+void BCCFSImpl::clearSingularPointConstraintsOfSparseMatrix()
+{
+    // the non-zero pattern is symmetric
+    for(int i = 0; i < sparseMlcp.rows(); ++i){
+        if(sparseMlcp.diagonal(i) < 1.0e-4){
+            const int end = sparseMlcp.rowEnd(i);
+            for(int k = sparseMlcp.rowBegin(i); k < end; ++k){
+                sparseMlcp.coeffRef(sparseMlcp.columnIndex(k), i) = 0.0;
+            }
+            sparseMlcp.diagonalRef(i) = numeric_limits<double>::max();
+        }
+    }
+}
+
+
+/**
+   The row is also cleared with the column, which does not change the solution
+   because the solution of the row is kept zero.
+*/
+void BCCFSImpl::clearSingularPointConstraintsOfSymmetricMatrix()
+{
+    for(int i = 0; i < symmetricMlcp.rows(); ++i){
+        if(symmetricMlcp.diagonal(i) < 1.0e-4){
+            for(int j=0; j < symmetricMlcp.rows(); ++j){
+                symmetricMlcp.coeffRef(j, i) = 0.0;
+            }
+            symmetricMlcp.diagonalRef(i) = numeric_limits<double>::max();
+        }
+    }
+}
+
+
+void BCCFSImpl::setConstantVectorAndMuBlock()
+{
+    double dtinv = 1.0 / world.timeStep();
+    const int block2 = globalNumConstraintVectors;
+    const int block3 = globalNumConstraintVectors + globalNumFrictionVectors;
+
+    if(isPatchContactActive){
+        isMomentFrictionRow.assign(globalNumFrictionVectors, false);
+    }
+
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+/*BC*/   if(linkPair.isPenaltyBased) continue;/***/
+        int numConstraintsInPair = linkPair.constraintPoints.size();
+
+        for(int j=0; j < numConstraintsInPair; ++j){
+            ConstraintPoint& constraint = linkPair.constraintPoints[j];
+            int globalIndex = constraint.globalIndex;
+
+            // set constant vector of LCP
+
+            // constraints for normal acceleration
+
+            if(linkPair.isNonContactConstraint){
+                // connection constraint
+
+                const double& error = constraint.depth;
+                double v;
+                if(error >= 0){
+                    v = 0.1 * (-1.0 + exp(-error * 20.0));
+                } else {
+                    v = 0.1 * ( 1.0 - exp( error * 20.0));
+                }
+					
+                b(globalIndex) = an0(globalIndex) + (constraint.normalProjectionOfRelVelocityOn0 + v) * dtinv;
+
+            } else {
+                // contact constraint
+                if(ENABLE_CONTACT_DEPTH_CORRECTION){
+                    double velOffset;
+                    const double depth = constraint.depth - contactCorrectionDepth;
+                    if(depth <= 0.0){
+                        velOffset = contactCorrectionVelocityRatio * depth;
+                    } else {
+                        velOffset = contactCorrectionVelocityRatio * (-1.0 / (depth + 1.0) + 1.0);
+                    }
+                    b(globalIndex) = an0(globalIndex) + (constraint.normalProjectionOfRelVelocityOn0 - velOffset) * dtinv;
+                } else {
+                    b(globalIndex) = an0(globalIndex) + constraint.normalProjectionOfRelVelocityOn0 * dtinv;
+                }
+
+                contactIndexToMu[globalIndex] = constraint.mu;
+
+                int globalFrictionIndex = constraint.globalFrictionIndex;
+                for(int k=0; k < constraint.numFrictionVectors; ++k){
+
+                    // constraints for tangent acceleration
+                    double tangentProjectionOfRelVelocity = contactPoints.frictionVector(constraint, k, 1).dot(contactPoints.relVelocityOn0(constraint));
+
+                    b(block2 + globalFrictionIndex) = at0(globalFrictionIndex);
+                    if( !IGNORE_CURRENT_VELOCITY_IN_STATIC_FRICTION || constraint.numFrictionVectors == 1){
+                        b(block2 + globalFrictionIndex) += tangentProjectionOfRelVelocity * dtinv;
+                    }
+
+                    if(usePivotingLCP){
+                        // set mu (coefficients of friction)
+                        Mlcp(block3 + globalFrictionIndex, globalIndex) = constraint.mu;
+                    } else {
+                        // for iterative solver
+                        frictionIndexToContactIndex[globalFrictionIndex] = globalIndex;
+                    }
+
+                    ++globalFrictionIndex;
+                }
+
+                if(constraint.numMomentVectors > 0){
+                    // relative angular velocity
+                    Vector3 relAngularVelocity = Vector3::Zero();
+                    for(int k=0; k < 2; ++k){
+                        DyLink* link = linkPair.link[k];
+                        if(!(link->isRoot() && link->isFixedJoint())){
+                            relAngularVelocity += k ? link->w() : Vector3(-link->w());
+                        }
+                    }
+                    for(int k=0; k < constraint.numMomentVectors; ++k){
+                        b(block2 + globalFrictionIndex) = at0(globalFrictionIndex);
+                        if(!IGNORE_CURRENT_VELOCITY_IN_STATIC_FRICTION){
+                            b(block2 + globalFrictionIndex) +=
+                                contactPoints.momentVector(constraint, k, 1).dot(relAngularVelocity) * dtinv;
+                        }
+                        frictionIndexToContactIndex[globalFrictionIndex] = globalIndex;
+                        isMomentFrictionRow[globalFrictionIndex] = true;
+                        ++globalFrictionIndex;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/**
+   @return the point stored in the previous step nearest to the given point within
+   WARM_START_POINT_MATCHING_DISTANCE, or null if there is no such point.
+   Only the points in the 27 cells of the spatial hash around the point are compared,
+   and the last one of the equally near points is returned as the linear search did.
+*/
+const BCCFSImpl::WarmStartPoint* BCCFSImpl::findWarmStartPoint(const LinkPair& linkPair, const Vector3& point) const
+{
+    if(linkPair.warmStartStep != stepCount - 1 || linkPair.warmStartPoints.empty()){
+        return 0;
+    }
+    const WarmStartPointArray& warmStartPoints = linkPair.warmStartPoints;
+    const std::vector<int>& heads = linkPair.warmStartGridHeads;
+    const std::vector<int>& next = linkPair.warmStartGridNext;
+    const int mask = heads.size() - 1;
+    int cell[3];
+    getSpatialHashCell(point, 1.0 / WARM_START_POINT_MATCHING_DISTANCE, cell);
+
+    int nearest = -1;
+    double minDistance2 = WARM_START_POINT_MATCHING_DISTANCE * WARM_START_POINT_MATCHING_DISTANCE;
+    for(int dx=-1; dx <= 1; ++dx){
+        for(int dy=-1; dy <= 1; ++dy){
+            for(int dz=-1; dz <= 1; ++dz){
+                const int bucket = spatialHashBucket(cell[0] + dx, cell[1] + dy, cell[2] + dz, mask);
+                for(int i = heads[bucket]; i >= 0; i = next[i]){
+                    const double d2 = (warmStartPoints[i].point - point).squaredNorm();
+                    if(d2 < minDistance2 || (d2 == minDistance2 && i > nearest)){
+                        minDistance2 = d2;
+                        nearest = i;
+                    }
+                }
+            }
+        }
+    }
+    return (nearest >= 0) ? &warmStartPoints[nearest] : 0;
+}
+
+
+/**
+   The solution of the previous step is given to each constraint point by its identity,
+   that is the geometry pair and the nearest previous point within
+   WARM_START_POINT_MATCHING_DISTANCE, so it is independent of the global indices.
+   The friction force and the moment of a contact patch are projected onto the current
+   friction vectors and moment vectors.
+*/
+void BCCFSImpl::setWarmStartSolution()
+{
+    const int n = globalNumConstraintVectors;
+
+    solution.setZero();
+    numWarmStartedPoints = 0;
+    numColdStartedPoints = 0;
+
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        if(linkPair.isPenaltyBased) continue;
+
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        const WarmStartPointArray& warmStartPoints = linkPair.warmStartPoints;
+
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            ConstraintPoint& constraint = constraintPoints[j];
+
+            const WarmStartPoint* prev = 0;
+            if(linkPair.isNonContactConstraint){
+                // the points of a non-contact constraint are fixed
+                if(linkPair.warmStartStep == stepCount - 1 && warmStartPoints.size() == constraintPoints.size()){
+                    prev = &warmStartPoints[j];
+                }
+            } else {
+                prev = findWarmStartPoint(linkPair, contactPoints.point(constraint));
+            }
+            if(!prev){
+                ++numColdStartedPoints;
+                continue;
+            }
+            ++numWarmStartedPoints;
+            solution(constraint.globalIndex) = prev->normalForce;
+            for(int l=0; l < constraint.numFrictionVectors; ++l){
+                solution(n + constraint.globalFrictionIndex + l) = prev->frictionForce.dot(contactPoints.frictionVector(constraint, l, 1));
+            }
+            // the moment vectors are orthogonal but not normalized
+            const int momentTop = n + constraint.globalFrictionIndex + constraint.numFrictionVectors;
+            for(int l=0; l < constraint.numMomentVectors; ++l){
+                const Vector3 m = contactPoints.momentVector(constraint, l, 1);
+                const double m2 = m.squaredNorm();
+                solution(momentTop + l) = (m2 > 0.0) ? (prev->moment.dot(m) / m2) : 0.0;
+            }
+        }
+    }
+
+    totalNumWarmStartedPoints += numWarmStartedPoints;
+    totalNumColdStartedPoints += numColdStartedPoints;
+
+    if(CFS_DEBUG){
+        os << "Warm-started points: " << numWarmStartedPoints
+           << ", cold-started points: " << numColdStartedPoints << std::endl;
+    }
+}
+
+
+void BCCFSImpl::storeWarmStartSolution()
+{
+    const int n = globalNumConstraintVectors;
+
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        if(linkPair.isPenaltyBased) continue;
+
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        WarmStartPointArray& warmStartPoints = linkPair.warmStartPoints;
+        warmStartPoints.resize(constraintPoints.size());
+
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            ConstraintPoint& constraint = constraintPoints[j];
+            WarmStartPoint& warmStartPoint = warmStartPoints[j];
+            warmStartPoint.point = contactPoints.point(constraint);
+            warmStartPoint.normalForce = solution(constraint.globalIndex);
+            warmStartPoint.frictionForce.setZero();
+            for(int l=0; l < constraint.numFrictionVectors; ++l){
+                warmStartPoint.frictionForce +=
+                    solution(n + constraint.globalFrictionIndex + l) * contactPoints.frictionVector(constraint, l, 1);
+            }
+            warmStartPoint.hasFrictionBase = (constraint.numFrictionVectors >= 2);
+            if(warmStartPoint.hasFrictionBase){
+                warmStartPoint.frictionBase = contactPoints.frictionVector(constraint, 0, 0);
+            }
+            warmStartPoint.moment.setZero();
+            const int momentTop = n + constraint.globalFrictionIndex + constraint.numFrictionVectors;
+            for(int l=0; l < constraint.numMomentVectors; ++l){
+                warmStartPoint.moment += solution(momentTop + l) * contactPoints.momentVector(constraint, l, 1);
+            }
+        }
+
+        // the points of a non-contact constraint are found by their positions in the array
+        if(!linkPair.isNonContactConstraint){
+            const int numPoints = warmStartPoints.size();
+            int numBuckets = 16;
+            while(numBuckets < 2 * numPoints){
+                numBuckets *= 2;
+            }
+            std::vector<int>& heads = linkPair.warmStartGridHeads;
+            std::vector<int>& next = linkPair.warmStartGridNext;
+            heads.assign(numBuckets, -1);
+            next.resize(numPoints);
+            int cell[3];
+            for(int j=0; j < numPoints; ++j){
+                getSpatialHashCell(warmStartPoints[j].point, 1.0 / WARM_START_POINT_MATCHING_DISTANCE, cell);
+                const int bucket = spatialHashBucket(cell[0], cell[1], cell[2], numBuckets - 1);
+                next[j] = heads[bucket];
+                heads[bucket] = j;
+            }
+        }
+        linkPair.warmStartStep = stepCount;
+    }
+}
+
+
+void BCCFSImpl::addConstraintForceToLinks()
+{
+    int n = constrainedLinkPairs.size();
+    for(int i=0; i < n; ++i){
+        LinkPair* linkPair = constrainedLinkPairs[i];
+/*BC*/    if(linkPair->isPenaltyBased) continue;
+        for(int j=0; j < 2; ++j){
+            // if(!linkPair->link[j]->isRoot() || linkPair->link[j]->jointType != Link::FIXED_JOINT){
+            addConstraintForceToLink(linkPair, j);
+            // }
+        }
+    }
+}
+
+
+void BCCFSImpl::addConstraintForceToLink(LinkPair* linkPair, int ipair)
+{
+/*BC*/   if(linkPair->isPenaltyBased) return;
+    Vector3 f_total   = Vector3::Zero();
+    Vector3 tau_total = Vector3::Zero();
+
+    ConstraintPointArray& constraintPoints = linkPair->constraintPoints;
+    int numConstraintPoints = constraintPoints.size();
+    DyLink* link = linkPair->link[ipair];
+
+    for(int i=0; i < numConstraintPoints; ++i){
+
+        ConstraintPoint& constraint = constraintPoints[i];
+        int globalIndex = constraint.globalIndex;
+
+        Vector3 f = solution(globalIndex) * contactPoints.normalTowardInside(constraint, ipair);
+
+        for(int j=0; j < constraint.numFrictionVectors; ++j){
+            f += solution(globalNumConstraintVectors + constraint.globalFrictionIndex + j) * contactPoints.frictionVector(constraint, j, ipair);
+        }
+
+        f_total   += f;
+        tau_total += contactPoints.point(constraint).cross(f);
+
+        const int momentTop = globalNumConstraintVectors + constraint.globalFrictionIndex + constraint.numFrictionVectors;
+        for(int j=0; j < constraint.numMomentVectors; ++j){
+            tau_total += solution(momentTop + j) * contactPoints.momentVector(constraint, j, ipair);
+        }
+
+        if(isConstraintForceOutputMode){
+            link->constraintForces().push_back(DyLink::ConstraintForce(contactPoints.point(constraint), f));
+        }
+    }
+    
+    link->f_ext()   += f_total;
+    link->tau_ext() += tau_total;
+
+
+    if(CFS_DEBUG){
+        os << "Constraint force to " << link->name() << ": f = " << f_total << ", tau = " << tau_total << std::endl;
+    }
+}
+
+
+
+/**
+   The acceleration of a constraint point on the link of the given side of the link pair,
+   calculated from the current accelerations of LinkData as in extractRelAccelsFromLinkPairCase1
+*/
+Vector3 BCCFSImpl::calcCurrentAccelOfConstraintPoint(LinkPair& linkPair, int which, const ConstraintPoint& constraint)
+{
+    if(linkPair.bodyData[which]->isStatic){
+        return contactPoints.defaultAccel(constraint, which);
+    }
+    DyLink* link = linkPair.link[which];
+    LinkData* linkData = linkPair.linkData[which];
+    return linkData->dvo - contactPoints.point(constraint).cross(linkData->dw) +
+        link->w().cross(link->vo() + link->w().cross(contactPoints.point(constraint)));
+}
+
+
+/**
+   Applies scale * f[k] at the point, and scale * tau[k] if tau is given, to the link of each
+   side k of the link pair.
+   A committed force stays in the ABM force elements, so the following calcAccelsABM calls
+   give the accelerations with all the committed forces. A force which is not committed
+   is cleared by the next calcAccelsABM call as in setAccelerationMatrix.
+*/
+void BCCFSImpl::applyForceToABMForceElements
+(LinkPair& linkPair, const Vector3& point, const Vector3* f, double scale, bool doCommit, const Vector3* tau)
+{
+    for(int k=0; k < 2; ++k){
+        BodyData& bodyData = *linkPair.bodyData[k];
+        // the bodies of ForwardDynamicsCBM do not use the ABM force elements
+        if(bodyData.isStatic || bodyData.forwardDynamicsCBM){
+            continue;
+        }
+        const Vector3 fk = scale * f[k];
+        Vector3 tauk = point.cross(fk);
+        if(tau){
+            tauk += scale * tau[k];
+        }
+        calcABMForceElementsWithTestForce(bodyData, linkPair.link[k], fk, tauk);
+
+        if(doCommit){
+            std::vector<LinkData>& linksData = bodyData.linksData;
+            for(DyLink* link = linkPair.link[k]; link->parent(); link = link->parent()){
+                if(!link->isFixedJoint()){
+                    LinkData& data = linksData[link->index()];
+                    data.uu0 = data.uu;
+                }
+            }
+            LinkData& rootData = linksData[0];
+            rootData.pf0   += bodyData.dpf;
+            rootData.ptau0 += bodyData.dptau;
+            bodyData.dpf  .setZero();
+            bodyData.dptau.setZero();
+        }
+    }
+}
+
+
+void BCCFSImpl::updateAccelsOfLinkPairBodies(LinkPair& linkPair)
+{
+    for(int k=0; k < 2; ++k){
+        BodyData& bodyData = *linkPair.bodyData[k];
+        if(!bodyData.isStatic && (!linkPair.isSameBodyPair || (k > 0))){
+            calcAccelsABM(bodyData, numeric_limits<int>::max());
+        }
+    }
+}
+
+
+/**
+   The diagonal elements of Mlcp are calculated by the same test forces as setAccelerationMatrix,
+   but only the acceleration of the constraint point itself is extracted.
+   This must be called before any force is committed to the ABM force elements.
+*/
+void BCCFSImpl::setMatrixFreeDiagonal()
+{
+    const int n = globalNumConstraintVectors;
+
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+/*BC*/  if(linkPair.isPenaltyBased) continue;
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+
+            ConstraintPoint& constraint = constraintPoints[j];
+            const int index = constraint.globalIndex;
+            Vector3 v[2];
+
+            contactPoints.getDirections(constraint, -1, v);
+            applyForceToABMForceElements(linkPair, contactPoints.point(constraint), v, 1.0, false);
+            updateAccelsOfLinkPairBodies(linkPair);
+            Vector3 relAccel =
+                calcCurrentAccelOfConstraintPoint(linkPair, 1, constraint) -
+                calcCurrentAccelOfConstraintPoint(linkPair, 0, constraint);
+            matrixFreeDiagonal(index) = contactPoints.normalTowardInside(constraint, 1).dot(relAccel) - an0(index);
+
+            for(int l=0; l < constraint.numFrictionVectors; ++l){
+                const int frictionIndex = constraint.globalFrictionIndex + l;
+                contactPoints.getDirections(constraint, l, v);
+                applyForceToABMForceElements(linkPair, contactPoints.point(constraint), v, 1.0, false);
+                updateAccelsOfLinkPairBodies(linkPair);
+                relAccel =
+                    calcCurrentAccelOfConstraintPoint(linkPair, 1, constraint) -
+                    calcCurrentAccelOfConstraintPoint(linkPair, 0, constraint);
+                matrixFreeDiagonal(n + frictionIndex) = contactPoints.frictionVector(constraint, l, 1).dot(relAccel) - at0(frictionIndex);
+            }
+        }
+    }
+
+    // same as clearSingularPointConstraintsOfClosedLoopConnections
+    for(int i=0; i < matrixFreeDiagonal.size(); ++i){
+        if(matrixFreeDiagonal(i) < 1.0e-4){
+            matrixFreeDiagonal(i) = numeric_limits<double>::max();
+        }
+    }
+}
+
+
+/**
+   Commits the forces of the solution to the ABM force elements.
+   calcAccelsOfABMBodies gives the accelerations with them.
+*/
+void BCCFSImpl::commitSolutionToABMForceElements(const VectorX& x)
+{
+    const int n = globalNumConstraintVectors;
+
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+/*BC*/  if(linkPair.isPenaltyBased) continue;
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            ConstraintPoint& constraint = constraintPoints[j];
+            Vector3 f[2];
+            Vector3 tau[2];
+            const int momentTop = n + constraint.globalFrictionIndex + constraint.numFrictionVectors;
+            for(int k=0; k < 2; ++k){
+                f[k] = x(constraint.globalIndex) * contactPoints.normalTowardInside(constraint, k);
+                for(int l=0; l < constraint.numFrictionVectors; ++l){
+                    f[k] += x(n + constraint.globalFrictionIndex + l) * contactPoints.frictionVector(constraint, l, k);
+                }
+                tau[k].setZero();
+                for(int l=0; l < constraint.numMomentVectors; ++l){
+                    tau[k] += x(momentTop + l) * contactPoints.momentVector(constraint, l, k);
+                }
+            }
+            applyForceToABMForceElements(linkPair, contactPoints.point(constraint), f, 1.0, true,
+                                         (constraint.numMomentVectors > 0) ? tau : 0);
+        }
+    }
+}
+
+
+void BCCFSImpl::calcAccelsOfABMBodies()
+{
+    for(size_t i=0; i < bodiesData.size(); ++i){
+        BodyData& bodyData = bodiesData[i];
+        if(bodyData.hasConstrainedLinks && !bodyData.isStatic && !bodyData.forwardDynamicsCBM){
+            calcAccelsABM(bodyData, numeric_limits<int>::max());
+        }
+    }
+}
+
+
+/**
+   Sets the accelerations of the links of the constrained bodies solved by ABM with the
+   solution, which are the same as the phases 2 and 3 of ABM with the constraint forces
+   added by addConstraintForceToLinks. The forces have already been committed by the
+   matrix-free mode, so this is one top-down sweep per body.
+*/
+void BCCFSImpl::setArticulatedAccelerations()
+{
+    calcAccelsOfABMBodies();
+
+    for(size_t i=0; i < bodiesData.size(); ++i){
+        BodyData& bodyData = bodiesData[i];
+        if(bodyData.hasConstrainedLinks && !bodyData.isStatic && !bodyData.forwardDynamicsCBM){
+            const LinkDataArray& linksData = bodyData.linksData;
+            for(size_t j=0; j < linksData.size(); ++j){
+                const LinkData& data = linksData[j];
+                DyLink* link = data.link;
+                link->dvo() = data.dvo;
+                link->dw()  = data.dw;
+                if(j > 0){
+                    link->ddq() = data.ddq;
+                }
+            }
+            bodyData.articulatedAccelerationStep = stepCount;
+            totalNumFusedABMLinks += linksData.size();
+        }
+    }
+}
+
+
+/**
+   Projected Gauss-Seidel method without Mlcp.
+   The residual of a row is the current relative acceleration of the constraint point
+   plus the constant terms of b, and the change of the row solution is applied through
+   the articulated inertia of the bodies of the link pair before the next row is updated.
+   The rows are visited link pair by link pair as in solveColorChunkByGaussSeidel.
+*/
+void BCCFSImpl::solveMCPByMatrixFreeGaussSeidel(VectorX& x, MCPLayout& layout)
+{
+    setMatrixFreeDiagonal();
+    commitSolutionToABMForceElements(x);
+    calcAccelsOfABMBodies();
+
+    double error = 0.0;
+    VectorXd x0;
+    int i = 0;
+    while(i < maxNumGaussSeidelIteration){
+        i++;
+
+        x0 = x;
+        for(size_t j=0; j < constrainedLinkPairs.size(); ++j){
+            LinkPair& linkPair = *constrainedLinkPairs[j];
+/*BC*/      if(linkPair.isPenaltyBased) continue;
+            solveLinkPairByMatrixFreeGaussSeidel(linkPair, x, layout);
+        }
+
+        double n = x.norm();
+        if(n > THRESH_TO_SWITCH_REL_ERROR){
+            error = (x - x0).norm() / n;
+        } else {
+            error = (x - x0).norm();
+        }
+        if(error < gaussSeidelErrorCriterion){
+            if(CFS_MCP_DEBUG_SHOW_ITERATION_STOP){
+                os << "stopped at " << i << ", error = " << error << endl;
+            }
+            break;
+        }
+    }
+
+    if(CFS_MCP_DEBUG){
+        if(i == maxNumGaussSeidelIteration){
+            os << "not stopped" << ", error = " << error << endl;
+        }
+        numGaussSeidelTotalLoops += i;
+        numGaussSeidelTotalCalls++;
+        numGaussSeidelTotalLoopsMax = std::max(numGaussSeidelTotalLoopsMax, i);
+        os << "Matrix-free iteration, avarage = " << (numGaussSeidelTotalLoops / numGaussSeidelTotalCalls);
+        os << ", max = " << numGaussSeidelTotalLoopsMax;
+        os << endl;
+    }
+}
+
+
+void BCCFSImpl::solveLinkPairByMatrixFreeGaussSeidel(LinkPair& linkPair, VectorX& x, MCPLayout& layout)
+{
+    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int numPoints = constraintPoints.size();
+    const int n = layout.numConstraintVectors;
+    const VectorX& M = matrixFreeDiagonal;
+
+    for(int k=0; k < numPoints; ++k){
+        ConstraintPoint& constraint = constraintPoints[k];
+        const int j = constraint.globalIndex;
+        const double prev = x(j);
+        double xx;
+        if(M(j) == numeric_limits<double>::max()){
+            xx = 0.0;
+        } else {
+            const Vector3 relAccel =
+                calcCurrentAccelOfConstraintPoint(linkPair, 1, constraint) -
+                calcCurrentAccelOfConstraintPoint(linkPair, 0, constraint);
+            const double w = contactPoints.normalTowardInside(constraint, 1).dot(relAccel) - an0(j) + b(j);
+            xx = x(j) - w / M(j);
+        }
+        if(j < layout.numContactNormalVectors){
+            setContactNormalSolution(x, j, xx, layout);
+        } else {
+            x(j) = xx;
+        }
+        if(x(j) != prev){
+            Vector3 v[2];
+            contactPoints.getDirections(constraint, -1, v);
+            applyForceToABMForceElements(linkPair, contactPoints.point(constraint), v, x(j) - prev, true);
+            updateAccelsOfLinkPairBodies(linkPair);
+        }
+    }
+
+    for(int k=0; k < numPoints; ++k){
+        ConstraintPoint& constraint = constraintPoints[k];
+        if(constraint.numFrictionVectors == 0){
+            continue;
+        }
+        const int top = n + constraint.globalFrictionIndex;
+        const Vector3 relAccel =
+            calcCurrentAccelOfConstraintPoint(linkPair, 1, constraint) -
+            calcCurrentAccelOfConstraintPoint(linkPair, 0, constraint);
+        double prev[4];
+        double f0[4];
+        for(int l=0; l < constraint.numFrictionVectors; ++l){
+            const int j = top + l;
+            prev[l] = x(j);
+            if(M(j) == numeric_limits<double>::max()){
+                f0[l] = 0.0;
+            } else {
+                const double w = contactPoints.frictionVector(constraint, l, 1).dot(relAccel) - at0(j - n) + b(j);
+                f0[l] = x(j) - w / M(j);
+            }
+            if(!ENABLE_TRUE_FRICTION_CONE){
+                setFrictionSolution(x, j, f0[l], layout.mcpHi[layout.frictionIndexToContactIndex[j - n]]);
+            }
+        }
+        if(ENABLE_TRUE_FRICTION_CONE){
+            if(constraint.numFrictionVectors == 2){
+                projectOntoFrictionCone(layout.mcpHi[constraint.globalIndex], f0[0], f0[1], x(top), x(top + 1));
+            } else {
+                for(int l=0; l < constraint.numFrictionVectors; ++l){
+                    setFrictionSolution(x, top + l, f0[l], layout.mcpHi[constraint.globalIndex]);
+                }
+            }
+        }
+
+        Vector3 df[2];
+        df[0].setZero();
+        df[1].setZero();
+        bool isChanged = false;
+        for(int l=0; l < constraint.numFrictionVectors; ++l){
+            const double d = x(top + l) - prev[l];
+            if(d != 0.0){
+                df[0] += d * contactPoints.frictionVector(constraint, l, 0);
+                df[1] += d * contactPoints.frictionVector(constraint, l, 1);
+                isChanged = true;
+            }
+        }
+        if(isChanged){
+            applyForceToABMForceElements(linkPair, contactPoints.point(constraint), df, 1.0, true);
+            updateAccelsOfLinkPairBodies(linkPair);
+        }
+    }
+}
+
+
+template<class TMatrix>
+void BCCFSImpl::solveMCPByProjectedGaussSeidel(const TMatrix& M, const VectorX& b, VectorX& x, MCPLayout& layout)
+{
+    static const int loopBlockSize = DEFAULT_NUM_GAUSS_SEIDEL_ITERATION_BLOCK;
+
+    if(numGaussSeidelInitialIteration > 0){
+        solveMCPByProjectedGaussSeidelInitial(M, b, x, numGaussSeidelInitialIteration, layout);
+    }
+
+    int numBlockLoops = maxNumGaussSeidelIteration / loopBlockSize;
+    if(numBlockLoops==0){
+        numBlockLoops = 1;
+    }
+
+    if(CFS_MCP_DEBUG){
+        os << "Iteration ";
+    }
+
+    double error = 0.0;
+    VectorXd x0;
+    int i = 0;
+    while(i < numBlockLoops){
+        i++;
+
+        for(int j=0; j < loopBlockSize - 1; ++j){
+            solveMCPByProjectedGaussSeidelStep(M, b, x, layout);
+        }
+
+        x0 = x;
+        solveMCPByProjectedGaussSeidelStep(M, b, x, layout);
+
+        if(true){
+            double n = x.norm();
+            if(n > THRESH_TO_SWITCH_REL_ERROR){
+                error = (x - x0).norm() / x.norm();
+            } else {
+                error = (x - x0).norm();
+            }
+        } else {
+            error = 0.0;
+            for(int j=0; j < x.size(); ++j){
+                double d = fabs(x(j) - x0(j));
+                if(d > THRESH_TO_SWITCH_REL_ERROR){
+                    d /= x(j);
+                }
+                if(d > error){
+                    error = d;
+                }
+            }
+        }
+
+        if(error < gaussSeidelErrorCriterion){
+            if(CFS_MCP_DEBUG_SHOW_ITERATION_STOP){
+                os << "stopped at " << (i * loopBlockSize) << ", error = " << error << endl;
+            }
+            break;
+        }
+    }
+
+    if(CFS_MCP_DEBUG){
+
+        if(i == numBlockLoops){
+            os << "not stopped" << ", error = " << error << endl;
+        }
+        
+        int n = loopBlockSize * i;
+        numGaussSeidelTotalLoops += n;
+        numGaussSeidelTotalCalls++;
+        numGaussSeidelTotalLoopsMax = std::max(numGaussSeidelTotalLoopsMax, n);
+        os << ", avarage = " << (numGaussSeidelTotalLoops / numGaussSeidelTotalCalls);
+        os << ", max = " << numGaussSeidelTotalLoopsMax;
+        os << endl;
+    }
+}
+
+
+template<class TMatrix>
+void BCCFSImpl::solveMCPByProjectedGaussSeidelMainStep(const TMatrix& M, const VectorX& b, VectorX& x, MCPLayout& layout)
+{
+    const int size = layout.numConstraintVectors + layout.numFrictionVectors;
+
+    for(int j=0; j < layout.numContactNormalVectors; ++j){
+
+        double xx;
+        if(M(j,j) == numeric_limits<double>::max()){
+            xx=0.0;
+        } else {
+            double sum = calcOffDiagonalRowProduct(M, j, x, size);
+            xx = (-b(j) - sum) / M(j, j);
+        }
+        setContactNormalSolution(x, j, xx, layout);
+    }
+    
+    for(int j=layout.numContactNormalVectors; j < layout.numConstraintVectors; ++j){
+        
+        if(M(j,j) == numeric_limits<double>::max()){
+            x(j)=0.0;
+        } else {
+            double sum = calcOffDiagonalRowProduct(M, j, x, size);
+            x(j) = (-b(j) - sum) / M(j, j);
+        }
+    }
+    
+    
+    if(ENABLE_TRUE_FRICTION_CONE){
+
+        for(int j=layout.numConstraintVectors; j < size; ++j){
+
+            const int frictionIndex = j - layout.numConstraintVectors;
+            const int contactIndex = layout.frictionIndexToContactIndex[frictionIndex];
+
+            if(layout.isMomentRow && (*layout.isMomentRow)[frictionIndex]){
+                double xx;
+                if(M(j,j) == numeric_limits<double>::max()) {
+                    xx = 0.0;
+                } else {
+                    double sum = calcOffDiagonalRowProduct(M, j, x, size);
+                    xx = (-b(j) - sum) / M(j, j);
+                }
+                setFrictionSolution(x, j, xx, layout.mcpHi[contactIndex]);
+                continue;
+            }
+            
+            double fx0;
+            if(M(j,j) == numeric_limits<double>::max()) {
+                fx0 = 0.0;
+            } else {
+                double sum = calcOffDiagonalRowProduct(M, j, x, size);
+                fx0 = (-b(j) - sum) / M(j, j);
+            }
+            double& fx = x(j);
+            
+            ++j;
+            
+            double fy0;
+            if(M(j,j) == numeric_limits<double>::max()) {
+                fy0=0.0;
+            } else {
+                double sum = calcOffDiagonalRowProduct(M, j, x, size);
+                fy0 = (-b(j) - sum) / M(j, j);
+            }
+            double& fy = x(j);
+            
+            projectOntoFrictionCone(layout.mcpHi[contactIndex], fx0, fy0, fx, fy);
+        }
+        
+    } else {
+
+        int frictionIndex = 0;
+        for(int j=layout.numConstraintVectors; j < size; ++j, ++frictionIndex){
+
+            double xx;
+            if(M(j,j) == numeric_limits<double>::max()) {
+                xx=0.0;
+            } else {
+                double sum = calcOffDiagonalRowProduct(M, j, x, size);
+                xx = (-b(j) - sum) / M(j, j);
+            }
+            
+            const int contactIndex = layout.frictionIndexToContactIndex[frictionIndex];
+            setFrictionSolution(x, j, xx, layout.mcpHi[contactIndex]);
+        }
+    }
+}
+
+
+/**
+   The link pairs of one color have no non-static body in common, so the rows of
+   different link pairs of the color are not coupled and are updated in parallel.
+   Returning from BCThreadPool::run works as the barrier between the colors.
+*/
+template<class TMatrix>
+void BCCFSImpl::solveMCPByColoredGaussSeidelStep(const TMatrix& M, const VectorX& b, VectorX& x, MCPLayout& layout)
+{
+    static const int numChunksPerThread = 4;
+    const int maxNumChunks = threadPool.numThreads() * numChunksPerThread;
+
+    for(int color=0; color < numColors; ++color){
+        const int classSize = colorClasses[color].size();
+        const int chunkSize = (classSize + maxNumChunks - 1) / maxNumChunks;
+        const int numChunks = (classSize + chunkSize - 1) / chunkSize;
+        threadPool.run(numChunks,
+                       boost::bind(&BCCFSImpl::solveColorChunkByGaussSeidel<TMatrix>, this,
+                                   boost::cref(M), boost::cref(b), boost::ref(x), boost::ref(layout), color, chunkSize, _1));
+    }
+}
+
+
+template<class TMatrix>
+void BCCFSImpl::solveColorChunkByGaussSeidel
+(const TMatrix& M, const VectorX& b, VectorX& x, MCPLayout& layout, int color, int chunkSize, int chunk)
+{
+    const std::vector<int>& linkPairIndices = colorClasses[color];
+    const int begin = chunk * chunkSize;
+    const int end = std::min(begin + chunkSize, static_cast<int>(linkPairIndices.size()));
+    const int n = layout.numConstraintVectors;
+
+    for(int i=begin; i < end; ++i){
+
+        ConstraintPointArray& constraintPoints = constrainedLinkPairs[linkPairIndices[i]]->constraintPoints;
+        const int numPoints = constraintPoints.size();
+
+        for(int k=0; k < numPoints; ++k){
+            const int j = constraintPoints[k].globalIndex;
+            double xx;
+            if(M(j,j) == numeric_limits<double>::max()){
+                xx = 0.0;
+            } else {
+                xx = (-b(j) - calcCoupledRowProduct(M, j, x)) / M(j, j);
+            }
+            if(j < layout.numContactNormalVectors){
+                setContactNormalSolution(x, j, xx, layout);
+            } else {
+                x(j) = xx;
+            }
+        }
+
+        for(int k=0; k < numPoints; ++k){
+            ConstraintPoint& constraint = constraintPoints[k];
+            const int top = n + constraint.globalFrictionIndex;
+            double f0[2];
+            for(int l=0; l < constraint.numFrictionVectors; ++l){
+                const int j = top + l;
+                double xx;
+                if(M(j,j) == numeric_limits<double>::max()){
+                    xx = 0.0;
+                } else {
+                    xx = (-b(j) - calcCoupledRowProduct(M, j, x)) / M(j, j);
+                }
+                if(ENABLE_TRUE_FRICTION_CONE){
+                    f0[l] = xx;
+                } else {
+                    setFrictionSolution(x, j, xx, layout.mcpHi[layout.frictionIndexToContactIndex[j - n]]);
+                }
+            }
+            if(ENABLE_TRUE_FRICTION_CONE && constraint.numFrictionVectors == 2){
+                projectOntoFrictionCone(layout.mcpHi[constraint.globalIndex], f0[0], f0[1], x(top), x(top + 1));
+            }
+        }
+    }
+}
+
+
+template<class TMatrix>
+void BCCFSImpl::solveMCPByProjectedGaussSeidelInitial
+(const TMatrix& M, const VectorX& b, VectorX& x, const int numIteration, MCPLayout& layout)
+{
+    const int size = layout.numConstraintVectors + layout.numFrictionVectors;
+
+    const double rstep = 1.0 / (numIteration * size);
+    double r = 0.0;
+
+    for(int i=0; i < numIteration; ++i){
+
+        for(int j=0; j < layout.numContactNormalVectors; ++j){
+
+            double xx;
+            if(M(j,j)==numeric_limits<double>::max()){
+                xx=0.0;
+            } else {
+                double sum = calcOffDiagonalRowProduct(M, j, x, size);
+                xx = (-b(j) - sum) / M(j, j);
+            }
+            if(xx < 0.0){
+                x(j) = 0.0;
+            } else {
+                x(j) = r * xx;
+            }
+            r += rstep;
+            layout.mcpHi[j] = layout.contactIndexToMu[j] * x(j);
+        }
+
+        for(int j=layout.numContactNormalVectors; j < layout.numConstraintVectors; ++j){
+
+            if(M(j,j)==numeric_limits<double>::max()){
+                x(j) = 0.0;
+            } else {
+                double sum = calcOffDiagonalRowProduct(M, j, x, size);
+                x(j) = r * (-b(j) - sum) / M(j, j);
+            }
+            r += rstep;
+        }
+
+        if(ENABLE_TRUE_FRICTION_CONE){
+
+            for(int j=layout.numConstraintVectors; j < size; ++j){
+
+                const int frictionIndex = j - layout.numConstraintVectors;
+                const int contactIndex = layout.frictionIndexToContactIndex[frictionIndex];
+
+                if(layout.isMomentRow && (*layout.isMomentRow)[frictionIndex]){
+                    double xx;
+                    if(M(j,j)==numeric_limits<double>::max())
+                        xx = 0.0;
+                    else{
+                        double sum = calcOffDiagonalRowProduct(M, j, x, size);
+                        xx = (-b(j) - sum) / M(j, j);
+                    }
+                    setFrictionSolution(x, j, xx, layout.mcpHi[contactIndex]);
+                    x(j) *= r;
+                    r += rstep;
+                    continue;
+                }
+
+                double fx0;
+                if(M(j,j)==numeric_limits<double>::max())
+                    fx0 = 0.0;
+                else{
+                    double sum = calcOffDiagonalRowProduct(M, j, x, size);
+                    fx0 = (-b(j) - sum) / M(j, j);
+                }
+                double& fx = x(j);
+
+                ++j;
+
+                double fy0;
+                if(M(j,j)==numeric_limits<double>::max())
+                    fy0 = 0.0;
+                else{
+                    double sum = calcOffDiagonalRowProduct(M, j, x, size);
+                    fy0 = (-b(j) - sum) / M(j, j);
+                }
+                double& fy = x(j);
+
+                const double fmax = layout.mcpHi[contactIndex];
+                const double fmax2 = fmax * fmax;
+                const double fmag2 = fx0 * fx0 + fy0 * fy0;
+
+                if(fmag2 > fmax2){
+                    const double s = r * fmax / sqrt(fmag2);
+                    fx = s * fx0;
+                    fy = s * fy0;
+                } else {
+                    fx = r * fx0;
+                    fy = r * fy0;
+                }
+                r += (rstep + rstep);
+            }
+
+        } else {
+
+            int frictionIndex = 0;
+            for(int j=layout.numConstraintVectors; j < size; ++j, ++frictionIndex){
+
+                double xx;
+                if(M(j,j)==numeric_limits<double>::max())
+                    xx = 0.0;
+                else{
+                    double sum = calcOffDiagonalRowProduct(M, j, x, size);
+                    xx = (-b(j) - sum) / M(j, j);
+                }
+
+                const int contactIndex = layout.frictionIndexToContactIndex[frictionIndex];
+                const double fmax = layout.mcpHi[contactIndex];
+                const double fmin = (STATIC_FRICTION_BY_TWO_CONSTRAINTS ? -fmax : 0.0);
+
+                if(xx < fmin){
+                    x(j) = fmin;
+                } else if(xx > fmax){
+                    x(j) = fmax;
+                } else {
+                    x(j) = xx;
+                }
+                x(j) *= r;
+                r += rstep;
+            }
+        }
+    }
+}
+
+
+void BCCFSImpl::checkLCPResult(MatrixX& M, VectorX& b, VectorX& x)
+{
+    os << "check LCP result\n";
+    os << "-------------------------------\n";
+
+    VectorX z = M * x + b;
+
+    int n = x.size();
+    for(int i=0; i < n; ++i){
+        os << "(" << x(i) << ", " << z(i) << ")";
+
+        if(x(i) < 0.0 || z(i) < 0.0 || x(i) * z(i) != 0.0){
+            os << " - X";
+        }
+        os << "\n";
+
+        if(i == globalNumConstraintVectors){
+            os << "-------------------------------\n";
+        } else if(i == globalNumConstraintVectors + globalNumFrictionVectors){
+            os << "-------------------------------\n";
+        }
+    }
+
+    os << "-------------------------------\n";
+
+
+    os << std::endl;
+}
+
+
+void BCCFSImpl::checkMCPResult(MatrixX& M, VectorX& b, VectorX& x)
+{
+    os << "check MCP result\n";
+    os << "-------------------------------\n";
+
+    VectorX z = M * x + b;
+
+    for(int i=0; i < globalNumConstraintVectors; ++i){
+        os << "(" << x(i) << ", " << z(i) << ")";
+
+        if(x(i) < 0.0 || z(i) < -1.0e-6){
+            os << " - X";
+        } else if(x(i) > 0.0 && fabs(z(i)) > 1.0e-6){
+            os << " - X";
+        } else if(z(i) > 1.0e-6 && fabs(x(i)) > 1.0e-6){
+            os << " - X";
+        }
+
+
+        os << "\n";
+    }
+
+    os << "-------------------------------\n";
+
+    int j = 0;
+    for(int i=globalNumConstraintVectors; i < globalNumConstraintVectors + globalNumFrictionVectors; ++i, ++j){
+        os << "(" << x(i) << ", " << z(i) << ")";
+
+        int contactIndex = frictionIndexToContactIndex[j];
+        double hi = contactIndexToMu[contactIndex] * x(contactIndex);
+
+        os << " hi = " << hi;
+
+        if(x(i) < 0.0 || x(i) > hi){
+            os << " - X";
+        } else if(x(i) == hi && z(i) > -1.0e-6){
+            os << " - X";
+        } else if(x(i) < hi && x(i) > 0.0 && fabs(z(i)) > 1.0e-6){
+            os << " - X";
+        }
+        os << "\n";
+    }
+
+    os << "-------------------------------\n";
+
+    os << std::endl;
+}
+
+
+#ifdef USE_PIVOTING_LCP
+bool BCCFSImpl::callPathLCPSolver(MatrixX& Mlcp, VectorX& b, VectorX& solution)
+{
+    int size = solution.size();
+    int square = size * size;
+    std::vector<double> lb(size + 1, 0.0);
+    std::vector<double> ub(size + 1, 1.0e20);
+
+    int m_nnz = 0;
+    std::vector<int> m_i(square + 1);
+    std::vector<int> m_j(square + 1);
+    std::vector<double> m_ij(square + 1);
+
+    for(int i=0; i < size; ++i){
+        solution(i) = 0.0;
+    }
+
+    for(int j=0; j < size; ++j){
+        for(int i=0; i < size; ++i){
+            double v = Mlcp(i, j);
+            if(v != 0.0){
+                m_i[m_nnz] = i+1;
+                m_j[m_nnz] = j+1;
+                m_ij[m_nnz] = v;
+                ++m_nnz;
+            }
+        }
+    }
+
+    MCP_Termination status;
+
+    SimpleLCP(size, m_nnz, &m_i[0], &m_j[0], &m_ij[0], &b(0), &lb[0], &ub[0], &status, &solution(0));
+
+    return (status == MCP_Solved);
+}
+#endif
+
+
+BCConstraintForceSolver::BCConstraintForceSolver(WorldBase& world)
+{
+    impl = new BCCFSImpl(world);
+}
+
+
+BCConstraintForceSolver::~BCConstraintForceSolver()
+{
+    delete impl;
+}
+
+
+void BCConstraintForceSolver::setCollisionDetector(CollisionDetectorPtr detector)
+{
+    impl->collisionDetector = detector;
+}
+
+
+CollisionDetectorPtr BCConstraintForceSolver::collisionDetector()
+{
+    return impl->collisionDetector;
+}
+
+
+void BCConstraintForceSolver::setFriction(double staticFriction, double slipFliction)
+{
+    impl->defaultStaticFriction = staticFriction;
+    impl->defaultSlipFriction = slipFliction;
+}
+
+
+double BCConstraintForceSolver::staticFriction() const
+{
+    return impl->defaultStaticFriction;
+}
+
+
+double BCConstraintForceSolver::slipFriction() const
+{
+    return impl->defaultSlipFriction;
+}
+
+
+void BCConstraintForceSolver::setContactCullingDistance(double distance)
+{
+    impl->defaultContactCullingDistance = distance;
+}
+
+
+double BCConstraintForceSolver::contactCullingDistance() const
+{
+    return impl->defaultContactCullingDistance;
+}
+
+
+void BCConstraintForceSolver::setContactCullingDepth(double depth)
+{
+    impl->defaultContactCullingDepth = depth;
+}
+
+
+double BCConstraintForceSolver::contactCullingDepth()
+{
+    return impl->defaultContactCullingDepth;
+}
+
+
+void BCConstraintForceSolver::setCoefficientOfRestitution(double epsilon)
+{
+    impl->defaultCoefficientOfRestitution = epsilon;
+}
+
+
+double BCConstraintForceSolver::coefficientOfRestitution() const
+{
+    return impl->defaultCoefficientOfRestitution;
+}
+
+
+void BCConstraintForceSolver::setGaussSeidelErrorCriterion(double e)
+{
+    impl->gaussSeidelErrorCriterion = e;
+/*BC*/  impl->pSNSCore->setGaussSeidelErrorCriterion(e);
+/*BC*/  impl->pQMRCore->setGaussSeidelErrorCriterion(e);
+/*BC*/  impl->pBGSCore->setGaussSeidelErrorCriterion(e);
+}
+
+
+double BCConstraintForceSolver::gaussSeidelErrorCriterion()
+{
+    return impl->gaussSeidelErrorCriterion;
+}
+
+
+void BCConstraintForceSolver::setGaussSeidelMaxNumIterations(int n)
+{
+    impl->maxNumGaussSeidelIteration = n;
+/*BC*/ impl->pSNSCore->setGaussSeidelMaxNumIterations(n);
+/*BC*/ impl->pQMRCore->setGaussSeidelMaxNumIterations(n);
+/*BC*/ impl->pBGSCore->setGaussSeidelMaxNumIterations(n);
+}
+
+
+int BCConstraintForceSolver::gaussSeidelMaxNumIterations()
+{
+    return impl->maxNumGaussSeidelIteration;
+}
+
+
+void BCConstraintForceSolver::setContactDepthCorrection(double depth, double velocityRatio)
+{
+    impl->contactCorrectionDepth = depth;
+    impl->contactCorrectionVelocityRatio = velocityRatio;
+}
+
+
+double BCConstraintForceSolver::contactCorrectionDepth()
+{
+    return impl->contactCorrectionDepth;
+}
+
+
+double BCConstraintForceSolver::contactCorrectionVelocityRatio()
+{
+    return impl->contactCorrectionVelocityRatio;
+}
+
+
+void BCConstraintForceSolver::enableConstraintForceOutput(bool on)
+{
+    impl->isConstraintForceOutputMode = on;
+}
+
+
+void BCConstraintForceSolver::set2Dmode(bool on)
+{
+    impl->is2Dmode = on;
+}
+
+
+void BCConstraintForceSolver::setSparseMatrixMode(bool on)
+{
+    impl->isSparseMatrixMode = on && !usePivotingLCP;
+}
+
+
+bool BCConstraintForceSolver::isSparseMatrixMode() const
+{
+    return impl->isSparseMatrixMode;
+}
+
+
+void BCConstraintForceSolver::setStableFrictionBasisMode(bool on)
+{
+    impl->isStableFrictionBasisMode = on;
+}
+
+
+bool BCConstraintForceSolver::isStableFrictionBasisMode() const
+{
+    return impl->isStableFrictionBasisMode;
+}
+
+
+void BCConstraintForceSolver::setIslandMode(bool on)
+{
+    impl->isIslandMode = on && !usePivotingLCP;
+}
+
+
+bool BCConstraintForceSolver::isIslandMode() const
+{
+    return impl->isIslandMode;
+}
+
+
+bool BCConstraintForceSolver::isMatrixFreeMode() const
+{
+    return impl->isMatrixFreeMode;
+}
+
+
+void BCConstraintForceSolver::setSymmetricMatrixMode(bool on)
+{
+    impl->isSymmetricMatrixMode = on && !usePivotingLCP;
+}
+
+
+bool BCConstraintForceSolver::isSymmetricMatrixMode() const
+{
+    return impl->isSymmetricMatrixMode;
+}
+
+
+bool BCConstraintForceSolver::isSymmetricMatrixUnsafe() const
+{
+    return impl->isSymmetricMatrixUnsafe;
+}
+
+
+int BCConstraintForceSolver::numSymmetricMatrixFallbacks() const
+{
+    return impl->numSymmetricMatrixFallbacks;
+}
+
+
+double BCConstraintForceSolver::maxSymmetricMatrixError() const
+{
+    return impl->maxSymmetricMatrixError;
+}
+
+
+void BCConstraintForceSolver::setParallelAssemblyMode(bool on)
+{
+    impl->isParallelAssemblyMode = on;
+}
+
+
+bool BCConstraintForceSolver::isParallelAssemblyMode() const
+{
+    return impl->isParallelAssemblyMode;
+}
+
+
+void BCConstraintForceSolver::setFusedABMMode(bool on)
+{
+    impl->isFusedABMMode = on;
+}
+
+
+bool BCConstraintForceSolver::isFusedABMMode() const
+{
+    return impl->isFusedABMMode;
+}
+
+
+bool BCConstraintForceSolver::areArticulatedAccelerationsGiven(int bodyIndex) const
+{
+    return impl->bodiesData[bodyIndex].articulatedAccelerationStep == impl->stepCount;
+}
+
+
+long BCConstraintForceSolver::totalNumFusedABMLinks() const
+{
+    return impl->totalNumFusedABMLinks;
+}
+
+
+void BCConstraintForceSolver::setJacobianAssemblyMode(bool on)
+{
+    impl->isJacobianAssemblyMode = on;
+}
+
+
+bool BCConstraintForceSolver::isJacobianAssemblyMode() const
+{
+    return impl->isJacobianAssemblyMode;
+}
+
+
+bool BCConstraintForceSolver::isJacobianAssemblyUnsafe() const
+{
+    return impl->isJacobianAssemblyUnsafe;
+}
+
+
+int BCConstraintForceSolver::numJacobianAssemblyChecks() const
+{
+    return impl->numJacobianAssemblyChecks;
+}
+
+
+double BCConstraintForceSolver::maxJacobianAssemblyError() const
+{
+    return impl->maxJacobianAssemblyError;
+}
 
-        } else {
-
-            int frictionIndex = 0;
-            for(int j=globalNumConstraintVectors; j < size; ++j, ++frictionIndex){
 
-                double xx;
-                if(M(j,j)==numeric_limits<double>::max())
-                    xx = 0.0;
-                else{
-                    double sum = -M(j, j) * x(j);
-                    for(int k=0; k < size; ++k){
-                        sum += M(j, k) * x(k);
-                    }
-                    xx = (-b(j) - sum) / M(j, j);
-                }
+double BCConstraintForceSolver::totalAssemblyTime() const
+{
+    return impl->totalAssemblyTime;
+}
 
-                const int contactIndex = frictionIndexToContactIndex[frictionIndex];
-                const double fmax = mcpHi[contactIndex];
-                const double fmin = (STATIC_FRICTION_BY_TWO_CONSTRAINTS ? -fmax : 0.0);
 
-                if(xx < fmin){
-                    x(j) = fmin;
-                } else if(xx > fmax){
-                    x(j) = fmax;
-                } else {
-                    x(j) = xx;
-                }
-                x(j) *= r;
-                r += rstep;
-            }
-        }
-    }
+int BCConstraintForceSolver::numAssemblies() const
+{
+    return impl->numAssemblies;
 }
 
 
-void BCCFSImpl::checkLCPResult(MatrixX& M, VectorX& b, VectorX& x)
+int BCConstraintForceSolver::numParallelAssemblies() const
 {
-    os << "check LCP result\n";
-    os << "-------------------------------\n";
+    return impl->numParallelAssemblies;
+}
 
-    VectorX z = M * x + b;
 
-    int n = x.size();
-    for(int i=0; i < n; ++i){
-        os << "(" << x(i) << ", " << z(i) << ")";
+int BCConstraintForceSolver::numRootInertiaFactorizationsInLastStep() const
+{
+    return impl->numRootInertiaFactorizationsInStep;
+}
 
-        if(x(i) < 0.0 || z(i) < 0.0 || x(i) * z(i) != 0.0){
-            os << " - X";
-        }
-        os << "\n";
 
-        if(i == globalNumConstraintVectors){
-            os << "-------------------------------\n";
-        } else if(i == globalNumConstraintVectors + globalNumFrictionVectors){
-            os << "-------------------------------\n";
-        }
-    }
+int BCConstraintForceSolver::numRootInertiaSolvesInLastStep() const
+{
+    return impl->numRootInertiaSolvesInStep;
+}
 
-    os << "-------------------------------\n";
+
+long BCConstraintForceSolver::totalNumRootInertiaFactorizations() const
+{
+    return impl->totalNumRootInertiaFactorizations;
+}
 
 
-    os << std::endl;
+long BCConstraintForceSolver::totalNumRootInertiaSolves() const
+{
+    return impl->totalNumRootInertiaSolves;
 }
 
 
-void BCCFSImpl::checkMCPResult(MatrixX& M, VectorX& b, VectorX& x)
+int BCConstraintForceSolver::numRootInertiaQRFallbacks() const
 {
-    os << "check MCP result\n";
-    os << "-------------------------------\n";
+    return impl->numRootInertiaQRFallbacks;
+}
 
-    VectorX z = M * x + b;
 
-    for(int i=0; i < globalNumConstraintVectors; ++i){
-        os << "(" << x(i) << ", " << z(i) << ")";
+void BCConstraintForceSolver::setNumThreads(int n)
+{
+    impl->threadPool.setNumThreads(n);
+}
 
-        if(x(i) < 0.0 || z(i) < -1.0e-6){
-            os << " - X";
-        } else if(x(i) > 0.0 && fabs(z(i)) > 1.0e-6){
-            os << " - X";
-        } else if(z(i) > 1.0e-6 && fabs(x(i)) > 1.0e-6){
-            os << " - X";
-        }
 
+int BCConstraintForceSolver::numThreads() const
+{
+    return impl->threadPool.numThreads();
+}
 
-        os << "\n";
-    }
 
-    os << "-------------------------------\n";
+int BCConstraintForceSolver::maxNumColors() const
+{
+    return impl->maxNumColors;
+}
 
-    int j = 0;
-    for(int i=globalNumConstraintVectors; i < globalNumConstraintVectors + globalNumFrictionVectors; ++i, ++j){
-        os << "(" << x(i) << ", " << z(i) << ")";
 
-        int contactIndex = frictionIndexToContactIndex[j];
-        double hi = contactIndexToMu[contactIndex] * x(contactIndex);
+int BCConstraintForceSolver::maxNumIslands() const
+{
+    return impl->maxNumIslands;
+}
 
-        os << " hi = " << hi;
 
-        if(x(i) < 0.0 || x(i) > hi){
-            os << " - X";
-        } else if(x(i) == hi && z(i) > -1.0e-6){
-            os << " - X";
-        } else if(x(i) < hi && x(i) > 0.0 && fabs(z(i)) > 1.0e-6){
-            os << " - X";
-        }
-        os << "\n";
-    }
+int BCConstraintForceSolver::maxColorClassSize() const
+{
+    return impl->maxColorClassSize;
+}
 
-    os << "-------------------------------\n";
 
-    os << std::endl;
+int BCConstraintForceSolver::numUnconvergedBlockGaussSeidelSolutions() const
+{
+    return impl->numBlockGaussSeidelUnconverged;
 }
 
 
-#ifdef USE_PIVOTING_LCP
-bool BCCFSImpl::callPathLCPSolver(MatrixX& Mlcp, VectorX& b, VectorX& solution)
+int BCConstraintForceSolver::numWarmStartedPoints() const
 {
-    int size = solution.size();
-    int square = size * size;
-    std::vector<double> lb(size + 1, 0.0);
-    std::vector<double> ub(size + 1, 1.0e20);
+    return impl->numWarmStartedPoints;
+}
 
-    int m_nnz = 0;
-    std::vector<int> m_i(square + 1);
-    std::vector<int> m_j(square + 1);
-    std::vector<double> m_ij(square + 1);
 
-    for(int i=0; i < size; ++i){
-        solution(i) = 0.0;
-    }
+int BCConstraintForceSolver::numColdStartedPoints() const
+{
+    return impl->numColdStartedPoints;
+}
 
-    for(int j=0; j < size; ++j){
-        for(int i=0; i < size; ++i){
-            double v = Mlcp(i, j);
-            if(v != 0.0){
-                m_i[m_nnz] = i+1;
-                m_j[m_nnz] = j+1;
-                m_ij[m_nnz] = v;
-                ++m_nnz;
-            }
-        }
-    }
 
-    MCP_Termination status;
+long BCConstraintForceSolver::totalNumWarmStartedPoints() const
+{
+    return impl->totalNumWarmStartedPoints;
+}
 
-    SimpleLCP(size, m_nnz, &m_i[0], &m_j[0], &m_ij[0], &b(0), &lb[0], &ub[0], &status, &solution(0));
 
-    return (status == MCP_Solved);
+long BCConstraintForceSolver::totalNumColdStartedPoints() const
+{
+    return impl->totalNumColdStartedPoints;
 }
-#endif
 
 
-BCConstraintForceSolver::BCConstraintForceSolver(WorldBase& world)
+void BCConstraintForceSolver::setMaxNumContactPointsPerLinkPair(int n)
 {
-    impl = new BCCFSImpl(world);
+    impl->maxNumContactPointsPerLinkPair = std::max(0, n);
 }
 
 
-BCConstraintForceSolver::~BCConstraintForceSolver()
+int BCConstraintForceSolver::maxNumContactPointsPerLinkPair() const
 {
-    delete impl;
+    return impl->maxNumContactPointsPerLinkPair;
 }
 
 
-void BCConstraintForceSolver::setCollisionDetector(CollisionDetectorPtr detector)
+void BCConstraintForceSolver::setMaxNumContactPointsPerStep(int n)
 {
-    impl->collisionDetector = detector;
+    impl->maxNumContactPointsPerStep = std::max(0, n);
 }
 
 
-CollisionDetectorPtr BCConstraintForceSolver::collisionDetector()
+int BCConstraintForceSolver::maxNumContactPointsPerStep() const
 {
-    return impl->collisionDetector;
+    return impl->maxNumContactPointsPerStep;
 }
 
 
-void BCConstraintForceSolver::setFriction(double staticFriction, double slipFliction)
+void BCConstraintForceSolver::setPatchContactMode(bool on)
 {
-    impl->defaultStaticFriction = staticFriction;
-    impl->defaultSlipFriction = slipFliction;
+    impl->isPatchContactMode = on;
 }
 
 
-double BCConstraintForceSolver::staticFriction() const
+bool BCConstraintForceSolver::isPatchContactMode() const
 {
-    return impl->defaultStaticFriction;
+    return impl->isPatchContactMode;
 }
 
 
-double BCConstraintForceSolver::slipFriction() const
+void BCConstraintForceSolver::setLinkPairEvictionSteps(int n)
 {
-    return impl->defaultSlipFriction;
+    impl->linkPairEvictionSteps = std::max(0, n);
 }
 
 
-void BCConstraintForceSolver::setContactCullingDistance(double distance)
+int BCConstraintForceSolver::linkPairEvictionSteps() const
 {
-    impl->defaultContactCullingDistance = distance;
+    return impl->linkPairEvictionSteps;
 }
 
 
-double BCConstraintForceSolver::contactCullingDistance() const
+int BCConstraintForceSolver::numRawContactPointsInLastStep() const
 {
-    return impl->defaultContactCullingDistance;
+    return impl->numRawContactPointsInStep;
 }
 
 
-void BCConstraintForceSolver::setContactCullingDepth(double depth)
+int BCConstraintForceSolver::numKeptContactPointsInLastStep() const
 {
-    impl->defaultContactCullingDepth = depth;
+    return impl->numKeptContactPointsInStep;
 }
 
 
-double BCConstraintForceSolver::contactCullingDepth()
+long BCConstraintForceSolver::totalNumRawContactPoints() const
 {
-    return impl->defaultContactCullingDepth;
+    return impl->totalNumRawContactPoints;
 }
 
 
-void BCConstraintForceSolver::setCoefficientOfRestitution(double epsilon)
+long BCConstraintForceSolver::totalNumKeptContactPoints() const
 {
-    impl->defaultCoefficientOfRestitution = epsilon;
+    return impl->totalNumKeptContactPoints;
 }
 
 
-double BCConstraintForceSolver::coefficientOfRestitution() const
+long BCConstraintForceSolver::totalNumContactPatches() const
 {
-    return impl->defaultCoefficientOfRestitution;
+    return impl->totalNumContactPatches;
 }
 
 
-void BCConstraintForceSolver::setGaussSeidelErrorCriterion(double e)
+int BCConstraintForceSolver::numCachedLinkPairs() const
 {
-    impl->gaussSeidelErrorCriterion = e;
-/*BC*/  impl->pSNSCore->setGaussSeidelErrorCriterion(e);
-/*BC*/  impl->pQMRCore->setGaussSeidelErrorCriterion(e);
+    return impl->geometryPairToLinkPairMap.size();
 }
 
 
-double BCConstraintForceSolver::gaussSeidelErrorCriterion()
+size_t BCConstraintForceSolver::linkPairCacheMemoryUsage() const
 {
-    return impl->gaussSeidelErrorCriterion;
+    return impl->linkPairCacheMemoryUsage();
 }
 
 
-void BCConstraintForceSolver::setGaussSeidelMaxNumIterations(int n)
+long BCConstraintForceSolver::totalNumEvictedLinkPairs() const
 {
-    impl->maxNumGaussSeidelIteration = n;
-/*BC*/ impl->pSNSCore->setGaussSeidelMaxNumIterations(n);
-/*BC*/ impl->pQMRCore->setGaussSeidelMaxNumIterations(n);
+    return impl->geometryPairToLinkPairMap.totalNumEvictedEntries();
 }
 
 
-int BCConstraintForceSolver::gaussSeidelMaxNumIterations()
+void BCConstraintForceSolver::setAutoPenaltyMaxNumConstraints(int n)
 {
-    return impl->maxNumGaussSeidelIteration;
+    impl->autoPenaltyMaxNumConstraints = std::max(0, n);
 }
 
 
-void BCConstraintForceSolver::setContactDepthCorrection(double depth, double velocityRatio)
+int BCConstraintForceSolver::autoPenaltyMaxNumConstraints() const
 {
-    impl->contactCorrectionDepth = depth;
-    impl->contactCorrectionVelocityRatio = velocityRatio;
+    return impl->autoPenaltyMaxNumConstraints;
 }
 
 
-double BCConstraintForceSolver::contactCorrectionDepth()
+void BCConstraintForceSolver::setAutoPenaltyMaxSolutionTime(double time)
 {
-    return impl->contactCorrectionDepth;
+    impl->autoPenaltyMaxSolutionTime = std::max(0.0, time);
 }
 
 
-double BCConstraintForceSolver::contactCorrectionVelocityRatio()
+double BCConstraintForceSolver::autoPenaltyMaxSolutionTime() const
 {
-    return impl->contactCorrectionVelocityRatio;
+    return impl->autoPenaltyMaxSolutionTime;
 }
 
 
-void BCConstraintForceSolver::enableConstraintForceOutput(bool on)
+int BCConstraintForceSolver::numAutoPenaltyLinkPairsInLastStep() const
 {
-    impl->isConstraintForceOutputMode = on;
+    return impl->numAutoPenaltyLinkPairsInStep;
 }
 
 
-void BCConstraintForceSolver::set2Dmode(bool on)
+long BCConstraintForceSolver::totalNumAutoPenaltyLinkPairs() const
 {
-    impl->is2Dmode = on;
+    return impl->totalNumAutoPenaltyLinkPairs;
 }
 
 
@@ -2468,63 +6311,253 @@ double BCConstraintForceSolver::getCollisionTime()
 }
 #endif
 /**************************************************/
+/**
+   The penalty forces of all the penalty-based link pairs in a step. The stiffness and the
+   damping are calculated once per pair, and the forces of the points of a pair are calculated
+   column-wise over the contiguous vectors in contactPoints. The sums of the forces and the
+   torques of the pairs are calculated in parallel for many pairs, and then the force to the
+   link 1 of each pair and its negation to the link 0 are added in one pass.
+
+   In the implicit mode, the forces of a pair depend on the forces of the other pairs on its
+   links, so they are calculated PENALTY_IMPLICIT_NUM_ITERATIONS times from zero. Each iteration
+   sums the forces of the previous one on the links serially and then calculates all the
+   pairs from the sums, which keeps the parallel calculation of the pairs.
+*/
 void BCCFSImpl::addPenaltyForceToLinks()
 {
-    int n = constrainedLinkPairs.size();
-    for(int i=0; i < n; ++i){
+    penaltyLinkPairs.clear();
+    penaltyPairColumns.clear();
+    int numPoints = 0;
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
         LinkPair* linkPair = constrainedLinkPairs[i];
-        if(!linkPair->isPenaltyBased) continue;
-        for(int j=0; j < 2; ++j){
-            // if(!linkPair->link[j]->isRoot() || linkPair->link[j]->jointType != Link::FIXED_JOINT){
-            addPenaltyForceToLink(linkPair, j);
-            // }
+        if(linkPair->isPenaltyBased && !linkPair->constraintPoints.empty()){
+            penaltyLinkPairs.push_back(linkPair);
+            penaltyPairColumns.push_back(numPoints);
+            numPoints += linkPair->constraintPoints.size();
+            if(isPenaltyImplicitAvailable(*linkPair)){
+                ++totalNumImplicitPenaltyLinkPairs;
+            }
+        }
+    }
+    const int numPairs = penaltyLinkPairs.size();
+    if(numPairs == 0){
+        return;
+    }
+
+    // the buffers only grow
+    if(penaltyForces.cols() < numPoints){
+        penaltyForces.resize(3, 2 * numPoints);
+        penaltyDepths.resize(2 * numPoints);
+        penaltyNormalVelocities.resize(2 * numPoints);
+        penaltyNormalForces.resize(2 * numPoints);
+    }
+    penaltyPairForces.assign(numPairs, Vector3::Zero());
+    penaltyPairTorques.assign(numPairs, Vector3::Zero());
+
+    const int numIterations = isPenaltyImplicitMode ? PENALTY_IMPLICIT_NUM_ITERATIONS : 1;
+    for(int iteration=0; iteration < numIterations; ++iteration){
+        if(isPenaltyImplicitMode){
+            for(int i=0; i < numPairs; ++i){
+                for(int k=0; k < 2; ++k){
+                    penaltyLinkPairs[i]->linkData[k]->penaltyForce.setZero();
+                    penaltyLinkPairs[i]->linkData[k]->penaltyTorque.setZero();
+                }
+            }
+            for(int i=0; i < numPairs; ++i){
+                LinkData* data0 = penaltyLinkPairs[i]->linkData[0];
+                LinkData* data1 = penaltyLinkPairs[i]->linkData[1];
+                data1->penaltyForce  += penaltyPairForces[i];
+                data1->penaltyTorque += penaltyPairTorques[i];
+                data0->penaltyForce  -= penaltyPairForces[i];
+                data0->penaltyTorque -= penaltyPairTorques[i];
+            }
         }
+        if(threadPool.numThreads() > 1 && numPairs >= PENALTY_PARALLEL_MIN_NUM_PAIRS){
+            const int chunkSize = (numPairs + threadPool.numThreads() * 4 - 1) / (threadPool.numThreads() * 4);
+            const int numChunks = (numPairs + chunkSize - 1) / chunkSize;
+            threadPool.run(numChunks, boost::bind(&BCCFSImpl::calcPenaltyForcesOfChunk, this, _1, chunkSize));
+        } else {
+            calcPenaltyForcesOfChunk(0, numPairs);
+        }
+    }
+
+    for(int i=0; i < numPairs; ++i){
+        LinkPair* linkPair = penaltyLinkPairs[i];
+        DyLink* link0 = linkPair->link[0];
+        DyLink* link1 = linkPair->link[1];
+        link1->f_ext()   += penaltyPairForces[i];
+        link1->tau_ext() += penaltyPairTorques[i];
+        link0->f_ext()   -= penaltyPairForces[i];
+        link0->tau_ext() -= penaltyPairTorques[i];
     }
 }
 
-void BCCFSImpl::addPenaltyForceToLink(LinkPair* linkPair, int ipair)
+
+void BCCFSImpl::calcPenaltyForcesOfChunk(int chunk, int chunkSize)
 {
-    if(!linkPair->isPenaltyBased) return;
-    Vector3 f_total   = Vector3::Zero();
-    Vector3 tau_total = Vector3::Zero();
-    ConstraintPointArray& constraintPoints = linkPair->constraintPoints;
-    int numConstraintPoints = constraintPoints.size();
-    DyLink* link = linkPair->link[ipair];
+    const int begin = chunk * chunkSize;
+    const int end = std::min(begin + chunkSize, static_cast<int>(penaltyLinkPairs.size()));
+    for(int i=begin; i < end; ++i){
+        calcPenaltyForcesOfLinkPair(i);
+    }
+}
+
+
+/**
+   The force to the link 1 is the spring-damper force along the normal toward the inside
+   of the link 1 and the damping of the tangential velocity saturated by kkwsat.
+   relVelocityOn0 holds v1 - v0, the velocity of the link 1 relative to the link 0.
+
+   In the implicit mode, the spring and the damping act on the depth and the velocity at the
+   end of the step. With the linearized velocity v + T a - T w f, where a is the acceleration
+   of the point by the gravity and the other forces on the links and w is the inverse of the
+   effective mass of the two links along the direction at the point, the force of
+   kp (depth + T v) + kd v is (kp depth + c (v + T a)) / (1 + c T w). The other forces are the
+   external forces and the forces of the other pairs in the previous iteration, and the
+   rigid inertias of the links are used for a and w, where the n points of the pair share w.
+   The rigid inertia is the effective mass only for the single link of a free body, so a pair
+   with a link of a moving articulated body is explicit.
+*/
+void BCCFSImpl::calcPenaltyForcesOfLinkPair(int pairIndex)
+{
+    LinkPair& linkPair = *penaltyLinkPairs[pairIndex];
+    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int n = constraintPoints.size();
+    const int begin = constraintPoints.front().index;
+    const int column = penaltyPairColumns[pairIndex];
+
+    Eigen::Map<Eigen::Matrix3Xd> points = ContactPointStore::columns(contactPoints.points, begin, n);
+    Eigen::Map<Eigen::Matrix3Xd> normals = ContactPointStore::columns(contactPoints.normals, begin, n);
+    Eigen::Map<Eigen::Matrix3Xd> relVelocities = ContactPointStore::columns(contactPoints.relVelocities, begin, n);
+
     double T  = world.timeStep();
-    for(int i=0; i < numConstraintPoints; ++i) 
-    {
-        ConstraintPoint& constraint = constraintPoints[i];
-        double minM  = kkwmin(linkPair->linkData[0]->link->mass(),
-                              linkPair->linkData[1]->link->mass());
-        double maxN  = kkwmax(linkPair->linkData[0]->penaltySpringCount,
-                              linkPair->linkData[1]->penaltySpringCount);
-               maxN  = kkwmax(maxN, 1.);
-        double kp = ( minM/(T*T*maxN)/200    ) * penaltyKpCoef ;
-        double kd = ( 2.* sqrt( minM * kp)/5 ) * penaltyKvCoef ;
-        Vector3  n = constraint.normalTowardInside[ipair];
-        Vector3  v = ((ipair==0)?(1.):(-1.))* constraint.relVelocityOn0;
-        double   v_n =  n.dot(v) ;
-        Vector3  v_t =  v  - n* v_n ;
-        //  p = p + v*T
-        //  v =     v + a*T
-        Vector3  f = (constraint.depth * kp + v_n * (kp*T+kd)) * n ;
-                 f +=                         v_t * (kp*T+kd)      ;
-        double fn = f.dot(n);
-        double mu = linkPair->muDynamic;
-        f =  n * kkwmax(fn,0) + kkwsat( mu*fn, f - n * fn) ;
-        f_total += f;
-        tau_total += constraint.point.cross(f);
+    double minM  = kkwmin(linkPair.linkData[0]->link->mass(),
+                          linkPair.linkData[1]->link->mass());
+    double maxN  = kkwmax(linkPair.linkData[0]->penaltySpringCount,
+                          linkPair.linkData[1]->penaltySpringCount);
+           maxN  = kkwmax(maxN, 1.);
+    double kp = ( minM/(T*T*maxN)/200    ) * penaltyKpCoef ;
+    double kd = ( 2.* sqrt( minM * kp)/5 ) * penaltyKvCoef ;
+    const double c = kp*T + kd;
+    const double mu = linkPair.muDynamic;
+
+    // the inverse masses, the centers of mass, the inverse inertias and the accelerations
+    // by the other forces of the links
+    double invMasses[2] = { 0.0, 0.0 };
+    Vector3 centersOfMass[2];
+    Matrix3 invInertias[2];
+    Vector3 accelerations[2];
+    Vector3 angularAccelerations[2];
+    if(isPenaltyImplicitAvailable(linkPair)){
+        for(int k=0; k < 2; ++k){
+            DyLink* link = linkPair.link[k];
+            accelerations[k].setZero();
+            angularAccelerations[k].setZero();
+            if(linkPair.bodyData[k]->isStatic || (link->isRoot() && link->isFixedJoint()) || link->m() <= 0.0){
+                continue;
+            }
+            invMasses[k] = 1.0 / link->m();
+            centersOfMass[k] = link->p() + link->R() * link->c();
+            const Matrix3 I = link->R() * link->I() * link->R().transpose();
+            if(I.determinant() > 0.0){
+                invInertias[k] = I.inverse();
+            } else {
+                invInertias[k].setZero();
+            }
+            // the force of this pair is to the link 1 and its negation to the link 0
+            const double sign = (k == 1) ? 1.0 : -1.0;
+            const Vector3 f = link->f_ext() + linkPair.linkData[k]->penaltyForce - sign * penaltyPairForces[pairIndex];
+            const Vector3 tau = link->tau_ext() + linkPair.linkData[k]->penaltyTorque - sign * penaltyPairTorques[pairIndex];
+            accelerations[k] = world.getGravityAcceleration() + invMasses[k] * f;
+            angularAccelerations[k] = invInertias[k] * (tau - centersOfMass[k].cross(f));
+        }
     }
-    link->f_ext()   += f_total;
-    link->tau_ext() += tau_total;
+    const bool isImplicit = (invMasses[0] > 0.0 || invMasses[1] > 0.0);
+
+    Eigen::VectorBlock<Eigen::RowVectorXd> depths = penaltyDepths.segment(column, n);
+    Eigen::VectorBlock<Eigen::RowVectorXd> normalVelocities = penaltyNormalVelocities.segment(column, n);
+    Eigen::VectorBlock<Eigen::RowVectorXd> normalForces = penaltyNormalForces.segment(column, n);
+    Eigen::Block<Eigen::Matrix3Xd, 3, Eigen::Dynamic, true> forces = penaltyForces.middleCols(column, n);
+
+    for(int i=0; i < n; ++i){
+        depths(i) = constraintPoints[i].depth;
+    }
+    // the relative velocities at the end of the step without the forces of the pair
+    forces = relVelocities;
+    if(isImplicit){
+        for(int i=0; i < n; ++i){
+            for(int k=0; k < 2; ++k){
+                if(invMasses[k] > 0.0){
+                    const Vector3 r = points.col(i) - centersOfMass[k];
+                    const Vector3 a = accelerations[k] + angularAccelerations[k].cross(r);
+                    forces.col(i) += (k == 1) ? Vector3(T * a) : Vector3(-T * a);
+                }
+            }
+        }
+    }
+    normalVelocities = -normals.cwiseProduct(forces).colwise().sum();
+    forces = -forces - normals * normalVelocities.asDiagonal(); // tangential velocities
+    normalForces = kp * depths + c * normalVelocities;
+
+    // kkwsat(mu * fn, c * vt) = c * vt * min(1, max(mu * fn, 0) / |c * vt|)
+    for(int i=0; i < n; ++i){
+        double ct = c;
+        const double vt = forces.col(i).norm();
+        if(isImplicit){
+            const Vector3 normal = normals.col(i);
+            const Vector3 tangent = (vt > 0.0) ? Vector3(forces.col(i) / vt) : Vector3(Vector3::Zero());
+            double wn = 0.0;
+            double wt = 0.0;
+            for(int k=0; k < 2; ++k){
+                if(invMasses[k] > 0.0){
+                    const Vector3 r = points.col(i) - centersOfMass[k];
+                    const Vector3 rn = r.cross(normal);
+                    const Vector3 rt = r.cross(tangent);
+                    wn += invMasses[k] + rn.dot(invInertias[k] * rn);
+                    wt += invMasses[k] + rt.dot(invInertias[k] * rt);
+                }
+            }
+            normalForces(i) /= (1.0 + c * T * n * wn);
+            ct = c / (1.0 + c * T * n * wt);
+        }
+        const double fmax = mu * normalForces(i);
+        const double ft = ct * vt;
+        const double scale = (fmax <= 0.0) ? 0.0 : ((fmax >= ft) ? 1.0 : (fmax / ft));
+        forces.col(i) *= ct * scale;
+    }
+    forces += normals * normalForces.cwiseMax(0.0).asDiagonal();
+
+    Vector3 tau = Vector3::Zero();
+    for(int i=0; i < n; ++i){
+        tau += points.col(i).cross(forces.col(i));
+    }
+    penaltyPairForces[pairIndex] = forces.rowwise().sum();
+    penaltyPairTorques[pairIndex] = tau;
+}
+bool BCCFSImpl::isPenaltyImplicitAvailable(const LinkPair& linkPair) const
+{
+    if(!isPenaltyImplicitMode){
+        return false;
+    }
+    for(int k=0; k < 2; ++k){
+        if(!linkPair.bodyData[k]->isStatic && linkPair.bodyData[k]->body->numLinks() > 1){
+            return false;
+        }
+    }
+    return true;
 }
 /********************************************/
 void   BCConstraintForceSolver::setPenaltySizeRatio(double arg){impl->penaltySizeRatio = arg;}
+void   BCConstraintForceSolver::setPenaltyImplicitMode(bool on){impl->isPenaltyImplicitMode = on;}
 void   BCConstraintForceSolver::setPenaltyKpCoef   (double arg){impl->penaltyKpCoef    = arg;}
 void   BCConstraintForceSolver::setPenaltyKvCoef   (double arg){impl->penaltyKvCoef    = arg;}
 void   BCConstraintForceSolver::setSolverID        (int    arg){impl->solverID         = arg;}
+void   BCConstraintForceSolver::setPenaltyBodyNames(const std::vector<std::string>& names){impl->penaltyBodyNames = names;}
 double BCConstraintForceSolver::penaltySizeRatio   () { return impl->penaltySizeRatio;}
+bool   BCConstraintForceSolver::isPenaltyImplicitMode() const { return impl->isPenaltyImplicitMode;}
+long   BCConstraintForceSolver::totalNumImplicitPenaltyLinkPairs() const { return impl->totalNumImplicitPenaltyLinkPairs;}
 double BCConstraintForceSolver::penaltyKpCoef      () { return impl->penaltyKpCoef   ;}
 double BCConstraintForceSolver::penaltyKvCoef      () { return impl->penaltyKvCoef   ;}
 int    BCConstraintForceSolver::solverID           () { return impl->solverID        ;}
+const std::vector<std::string>& BCConstraintForceSolver::penaltyBodyNames() const { return impl->penaltyBodyNames;}
 /********************************************/
@@ -38,6 +38,8 @@ ORIGINAL FILE: src/Body/ConstraintForceSolver.h
 #define CNOID_BCCONSTRAINT_FORCE_SOLVER_H
 
 #include <cnoid/CollisionSeq>
+#include <string>
+#include <vector>
 //#include "exportdecl.h"
 
 namespace cnoid
@@ -85,6 +87,175 @@ public:
     void set2Dmode(bool on);
     void enableConstraintForceOutput(bool on);
 
+    void setSparseMatrixMode(bool on);
+    bool isSparseMatrixMode() const;
+
+    /**
+       The friction vectors of a contact are given by projecting the ones of the
+       nearest contact point of the previous step onto the current tangent plane.
+    */
+    void setStableFrictionBasisMode(bool on);
+    bool isStableFrictionBasisMode() const;
+
+    /**
+       The LCP of each group of the bodies connected by the constraints is solved separately,
+       and the groups are solved in parallel. Only the solution is split: the matrix of the
+       whole step is still assembled, in the sparse storage whether or not setSparseMatrixMode()
+       is given, and the blocks of the groups are copied from its nonzero elements. With the
+       Siconos solver, the islands are solved one after another in one thread.
+    */
+    void setIslandMode(bool on);
+    bool isIslandMode() const;
+
+    /**
+       The contact points of a link pair are reduced to the given number of the points which
+       include the deepest one and span the support polygon. The contact points of a step are
+       reduced to the given number of the deepest ones. Zero means no limit.
+    */
+    void setMaxNumContactPointsPerLinkPair(int n);
+    int maxNumContactPointsPerLinkPair() const;
+    void setMaxNumContactPointsPerStep(int n);
+    int maxNumContactPointsPerStep() const;
+    /**
+       The contact points of a link pair forming a flat patch are replaced by one point with
+       the torsional friction and the tilting moments of the patch. This is only used with
+       the projected Gauss-Seidel solver without the symmetric matrix, island, matrix-free
+       and Jacobian assembly modes.
+    */
+    void setPatchContactMode(bool on);
+    bool isPatchContactMode() const;
+    /**
+       The link pair of a geometry pair, which keeps the data of its contact points between
+       the steps, is removed when the pair has not collided for the given number of steps.
+       Zero means that the link pairs are kept until initialize().
+    */
+    void setLinkPairEvictionSteps(int n);
+    int linkPairEvictionSteps() const;
+    /**
+       When the number of the contact constraints of a step exceeds the given number, or the
+       time of the constraint solution of the previous step exceeds the given time in seconds,
+       the least important contact link pairs are moved to the penalty-based contacts for the
+       step. The light, slow and distant ones from the articulated bodies come first, and the
+       pairs are restored when the budget allows. Zero means no limit.
+    */
+    void setAutoPenaltyMaxNumConstraints(int n);
+    int autoPenaltyMaxNumConstraints() const;
+    void setAutoPenaltyMaxSolutionTime(double time);
+    double autoPenaltyMaxSolutionTime() const;
+    void setNumThreads(int n);
+    int numThreads() const;
+
+    /**
+       True if the solver ID 5 (matrix-free Gauss-Seidel) is given and no body
+       is solved by ForwardDynamicsCBM. Otherwise the solver ID 5 works as the
+       projected Gauss-Seidel method with the assembled matrix. Valid after initialize().
+    */
+    bool isMatrixFreeMode() const;
+
+    /**
+       Mlcp is assembled from the contact Jacobians and the factorized joint-space inertia
+       of each body instead of applying the test forces one by one. The result is compared
+       with the assembly by the test forces periodically, and the test forces are used for
+       the rest of the simulation when they do not agree.
+    */
+    void setJacobianAssemblyMode(bool on);
+    bool isJacobianAssemblyMode() const;
+    bool isJacobianAssemblyUnsafe() const;
+    int numJacobianAssemblyChecks() const;
+    // largest difference found by the check relative to the largest element
+    double maxJacobianAssemblyError() const;
+
+    /**
+       Mlcp is assumed to be symmetric, so only the elements of its upper triangle are
+       calculated and stored in packed form, which the solvers read directly. This mode is
+       not used with the sparse matrix, island, matrix-free or Jacobian assembly modes, nor in the
+       steps where a body solved by ForwardDynamicsCBM has a constraint between its own links.
+       The half assembly is compared with the full assembly at sampled columns periodically,
+       and it is not used for the rest of the simulation when they do not agree.
+    */
+    void setSymmetricMatrixMode(bool on);
+    bool isSymmetricMatrixMode() const;
+    bool isSymmetricMatrixUnsafe() const;
+    // steps assembled fully because of the constraints between the links of a ForwardDynamicsCBM body
+    int numSymmetricMatrixFallbacks() const;
+    // largest difference found by the sampled check relative to the largest element
+    double maxSymmetricMatrixError() const;
+
+    /**
+       The test forces of the link pairs are applied by the threads of setNumThreads()
+       with their own copies of the scratch data of the ABM calculation. The result is the
+       same as the serial assembly. The serial assembly is used when a constrained body is
+       solved by ForwardDynamicsCBM. The accelerations without the constraint forces
+       are also calculated in parallel for the bodies and the link pairs.
+    */
+    void setParallelAssemblyMode(bool on);
+    bool isParallelAssemblyMode() const;
+
+    /**
+       The accelerations of the links of the constrained bodies solved by ABM are set with
+       the constraint forces by the ABM force elements of this solver, which already include
+       the bottom-up sweep of the phase 2 of ABM. BCForwardDynamicsABM skips the phases 2
+       and 3 of a body when areArticulatedAccelerationsGiven() is true in the step.
+       The mode only takes effect with the matrix-free solver (solver ID 5), whose iterations
+       have already committed the forces to the force elements, and is ignored otherwise.
+    */
+    void setFusedABMMode(bool on);
+    bool isFusedABMMode() const;
+    bool areArticulatedAccelerationsGiven(int bodyIndex) const;
+    // links whose accelerations were given since initialize()
+    long totalNumFusedABMLinks() const;
+
+    // time of the assembly of Mlcp (setAccelerationMatrix) since initialize()
+    double totalAssemblyTime() const;
+    int numAssemblies() const;
+    // assemblies whose test forces were applied by the threads since initialize()
+    int numParallelAssemblies() const;
+
+    // the articulated inertia of a free root link is factorized once per body and step
+    int numRootInertiaFactorizationsInLastStep() const;
+    int numRootInertiaSolvesInLastStep() const;
+    // sums since initialize()
+    long totalNumRootInertiaFactorizations() const;
+    long totalNumRootInertiaSolves() const;
+    // factorizations by the QR decomposition because the inertia was ill-conditioned
+    int numRootInertiaQRFallbacks() const;
+
+    // coloring quality of the parallel Gauss-Seidel solver since initialize()
+    int maxNumColors() const;
+    int maxColorClassSize() const;
+
+    // largest number of the islands in a step since initialize()
+    int maxNumIslands() const;
+
+    // solutions of the block Gauss-Seidel solver which stopped at the maximum number of the
+    // iterations since initialize(); their last iterates are applied
+    int numUnconvergedBlockGaussSeidelSolutions() const;
+
+    // constraint points given the previous solution by the contact identity in the last step
+    int numWarmStartedPoints() const;
+    int numColdStartedPoints() const;
+    // sums since initialize()
+    long totalNumWarmStartedPoints() const;
+    long totalNumColdStartedPoints() const;
+
+    // collision points given by the collision detector and those kept after the culling in the last step
+    int numRawContactPointsInLastStep() const;
+    int numKeptContactPointsInLastStep() const;
+    // sums since initialize()
+    long totalNumRawContactPoints() const;
+    long totalNumKeptContactPoints() const;
+    // contact patches which replaced their points since initialize()
+    long totalNumContactPatches() const;
+
+    // link pairs kept for the geometry pairs and the bytes used by them
+    int numCachedLinkPairs() const;
+    size_t linkPairCacheMemoryUsage() const;
+    // link pairs removed by the eviction since initialize()
+    long totalNumEvictedLinkPairs() const;
+    // link pairs moved to the penalty-based contacts by the budgets in the last step and since initialize()
+    int numAutoPenaltyLinkPairsInLastStep() const;
+    long totalNumAutoPenaltyLinkPairs() const;
+
 
     void initialize(void);
     void solve();
@@ -104,6 +275,16 @@ public:
     void setPenaltyKvCoef(double aKvCoef);
     void setPenaltySizeRatio(double aSizeRatio);
     void setSolverID     (int arg);
+    // the contacts of the given bodies, as well as the bodies whose names start with "PEN", are penalty-based
+    void setPenaltyBodyNames(const std::vector<std::string>& names);
+    const std::vector<std::string>& penaltyBodyNames() const;
+    // the spring and the damping of the penalty forces are integrated linearly implicitly, which allows larger time steps;
+    // only the pairs between the single-link free bodies and the static bodies are implicit, because the rigid
+    // inertia of a link of an articulated body is not its effective mass, and the other pairs stay explicit
+    void setPenaltyImplicitMode(bool on);
+    bool isPenaltyImplicitMode() const;
+    // penalty link pairs integrated implicitly, summed over the steps since initialize()
+    long totalNumImplicitPenaltyLinkPairs() const;
 };
 
 };
@@ -0,0 +1,283 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+
+
+#include <cnoid/EigenUtil>
+#include <Eigen/LU>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+
+
+#include "BCCoreBlockGS.h"
+
+
+using namespace cnoid;
+
+
+static const double THRESH_TO_SWITCH_REL_ERROR = 1.0e-8;
+
+
+BCCoreBlockGS::BCCoreBlockGS(int maxNumGaussSeidelIteration, double gaussSeidelErrorCriterion)
+{
+	SZ = 0;
+	NC = 0;
+	NITE = 0;
+	CONV = true;
+	setGaussSeidelMaxNumIterations(maxNumGaussSeidelIteration);
+	setGaussSeidelErrorCriterion  (gaussSeidelErrorCriterion);
+}
+void BCCoreBlockGS::setGaussSeidelMaxNumIterations(int n)
+{
+	MAXITE = n;
+}
+void BCCoreBlockGS::setGaussSeidelErrorCriterion(double e)
+{
+	ERRCRI = e;
+}
+
+BCCoreBlockGS::~BCCoreBlockGS()
+{
+  DeleteBuffer();
+}
+
+void BCCoreBlockGS::NewBuffer(int aSZ)
+{
+  if(aSZ<=0){SZ=0;DeleteBuffer();return;}
+  SZ = aSZ;
+  pri .resize(SZ);
+  ipr .resize(SZ);
+  keep.resize(SZ);
+  dg  .resize(SZ);
+  rbgn.resize(SZ+1);
+  z   .resize(SZ);
+  bp  .resize(SZ);
+}
+
+void BCCoreBlockGS::DeleteBuffer()
+{
+  pri .clear();
+  ipr .clear();
+  keep.clear();
+  dg  .clear();
+  rbgn.clear();
+  cidx.clear();
+  cval.clear();
+  D   .clear();
+  Dinv.clear();
+}
+
+
+/*
+ original layout : [ normals(NC) | bilaterals | frictions(2*NC) ]
+ permuted layout : [ n0 t0 s0 | n1 t1 s1 | ... | bilaterals ]
+*/
+void BCCoreBlockGS::setPermutation()
+{
+	const int NN = SZ - 2*NC;
+	for(int ia=0;ia<NC;ia++)
+	{
+		pri[3*ia+0] = ia;
+		pri[3*ia+1] = NN + 2*ia + 0;
+		pri[3*ia+2] = NN + 2*ia + 1;
+	}
+	for(int i=NC;i<NN;i++){pri[2*NC+i] = i;}
+	for(int p=0;p<SZ;p++){ipr[pri[p]] = p;}
+	D   .resize(NC);
+	Dinv.resize(NC);
+	for(int ia=0;ia<NC;ia++){D[ia].setZero();}
+	cidx.clear();
+	cval.clear();
+}
+
+void BCCoreBlockGS::beginRow(int p)
+{
+	rbgn[p] = cidx.size();
+	keep[p] = 1.0;
+	dg  [p] = 0.0;
+}
+
+void BCCoreBlockGS::addElement(int p, int q, double v)
+{
+	if(p==q)
+	{
+		if(v==numeric_limits<double>::max()){keep[p] = 0.0; return;} // cleared as singular
+		dg[p] = v;
+	}
+	const int ia = p/3;
+	if(p<3*NC){if(q/3==ia){D[ia](p-3*ia, q-3*ia) = v; return;}}
+	else      {if(q==p) return;}
+	cidx.push_back(q);
+	cval.push_back(v);
+}
+
+void BCCoreBlockGS::setDiagonalBlocks()
+{
+	rbgn[SZ] = cidx.size();
+	for(int ia=0;ia<NC;ia++)
+	{
+		Matrix3 A = D[ia];
+		for(int i=0;i<3;i++)
+		{
+			if(keep[3*ia+i]==0.0){A.row(i).setZero();A.col(i).setZero();A(i,i)=1.0;}
+		}
+		bool invertible;
+		double det;
+		A.computeInverseAndDetWithCheck(Dinv[ia], det, invertible);
+		if(!invertible)
+		{
+			Dinv[ia].setZero();
+			for(int i=0;i<3;i++){if(A(i,i)>0.)Dinv[ia](i,i) = 1./A(i,i);}
+		}
+	}
+}
+
+
+template<class TMatrix>
+void BCCoreBlockGS::setRowsOfFullMatrix(const TMatrix& A)
+{
+	for(int p=0;p<SZ;p++)
+	{
+		beginRow(p);
+		const int i = pri[p];
+		for(int q=0;q<SZ;q++)
+		{
+			const double v = A(i, pri[q]);
+			if(v!=0.){addElement(p, q, v);}
+		}
+	}
+}
+
+bool BCCoreBlockGS::callSolver(const MatrixX& A, const VectorX& ab, VectorX& ax, const VectorX& contactIndexToMu, ofstream& os)
+{
+	NC = contactIndexToMu.size();
+	if(SZ==0 || SZ<3*NC) return false;
+	setPermutation();
+	setRowsOfFullMatrix(A);
+	setDiagonalBlocks();
+	return solve(ab, ax, contactIndexToMu, os);
+}
+
+bool BCCoreBlockGS::callSolver(const BCPackedSymmetricMatrix& A, const VectorX& ab, VectorX& ax, const VectorX& contactIndexToMu, ofstream& os)
+{
+	NC = contactIndexToMu.size();
+	if(SZ==0 || SZ<3*NC) return false;
+	setPermutation();
+	setRowsOfFullMatrix(A);
+	setDiagonalBlocks();
+	return solve(ab, ax, contactIndexToMu, os);
+}
+
+bool BCCoreBlockGS::callSolver(const BCSparseMatrix& A, const VectorX& ab, VectorX& ax, const VectorX& contactIndexToMu, ofstream& os)
+{
+	NC = contactIndexToMu.size();
+	if(SZ==0 || SZ<3*NC) return false;
+	setPermutation();
+	for(int p=0;p<SZ;p++)
+	{
+		beginRow(p);
+		const int i = pri[p];
+		for(int k=A.rowBegin(i);k<A.rowEnd(i);k++)
+		{
+			const double v = A.value(k);
+			if(v!=0.){addElement(p, ipr[A.columnIndex(k)], v);}
+		}
+	}
+	setDiagonalBlocks();
+	return solve(ab, ax, contactIndexToMu, os);
+}
+
+
+bool BCCoreBlockGS::solve(const VectorX& ab, VectorX& ax, const VectorX& mu, ofstream& os)
+{
+	for(int p=0;p<SZ;p++){bp(p) = ab(pri[p]); z(p) = ax(pri[p]) * keep[p];}
+	double err = 0;
+	for(NITE=1;NITE<=MAXITE;NITE++)
+	{
+		double dz2 = 0, z2 = 0;
+		for(int ia=0;ia<NC;ia++)
+		{
+			const int p = 3*ia;
+			Vector3 r;
+			for(int i=0;i<3;i++)
+			{
+				double s = -bp(p+i);
+				for(int k=rbgn[p+i];k<rbgn[p+i+1];k++){s -= cval[k]*z(cidx[k]);}
+				r(i) = s * keep[p+i];
+			}
+			Vector3 f = Dinv[ia] * r;
+			const double fmax = mu(ia) * f(0);
+			const double ft2  = f(1)*f(1) + f(2)*f(2);
+			// the contact separates only if the normal velocity without the force is not negative.
+			// the normal force of the block can also be negative by the coupling with the friction
+			if(f(0)<=0. && r(0)<=0.){f.setZero();}
+			else if(f(0)<=0. || ft2 > fmax*fmax)
+			{
+				// keep the friction direction, and re-solve the normal row with the friction on the cone
+				double fn = 0., d1 = 0., d2 = 0.;
+				if(ft2>0.)
+				{
+					const double ft = sqrt(ft2);
+					d1 = f(1)/ft;
+					d2 = f(2)/ft;
+					const double den = D[ia](0,0) + mu(ia) * (D[ia](0,1)*d1 + D[ia](0,2)*d2);
+					if(den>0.){fn = r(0)/den;}
+				}
+				// the normal row is solved without the friction if the friction on the cone pulls the contact
+				if(fn<=0.)
+				{
+					d1 = 0.;
+					d2 = 0.;
+					fn = (D[ia](0,0)>0. && r(0)>0.) ? r(0)/D[ia](0,0) : 0.;
+				}
+				f(0) = fn;
+				f(1) = mu(ia) * fn * d1 * keep[p+1];
+				f(2) = mu(ia) * fn * d2 * keep[p+2];
+			}
+			for(int i=0;i<3;i++){const double d = f(i)-z(p+i); dz2 += d*d; z2 += f(i)*f(i); z(p+i) = f(i);}
+		}
+		for(int p=3*NC;p<SZ;p++)
+		{
+			double s = -bp(p);
+			for(int k=rbgn[p];k<rbgn[p+1];k++){s -= cval[k]*z(cidx[k]);}
+			const double f = (keep[p]!=0. && dg[p]!=0.) ? s/dg[p] : 0.;
+			const double d = f-z(p); dz2 += d*d; z2 += f*f; z(p) = f;
+		}
+		err = (sqrt(z2) > THRESH_TO_SWITCH_REL_ERROR) ? sqrt(dz2/z2) : sqrt(dz2);
+		if(err < ERRCRI) break;
+	}
+	if(NITE>MAXITE) NITE = MAXITE;
+	for(int p=0;p<SZ;p++){ax(pri[p]) = z(p);}
+	// the last iterate is applied also when it did not converge, as the other cores do
+	CONV = (err < ERRCRI);
+	if(!CONV){ os << "Block GS: not converged in " << NITE << " iterations, error " << err << std::endl; }
+	return true;
+}
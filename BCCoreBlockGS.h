@@ -0,0 +1,101 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+
+
+#ifndef CNOID_BCPLUGIN_BCCOREBLOCKGS_H
+#define CNOID_BCPLUGIN_BCCOREBLOCKGS_H
+
+#include <vector>
+#include <fstream>
+#include "BCSparseMatrix.h"
+#include "BCPackedSymmetricMatrix.h"
+
+using namespace std;
+
+
+namespace cnoid
+{
+
+/*
+ Projected block Gauss-Seidel solver.
+ The unknowns are reordered contact-major: the normal and the two friction
+ unknowns of a contact are contiguous, followed by the bilateral ones.
+ Each sweep solves one 3x3 diagonal block per contact with its cached
+ inverse and projects the result onto the friction cone.
+ The constraint layout must be the one of ENABLE_TRUE_FRICTION_CONE.
+*/
+class BCCoreBlockGS
+{
+  public:
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> MatrixX;
+    typedef VectorXd VectorX;
+    void NewBuffer   (int aSZ) ;
+    void DeleteBuffer();
+
+    BCCoreBlockGS(int maxNumGaussSeidelIteration, double gaussSeidelErrorCriterion);
+    ~BCCoreBlockGS();
+    bool   callSolver(const MatrixX& Mlcp, const VectorX& b, VectorX& solution, const VectorX& contactIndexToMu,ofstream& os);
+    bool   callSolver(const BCSparseMatrix& Mlcp, const VectorX& b, VectorX& solution, const VectorX& contactIndexToMu,ofstream& os);
+    bool   callSolver(const BCPackedSymmetricMatrix& Mlcp, const VectorX& b, VectorX& solution, const VectorX& contactIndexToMu,ofstream& os);
+	void setGaussSeidelErrorCriterion(double e);
+	void setGaussSeidelMaxNumIterations(int n);
+	int numIterations() const { return NITE; }
+	// whether the error of the last call reached the criterion; callSolver returns true regardless
+	bool isConverged() const { return CONV; }
+    int SZ;     // total number of unknowns
+    int NC;     // number of contacts
+    int MAXITE;
+    int NITE;   // number of sweeps in the last call
+    bool CONV;  // converged in the last call
+    double ERRCRI;
+  private:
+	std::vector<int>    pri;    // permuted index -> original index
+	std::vector<int>    ipr;    // original index -> permuted index
+	std::vector<int>    rbgn;   // off-diagonal-block elements of the permuted rows
+	std::vector<int>    cidx;
+	std::vector<double> cval;
+	std::vector<Matrix3> Dinv;  // inverse of the diagonal block of each contact
+	std::vector<Matrix3> D;
+	std::vector<double> keep;   // 0 for rows cleared as singular, otherwise 1
+	std::vector<double> dg;     // diagonal elements
+	VectorX z;
+	VectorX bp;
+	void setPermutation();
+	void beginRow(int p);
+	void addElement(int p, int q, double v);
+	void setDiagonalBlocks();
+	template<class TMatrix> void setRowsOfFullMatrix(const TMatrix& A);
+	bool solve(const VectorX& ab, VectorX& ax, const VectorX& mu, ofstream& os);
+};
+
+};
+
+#endif
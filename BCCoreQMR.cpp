@@ -89,6 +89,22 @@ void BCCoreQMR::DeleteBuffer()
 
 
 bool BCCoreQMR::callSolver(const MatrixX& A, const VectorX& ab, VectorX& ax, const VectorX& contactIndexToMu, ofstream& os)    
+{
+	return solve(A, ab, ax);
+}
+
+bool BCCoreQMR::callSolver(const BCSparseMatrix& A, const VectorX& ab, VectorX& ax, const VectorX& contactIndexToMu, ofstream& os)    
+{
+	return solve(A, ab, ax);
+}
+
+bool BCCoreQMR::callSolver(const BCPackedSymmetricMatrix& A, const VectorX& ab, VectorX& ax, const VectorX& contactIndexToMu, ofstream& os)    
+{
+	return solve(A, ab, ax);
+}
+
+template<class TMatrix>
+bool BCCoreQMR::solve(const TMatrix& A, const VectorX& ab, VectorX& ax)
 {
 	const double EPSTHRESH = 1.0e-20;
 	ini_copy(&x, ax);
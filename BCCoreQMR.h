@@ -33,6 +33,8 @@
 #define CNOID_BCPLUGIN_BCCOREQMR_H
 
 #include <boost/random.hpp>
+#include "BCSparseMatrix.h"
+#include "BCPackedSymmetricMatrix.h"
 
 using namespace std;
 
@@ -52,6 +54,8 @@ class BCCoreQMR
     BCCoreQMR(int maxNumGaussSeidelIteration, double gaussSeidelErrorCriterion);
     ~BCCoreQMR();
     bool   callSolver(const MatrixX& Mlcp, const VectorX& b, VectorX& solution, const VectorX& contactIndexToMu,ofstream& os);    
+    bool   callSolver(const BCSparseMatrix& Mlcp, const VectorX& b, VectorX& solution, const VectorX& contactIndexToMu,ofstream& os);    
+    bool   callSolver(const BCPackedSymmetricMatrix& Mlcp, const VectorX& b, VectorX& solution, const VectorX& contactIndexToMu,ofstream& os);    
 	void setGaussSeidelErrorCriterion(double e);
 	void setGaussSeidelMaxNumIterations(int n);
 	double * thebuf;
@@ -77,6 +81,8 @@ class BCCoreQMR
     KKVector w ;/*10*/
     KKVector vt;/*11*/
     KKVector wt;/*12*/
+    template<class TMatrix>
+    bool solve(const TMatrix& A, const VectorX& ab, VectorX& ax);
     void iniV_mulMOVO(KKVector* x, const MatrixX& A, const KKVector& b)
     {
 		for(int i=0;i<SZ;i++){(*x)(i)=0;for(int j=0;j<SZ;j++)(*x)(i)+=A(i,j)*b(j);}
@@ -85,6 +91,23 @@ class BCCoreQMR
     {
 		for(int i=0;i<SZ;i++){(*x)(i)=0;for(int j=0;j<SZ;j++)(*x)(i)+=A(j,i)*b(j);}
 	} 
+    void iniV_mulMOVO(KKVector* x, const BCSparseMatrix& A, const KKVector& b)
+    {
+		for(int i=0;i<SZ;i++){(*x)(i)=0;for(int k=A.rowBegin(i);k<A.rowEnd(i);k++)(*x)(i)+=A.value(k)*b(A.columnIndex(k));}
+	} 
+    void iniV_mulMTVO(KKVector* x, const BCSparseMatrix& A, const KKVector& b)
+    {
+		for(int i=0;i<SZ;i++){(*x)(i)=0;}
+		for(int j=0;j<SZ;j++){for(int k=A.rowBegin(j);k<A.rowEnd(j);k++)(*x)(A.columnIndex(k))+=A.value(k)*b(j);}
+	} 
+    void iniV_mulMOVO(KKVector* x, const BCPackedSymmetricMatrix& A, const KKVector& b)
+    {
+		for(int i=0;i<SZ;i++){(*x)(i)=0;for(int j=0;j<SZ;j++)(*x)(i)+=A(i,j)*b(j);}
+	} 
+    void iniV_mulMTVO(KKVector* x, const BCPackedSymmetricMatrix& A, const KKVector& b)
+    {
+		iniV_mulMOVO(x, A, b);
+	} 
 	void iniV_zero   (KKVector* x){for(int i=0;i<SZ;i++){(*x)(i)=0;}}
 	void iniS_squVTVO(double  * x, const KKVector& a                   ){(*x)=0;for(int i=0;i<SZ;i++){(*x)+=a(i)*a(i);}}
 	void iniS_mulVTVO(double  * x, const KKVector& a, const KKVector& b){(*x)=0;for(int i=0;i<SZ;i++){(*x)+=a(i)*b(i);}}
@@ -49,6 +49,7 @@ BCCoreSiconos::BCCoreSiconos(int maxNumGaussSeidelIteration, double gaussSeidelE
     prob->M             = new NumericsMatrix;
     prob->M->matrix1    = new SparseBlockStructuredMatrix;
     prob->q             = 0;
+    hasDenseMatrixBuffer = false;
     numops->verboseMode = 0;  /*************/
 //  SICONOS_FRICTION_3D_projectionOnCylinder;
     fc3d_setDefaultSolverOptions(solops, SICONOS_FRICTION_3D_NSGS   );
@@ -87,17 +88,24 @@ BCCoreSiconos::~BCCoreSiconos()
 #endif
 }
 
-void BCCoreSiconos::NewBuffer(int NC3)
+void BCCoreSiconos::NewBuffer(int NC3, bool withDenseMatrix)
 {
   if(NC3<=0){return;}
   int NC= NC3/3;
 #ifdef BUILD_BCPLUGIN_WITH_SICONOS
-  prob->q                      = new double  [NC3 + NC + NC3 + NC3 + NC3 * NC3];
-  for(int i=0;i<NC3 + NC + NC3 + NC3 + NC3 * NC3;i++) prob->q[i]=0;
+  // the sparse matrix mode gives blocks of its own to sparsify_A
+  int NM = withDenseMatrix ? (NC3 * NC3) : 0;
+  hasDenseMatrixBuffer = withDenseMatrix;
+  prob->q                      = new double  [NC3 + NC + NC3 + NC3 + NM];
+  for(int i=0;i<NC3 + NC + NC3 + NC3 + NM;i++) prob->q[i]=0;
   prob->mu                     = &(prob->q[NC3                  ]);
   reaction                     = &(prob->q[NC3 + NC             ]);
   velocity                     = &(prob->q[NC3 + NC + NC3       ]);
-  if( USE_FULL_MATRIX )
+  if(!withDenseMatrix)
+  {
+    prob->M->matrix0 = 0;
+  }
+  else if( USE_FULL_MATRIX )
   {
     prob->M->matrix0 = &(prob->q[NC3 + NC + NC3 + NC3 ]);
   }
@@ -115,13 +123,14 @@ void BCCoreSiconos::DeleteBuffer()
 #ifdef BUILD_BCPLUGIN_WITH_SICONOS
   if(prob->q==0) return;
   delete [] prob->q          ;
-  if(! USE_FULL_MATRIX )
+  if(! USE_FULL_MATRIX && hasDenseMatrixBuffer )
   {
     delete [] prob->M->matrix1->block;
     delete [] prob->M->matrix1->blocksize0;
     delete [] prob->M->matrix1->index1_data;
   }
   prob->q = 0;
+  hasDenseMatrixBuffer = false;
 #endif
 }
 
@@ -139,9 +148,7 @@ bool BCCoreSiconos::callSolver(MatrixX& Mlcp, VectorX& b, VectorX& solution, Vec
     if(       b.rows()!= NC3){ os << "   warning-2 " << std::endl;return false;}
     if(solution.rows()!= NC3){ os << "   warning-3 " << std::endl;return false;}
   } 
-  for(int ia=0;ia<NC;ia++)for(int i=0;i<3;i++)prob->q [3*ia+i]= b(((i==0)?(ia):(2*ia+i+NC-1)));
-  for(int ia=0;ia<NC;ia++)                    prob->mu[  ia  ]= contactIndexToMu[ia];
-  prob->numberOfContacts = NC;
+  setProblemVectors(b, contactIndexToMu, NC);
 
   if( USE_FULL_MATRIX )
   {
@@ -165,10 +172,10 @@ bool BCCoreSiconos::callSolver(MatrixX& Mlcp, VectorX& b, VectorX& solution, Vec
     sparsify_A( prob->M->matrix1 , Mlcp , NC , &os);
   }
   
+  setReaction(solution, NC);
   fc3d_driver(prob,reaction,velocity,solops, numops);
   
-  double* prea = reaction ;
-  for(int ia=0;ia<NC;ia++)for(int i=0;i<3;i++) solution(((i==0)?(ia):(2*ia+i+NC-1))) = prea[3*ia+i] ;
+  getSolution(solution, NC);
   if(CFS_DEBUG_VERBOSE)
   {
     os << "=---------------------------------="<< std::endl; 
@@ -179,7 +186,148 @@ bool BCCoreSiconos::callSolver(MatrixX& Mlcp, VectorX& b, VectorX& solution, Vec
   return true;
 }
 
+bool BCCoreSiconos::callSolver(const BCSparseMatrix& Mlcp, VectorX& b, VectorX& solution, VectorX& contactIndexToMu, ofstream& os)
+{
+#ifdef BUILD_BCPLUGIN_WITH_SICONOS
+  int NC3 = Mlcp.rows();
+  if(NC3<=0) return true;
+  int NC = NC3/3;
+  setProblemVectors(b, contactIndexToMu, NC);
+  prob->M->storageType = 1;
+  prob->M->size0       = NC3;
+  prob->M->size1       = NC3;
+  sparsify_A( prob->M->matrix1 , Mlcp , NC );
+
+  setReaction(solution, NC);
+  fc3d_driver(prob,reaction,velocity,solops, numops);
+
+  getSolution(solution, NC);
+#endif
+  return true;
+}
+
+// the block-sparse storage is used because the packed matrix has no dense buffer
+bool BCCoreSiconos::callSolver(const BCPackedSymmetricMatrix& Mlcp, VectorX& b, VectorX& solution, VectorX& contactIndexToMu, ofstream& os)
+{
+#ifdef BUILD_BCPLUGIN_WITH_SICONOS
+  int NC3 = Mlcp.rows();
+  if(NC3<=0) return true;
+  int NC = NC3/3;
+  setProblemVectors(b, contactIndexToMu, NC);
+  prob->M->storageType = 1;
+  prob->M->size0       = NC3;
+  prob->M->size1       = NC3;
+  sparsify_A( prob->M->matrix1 , Mlcp , NC );
+
+  setReaction(solution, NC);
+  fc3d_driver(prob,reaction,velocity,solops, numops);
+
+  getSolution(solution, NC);
+#endif
+  return true;
+}
+
 #ifdef BUILD_BCPLUGIN_WITH_SICONOS
+void BCCoreSiconos::setProblemVectors(VectorX& b, VectorX& contactIndexToMu, int NC)
+{
+  for(int ia=0;ia<NC;ia++)for(int i=0;i<3;i++)prob->q [3*ia+i]= b(((i==0)?(ia):(2*ia+i+NC-1)));
+  for(int ia=0;ia<NC;ia++)                    prob->mu[  ia  ]= contactIndexToMu[ia];
+  prob->numberOfContacts = NC;
+}
+
+// the initial guess of the solver, which is the warm-started solution
+void BCCoreSiconos::setReaction(const VectorX& solution, int NC)
+{
+  double* prea = reaction ;
+  for(int ia=0;ia<NC;ia++)for(int i=0;i<3;i++) prea[3*ia+i] = solution(((i==0)?(ia):(2*ia+i+NC-1))) ;
+}
+
+void BCCoreSiconos::getSolution(VectorX& solution, int NC)
+{
+  double* prea = reaction ;
+  for(int ia=0;ia<NC;ia++)for(int i=0;i<3;i++) solution(((i==0)?(ia):(2*ia+i+NC-1))) = prea[3*ia+i] ;
+}
+
+// The blocks coupled with contact ia are given by the normal columns of row ia
+void BCCoreSiconos::sparsify_A(SparseBlockStructuredMatrix* pmat, const BCSparseMatrix& Mlcp, int NC)
+{
+  SparseBlockStructuredMatrix& mat = *pmat;
+  int NB = 0;
+  for(int ia=0;ia<NC;ia++)
+    for(int k=Mlcp.rowBegin(ia);k<Mlcp.rowEnd(ia) && Mlcp.columnIndex(k)<NC;k++) NB++;
+  sparseBlockValues.resize(9*NB);
+  sparseBlocks     .resize(NB);
+  sparseIndexData  .resize(NC+1+NB);
+  sparseBlockSizes .resize(NC);
+  mat.block       = &sparseBlocks[0];
+  mat.index1_data = &sparseIndexData[0];
+  mat.index2_data = mat.index1_data + (NC+1);
+  mat.blocksize0  = &sparseBlockSizes[0];
+  NB=0;
+  mat.index1_data[0]=0 ;
+  for(int ia=0;ia<NC;ia++)
+  {
+    mat.index1_data[ia+1]=mat.index1_data[ia];
+    for(int k=Mlcp.rowBegin(ia);k<Mlcp.rowEnd(ia);k++)
+    {
+      int ja = Mlcp.columnIndex(k);
+      if(ja>=NC) break;
+      mat.block[NB] = &sparseBlockValues[9*NB];
+      copy_block(mat.block[NB], Mlcp, NC,ia,ja);
+      mat.index1_data[ia+1] ++ ;
+      mat.index2_data[NB] = ja;
+      NB++;
+    }
+  }
+  mat.nbblocks     = NB;
+  mat.blocknumber0 = NC;
+  mat.blocknumber1 = NC;
+  for(int i=0;i<NC;i++)mat.blocksize0[i]=(i+1)*3;
+  mat.blocksize1 = mat.blocksize0;
+  mat.filled1 = NC+1;
+  mat.filled2 = NB  ;
+}
+
+// The non-zero blocks are counted first, and then copied to the buffers
+void BCCoreSiconos::sparsify_A(SparseBlockStructuredMatrix* pmat, const BCPackedSymmetricMatrix& Mlcp, int NC)
+{
+  SparseBlockStructuredMatrix& mat = *pmat;
+  int NB = 0;
+  for(int ia=0;ia<NC;ia++)for(int ja=0;ja<NC;ja++) NB += check_zero_block(Mlcp,NC,ia,ja);
+  sparseBlockValues.resize(9*NB);
+  sparseBlocks     .resize(NB);
+  sparseIndexData  .resize(NC+1+NB);
+  sparseBlockSizes .resize(NC);
+  mat.block       = &sparseBlocks[0];
+  mat.index1_data = &sparseIndexData[0];
+  mat.index2_data = mat.index1_data + (NC+1);
+  mat.blocksize0  = &sparseBlockSizes[0];
+  NB=0;
+  mat.index1_data[0]=0 ;
+  for(int ia=0;ia<NC;ia++)
+  {
+    mat.index1_data[ia+1]=mat.index1_data[ia];
+    for(int ja=0;ja<NC;ja++)
+    {
+      if(check_zero_block(Mlcp,NC,ia,ja)==1)
+      {
+        mat.block[NB] = &sparseBlockValues[9*NB];
+        copy_block(mat.block[NB], Mlcp, NC,ia,ja);
+        mat.index1_data[ia+1] ++ ;
+        mat.index2_data[NB] = ja;
+        NB++;
+      }
+    }
+  }
+  mat.nbblocks     = NB;
+  mat.blocknumber0 = NC;
+  mat.blocknumber1 = NC;
+  for(int i=0;i<NC;i++)mat.blocksize0[i]=(i+1)*3;
+  mat.blocksize1 = mat.blocksize0;
+  mat.filled1 = NC+1;
+  mat.filled2 = NB  ;
+}
+
 void BCCoreSiconos::sparsify_A(SparseBlockStructuredMatrix* pmat, MatrixX& Mlcp, int NC, ofstream* pos )
 {
   SparseBlockStructuredMatrix& mat = *pmat;
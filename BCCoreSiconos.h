@@ -41,6 +41,10 @@
 //class SparseBlockStructuredMatrix ;
 #endif
 
+#include "BCSparseMatrix.h"
+#include "BCPackedSymmetricMatrix.h"
+#include <vector>
+
 using namespace std;
 
 
@@ -54,7 +58,7 @@ class BCCoreSiconos
     typedef VectorXd VectorX;
   
     bool USE_FULL_MATRIX ;
-    void NewBuffer   (int aNC) ;
+    void NewBuffer   (int aNC, bool withDenseMatrix = true) ;
     void DeleteBuffer();
   public:
     double                 *reaction  ;
@@ -63,6 +67,8 @@ class BCCoreSiconos
     BCCoreSiconos(int maxNumGaussSeidelIteration, double gaussSeidelErrorCriterion);
     ~BCCoreSiconos();
     bool   callSolver(MatrixX& Mlcp, VectorX& b, VectorX& solution, VectorX& contactIndexToMu,ofstream& os);    
+    bool   callSolver(const BCSparseMatrix& Mlcp, VectorX& b, VectorX& solution, VectorX& contactIndexToMu,ofstream& os);    
+    bool   callSolver(const BCPackedSymmetricMatrix& Mlcp, VectorX& b, VectorX& solution, VectorX& contactIndexToMu,ofstream& os);    
  	void setGaussSeidelErrorCriterion(double e);
 	void setGaussSeidelMaxNumIterations(int n);
    
@@ -73,6 +79,16 @@ class BCCoreSiconos
     NumericsOptions        *numops    ;
     SolverOptions          *solops    ;
     static void sparsify_A(SparseBlockStructuredMatrix* pmat, MatrixX& Mlcp, int NC, ofstream* pos );
+    void sparsify_A(SparseBlockStructuredMatrix* pmat, const BCSparseMatrix& Mlcp, int NC);
+    void sparsify_A(SparseBlockStructuredMatrix* pmat, const BCPackedSymmetricMatrix& Mlcp, int NC);
+    void setProblemVectors(VectorX& b, VectorX& contactIndexToMu, int NC);
+    void setReaction(const VectorX& solution, int NC);
+    void getSolution(VectorX& solution, int NC);
+    bool hasDenseMatrixBuffer;
+    std::vector<double>       sparseBlockValues;
+    std::vector<double*>      sparseBlocks;
+    std::vector<size_t>       sparseIndexData;
+    std::vector<unsigned int> sparseBlockSizes;
 #endif
   public:
 
@@ -88,6 +104,18 @@ class BCCoreSiconos
       return 0;
     }
 
+    static int check_zero_block(const BCPackedSymmetricMatrix& Mlcp, int NC, int ia,int ja)
+    {
+      for(int i = 0; i<3; i++)for(int j = 0; j<3; j++)
+      {
+        if(fabs(Mlcp(((i==0)?(ia):(2*ia+i+NC-1)),((j==0)?(ja):(2*ja+j+NC-1))) ) >1e-10)
+        {
+          return 1;
+        }
+      }
+      return 0;
+    }
+
     static int construct_sparsity_matrix(int * ibuf, MatrixX& Mlcp, int NC)
     {
       int count=0;
@@ -120,6 +148,16 @@ class BCCoreSiconos
       for(int i=0;i<3;i++)for(int j=0;j<3;j++) bbuf[3*j+i]= Mlcp(((i==0)?(ia):(2*ia+i+NC-1)),((j==0)?(ja):(2*ja+j+NC-1))) ;
     }
 
+    static void copy_block(double * bbuf, const BCSparseMatrix& Mlcp, int NC, int ia,int ja)
+    {
+      for(int i=0;i<3;i++)for(int j=0;j<3;j++) bbuf[3*j+i]= Mlcp.coeff(((i==0)?(ia):(2*ia+i+NC-1)),((j==0)?(ja):(2*ja+j+NC-1))) ;
+    }
+
+    static void copy_block(double * bbuf, const BCPackedSymmetricMatrix& Mlcp, int NC, int ia,int ja)
+    {
+      for(int i=0;i<3;i++)for(int j=0;j<3;j++) bbuf[3*j+i]= Mlcp.coeff(((i==0)?(ia):(2*ia+i+NC-1)),((j==0)?(ja):(2*ja+j+NC-1))) ;
+    }
+
   /*************************************************************************************/  
 
 
@@ -0,0 +1,202 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+/*************************************************
+
+ORIGINAL FILE: src/Body/ForwardDynamicsABM.cpp
+
+**************************************************/
+
+#include "BCForwardDynamicsABM.h"
+#include "BCConstraintForceSolver.h"
+#include <cnoid/DyBody>
+#include <cnoid/LinkTraverse>
+#include <cnoid/EigenUtil>
+
+using namespace std;
+using namespace cnoid;
+
+
+BCForwardDynamicsABM::BCForwardDynamicsABM(DyBody* body, BCConstraintForceSolver& cfs, int bodyIndex)
+    : ForwardDynamicsABM(body),
+      cfs(cfs),
+      bodyIndex(bodyIndex)
+{
+
+}
+
+
+void BCForwardDynamicsABM::calcNextState()
+{
+    // the force sensors use the articulated forces of the phase 2
+    if(!cfs.areArticulatedAccelerationsGiven(bodyIndex) || !sensorHelper.forceSensors().empty()){
+        ForwardDynamicsABM::calcNextState();
+        return;
+    }
+
+    DyLink* root = body->rootLink();
+
+    if(root->isFreeJoint()){
+        root->dv() = root->dvo() - root->p().cross(root->dw()) + root->w().cross(root->vo() + root->w().cross(root->p()));
+        Position T;
+        SE3exp(T, root->T(), root->w(), root->vo(), timeStep);
+        root->T() = T;
+        root->vo() += root->dvo() * timeStep;
+        root->w()  += root->dw()  * timeStep;
+    }
+
+    const int n = body->numJoints();
+    for(int i=0; i < n; ++i){
+        Link* joint = body->joint(i);
+        joint->q()  += joint->dq()  * timeStep;
+        joint->dq() += joint->ddq() * timeStep;
+    }
+
+    calcABMPhase1();
+    calcABMPhase2Part1();
+
+    if(sensorHelper.isActive()){
+        sensorHelper.updateGyroAndAccelerationSensors();
+    }
+}
+
+
+void BCForwardDynamicsABM::calcABMPhase1()
+{
+    const LinkTraverse& traverse = body->linkTraverse();
+    const int n = traverse.numLinks();
+
+    for(int i=0; i < n; ++i){
+        DyLink* link = static_cast<DyLink*>(traverse[i]);
+        DyLink* parent = link->parent();
+
+        if(parent){
+            switch(link->jointType()){
+
+            case Link::ROTATIONAL_JOINT:
+                link->R().noalias() = parent->R() * AngleAxisd(link->q(), link->a());
+                link->p().noalias() = parent->R() * link->b() + parent->p();
+                link->sw().noalias() = parent->R() * link->a();
+                link->sv().noalias() = link->p().cross(link->sw());
+                link->w().noalias() = link->dq() * link->sw() + parent->w();
+                break;
+
+            case Link::SLIDE_JOINT:
+                link->p().noalias() = parent->R() * (link->b() + link->q() * link->d()) + parent->p();
+                link->R() = parent->R();
+                link->sw().setZero();
+                link->sv().noalias() = parent->R() * link->d();
+                link->w() = parent->w();
+                break;
+
+            case Link::FIXED_JOINT:
+            default:
+                link->p().noalias() = parent->R() * link->b() + parent->p();
+                link->R() = parent->R();
+                link->w() = parent->w();
+                link->vo() = parent->vo();
+                link->sw().setZero();
+                link->sv().setZero();
+                link->cv().setZero();
+                link->cw().setZero();
+                goto COMMON_CALCS_FOR_ALL_JOINT_TYPES;
+            }
+
+            // Common for ROTATE and SLIDE
+            link->vo().noalias() = link->dq() * link->sv() + parent->vo();
+            const Vector3 dsv = parent->w().cross(link->sv()) + parent->vo().cross(link->sw());
+            const Vector3 dsw = parent->w().cross(link->sw());
+            link->cv() = link->dq() * dsv;
+            link->cw() = link->dq() * dsw;
+        }
+
+    COMMON_CALCS_FOR_ALL_JOINT_TYPES:
+
+        link->v() = link->vo() + link->w().cross(link->p());
+        link->wc().noalias() = link->R() * link->c() + link->p();
+
+        // compute I^s (Eq.(6.24) of Kajita's textbook))
+        const Matrix3 Iw = link->R() * link->I() * link->R().transpose();
+        const Matrix3 c_hat = hat(link->wc());
+        link->Iww().noalias() = link->m() * c_hat * c_hat.transpose() + Iw;
+        link->Ivv() = link->m() * Matrix3::Identity();
+        link->Iwv() = link->m() * c_hat;
+
+        // compute P and L (Eq.(6.25) of Kajita's textbook)
+        const Vector3 P = link->m() * (link->vo() + link->w().cross(link->wc()));
+        const Vector3 L = link->Iww() * link->w() + link->m() * link->wc().cross(link->vo());
+
+        link->pf().noalias()   = link->w().cross(P);
+        link->ptau().noalias() = link->vo().cross(P) + link->w().cross(L);
+
+        // the gravity is included in the bias force
+        const Vector3 fg = link->m() * g;
+        link->pf()   -= fg;
+        link->ptau() -= link->wc().cross(fg);
+    }
+}
+
+
+void BCForwardDynamicsABM::calcABMPhase2Part1()
+{
+    const LinkTraverse& traverse = body->linkTraverse();
+    const int n = traverse.numLinks();
+
+    for(int i = n-1; i >= 0; --i){
+        DyLink* link = static_cast<DyLink*>(traverse[i]);
+
+        for(DyLink* child = link->child(); child; child = child->sibling()){
+
+            // the velocity-product terms with the articulated inertia of the child
+            link->pf().noalias()   += child->Ivv() * child->cv() + child->Iwv().transpose() * child->cw();
+            link->ptau().noalias() += child->Iwv() * child->cv() + child->Iww() * child->cw();
+
+            link->Ivv() += child->Ivv();
+            link->Iwv() += child->Iwv();
+            link->Iww() += child->Iww();
+
+            if(!child->isFixedJoint()){
+                const Vector3 hhv_dd = child->hhv() / child->dd();
+                const Vector3 hhw_dd = child->hhw() / child->dd();
+                link->Ivv().noalias() -= hhv_dd * child->hhv().transpose();
+                link->Iwv().noalias() -= hhw_dd * child->hhv().transpose();
+                link->Iww().noalias() -= hhw_dd * child->hhw().transpose();
+            }
+        }
+
+        if(i > 0){
+            if(!link->isFixedJoint()){
+                link->hhv().noalias() = link->Ivv() * link->sv() + link->Iwv().transpose() * link->sw();
+                link->hhw().noalias() = link->Iwv() * link->sv() + link->Iww() * link->sw();
+                link->dd() = link->sv().dot(link->hhv()) + link->sw().dot(link->hhw()) + link->Jm2();
+                link->uu() = - link->hhv().dot(link->cv()) - link->hhw().dot(link->cw());
+            }
+        }
+    }
+}
@@ -0,0 +1,76 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+/*************************************************
+
+ORIGINAL FILE: src/Body/ForwardDynamicsABM.h
+
+**************************************************/
+
+#ifndef CNOID_BCPLUGIN_BCFORWARD_DYNAMICS_ABM_H
+#define CNOID_BCPLUGIN_BCFORWARD_DYNAMICS_ABM_H
+
+#include <cnoid/ForwardDynamicsABM>
+
+namespace cnoid
+{
+
+class DyLink;
+class BCConstraintForceSolver;
+
+/**
+   ForwardDynamicsABM which takes the accelerations of the links from BCConstraintForceSolver
+   in the fused ABM mode instead of calculating the phases 2 and 3 of ABM again with the same
+   external forces and the constraint forces. The other steps are the ones of the base class.
+
+   The phases of ForwardDynamicsABM are private, so the step with the given accelerations
+   repeats the Euler integration and the phases 1 and 2 (part 1) for the next step.
+   They are copies of the ones of ForwardDynamicsABM of Choreonoid and must be kept
+   in sync with them. The class is only used with the matrix-free solver.
+*/
+class BCForwardDynamicsABM : public ForwardDynamicsABM
+{
+  public:
+    BCForwardDynamicsABM(DyBody* body, BCConstraintForceSolver& cfs, int bodyIndex);
+
+    virtual void calcNextState();
+
+  private:
+    void calcABMPhase1();
+    void calcABMPhase2Part1();
+
+    BCConstraintForceSolver& cfs;
+    int bodyIndex;
+};
+
+typedef boost::shared_ptr<BCForwardDynamicsABM> BCForwardDynamicsABMPtr;
+
+};
+
+#endif
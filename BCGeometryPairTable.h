@@ -0,0 +1,248 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+#ifndef CNOID_BCPLUGIN_BCGEOMETRY_PAIR_TABLE_H
+#define CNOID_BCPLUGIN_BCGEOMETRY_PAIR_TABLE_H
+
+#include <vector>
+#include <new>
+#include <cstddef>
+
+namespace cnoid
+{
+
+/**
+   Hash table from a pair of geometry ids to a value of T. The table is an open-addressing
+   array with the linear probing, and the values are stored in a pool of fixed-size chunks,
+   so the address of a value does not change while it is in the table. Each value records
+   the last step at which it was found or inserted, and evict() removes the values which
+   have not been used for the given number of steps. The slots of the removed values are
+   reused by the following insertions.
+*/
+template<class T>
+class BCGeometryPairTable
+{
+  public:
+    static const int CHUNK_SIZE = 64;
+
+    BCGeometryPairTable() : numEntries(0), totalNumEvicted(0) { }
+    ~BCGeometryPairTable() { releaseChunks(); }
+
+    void clear() {
+        releaseChunks();
+        slots.clear();
+        freeEntries.clear();
+        numEntries = 0;
+    }
+
+    //! @return null if the pair is not in the table
+    T* find(int id0, int id1, int step) {
+        const int index = findSlot(id0, id1);
+        if(index < 0){
+            return 0;
+        }
+        Entry& entry = entryAt(index);
+        entry.lastStep = step;
+        return &entry.value;
+    }
+
+    //! The pair must not be in the table. The value is initialized by T().
+    T& insert(int id0, int id1, int step) {
+        if(2 * (numEntries + 1) > static_cast<int>(slots.size())){
+            rehash(slots.empty() ? 16 : 2 * slots.size());
+        }
+        int index;
+        if(freeEntries.empty()){
+            index = chunks.size() * CHUNK_SIZE;
+            chunks.push_back(new Entry[CHUNK_SIZE]);
+            for(int i = CHUNK_SIZE - 1; i > 0; --i){
+                freeEntries.push_back(index + i);
+            }
+        } else {
+            index = freeEntries.back();
+            freeEntries.pop_back();
+        }
+        Entry& entry = entryAt(index);
+        entry.lastStep = step;
+        entry.id0 = id0;
+        entry.id1 = id1;
+        insertSlot(id0, id1, index);
+        ++numEntries;
+        return entry.value;
+    }
+
+    /**
+       Removes the values whose last step is before step - maxIdleSteps.
+       The memory owned by a removed value is released by resetting it to T().
+       @return the number of the removed values
+    */
+    int evict(int step, int maxIdleSteps) {
+        staleEntries.clear();
+        for(size_t i=0; i < slots.size(); ++i){
+            const int index = slots[i].entry;
+            if(index >= 0 && entryAt(index).lastStep < step - maxIdleSteps){
+                staleEntries.push_back(index);
+            }
+        }
+        for(size_t i=0; i < staleEntries.size(); ++i){
+            const int index = staleEntries[i];
+            Entry& entry = entryAt(index);
+            eraseSlot(entry.id0, entry.id1);
+            entry.id0 = -1;
+            entry.id1 = -1;
+            entry.value.~T();
+            new(&entry.value) T();
+            freeEntries.push_back(index);
+            --numEntries;
+        }
+        totalNumEvicted += staleEntries.size();
+        return staleEntries.size();
+    }
+
+    int size() const { return numEntries; }
+    long totalNumEvictedEntries() const { return totalNumEvicted; }
+
+    //! The values of the pool are given by the indices in [0, poolSize()), where the unused ones are T()
+    int poolSize() const { return chunks.size() * CHUNK_SIZE; }
+    T& valueAt(int index) { return entryAt(index).value; }
+
+    //! Bytes of the slots and the pool, which do not include the memory owned by the values
+    size_t memoryUsage() const {
+        return slots.capacity() * sizeof(Slot) + chunks.size() * CHUNK_SIZE * sizeof(Entry)
+            + (freeEntries.capacity() + staleEntries.capacity()) * sizeof(int);
+    }
+
+  private:
+    struct Slot {
+        int id0;
+        int id1;
+        int entry; // index in the pool, -1 if the slot is empty
+    };
+    struct Entry {
+        Entry() : id0(-1), id1(-1), lastStep(0) { }
+        T value;
+        int id0;
+        int id1;
+        int lastStep;
+    };
+
+    std::vector<Slot> slots; // the size is a power of two
+    std::vector<Entry*> chunks;
+    std::vector<int> freeEntries;
+    std::vector<int> staleEntries;
+    int numEntries;
+    long totalNumEvicted;
+
+    static unsigned int hash(int id0, int id1) {
+        unsigned int h = static_cast<unsigned int>(id0) * 0x9e3779b1u + static_cast<unsigned int>(id1);
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        return h;
+    }
+
+    Entry& entryAt(int index) { return chunks[index / CHUNK_SIZE][index % CHUNK_SIZE]; }
+
+    int findSlot(int id0, int id1) const {
+        if(slots.empty()){
+            return -1;
+        }
+        const int mask = slots.size() - 1;
+        for(int i = hash(id0, id1) & mask; slots[i].entry >= 0; i = (i + 1) & mask){
+            if(slots[i].id0 == id0 && slots[i].id1 == id1){
+                return slots[i].entry;
+            }
+        }
+        return -1;
+    }
+
+    void insertSlot(int id0, int id1, int index) {
+        const int mask = slots.size() - 1;
+        int i = hash(id0, id1) & mask;
+        while(slots[i].entry >= 0){
+            i = (i + 1) & mask;
+        }
+        slots[i].id0 = id0;
+        slots[i].id1 = id1;
+        slots[i].entry = index;
+    }
+
+    // backward shift deletion, which keeps the probe sequences without tombstones
+    void eraseSlot(int id0, int id1) {
+        const int mask = slots.size() - 1;
+        int i = hash(id0, id1) & mask;
+        while(!(slots[i].id0 == id0 && slots[i].id1 == id1)){
+            i = (i + 1) & mask;
+        }
+        int j = i;
+        while(true){
+            j = (j + 1) & mask;
+            if(slots[j].entry < 0){
+                break;
+            }
+            const int home = hash(slots[j].id0, slots[j].id1) & mask;
+            // the slot j can move to the hole i if its home is not in (i, j] cyclically
+            if(((j - home) & mask) >= ((j - i) & mask)){
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i].entry = -1;
+    }
+
+    void rehash(int size) {
+        std::vector<Slot> old;
+        old.swap(slots);
+        Slot empty;
+        empty.id0 = -1;
+        empty.id1 = -1;
+        empty.entry = -1;
+        slots.assign(size, empty);
+        for(size_t i=0; i < old.size(); ++i){
+            if(old[i].entry >= 0){
+                insertSlot(old[i].id0, old[i].id1, old[i].entry);
+            }
+        }
+    }
+
+    void releaseChunks() {
+        for(size_t i=0; i < chunks.size(); ++i){
+            delete [] chunks[i];
+        }
+        chunks.clear();
+    }
+
+    BCGeometryPairTable(const BCGeometryPairTable& org);
+    BCGeometryPairTable& operator=(const BCGeometryPairTable& org);
+};
+
+};
+
+#endif
@@ -0,0 +1,126 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+
+#include "BCPackedSymmetricMatrix.h"
+#include <algorithm>
+
+using namespace cnoid;
+
+
+BCPackedSymmetricMatrix::BCPackedSymmetricMatrix()
+{
+    clear();
+}
+
+
+void BCPackedSymmetricMatrix::clear()
+{
+    size = 0;
+    positions.clear();
+    positionToRow.clear();
+    values.clear();
+}
+
+
+void BCPackedSymmetricMatrix::setOrder(const std::vector<int>& rowToPosition)
+{
+    size = rowToPosition.size();
+    positions = rowToPosition;
+    positionToRow.resize(size);
+    for(int i=0; i < size; ++i){
+        positionToRow[positions[i]] = i;
+    }
+    values.resize(columnTop(size));
+}
+
+
+void BCPackedSymmetricMatrix::setZero()
+{
+    std::fill(values.begin(), values.end(), 0.0);
+}
+
+
+double BCPackedSymmetricMatrix::calcOffDiagonalRowProduct(int row, const VectorX& x) const
+{
+    const int p = positions[row];
+    double sum = 0.0;
+
+    // the upper part of the column p is contiguous
+    const double* column = &values[columnTop(p)];
+    for(int q=0; q < p; ++q){
+        sum += column[q] * x(positionToRow[q]);
+    }
+
+    // the rest of the row p is given by the row p of the following columns
+    std::size_t k = columnTop(p + 1) + p;
+    for(int q = p + 1; q < size; ++q){
+        sum += values[k] * x(positionToRow[q]);
+        k += q + 1;
+    }
+
+    return sum;
+}
+
+
+void BCPackedSymmetricMatrix::multiply(const VectorX& x, VectorX& out_y) const
+{
+    for(int i=0; i < size; ++i){
+        out_y(i) = 0.0;
+    }
+    std::size_t k = 0;
+    for(int q=0; q < size; ++q){
+        const int col = positionToRow[q];
+        const double xq = x(col);
+        double sum = 0.0;
+        for(int p=0; p < q; ++p, ++k){
+            const int row = positionToRow[p];
+            sum += values[k] * x(row);
+            out_y(row) += values[k] * xq;
+        }
+        out_y(col) += sum + values[k] * xq;
+        ++k;
+    }
+}
+
+
+void BCPackedSymmetricMatrix::copyTo(MatrixX& out_M) const
+{
+    out_M.resize(size, size);
+    std::size_t k = 0;
+    for(int q=0; q < size; ++q){
+        const int col = positionToRow[q];
+        for(int p=0; p <= q; ++p, ++k){
+            const int row = positionToRow[p];
+            out_M(row, col) = values[k];
+            out_M(col, row) = values[k];
+        }
+    }
+}
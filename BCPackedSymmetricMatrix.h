@@ -0,0 +1,106 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+
+
+#ifndef CNOID_BCPLUGIN_BCPACKEDSYMMETRICMATRIX_H
+#define CNOID_BCPLUGIN_BCPACKEDSYMMETRICMATRIX_H
+
+#include <cnoid/EigenTypes>
+#include <vector>
+#include <cstddef>
+
+namespace cnoid
+{
+
+/**
+   Packed storage of a symmetric LCP/MCP matrix.
+   The rows are reordered by the positions given to setOrder(), and the upper triangle
+   of the reordered matrix is stored column by column, so the elements (i, j) and (j, i)
+   share one value.
+*/
+class BCPackedSymmetricMatrix
+{
+  public:
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> MatrixX;
+    typedef VectorXd VectorX;
+
+    BCPackedSymmetricMatrix();
+
+    void clear();
+
+    /**
+       @param rowToPosition position of each row in the packed order
+    */
+    void setOrder(const std::vector<int>& rowToPosition);
+
+    void setZero();
+
+    int rows() const { return size; }
+    int cols() const { return size; }
+    int numStoredElements() const { return values.size(); }
+
+    double diagonal(int row) const { return values[diagonalIndex(row)]; }
+    double& diagonalRef(int row) { return values[diagonalIndex(row)]; }
+
+    double coeff(int row, int col) const { return values[elementIndex(row, col)]; }
+    double operator()(int row, int col) const { return coeff(row, col); }
+    double& coeffRef(int row, int col) { return values[elementIndex(row, col)]; }
+
+    //! sum of M(row, k) * x(k) for k != row
+    double calcOffDiagonalRowProduct(int row, const VectorX& x) const;
+
+    void multiply(const VectorX& x, VectorX& out_y) const;
+
+    void copyTo(MatrixX& out_M) const;
+
+  private:
+    int size;
+    std::vector<int> positions;
+    std::vector<int> positionToRow;
+    std::vector<double> values;
+
+    static std::size_t columnTop(int position) {
+        return static_cast<std::size_t>(position) * (position + 1) / 2;
+    }
+    std::size_t diagonalIndex(int row) const {
+        const int p = positions[row];
+        return columnTop(p) + p;
+    }
+    std::size_t elementIndex(int row, int col) const {
+        const int p = positions[row];
+        const int q = positions[col];
+        return (p < q) ? (columnTop(q) + p) : (columnTop(p) + q);
+    }
+};
+
+};
+
+#endif
@@ -45,6 +45,7 @@ ORIGINAL FILE: src/BodyPlugin/AISTSimulatorItem.cpp
 #include <cnoid/DyBody>
 #include <cnoid/ForwardDynamicsCBM>
 #include "BCConstraintForceSolver.h"
+#include "BCForwardDynamicsABM.h"
 #include <cnoid/LeggedBodyHelper>
 #include <cnoid/FloatingNumberString>
 #include <cnoid/EigenUtil>
@@ -54,6 +55,8 @@ ORIGINAL FILE: src/BodyPlugin/AISTSimulatorItem.cpp
 #include <boost/thread.hpp>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <algorithm>
 #include "gettext.h"
 
 using namespace std;
@@ -193,6 +196,20 @@ public:
     double epsilon;
     bool is2Dmode;
     bool isKinematicWalkingEnabled;
+    bool isSparseMatrixMode;
+    bool isFusedABMMode;
+    bool isSymmetricMatrixMode;
+    bool isParallelAssemblyMode;
+    bool isJacobianAssemblyMode;
+    bool isStableFrictionBasisMode;
+    bool isIslandMode;
+    int numThreads;
+    int maxNumContactPointsPerLinkPair;
+    int maxNumContactPointsPerStep;
+    bool isPatchContactMode;
+    int linkPairEvictionSteps;
+    int autoPenaltyMaxNumConstraints;
+    double autoPenaltyMaxSolutionTime;
 
     typedef std::map<Body*, int> BodyIndexMap;
     BodyIndexMap bodyIndexMap;
@@ -212,6 +229,8 @@ public:
     void doPutProperties(PutPropertyFunction& putProperty);
     bool store(Archive& archive);
     bool restore(const Archive& archive);
+    void putStatistics();
+    bool isFusedABMActive() const;
 
     // for debug
     ofstream os;
@@ -219,6 +238,8 @@ public:
     double penaltyKpCoef;     // ADDED
     double penaltyKvCoef;     // ADDED
     double penaltySizeRatio;  // ADDED
+    string penaltyBodies;     // names separated by commas or spaces
+    bool isPenaltyImplicitMode;
 };
 
 }
@@ -255,6 +276,9 @@ BCSimulatorItemImpl::BCSimulatorItemImpl(BCSimulatorItem* self)
     solverMode.setSymbol(BCSimulatorItem::SLV_GAUSS_SEIDEL ,  N_("GaussSeidel"));
     solverMode.setSymbol(BCSimulatorItem::SLV_SICONOS      ,  N_("Siconos"));
     solverMode.setSymbol(BCSimulatorItem::SLV_QMR          ,  N_("QMR(TBD)"));
+    solverMode.setSymbol(BCSimulatorItem::SLV_BLOCK_GAUSS_SEIDEL, N_("Block GS"));
+    solverMode.setSymbol(BCSimulatorItem::SLV_COLORED_GAUSS_SEIDEL, N_("Parallel GS"));
+    solverMode.setSymbol(BCSimulatorItem::SLV_MATRIX_FREE_GAUSS_SEIDEL, N_("Matrix-free GS"));
     solverMode.select(BCSimulatorItem::SLV_GAUSS_SEIDEL);
     
     gravity << 0.0, 0.0, -DEFAULT_GRAVITY_ACCELERATION;
@@ -273,10 +297,25 @@ BCSimulatorItemImpl::BCSimulatorItemImpl(BCSimulatorItem* self)
 
     isKinematicWalkingEnabled = false;
     is2Dmode = false;
+    isSparseMatrixMode = cfs.isSparseMatrixMode();
+    isFusedABMMode = cfs.isFusedABMMode();
+    isSymmetricMatrixMode = cfs.isSymmetricMatrixMode();
+    isParallelAssemblyMode = cfs.isParallelAssemblyMode();
+    isJacobianAssemblyMode = cfs.isJacobianAssemblyMode();
+    isStableFrictionBasisMode = cfs.isStableFrictionBasisMode();
+    isIslandMode = cfs.isIslandMode();
+    numThreads = cfs.numThreads();
+    maxNumContactPointsPerLinkPair = cfs.maxNumContactPointsPerLinkPair();
+    maxNumContactPointsPerStep = cfs.maxNumContactPointsPerStep();
+    isPatchContactMode = cfs.isPatchContactMode();
+    linkPairEvictionSteps = cfs.linkPairEvictionSteps();
+    autoPenaltyMaxNumConstraints = cfs.autoPenaltyMaxNumConstraints();
+    autoPenaltyMaxSolutionTime = cfs.autoPenaltyMaxSolutionTime();
     
     penaltyKpCoef = cfs.penaltyKpCoef();         // ADDED
     penaltyKvCoef = cfs.penaltyKvCoef();         // ADDED
     penaltySizeRatio = cfs.penaltySizeRatio();   // ADDED
+    isPenaltyImplicitMode = cfs.isPenaltyImplicitMode();
 }
 
 
@@ -306,9 +345,25 @@ BCSimulatorItemImpl::BCSimulatorItemImpl(BCSimulatorItem* self, const BCSimulato
     epsilon = org.epsilon;
     isKinematicWalkingEnabled = org.isKinematicWalkingEnabled;
     is2Dmode = org.is2Dmode; 
+    isSparseMatrixMode = org.isSparseMatrixMode;
+    isFusedABMMode = org.isFusedABMMode;
+    isSymmetricMatrixMode = org.isSymmetricMatrixMode;
+    isParallelAssemblyMode = org.isParallelAssemblyMode;
+    isJacobianAssemblyMode = org.isJacobianAssemblyMode;
+    isStableFrictionBasisMode = org.isStableFrictionBasisMode;
+    isIslandMode = org.isIslandMode;
+    numThreads = org.numThreads;
+    maxNumContactPointsPerLinkPair = org.maxNumContactPointsPerLinkPair;
+    maxNumContactPointsPerStep = org.maxNumContactPointsPerStep;
+    isPatchContactMode = org.isPatchContactMode;
+    linkPairEvictionSteps = org.linkPairEvictionSteps;
+    autoPenaltyMaxNumConstraints = org.autoPenaltyMaxNumConstraints;
+    autoPenaltyMaxSolutionTime = org.autoPenaltyMaxSolutionTime;
     penaltyKpCoef = org.penaltyKpCoef;       // ADDED
     penaltyKvCoef = org.penaltyKvCoef;       // ADDED
     penaltySizeRatio = org.penaltySizeRatio; // ADDED
+    penaltyBodies = org.penaltyBodies;
+    isPenaltyImplicitMode = org.isPenaltyImplicitMode;
 }
 
 
@@ -402,6 +457,90 @@ void BCSimulatorItem::set2Dmode(bool on)
 }
 
 
+void BCSimulatorItem::setSparseMatrixMode(bool on)
+{
+    impl->isSparseMatrixMode = on;
+}
+
+
+void BCSimulatorItem::setFusedABMMode(bool on)
+{
+    impl->isFusedABMMode = on;
+}
+
+
+void BCSimulatorItem::setSymmetricMatrixMode(bool on)
+{
+    impl->isSymmetricMatrixMode = on;
+}
+
+
+void BCSimulatorItem::setParallelAssemblyMode(bool on)
+{
+    impl->isParallelAssemblyMode = on;
+}
+
+
+void BCSimulatorItem::setJacobianAssemblyMode(bool on)
+{
+    impl->isJacobianAssemblyMode = on;
+}
+
+
+void BCSimulatorItem::setStableFrictionBasisMode(bool on)
+{
+    impl->isStableFrictionBasisMode = on;
+}
+
+
+void BCSimulatorItem::setIslandMode(bool on)
+{
+    impl->isIslandMode = on;
+}
+
+
+void BCSimulatorItem::setNumThreads(int n)
+{
+    impl->numThreads = n;
+}
+
+
+void BCSimulatorItem::setMaxNumContactPointsPerLinkPair(int n)
+{
+    impl->maxNumContactPointsPerLinkPair = n;
+}
+
+
+void BCSimulatorItem::setMaxNumContactPointsPerStep(int n)
+{
+    impl->maxNumContactPointsPerStep = n;
+}
+
+
+void BCSimulatorItem::setPatchContactMode(bool on)
+{
+    impl->isPatchContactMode = on;
+}
+
+
+void BCSimulatorItem::setLinkPairEvictionSteps(int n)
+{
+    impl->linkPairEvictionSteps = n;
+}
+
+
+void BCSimulatorItem::setAutoPenaltyMaxNumConstraints(int n)
+{
+    impl->autoPenaltyMaxNumConstraints = n;
+}
+
+
+void BCSimulatorItem::setAutoPenaltyMaxSolutionTime(double time)
+{
+    impl->autoPenaltyMaxSolutionTime = time;
+}
+
+
 void BCSimulatorItem::setKinematicWalkingEnabled(bool on)
 {
     impl->isKinematicWalkingEnabled = on;
@@ -466,6 +605,9 @@ bool BCSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBody*
     BCConstraintForceSolver& cfs = world.constraintForceSolver;
     if     (solverMode.is(BCSimulatorItem::SLV_GAUSS_SEIDEL ))cfs.setSolverID(0);
     else if(solverMode.is(BCSimulatorItem::SLV_SICONOS      ))cfs.setSolverID(1);
+    else if(solverMode.is(BCSimulatorItem::SLV_BLOCK_GAUSS_SEIDEL))cfs.setSolverID(3);
+    else if(solverMode.is(BCSimulatorItem::SLV_COLORED_GAUSS_SEIDEL))cfs.setSolverID(4);
+    else if(solverMode.is(BCSimulatorItem::SLV_MATRIX_FREE_GAUSS_SEIDEL))cfs.setSolverID(5);
     else                                                      cfs.setSolverID(2);
     
     cfs.setGaussSeidelErrorCriterion(errorCriterion.value());
@@ -490,10 +632,35 @@ bool BCSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBody*
     if(is2Dmode){
         cfs.set2Dmode(true);
     }
+    cfs.setSparseMatrixMode(isSparseMatrixMode);
+    cfs.setFusedABMMode(isFusedABMActive());
+    cfs.setSymmetricMatrixMode(isSymmetricMatrixMode);
+    cfs.setParallelAssemblyMode(isParallelAssemblyMode);
+    cfs.setJacobianAssemblyMode(isJacobianAssemblyMode);
+    cfs.setStableFrictionBasisMode(isStableFrictionBasisMode);
+    cfs.setIslandMode(isIslandMode);
+    cfs.setNumThreads(numThreads);
+    cfs.setMaxNumContactPointsPerLinkPair(maxNumContactPointsPerLinkPair);
+    cfs.setMaxNumContactPointsPerStep(maxNumContactPointsPerStep);
+    cfs.setPatchContactMode(isPatchContactMode);
+    cfs.setLinkPairEvictionSteps(linkPairEvictionSteps);
+    cfs.setAutoPenaltyMaxNumConstraints(autoPenaltyMaxNumConstraints);
+    cfs.setAutoPenaltyMaxSolutionTime(autoPenaltyMaxSolutionTime);
     cfs.setPenaltyKpCoef(penaltyKpCoef );        // ADDED
     cfs.setPenaltyKvCoef(penaltyKvCoef );        // ADDED
     cfs.setPenaltySizeRatio(penaltySizeRatio );  // ADDED
 
+    string names(penaltyBodies);
+    std::replace(names.begin(), names.end(), ',', ' ');
+    istringstream nameStream(names);
+    vector<string> penaltyBodyNames;
+    string name;
+    while(nameStream >> name){
+        penaltyBodyNames.push_back(name);
+    }
+    cfs.setPenaltyBodyNames(penaltyBodyNames);
+    cfs.setPenaltyImplicitMode(isPenaltyImplicitMode);
+
     world.initialize();
 
     return true;
@@ -531,6 +698,10 @@ void BCSimulatorItemImpl::addBody(BCSimBody* simBody)
         ForwardDynamicsCBMPtr cbm = make_shared_aligned<ForwardDynamicsCBM>(body);
         cbm->setHighGainModeForAllJoints();
         bodyIndexMap[body] = world.addBody(body, cbm);
+    } else if(isFusedABMActive()){
+        BCForwardDynamicsABMPtr abm(
+            new BCForwardDynamicsABM(body, world.constraintForceSolver, world.numBodies()));
+        bodyIndexMap[body] = world.addBody(body, abm);
     } else {
         bodyIndexMap[body] = world.addBody(body);
     }
@@ -597,6 +768,110 @@ void BCSimulatorItem::finalizeSimulation()
     if(ENABLE_DEBUG_OUTPUT){
         impl->os.close();
     }
+    impl->putStatistics();
+}
+
+
+// BCForwardDynamicsABM only implements the Euler method, and the solver only gives the
+// accelerations with the matrix-free solver
+bool BCSimulatorItemImpl::isFusedABMActive() const
+{
+    return isFusedABMMode &&
+        integrationMode.is(BCSimulatorItem::EULER_INTEGRATION) &&
+        solverMode.is(BCSimulatorItem::SLV_MATRIX_FREE_GAUSS_SEIDEL);
+}
+
+
+void BCSimulatorItemImpl::putStatistics()
+{
+    BCConstraintForceSolver& cfs = world.constraintForceSolver;
+    MessageView* mv = MessageView::instance();
+
+    if(solverMode.is(BCSimulatorItem::SLV_COLORED_GAUSS_SEIDEL) && !isIslandMode){
+        mv->putln(fmt(_("%1%: the link pairs were colored with up to %2% colors, and the largest color class had %3% link pairs."))
+                  % self->name() % cfs.maxNumColors() % cfs.maxColorClassSize());
+    }
+
+    if(solverMode.is(BCSimulatorItem::SLV_MATRIX_FREE_GAUSS_SEIDEL) && !cfs.isMatrixFreeMode()){
+        mv->putln(fmt(_("%1%: the matrix-free solver is not available for the high-gain mode bodies, so the Gauss-Seidel solver with the assembled matrix was used."))
+                  % self->name());
+    }
+
+    if(cfs.numUnconvergedBlockGaussSeidelSolutions() > 0){
+        mv->putln(fmt(_("%1%: the block Gauss-Seidel solver did not converge in %2% solutions, and their last iterates were applied."))
+                  % self->name() % cfs.numUnconvergedBlockGaussSeidelSolutions());
+    }
+
+    if(isFusedABMMode && !isFusedABMActive()){
+        mv->putln(fmt(_("%1%: the fused ABM mode was ignored because it only works with the matrix-free solver and the Euler method."))
+                  % self->name());
+    }
+
+    if(cfs.numAssemblies() > 0){
+        mv->putln(fmt(_("%1%: the LCP matrix was assembled %2% times in %3% ms on average by the %4%."))
+                  % self->name() % cfs.numAssemblies() % (cfs.totalAssemblyTime() * 1000.0 / cfs.numAssemblies())
+                  % ((isJacobianAssemblyMode && !cfs.isJacobianAssemblyUnsafe()) ? _("Jacobians") : _("test forces")));
+    }
+
+    if(cfs.totalNumFusedABMLinks() > 0){
+        mv->putln(fmt(_("%1%: the accelerations of %2% links were given by the constraint force solver without the second ABM sweep."))
+                  % self->name() % cfs.totalNumFusedABMLinks());
+    }
+
+    if(cfs.totalNumRootInertiaFactorizations() > 0){
+        mv->putln(fmt(_("%1%: the root inertias were factorized %2% times (%3% by QR) and used for %4% solves."))
+                  % self->name() % cfs.totalNumRootInertiaFactorizations() % cfs.numRootInertiaQRFallbacks()
+                  % cfs.totalNumRootInertiaSolves());
+    }
+
+    if(isJacobianAssemblyMode && cfs.numJacobianAssemblyChecks() > 0){
+        if(cfs.isJacobianAssemblyUnsafe()){
+            mv->putln(fmt(_("%1%: the Jacobian assembly did not agree with the test forces (relative error %2%), so it was disabled."))
+                      % self->name() % cfs.maxJacobianAssemblyError());
+        } else {
+            mv->putln(fmt(_("%1%: the Jacobian assembly agreed with the test forces in %2% checks (relative error %3%)."))
+                      % self->name() % cfs.numJacobianAssemblyChecks() % cfs.maxJacobianAssemblyError());
+        }
+    }
+
+    if(isSymmetricMatrixMode){
+        if(cfs.isSymmetricMatrixUnsafe()){
+            mv->putln(fmt(_("%1%: the LCP matrix was not symmetric (relative error %2%), so the symmetric matrix mode was disabled."))
+                      % self->name() % cfs.maxSymmetricMatrixError());
+        }
+        if(cfs.numSymmetricMatrixFallbacks() > 0){
+            mv->putln(fmt(_("%1%: the LCP matrix was fully assembled in %2% steps because of the constraints between the links of a high-gain mode body."))
+                      % self->name() % cfs.numSymmetricMatrixFallbacks());
+        }
+    }
+
+    const long numWarmStarted = cfs.totalNumWarmStartedPoints();
+    const long numColdStarted = cfs.totalNumColdStartedPoints();
+    if(numWarmStarted + numColdStarted > 0){
+        mv->putln(fmt(_("%1%: %2% constraint points were warm-started and %3% were cold-started."))
+                  % self->name() % numWarmStarted % numColdStarted);
+    }
+
+    if(cfs.totalNumRawContactPoints() > 0){
+        mv->putln(fmt(_("%1%: %2% of %3% collision points were kept as contact points."))
+                  % self->name() % cfs.totalNumKeptContactPoints() % cfs.totalNumRawContactPoints());
+    }
+
+    if(cfs.totalNumContactPatches() > 0){
+        mv->putln(fmt(_("%1%: %2% contact patches replaced their contact points."))
+                  % self->name() % cfs.totalNumContactPatches());
+    }
+
+    if(cfs.numCachedLinkPairs() > 0 || cfs.totalNumEvictedLinkPairs() > 0){
+        mv->putln(fmt(_("%1%: %2% link pairs are cached in %3% bytes, and %4% link pairs were evicted."))
+                  % self->name() % cfs.numCachedLinkPairs() % cfs.linkPairCacheMemoryUsage()
+                  % cfs.totalNumEvictedLinkPairs());
+    }
+
+    if(cfs.totalNumAutoPenaltyLinkPairs() > 0){
+        mv->putln(fmt(_("%1%: %2% contact link pairs were moved to the penalty-based contacts by the budgets."))
+                  % self->name() % cfs.totalNumAutoPenaltyLinkPairs());
+    }
 }
 
 CollisionLinkPairListPtr BCSimulatorItem::getCollisions()
@@ -669,6 +944,8 @@ void BCSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
     putProperty(_("penaltyKpCoef"), penaltyKpCoef, changeProperty(penaltyKpCoef));          // ADDED
     putProperty(_("penaltyKvCoef"), penaltyKvCoef, changeProperty(penaltyKvCoef));          // ADDED
     putProperty(_("penaltySizeRatio"), penaltySizeRatio, changeProperty(penaltySizeRatio)); // ADDED 
+    putProperty(_("penaltyBodies"), penaltyBodies, changeProperty(penaltyBodies));
+    putProperty(_("penaltyImplicit"), isPenaltyImplicitMode, changeProperty(isPenaltyImplicitMode));
     putProperty(_("Contact culling distance"), contactCullingDistance,
                 (boost::bind(&FloatingNumberString::setNonNegativeValue, boost::ref(contactCullingDistance), _1)));
     putProperty(_("Contact culling depth"), contactCullingDepth,
@@ -683,6 +960,27 @@ void BCSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
     putProperty(_("Kinematic walking"), isKinematicWalkingEnabled,
                 changeProperty(isKinematicWalkingEnabled));
     putProperty(_("2D mode"), is2Dmode, changeProperty(is2Dmode));
+    putProperty(_("Sparse matrix"), isSparseMatrixMode, changeProperty(isSparseMatrixMode));
+    if(solverMode.is(BCSimulatorItem::SLV_MATRIX_FREE_GAUSS_SEIDEL)){
+        putProperty(_("Fused ABM"), isFusedABMMode, changeProperty(isFusedABMMode));
+    }
+    putProperty(_("Symmetric matrix"), isSymmetricMatrixMode, changeProperty(isSymmetricMatrixMode));
+    putProperty(_("Parallel assembly"), isParallelAssemblyMode, changeProperty(isParallelAssemblyMode));
+    putProperty(_("Jacobian assembly"), isJacobianAssemblyMode, changeProperty(isJacobianAssemblyMode));
+    putProperty(_("Stable friction basis"), isStableFrictionBasisMode, changeProperty(isStableFrictionBasisMode));
+    putProperty(_("Island decomposition"), isIslandMode, changeProperty(isIslandMode));
+    putProperty.min(1.0)(_("Num threads"), numThreads, changeProperty(numThreads));
+    putProperty.min(0.0)(_("Max contacts per link pair"), maxNumContactPointsPerLinkPair,
+                         changeProperty(maxNumContactPointsPerLinkPair));
+    putProperty.min(0.0)(_("Max contacts per step"), maxNumContactPointsPerStep,
+                         changeProperty(maxNumContactPointsPerStep));
+    putProperty(_("Patch contact"), isPatchContactMode, changeProperty(isPatchContactMode));
+    putProperty.min(0.0)(_("Link pair eviction steps"), linkPairEvictionSteps,
+                         changeProperty(linkPairEvictionSteps));
+    putProperty.min(0.0)(_("Auto penalty max constraints"), autoPenaltyMaxNumConstraints,
+                         changeProperty(autoPenaltyMaxNumConstraints));
+    putProperty.decimals(4).min(0.0)(_("Auto penalty max time"), autoPenaltyMaxSolutionTime,
+                                     changeProperty(autoPenaltyMaxSolutionTime));
 }
 
 
@@ -709,9 +1007,25 @@ bool BCSimulatorItemImpl::store(Archive& archive)
     archive.write("contactCorrectionVelocityRatio", contactCorrectionVelocityRatio);
     archive.write("kinematicWalking", isKinematicWalkingEnabled);
     archive.write("2Dmode", is2Dmode);
+    archive.write("sparseMatrix", isSparseMatrixMode);
+    archive.write("fusedABM", isFusedABMMode);
+    archive.write("symmetricMatrix", isSymmetricMatrixMode);
+    archive.write("parallelAssembly", isParallelAssemblyMode);
+    archive.write("jacobianAssembly", isJacobianAssemblyMode);
+    archive.write("stableFrictionBasis", isStableFrictionBasisMode);
+    archive.write("islandDecomposition", isIslandMode);
+    archive.write("numThreads", numThreads);
+    archive.write("maxContactPointsPerLinkPair", maxNumContactPointsPerLinkPair);
+    archive.write("maxContactPointsPerStep", maxNumContactPointsPerStep);
+    archive.write("patchContact", isPatchContactMode);
+    archive.write("linkPairEvictionSteps", linkPairEvictionSteps);
+    archive.write("autoPenaltyMaxConstraints", autoPenaltyMaxNumConstraints);
+    archive.write("autoPenaltyMaxTime", autoPenaltyMaxSolutionTime);
     archive.write("penaltyKpCoef", penaltyKpCoef);       // ADDED
     archive.write("penaltyKvCoef", penaltyKvCoef);       // ADDED
     archive.write("penaltySizeRatio", penaltySizeRatio); // ADDED
+    archive.write("penaltyBodies", penaltyBodies);
+    archive.write("penaltyImplicit", isPenaltyImplicitMode);
     return true;
 }
 
@@ -746,9 +1060,25 @@ bool BCSimulatorItemImpl::restore(const Archive& archive)
     contactCorrectionVelocityRatio = archive.get("contactCorrectionVelocityRatio", contactCorrectionVelocityRatio.string());
     archive.read("kinematicWalking", isKinematicWalkingEnabled);
     archive.read("2Dmode", is2Dmode);
+    archive.read("sparseMatrix", isSparseMatrixMode);
+    archive.read("fusedABM", isFusedABMMode);
+    archive.read("symmetricMatrix", isSymmetricMatrixMode);
+    archive.read("parallelAssembly", isParallelAssemblyMode);
+    archive.read("jacobianAssembly", isJacobianAssemblyMode);
+    archive.read("stableFrictionBasis", isStableFrictionBasisMode);
+    archive.read("islandDecomposition", isIslandMode);
+    archive.read("numThreads", numThreads);
+    archive.read("maxContactPointsPerLinkPair", maxNumContactPointsPerLinkPair);
+    archive.read("maxContactPointsPerStep", maxNumContactPointsPerStep);
+    archive.read("patchContact", isPatchContactMode);
+    archive.read("linkPairEvictionSteps", linkPairEvictionSteps);
+    archive.read("autoPenaltyMaxConstraints", autoPenaltyMaxNumConstraints);
+    archive.read("autoPenaltyMaxTime", autoPenaltyMaxSolutionTime);
     archive.read("penaltyKpCoef", penaltyKpCoef);         // ADDED
     archive.read("penaltyKvCoef", penaltyKvCoef);         // ADDED
     archive.read("penaltySizeRatio", penaltySizeRatio);   // ADDED
+    archive.read("penaltyBodies", penaltyBodies);
+    archive.read("penaltyImplicit", isPenaltyImplicitMode);
     return true;
 }
 
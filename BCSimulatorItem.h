@@ -56,7 +56,7 @@ public:
 
     enum DynamicsMode    { FORWARD_DYNAMICS = 0, HG_DYNAMICS, KINEMATICS, N_DYNAMICS_MODES };
     enum IntegrationMode { EULER_INTEGRATION = 0, RUNGE_KUTTA_INTEGRATION, N_INTEGRATION_MODES };
-/*BC*/ enum SolverMode      { SLV_GAUSS_SEIDEL = 0, SLV_SICONOS, SLV_QMR, N_SOLVER_MODES };
+/*BC*/ enum SolverMode      { SLV_GAUSS_SEIDEL = 0, SLV_SICONOS, SLV_QMR, SLV_BLOCK_GAUSS_SEIDEL, SLV_COLORED_GAUSS_SEIDEL, SLV_MATRIX_FREE_GAUSS_SEIDEL, N_SOLVER_MODES };
 
     void setDynamicsMode(int mode);
     void setIntegrationMode(int mode);
@@ -72,6 +72,20 @@ public:
     void setContactCorrectionVelocityRatio(double value);
     void setEpsilon(double epsilon);
     void set2Dmode(bool on);
+    void setSparseMatrixMode(bool on);
+    void setFusedABMMode(bool on);
+    void setSymmetricMatrixMode(bool on);
+    void setParallelAssemblyMode(bool on);
+    void setJacobianAssemblyMode(bool on);
+    void setStableFrictionBasisMode(bool on);
+    void setIslandMode(bool on);
+    void setNumThreads(int n);
+    void setMaxNumContactPointsPerLinkPair(int n);
+    void setMaxNumContactPointsPerStep(int n);
+    void setPatchContactMode(bool on);
+    void setLinkPairEvictionSteps(int n);
+    void setAutoPenaltyMaxNumConstraints(int n);
+    void setAutoPenaltyMaxSolutionTime(double time);
     void setKinematicWalkingEnabled(bool on); 
 
     virtual void setForcedBodyPosition(BodyItem* bodyItem, const Position& T);
@@ -0,0 +1,135 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+
+#include "BCSparseMatrix.h"
+#include <algorithm>
+
+using namespace cnoid;
+
+
+BCSparseMatrix::BCSparseMatrix()
+{
+    outsideValue = 0.0;
+    clear();
+}
+
+
+void BCSparseMatrix::clear()
+{
+    size = 0;
+    rowStart.assign(1, 0);
+    columns.clear();
+    diagonalPositions.clear();
+    values.clear();
+}
+
+
+void BCSparseMatrix::setStructure
+(int size_, const std::vector<int>& rowToGroup, const std::vector< std::vector<int> >& groupColumns)
+{
+    size = size_;
+    rowStart.resize(size + 1);
+    diagonalPositions.resize(size);
+
+    int nnz = 0;
+    rowStart[0] = 0;
+    for(int i=0; i < size; ++i){
+        nnz += groupColumns[rowToGroup[i]].size();
+        rowStart[i + 1] = nnz;
+    }
+
+    columns.resize(nnz);
+    for(int i=0; i < size; ++i){
+        const std::vector<int>& cols = groupColumns[rowToGroup[i]];
+        std::copy(cols.begin(), cols.end(), columns.begin() + rowStart[i]);
+        diagonalPositions[i] = findPosition(i, i);
+    }
+
+    values.assign(nnz, 0.0);
+}
+
+
+void BCSparseMatrix::setZero()
+{
+    std::fill(values.begin(), values.end(), 0.0);
+}
+
+
+int BCSparseMatrix::findPosition(int row, int col) const
+{
+    std::vector<int>::const_iterator begin = columns.begin() + rowStart[row];
+    std::vector<int>::const_iterator end   = columns.begin() + rowStart[row + 1];
+    std::vector<int>::const_iterator p = std::lower_bound(begin, end, col);
+    if(p != end && *p == col){
+        return p - columns.begin();
+    }
+    return -1;
+}
+
+
+void BCSparseMatrix::multiply(const VectorX& x, VectorX& out_y) const
+{
+    for(int i=0; i < size; ++i){
+        double sum = 0.0;
+        const int end = rowStart[i + 1];
+        for(int k = rowStart[i]; k < end; ++k){
+            sum += values[k] * x(columns[k]);
+        }
+        out_y(i) = sum;
+    }
+}
+
+
+void BCSparseMatrix::multiplyTransposed(const VectorX& x, VectorX& out_y) const
+{
+    for(int i=0; i < size; ++i){
+        out_y(i) = 0.0;
+    }
+    for(int i=0; i < size; ++i){
+        const double xi = x(i);
+        const int end = rowStart[i + 1];
+        for(int k = rowStart[i]; k < end; ++k){
+            out_y(columns[k]) += values[k] * xi;
+        }
+    }
+}
+
+
+void BCSparseMatrix::copyTo(MatrixX& out_M) const
+{
+    out_M.setZero(size, size);
+    for(int i=0; i < size; ++i){
+        const int end = rowStart[i + 1];
+        for(int k = rowStart[i]; k < end; ++k){
+            out_M(i, columns[k]) = values[k];
+        }
+    }
+}
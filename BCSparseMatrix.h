@@ -0,0 +1,142 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+
+
+#ifndef CNOID_BCPLUGIN_BCSPARSEMATRIX_H
+#define CNOID_BCPLUGIN_BCSPARSEMATRIX_H
+
+#include <cnoid/EigenTypes>
+#include <vector>
+#include <cassert>
+
+namespace cnoid
+{
+
+/**
+   Row-compressed storage of the LCP/MCP matrix.
+   The rows are grouped (one group per constrained link pair), and all the rows of
+   a group share the same sorted list of non-zero columns. The pattern is given by
+   the caller and does not change until setStructure() is called again.
+*/
+class BCSparseMatrix
+{
+  public:
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> MatrixX;
+    typedef VectorXd VectorX;
+
+    BCSparseMatrix();
+
+    void clear();
+
+    /**
+       @param rowToGroup group index of each row
+       @param groupColumns sorted column indices of the non-zero elements of each group
+    */
+    void setStructure(int size, const std::vector<int>& rowToGroup, const std::vector< std::vector<int> >& groupColumns);
+
+    void setZero();
+
+    int rows() const { return size; }
+    int cols() const { return size; }
+    int nonZeros() const { return values.size(); }
+
+    int rowBegin(int row) const { return rowStart[row]; }
+    int rowEnd(int row) const { return rowStart[row + 1]; }
+    int columnIndex(int k) const { return columns[k]; }
+    double value(int k) const { return values[k]; }
+    double& valueRef(int k) { return values[k]; }
+
+    double diagonal(int row) const { return values[diagonalPositions[row]]; }
+    double& diagonalRef(int row) { return values[diagonalPositions[row]]; }
+
+    /**
+       @return -1 if the element is not included in the non-zero pattern
+    */
+    int findPosition(int row, int col) const;
+
+    double coeff(int row, int col) const {
+        if(row == col){
+            return diagonal(row);
+        }
+        int k = findPosition(row, col);
+        return (k >= 0) ? values[k] : 0.0;
+    }
+
+    double operator()(int row, int col) const { return coeff(row, col); }
+
+    /**
+       The element must be included in the non-zero pattern. Otherwise, an assertion fails in
+       the debug build, and a scratch value which is not a part of the matrix is returned.
+    */
+    double& coeffRef(int row, int col) {
+        if(row == col){
+            return diagonalRef(row);
+        }
+        const int k = findPosition(row, col);
+        assert(k >= 0);
+        if(k < 0){
+            outsideValue = 0.0;
+            return outsideValue;
+        }
+        return values[k];
+    }
+
+    //! sum of M(row, k) * x(k) for k != row
+    double calcOffDiagonalRowProduct(int row, const VectorX& x) const {
+        double sum = 0.0;
+        const int diagonalPosition = diagonalPositions[row];
+        for(int k = rowStart[row]; k < diagonalPosition; ++k){
+            sum += values[k] * x(columns[k]);
+        }
+        const int end = rowStart[row + 1];
+        for(int k = diagonalPosition + 1; k < end; ++k){
+            sum += values[k] * x(columns[k]);
+        }
+        return sum;
+    }
+
+    void multiply(const VectorX& x, VectorX& out_y) const;
+    void multiplyTransposed(const VectorX& x, VectorX& out_y) const;
+
+    void copyTo(MatrixX& out_M) const;
+
+  private:
+    int size;
+    std::vector<int> rowStart;
+    std::vector<int> columns;
+    std::vector<int> diagonalPositions;
+    std::vector<double> values;
+    double outsideValue; // written by coeffRef for an element outside the pattern
+};
+
+};
+
+#endif
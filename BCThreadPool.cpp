@@ -0,0 +1,266 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+
+
+#include "BCThreadPool.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <deque>
+#include <vector>
+
+using namespace cnoid;
+
+
+namespace cnoid {
+
+class BCThreadPoolImpl
+{
+public:
+    struct TaskQueue
+    {
+        boost::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    std::vector<TaskQueue*> queues;
+    std::vector<boost::thread*> threads;
+
+    boost::mutex mutex;
+    boost::condition_variable jobCondition;
+    boost::condition_variable doneCondition;
+    int jobGeneration;
+    int numActiveWorkers;
+    bool isTerminating;
+    const BCThreadPool::TaskFunction* function;
+
+    BCThreadPoolImpl();
+    ~BCThreadPoolImpl();
+    void startThreads(int n);
+    void stopThreads();
+    void run(int numTasks, const BCThreadPool::TaskFunction& func);
+    void workerMain(int worker, int generation);
+    void processTasks(int worker);
+    bool popTask(int worker, int& out_task);
+    bool stealTask(int worker, int& out_task);
+};
+
+}
+
+
+BCThreadPool::BCThreadPool()
+{
+    impl = new BCThreadPoolImpl();
+}
+
+
+BCThreadPoolImpl::BCThreadPoolImpl()
+{
+    jobGeneration = 0;
+    numActiveWorkers = 0;
+    isTerminating = false;
+    function = 0;
+    queues.push_back(new TaskQueue());
+}
+
+
+BCThreadPool::~BCThreadPool()
+{
+    delete impl;
+}
+
+
+BCThreadPoolImpl::~BCThreadPoolImpl()
+{
+    stopThreads();
+    delete queues[0];
+}
+
+
+void BCThreadPool::setNumThreads(int n)
+{
+    if(n < 1){
+        n = 1;
+    }
+    if(n != numThreads()){
+        impl->stopThreads();
+        impl->startThreads(n);
+    }
+}
+
+
+int BCThreadPool::numThreads() const
+{
+    return impl->queues.size();
+}
+
+
+void BCThreadPoolImpl::startThreads(int n)
+{
+    isTerminating = false;
+    for(int i=1; i < n; ++i){
+        queues.push_back(new TaskQueue());
+    }
+    // a new worker waits for the job after the current generation
+    int generation;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        generation = jobGeneration;
+    }
+    for(int i=1; i < n; ++i){
+        threads.push_back(new boost::thread(boost::bind(&BCThreadPoolImpl::workerMain, this, i, generation)));
+    }
+}
+
+
+void BCThreadPoolImpl::stopThreads()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        isTerminating = true;
+    }
+    jobCondition.notify_all();
+
+    for(size_t i=0; i < threads.size(); ++i){
+        threads[i]->join();
+        delete threads[i];
+    }
+    threads.clear();
+
+    for(size_t i=1; i < queues.size(); ++i){
+        delete queues[i];
+    }
+    queues.resize(1);
+}
+
+
+void BCThreadPool::run(int numTasks, const TaskFunction& func)
+{
+    impl->run(numTasks, func);
+}
+
+
+void BCThreadPoolImpl::run(int numTasks, const BCThreadPool::TaskFunction& func)
+{
+    const int numWorkers = queues.size();
+
+    if(numWorkers == 1 || numTasks <= 1){
+        for(int i=0; i < numTasks; ++i){
+            func(i, 0);
+        }
+        return;
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for(int i=0; i < numWorkers; ++i){
+            TaskQueue& queue = *queues[i];
+            boost::unique_lock<boost::mutex> queueLock(queue.mutex);
+            queue.tasks.clear();
+            for(int j=i; j < numTasks; j += numWorkers){
+                queue.tasks.push_back(j);
+            }
+        }
+        function = &func;
+        numActiveWorkers = numWorkers - 1;
+        ++jobGeneration;
+    }
+    jobCondition.notify_all();
+
+    processTasks(0);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while(numActiveWorkers > 0){
+        doneCondition.wait(lock);
+    }
+    function = 0;
+}
+
+
+void BCThreadPoolImpl::workerMain(int worker, int generation)
+{
+    while(true){
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while(!isTerminating && jobGeneration == generation){
+                jobCondition.wait(lock);
+            }
+            if(isTerminating){
+                break;
+            }
+            generation = jobGeneration;
+        }
+
+        processTasks(worker);
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if(--numActiveWorkers == 0){
+            doneCondition.notify_all();
+        }
+    }
+}
+
+
+void BCThreadPoolImpl::processTasks(int worker)
+{
+    int task;
+    while(popTask(worker, task) || stealTask(worker, task)){
+        (*function)(task, worker);
+    }
+}
+
+
+bool BCThreadPoolImpl::popTask(int worker, int& out_task)
+{
+    TaskQueue& queue = *queues[worker];
+    boost::unique_lock<boost::mutex> lock(queue.mutex);
+    if(queue.tasks.empty()){
+        return false;
+    }
+    out_task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+}
+
+
+bool BCThreadPoolImpl::stealTask(int worker, int& out_task)
+{
+    const int numWorkers = queues.size();
+    for(int i=1; i < numWorkers; ++i){
+        TaskQueue& queue = *queues[(worker + i) % numWorkers];
+        boost::unique_lock<boost::mutex> lock(queue.mutex);
+        if(!queue.tasks.empty()){
+            out_task = queue.tasks.back();
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
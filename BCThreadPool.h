@@ -0,0 +1,72 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+
+
+#ifndef CNOID_BCPLUGIN_BCTHREADPOOL_H
+#define CNOID_BCPLUGIN_BCTHREADPOOL_H
+
+#include <boost/function.hpp>
+
+namespace cnoid
+{
+
+class BCThreadPoolImpl;
+
+/**
+   A fixed set of worker threads which runs a batch of independent tasks.
+   The tasks are dealt to the per-thread queues in the given order, and an idle
+   thread steals tasks from the tail of the other queues. The calling thread works
+   as the worker 0, so the pool with one thread runs the tasks sequentially.
+*/
+class BCThreadPool
+{
+  public:
+    typedef boost::function<void(int task, int worker)> TaskFunction;
+
+    BCThreadPool();
+    ~BCThreadPool();
+
+    //! The number includes the calling thread. This must not be called while run() is executed.
+    void setNumThreads(int n);
+    int numThreads() const;
+
+    //! Calls func(task, worker) for each task in [0, numTasks) and returns when all the tasks are finished.
+    void run(int numTasks, const TaskFunction& func);
+
+  private:
+    BCThreadPoolImpl* impl;
+    BCThreadPool(const BCThreadPool& org);
+    BCThreadPool& operator=(const BCThreadPool& org);
+};
+
+};
+
+#endif
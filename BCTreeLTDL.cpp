@@ -0,0 +1,105 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+
+#include "BCTreeLTDL.h"
+#include <cmath>
+
+using namespace cnoid;
+
+
+void BCTreeLTDL::setParents(const std::vector<int>& parents_)
+{
+    parents = parents_;
+    const int n = parents.size();
+    H.resize(n, n);
+    H.setZero();
+}
+
+
+bool BCTreeLTDL::factorize()
+{
+    const int n = parents.size();
+
+    for(int k = n - 1; k >= 0; --k){
+        const double d = H(k, k);
+        if(!(d > 0.0)){
+            return false;
+        }
+        int i = parents[k];
+        while(i >= 0){
+            const double a = H(k, i) / d;
+            int j = i;
+            while(j >= 0){
+                H(i, j) -= a * H(k, j);
+                j = parents[j];
+            }
+            H(k, i) = a;
+            i = parents[i];
+        }
+    }
+    return true;
+}
+
+
+void BCTreeLTDL::solve(MatrixX& B) const
+{
+    const int n = parents.size();
+
+    // L^T
+    for(int i = n - 1; i >= 0; --i){
+        for(int j = parents[i]; j >= 0; j = parents[j]){
+            B.row(j) -= H(i, j) * B.row(i);
+        }
+    }
+    // D
+    for(int i = 0; i < n; ++i){
+        B.row(i) /= H(i, i);
+    }
+    // L
+    for(int i = 0; i < n; ++i){
+        for(int j = parents[i]; j >= 0; j = parents[j]){
+            B.row(i) -= H(i, j) * B.row(j);
+        }
+    }
+}
+
+
+void BCTreeLTDL::solveHalf(MatrixX& B, const std::vector<int>& dofs) const
+{
+    // L^T, where the ancestors of a DOF follow it in dofs
+    for(size_t k=0; k < dofs.size(); ++k){
+        const int i = dofs[k];
+        for(int j = parents[i]; j >= 0; j = parents[j]){
+            B.row(j) -= H(i, j) * B.row(i);
+        }
+        B.row(i) /= std::sqrt(H(i, i));
+    }
+}
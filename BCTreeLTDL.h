@@ -0,0 +1,84 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+#ifndef CNOID_BCPLUGIN_BCTREELTDL_H
+#define CNOID_BCPLUGIN_BCTREELTDL_H
+
+#include <cnoid/EigenTypes>
+#include <vector>
+
+namespace cnoid
+{
+
+/**
+   LTDL factorization H = L^T D L of a joint-space inertia matrix whose sparsity
+   follows the kinematic tree (R. Featherstone, Rigid Body Dynamics Algorithms, Sec. 6.5).
+   The degree of freedom i is coupled only with its ancestors given by the parent array,
+   where parent(i) < i, so the factorization does not fill any new elements.
+*/
+class BCTreeLTDL
+{
+  public:
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> MatrixX;
+
+    //! @param parents parent DOF of each DOF, or -1 for the DOF of the base
+    void setParents(const std::vector<int>& parents);
+
+    int size() const { return parents.size(); }
+    int parent(int i) const { return parents[i]; }
+
+    /**
+       Elements H(i, j) where j is i or an ancestor of i must be set before factorize().
+       After factorize() the same elements store D (diagonal) and L.
+    */
+    MatrixX& matrix() { return H; }
+
+    //! @return false if the matrix is not positive definite
+    bool factorize();
+
+    //! B = H^-1 B for the columns of B
+    void solve(MatrixX& B) const;
+
+    /**
+       B = D^-1/2 L^-T B for the columns of B, so that B^T H^-1 B is the product of the
+       result with its transpose. Only the rows of dofs, given in descending order, are
+       calculated, and they must include the nonzero rows of B and their ancestors.
+       The result is zero in the other rows, which are not changed.
+    */
+    void solveHalf(MatrixX& B, const std::vector<int>& dofs) const;
+
+  private:
+    std::vector<int> parents;
+    MatrixX H;
+};
+
+};
+
+#endif
@@ -0,0 +1,418 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+/**
+   Measures the part of a step of BCForwardDynamicsABM that the fused ABM mode of
+   BCConstraintForceSolver replaces, on a free-floating chain with contacts on the root and
+   on the tip. Without the mode, the constraint forces are added to the external forces and
+   the phase 2 (part 2) and the phase 3 of ABM are calculated. With the mode, the solver
+   commits the constraint forces to its ABM force elements by the paths of the contact links
+   to the root and sets the accelerations by one top-down sweep. In the matrix-free mode the
+   forces are committed by the iterations of the solver, so only the sweep remains. Both
+   give the same accelerations, and the largest difference is reported.
+   This is a model: the phases are the ones of BCForwardDynamicsABM and the sweeps the
+   ones of the solver, over the links of a vector instead of DyLink, so the times are not
+   the ones of the plugin classes. The mode is only used with the matrix-free solver, whose
+   cost is the fused MF column; the fused column is the cost it would have after the other
+   solvers.
+*/
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/Cholesky>
+#include <Eigen/QR>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <cstdlib>
+#include <cstdio>
+
+namespace {
+
+typedef Eigen::Vector3d Vector3;
+typedef Eigen::Matrix3d Matrix3;
+typedef Eigen::Matrix<double, 6, 6> Matrix6;
+typedef Eigen::Matrix<double, 6, 1> Vector6;
+
+const int numContactsPerLink = 4;
+
+Matrix3 hat(const Vector3& x)
+{
+    Matrix3 m;
+    m << 0.0, -x(2), x(1),
+        x(2), 0.0, -x(0),
+        -x(1), x(0), 0.0;
+    return m;
+}
+
+struct Link
+{
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    int parent;
+    Vector3 a, b, c;
+    double m, Jm2, q, dq, u;
+    Matrix3 I, R;
+    Vector3 p, sw, sv, w, vo, cv, cw, wc, pf, ptau, hhv, hhw, dvo, dw, f_ext, tau_ext;
+    Matrix3 Ivv, Iwv, Iww;
+    double dd, uu, ddq;
+};
+
+// the scratch data of the solver
+struct LinkData
+{
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Vector3 pf0, ptau0, dvo, dw;
+    double uu, uu0, ddq;
+};
+
+struct Contact
+{
+    int link;
+    Vector3 point;
+    Vector3 force;
+};
+
+double randomValue(double range)
+{
+    return range * (2.0 * std::rand() / RAND_MAX - 1.0);
+}
+
+Vector3 randomVector(double range)
+{
+    return Vector3(randomValue(range), randomValue(range), randomValue(range));
+}
+
+class ChainScene
+{
+public:
+    ChainScene(int numLinks) : links(numLinks), linksData(numLinks), g(0.0, 0.0, -9.8) {
+        for(int i=0; i < numLinks; ++i){
+            Link& link = links[i];
+            link.parent = i - 1;
+            link.a = randomVector(1.0).normalized();
+            link.b = Vector3(0.0, 0.0, 0.1) + randomVector(0.02);
+            link.c = randomVector(0.05);
+            link.m = 1.0 + randomValue(0.5);
+            link.I = Vector3(0.01, 0.02, 0.015).asDiagonal();
+            link.Jm2 = 0.0;
+            link.q = randomValue(1.0);
+            link.dq = randomValue(1.0);
+            link.u = randomValue(1.0);
+            link.f_ext.setZero();
+            link.tau_ext.setZero();
+        }
+        Link& root = links[0];
+        root.R = Eigen::AngleAxisd(0.3, Vector3(1.0, 2.0, 3.0).normalized()).toRotationMatrix();
+        root.p = Vector3(0.0, 0.0, 0.5);
+        root.w = randomVector(0.5);
+        root.vo = randomVector(0.5) - root.p.cross(root.w);
+
+        for(int k=0; k < 2; ++k){
+            const int index = (k == 0) ? 0 : (numLinks - 1);
+            for(int i=0; i < numContactsPerLink; ++i){
+                Contact contact;
+                contact.link = index;
+                contact.point = randomVector(0.1);
+                contact.force = Vector3(0.0, 0.0, 10.0) + randomVector(2.0);
+                contacts.push_back(contact);
+            }
+        }
+
+        calcPhase1();
+        calcPhase2Part1();
+        initABMForceElementsWithNoExtForce();
+
+        savedLinks = links;
+        savedLinksData = linksData;
+        Matrix6 M;
+        M << root.Ivv, root.Iwv.transpose(), root.Iwv, root.Iww;
+        rootInertia.compute(M);
+    }
+
+    // the phases 2 (part 2) and 3 of BCForwardDynamicsABM with the constraint forces
+    void calcFullABM() {
+        restore();
+        for(size_t i=0; i < contacts.size(); ++i){
+            Link& link = links[contacts[i].link];
+            link.f_ext   += contacts[i].force;
+            link.tau_ext += contacts[i].point.cross(contacts[i].force);
+        }
+        calcPhase2Part2();
+        calcPhase3();
+    }
+
+    // commitSolutionToABMForceElements and calcAccelsABM of the solver
+    void calcFusedABM(bool isCommitted) {
+        restore();
+        if(!isCommitted){
+            for(size_t i=0; i < contacts.size(); ++i){
+                commitForce(contacts[i].link, contacts[i].force, contacts[i].point.cross(contacts[i].force));
+            }
+        }
+        calcAccelsABM();
+    }
+
+    void commitAll() {
+        for(size_t i=0; i < contacts.size(); ++i){
+            commitForce(contacts[i].link, contacts[i].force, contacts[i].point.cross(contacts[i].force));
+        }
+        savedLinksData = linksData;
+    }
+
+    double maxDifference(const ChainScene& other) const {
+        double d = 0.0;
+        for(size_t i=0; i < links.size(); ++i){
+            d = std::max(d, (links[i].dvo - other.linksData[i].dvo).cwiseAbs().maxCoeff());
+            d = std::max(d, (links[i].dw  - other.linksData[i].dw ).cwiseAbs().maxCoeff());
+            if(i > 0){
+                d = std::max(d, std::fabs(links[i].ddq - other.linksData[i].ddq));
+            }
+        }
+        return d;
+    }
+
+private:
+    std::vector<Link, Eigen::aligned_allocator<Link> > links;
+    std::vector<Link, Eigen::aligned_allocator<Link> > savedLinks;
+    std::vector<LinkData, Eigen::aligned_allocator<LinkData> > linksData;
+    std::vector<LinkData, Eigen::aligned_allocator<LinkData> > savedLinksData;
+    std::vector<Contact> contacts;
+    Eigen::LLT<Matrix6> rootInertia;
+    Vector3 g;
+
+    // the quantities that the phases and the sweeps change
+    void restore() {
+        for(size_t i=0; i < links.size(); ++i){
+            links[i].pf = savedLinks[i].pf;
+            links[i].ptau = savedLinks[i].ptau;
+            links[i].uu = savedLinks[i].uu;
+            links[i].f_ext.setZero();
+            links[i].tau_ext.setZero();
+            linksData[i].pf0 = savedLinksData[i].pf0;
+            linksData[i].ptau0 = savedLinksData[i].ptau0;
+            linksData[i].uu = savedLinksData[i].uu;
+            linksData[i].uu0 = savedLinksData[i].uu0;
+        }
+    }
+
+    void calcPhase1() {
+        for(size_t i=0; i < links.size(); ++i){
+            Link& link = links[i];
+            if(link.parent >= 0){
+                const Link& parent = links[link.parent];
+                link.R = parent.R * Eigen::AngleAxisd(link.q, link.a);
+                link.p = parent.R * link.b + parent.p;
+                link.sw = parent.R * link.a;
+                link.sv = link.p.cross(link.sw);
+                link.w = link.dq * link.sw + parent.w;
+                link.vo = link.dq * link.sv + parent.vo;
+                const Vector3 dsv = parent.w.cross(link.sv) + parent.vo.cross(link.sw);
+                const Vector3 dsw = parent.w.cross(link.sw);
+                link.cv = link.dq * dsv;
+                link.cw = link.dq * dsw;
+            }
+            link.wc = link.R * link.c + link.p;
+            const Matrix3 Iw = link.R * link.I * link.R.transpose();
+            const Matrix3 c_hat = hat(link.wc);
+            link.Iww = link.m * c_hat * c_hat.transpose() + Iw;
+            link.Ivv = link.m * Matrix3::Identity();
+            link.Iwv = link.m * c_hat;
+            const Vector3 P = link.m * (link.vo + link.w.cross(link.wc));
+            const Vector3 L = link.Iww * link.w + link.m * link.wc.cross(link.vo);
+            link.pf = link.w.cross(P);
+            link.ptau = link.vo.cross(P) + link.w.cross(L);
+            const Vector3 fg = link.m * g;
+            link.pf -= fg;
+            link.ptau -= link.wc.cross(fg);
+        }
+    }
+
+    // the children of a link follow the link, so they are completed before it
+    void calcPhase2Part1() {
+        for(int i = links.size() - 1; i > 0; --i){
+            Link& link = links[i];
+            Link& parent = links[link.parent];
+            link.hhv = link.Ivv * link.sv + link.Iwv.transpose() * link.sw;
+            link.hhw = link.Iwv * link.sv + link.Iww * link.sw;
+            link.dd = link.sv.dot(link.hhv) + link.sw.dot(link.hhw) + link.Jm2;
+            link.uu = - link.hhv.dot(link.cv) - link.hhw.dot(link.cw);
+
+            parent.pf   += link.Ivv * link.cv + link.Iwv.transpose() * link.cw;
+            parent.ptau += link.Iwv * link.cv + link.Iww * link.cw;
+            parent.Ivv += link.Ivv;
+            parent.Iwv += link.Iwv;
+            parent.Iww += link.Iww;
+            const Vector3 hhv_dd = link.hhv / link.dd;
+            const Vector3 hhw_dd = link.hhw / link.dd;
+            parent.Ivv -= hhv_dd * link.hhv.transpose();
+            parent.Iwv -= hhw_dd * link.hhv.transpose();
+            parent.Iww -= hhw_dd * link.hhw.transpose();
+        }
+    }
+
+    void calcPhase2Part2() {
+        for(int i = links.size() - 1; i >= 0; --i){
+            Link& link = links[i];
+            link.pf   -= link.f_ext;
+            link.ptau -= link.tau_ext;
+            if(i > 0){
+                link.uu += link.u - (link.sv.dot(link.pf) + link.sw.dot(link.ptau));
+                Link& parent = links[link.parent];
+                const double uu_dd = link.uu / link.dd;
+                parent.pf   += link.pf + uu_dd * link.hhv;
+                parent.ptau += link.ptau + uu_dd * link.hhw;
+            }
+        }
+    }
+
+    void calcPhase3() {
+        Link& root = links[0];
+        Matrix6 M;
+        M << root.Ivv, root.Iwv.transpose(), root.Iwv, root.Iww;
+        Vector6 f;
+        f << root.pf, root.ptau;
+        f *= -1.0;
+        const Vector6 a(M.colPivHouseholderQr().solve(f));
+        root.dvo = a.head<3>();
+        root.dw  = a.tail<3>();
+        for(size_t i=1; i < links.size(); ++i){
+            Link& link = links[i];
+            const Link& parent = links[link.parent];
+            link.ddq = (link.uu - (link.hhv.dot(parent.dvo) + link.hhw.dot(parent.dw))) / link.dd;
+            link.dvo = parent.dvo + link.cv + link.sv * link.ddq;
+            link.dw  = parent.dw  + link.cw + link.sw * link.ddq;
+        }
+    }
+
+    void initABMForceElementsWithNoExtForce() {
+        for(int i = links.size() - 1; i >= 0; --i){
+            const Link& link = links[i];
+            LinkData& data = linksData[i];
+            data.pf0 += link.pf - link.f_ext;
+            data.ptau0 += link.ptau - link.tau_ext;
+            if(i > 0){
+                data.uu0 = link.uu + link.u - (link.sv.dot(data.pf0) + link.sw.dot(data.ptau0));
+                data.uu = data.uu0;
+                LinkData& parentData = linksData[link.parent];
+                const double uu_dd = data.uu0 / link.dd;
+                parentData.pf0   += data.pf0 + uu_dd * link.hhv;
+                parentData.ptau0 += data.ptau0 + uu_dd * link.hhw;
+            }
+        }
+    }
+
+    // calcABMForceElementsWithTestForce and the commit of applyForceToABMForceElements
+    void commitForce(int linkIndex, const Vector3& f, const Vector3& tau) {
+        Vector3 dpf = -f;
+        Vector3 dptau = -tau;
+        for(int i = linkIndex; i > 0; i = links[i].parent){
+            const Link& link = links[i];
+            LinkData& data = linksData[i];
+            const double duu = -(link.sv.dot(dpf) + link.sw.dot(dptau));
+            data.uu += duu;
+            const double duudd = duu / link.dd;
+            dpf   += duudd * link.hhv;
+            dptau += duudd * link.hhw;
+        }
+        for(int i = linkIndex; i > 0; i = links[i].parent){
+            linksData[i].uu0 = linksData[i].uu;
+        }
+        linksData[0].pf0   += dpf;
+        linksData[0].ptau0 += dptau;
+    }
+
+    void calcAccelsABM() {
+        LinkData& rootData = linksData[0];
+        Vector6 a;
+        a << rootData.pf0, rootData.ptau0;
+        a *= -1.0;
+        a = rootInertia.solve(a);
+        rootData.dvo = a.head<3>();
+        rootData.dw  = a.tail<3>();
+        for(size_t i=1; i < links.size(); ++i){
+            const Link& link = links[i];
+            LinkData& data = linksData[i];
+            const LinkData& parentData = linksData[link.parent];
+            data.ddq = (data.uu - (link.hhv.dot(parentData.dvo) + link.hhw.dot(parentData.dw))) / link.dd;
+            data.dvo = parentData.dvo + link.cv + link.sv * data.ddq;
+            data.dw  = parentData.dw  + link.cw + link.sw * data.ddq;
+            data.uu = data.uu0;
+        }
+    }
+};
+
+double measure(ChainScene& scene, int mode, int numRepeats)
+{
+    std::clock_t start = std::clock();
+    for(int i=0; i < numRepeats; ++i){
+        if(mode == 0){
+            scene.calcFullABM();
+        } else {
+            scene.calcFusedABM(mode == 2);
+        }
+    }
+    return static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC / numRepeats * 1.0e6;
+}
+
+}
+
+
+int main(int argc, char* argv[])
+{
+    const int totalNumLinks = (argc > 1) ? std::atoi(argv[1]) : 2000000;
+    const int sizes[] = { 10, 30, 100, 300 };
+
+    std::printf("model of the phases and the sweeps over a vector of links, not the plugin classes\n");
+    std::printf("%8s %14s %14s %14s %12s\n",
+                "links", "full [us]", "fused [us]", "fused MF [us]", "difference");
+
+    for(int k=0; k < 4; ++k){
+        const int numLinks = sizes[k];
+        const int numRepeats = std::max(1, totalNumLinks / numLinks);
+        std::srand(1);
+        ChainScene full(numLinks);
+        std::srand(1);
+        ChainScene fused(numLinks);
+        std::srand(1);
+        ChainScene committed(numLinks);
+        committed.commitAll();
+
+        const double fullTime = measure(full, 0, numRepeats);
+        const double fusedTime = measure(fused, 1, numRepeats);
+        const double committedTime = measure(committed, 2, numRepeats);
+        const double difference = std::max(full.maxDifference(fused), full.maxDifference(committed));
+
+        std::printf("%8d %14.3f %14.3f %14.3f %12.3g\n",
+                    numLinks, fullTime, fusedTime, committedTime, difference);
+    }
+
+    return 0;
+}
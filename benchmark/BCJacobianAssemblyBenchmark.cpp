@@ -0,0 +1,508 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+/**
+   Times the assembly of Mlcp of BCConstraintForceSolver for a humanoid of 30 joints with a
+   free root standing on its feet, by the test forces and by the Jacobians. The test-force
+   assembly applies the normal and the two friction forces of a point together through the
+   articulated inertias and sweeps the accelerations of all the links
+   (calcABMForceElementsWithTestForceBatch and calcAccelsABMBatch). The Jacobian assembly
+   calculates the joint-space inertia by the composite rigid body algorithm, factorizes it
+   by BCTreeLTDL and forms J H^-1 J^T from the DOFs on the paths of the contact links
+   (setAccelerationMatrixByJacobians).
+   Both give the same matrix, and the largest difference relative to the largest element is
+   reported. The links are the elements of a vector instead of DyLink.
+*/
+
+#include "../BCTreeLTDL.h"
+#include <Eigen/Geometry>
+#include <Eigen/Cholesky>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <cstdlib>
+#include <cstdio>
+
+using namespace cnoid;
+
+namespace {
+
+typedef Eigen::Matrix<double, 6, 6> Matrix6;
+typedef Eigen::Matrix<double, 6, 1> Vector6;
+// the normal and the two friction vectors of a point
+typedef Eigen::Matrix<double, 3, 3> Vector3Batch;
+typedef Eigen::Matrix<double, 1, 3> ScalarBatch;
+typedef Eigen::Matrix<double, 6, 3> Vector6Batch;
+
+const int numPointsPerFoot = 4;
+const int numFrictionVectors = 2;
+
+Matrix3 hat(const Vector3& x)
+{
+    Matrix3 m;
+    m << 0.0, -x(2), x(1),
+        x(2), 0.0, -x(0),
+        -x(1), x(0), 0.0;
+    return m;
+}
+
+double randomValue(double range)
+{
+    return range * (2.0 * std::rand() / RAND_MAX - 1.0);
+}
+
+Vector3 randomVector(double range)
+{
+    return Vector3(randomValue(range), randomValue(range), randomValue(range));
+}
+
+struct Link
+{
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    int parent;
+    Vector3 a, b, c;
+    double m, q, dq;
+    Matrix3 I, R;
+    Vector3 p, sw, sv, w, vo, cv, cw, wc, pf, ptau, hhv, hhw;
+    Matrix3 Ivv, Iwv, Iww;
+    double dd;
+    // the scratch data of the solver
+    Vector3 pf0, ptau0, dvo, dw;
+    double uu, uu0, ddq;
+    Vector3Batch dvoBatch, dwBatch;
+    ScalarBatch duuBatch;
+};
+
+struct Constraint
+{
+    int link;
+    Vector3 point;
+    Vector3 direction;
+};
+
+class HumanoidScene
+{
+public:
+    HumanoidScene() : g(0.0, 0.0, -9.8) {
+        addLink(-1, 10.0, Vector3::Zero());
+        // legs of 6 joints from the root
+        for(int side=0; side < 2; ++side){
+            int parent = 0;
+            for(int i=0; i < 6; ++i){
+                const Vector3 offset = (i == 0) ? Vector3(0.0, side ? -0.1 : 0.1, -0.1) : Vector3(0.0, 0.0, -0.07);
+                parent = addLink(parent, 1.5, offset);
+            }
+            feet.push_back(parent);
+        }
+        // waist of 2 joints, neck of 2 joints and arms of 7 joints
+        int chest = addLink(addLink(0, 3.0, Vector3(0.0, 0.0, 0.1)), 5.0, Vector3(0.0, 0.0, 0.1));
+        addLink(addLink(chest, 0.5, Vector3(0.0, 0.0, 0.2)), 1.0, Vector3(0.0, 0.0, 0.05));
+        for(int side=0; side < 2; ++side){
+            int parent = chest;
+            for(int i=0; i < 7; ++i){
+                const Vector3 offset = (i == 0) ? Vector3(0.0, side ? -0.15 : 0.15, 0.15) : Vector3(0.0, 0.0, -0.05);
+                parent = addLink(parent, 0.8, offset);
+            }
+        }
+
+        Link& root = links[0];
+        root.R = Eigen::AngleAxisd(0.1, Vector3(1.0, 2.0, 3.0).normalized()).toRotationMatrix();
+        root.p = Vector3(0.0, 0.0, 0.8);
+        root.w = randomVector(0.2);
+        root.vo = randomVector(0.2) - root.p.cross(root.w);
+
+        calcPhase1();
+        calcPhase2Part1();
+        initABMForceElementsWithNoExtForce();
+        Matrix6 M;
+        M << root.Ivv, root.Iwv.transpose(), root.Iwv, root.Iww;
+        rootInertia.compute(M);
+
+        // the normal and the friction vectors of the points on the soles, which are in the
+        // columns of the rows of each point
+        for(size_t i=0; i < feet.size(); ++i){
+            const Link& foot = links[feet[i]];
+            for(int j=0; j < numPointsPerFoot; ++j){
+                Constraint constraint;
+                constraint.link = feet[i];
+                constraint.point = foot.p + foot.R * Vector3((j & 1) ? 0.1 : -0.05, (j & 2) ? 0.05 : -0.05, -0.05);
+                constraint.direction = Vector3::UnitZ();
+                constraints.push_back(constraint);
+                for(int k=0; k < numFrictionVectors; ++k){
+                    constraint.direction = (k == 0) ? Vector3::UnitX() : Vector3::UnitY();
+                    constraints.push_back(constraint);
+                }
+            }
+        }
+
+        std::vector<int> parents;
+        for(int i=0; i < 6; ++i){
+            parents.push_back(i - 1);
+        }
+        for(size_t i=1; i < links.size(); ++i){
+            parents.push_back((links[i].parent == 0) ? 5 : (links[i].parent + 5));
+        }
+        ltdl.setParents(parents);
+
+        // the DOFs on the paths of the feet in descending order
+        std::vector<bool> isPathLink(links.size(), false);
+        for(size_t i=0; i < feet.size(); ++i){
+            for(int j = feet[i]; j >= 0; j = links[j].parent){
+                isPathLink[j] = true;
+            }
+        }
+        for(int i = links.size() - 1; i > 0; --i){
+            if(isPathLink[i]){
+                pathDofs.push_back(i + 5);
+            }
+        }
+        for(int i=5; i >= 0; --i){
+            pathDofs.push_back(i);
+        }
+    }
+
+    int numJoints() const { return links.size() - 1; }
+    int numConstraints() const { return constraints.size(); }
+
+    void assembleByTestForces(MatrixX& M) {
+        const int size = constraints.size();
+        M.resize(size, size);
+        VectorX a0(size);
+        calcAccelsABM();
+        for(int i=0; i < size; ++i){
+            a0(i) = calcAccelOfConstraint(constraints[i]);
+        }
+        for(int j=0; j < size; j += 3){
+            const Constraint& force = constraints[j];
+            Vector3Batch f;
+            Vector3Batch tau;
+            for(int l=0; l < 3; ++l){
+                f.col(l) = constraints[j + l].direction;
+                tau.col(l) = force.point.cross(f.col(l));
+            }
+            calcABMForceElementsWithTestForceBatch(force.link, f, tau);
+            calcAccelsABMBatch();
+            for(int i=0; i < size; ++i){
+                const Constraint& constraint = constraints[i];
+                const Link& link = links[constraint.link];
+                for(int l=0; l < 3; ++l){
+                    M(i, j + l) = constraint.direction.dot(
+                        link.dvoBatch.col(l) + link.dwBatch.col(l).cross(constraint.point)) - a0(i);
+                }
+            }
+        }
+    }
+
+    void assembleByJacobians(MatrixX& M) {
+        calcJointSpaceInertia();
+        ltdl.factorize();
+        const int size = constraints.size();
+        J.setZero(size, ltdl.size());
+        for(int i=0; i < size; ++i){
+            const Constraint& constraint = constraints[i];
+            addJacobianRow(constraint.link, constraint.direction, constraint.point.cross(constraint.direction), i);
+        }
+        Y = J.transpose();
+        ltdl.solveHalf(Y, pathDofs);
+        pathY.resize(pathDofs.size(), size);
+        for(size_t i=0; i < pathDofs.size(); ++i){
+            pathY.row(i) = Y.row(pathDofs[i]);
+        }
+        M.noalias() = pathY.transpose() * pathY;
+    }
+
+private:
+    std::vector<Link, Eigen::aligned_allocator<Link> > links;
+    std::vector<int> feet;
+    std::vector<Constraint> constraints;
+    Eigen::LLT<Matrix6> rootInertia;
+    Vector3 g;
+    Vector3 dpf;
+    Vector3 dptau;
+    Vector3Batch dpfBatch;
+    Vector3Batch dptauBatch;
+    BCTreeLTDL ltdl;
+    std::vector<int> pathDofs;
+    BCTreeLTDL::MatrixX J;
+    BCTreeLTDL::MatrixX Y;
+    BCTreeLTDL::MatrixX pathY;
+
+    int addLink(int parent, double m, const Vector3& b) {
+        Link link;
+        link.parent = parent;
+        link.a = randomVector(1.0).normalized();
+        link.b = b;
+        link.c = randomVector(0.02);
+        link.m = m;
+        link.I = m * Vector3(0.002, 0.003, 0.001).asDiagonal();
+        link.q = randomValue(0.5);
+        link.dq = randomValue(0.5);
+        link.pf0.setZero();
+        link.ptau0.setZero();
+        links.push_back(link);
+        return links.size() - 1;
+    }
+
+    double calcAccelOfConstraint(const Constraint& constraint) const {
+        const Link& link = links[constraint.link];
+        return constraint.direction.dot(link.dvo + link.dw.cross(constraint.point));
+    }
+
+    void calcPhase1() {
+        for(size_t i=0; i < links.size(); ++i){
+            Link& link = links[i];
+            if(link.parent >= 0){
+                const Link& parent = links[link.parent];
+                link.R = parent.R * Eigen::AngleAxisd(link.q, link.a);
+                link.p = parent.R * link.b + parent.p;
+                link.sw = parent.R * link.a;
+                link.sv = link.p.cross(link.sw);
+                link.w = link.dq * link.sw + parent.w;
+                link.vo = link.dq * link.sv + parent.vo;
+                link.cv = link.dq * (parent.w.cross(link.sv) + parent.vo.cross(link.sw));
+                link.cw = link.dq * parent.w.cross(link.sw);
+            }
+            link.wc = link.R * link.c + link.p;
+            const Matrix3 c_hat = hat(link.wc);
+            link.Iww = link.m * c_hat * c_hat.transpose() + link.R * link.I * link.R.transpose();
+            link.Ivv = link.m * Matrix3::Identity();
+            link.Iwv = link.m * c_hat;
+            const Vector3 P = link.m * (link.vo + link.w.cross(link.wc));
+            const Vector3 L = link.Iww * link.w + link.m * link.wc.cross(link.vo);
+            link.pf = link.w.cross(P) - link.m * g;
+            link.ptau = link.vo.cross(P) + link.w.cross(L) - link.wc.cross(link.m * g);
+        }
+    }
+
+    // the children of a link follow the link, so they are completed before it
+    void calcPhase2Part1() {
+        for(int i = links.size() - 1; i > 0; --i){
+            Link& link = links[i];
+            Link& parent = links[link.parent];
+            link.hhv = link.Ivv * link.sv + link.Iwv.transpose() * link.sw;
+            link.hhw = link.Iwv * link.sv + link.Iww * link.sw;
+            link.dd = link.sv.dot(link.hhv) + link.sw.dot(link.hhw);
+            link.uu = - link.hhv.dot(link.cv) - link.hhw.dot(link.cw);
+            parent.pf   += link.Ivv * link.cv + link.Iwv.transpose() * link.cw;
+            parent.ptau += link.Iwv * link.cv + link.Iww * link.cw;
+            parent.Ivv += link.Ivv - link.hhv * link.hhv.transpose() / link.dd;
+            parent.Iwv += link.Iwv - link.hhw * link.hhv.transpose() / link.dd;
+            parent.Iww += link.Iww - link.hhw * link.hhw.transpose() / link.dd;
+        }
+    }
+
+    void initABMForceElementsWithNoExtForce() {
+        for(int i = links.size() - 1; i >= 0; --i){
+            Link& link = links[i];
+            link.pf0 += link.pf;
+            link.ptau0 += link.ptau;
+            if(i > 0){
+                link.uu0 = link.uu - (link.sv.dot(link.pf0) + link.sw.dot(link.ptau0));
+                link.uu = link.uu0;
+                Link& parent = links[link.parent];
+                parent.pf0   += link.pf0 + (link.uu0 / link.dd) * link.hhv;
+                parent.ptau0 += link.ptau0 + (link.uu0 / link.dd) * link.hhw;
+            }
+        }
+        dpf.setZero();
+        dptau.setZero();
+        dpfBatch.setZero();
+        dptauBatch.setZero();
+        for(size_t i=0; i < links.size(); ++i){
+            links[i].duuBatch.setZero();
+        }
+    }
+
+    void calcABMForceElementsWithTestForceBatch(int linkIndex, const Vector3Batch& f, const Vector3Batch& tau) {
+        Vector3Batch pf = -f;
+        Vector3Batch ptau = -tau;
+        for(int i = linkIndex; i > 0; i = links[i].parent){
+            Link& link = links[i];
+            const ScalarBatch duu = -(link.sv.transpose() * pf + link.sw.transpose() * ptau);
+            link.duuBatch += duu;
+            const ScalarBatch duudd = duu / link.dd;
+            pf   += link.hhv * duudd;
+            ptau += link.hhw * duudd;
+        }
+        dpfBatch += pf;
+        dptauBatch += ptau;
+    }
+
+    void calcAccelsABMBatch() {
+        Link& root = links[0];
+        Vector6Batch a;
+        a << (dpfBatch.colwise() + root.pf0), (dptauBatch.colwise() + root.ptau0);
+        a = rootInertia.solve(-a);
+        root.dvoBatch = a.topRows<3>();
+        root.dwBatch  = a.bottomRows<3>();
+        dpfBatch.setZero();
+        dptauBatch.setZero();
+        for(size_t i=1; i < links.size(); ++i){
+            Link& link = links[i];
+            const Link& parent = links[link.parent];
+            const ScalarBatch ddq =
+                ((link.duuBatch.array() + link.uu0) -
+                 (link.hhv.transpose() * parent.dvoBatch + link.hhw.transpose() * parent.dwBatch).array()) / link.dd;
+            link.dvoBatch = (parent.dvoBatch + link.sv * ddq).colwise() + link.cv;
+            link.dwBatch  = (parent.dwBatch  + link.sw * ddq).colwise() + link.cw;
+            link.duuBatch.setZero();
+        }
+    }
+
+    void calcAccelsABM() {
+        Link& root = links[0];
+        Vector6 a;
+        a << root.pf0 + dpf, root.ptau0 + dptau;
+        a = rootInertia.solve(-a);
+        root.dvo = a.head<3>();
+        root.dw  = a.tail<3>();
+        dpf.setZero();
+        dptau.setZero();
+        for(size_t i=1; i < links.size(); ++i){
+            Link& link = links[i];
+            const Link& parent = links[link.parent];
+            link.ddq = (link.uu - (link.hhv.dot(parent.dvo) + link.hhw.dot(parent.dw))) / link.dd;
+            link.dvo = parent.dvo + link.cv + link.sv * link.ddq;
+            link.dw  = parent.dw  + link.cw + link.sw * link.ddq;
+            link.uu = link.uu0;
+        }
+    }
+
+    // the DOFs of the root are 0 to 5 and the joint of the link i is the DOF i + 5
+    void getDofAxis(int linkIndex, int localDof, int& out_dof, Vector3& out_sv, Vector3& out_sw) const {
+        if(linkIndex == 0){
+            out_dof = localDof;
+            out_sv.setZero();
+            out_sw.setZero();
+            if(localDof < 3){
+                out_sv(localDof) = 1.0;
+            } else {
+                out_sw(localDof - 3) = 1.0;
+            }
+        } else {
+            out_dof = linkIndex + 5;
+            out_sv = links[linkIndex].sv;
+            out_sw = links[linkIndex].sw;
+        }
+    }
+
+    void calcJointSpaceInertia() {
+        const int n = links.size();
+        std::vector<double> m(n);
+        std::vector<Vector3, Eigen::aligned_allocator<Vector3> > h(n);
+        std::vector<Matrix3, Eigen::aligned_allocator<Matrix3> > Io(n);
+        for(int i=0; i < n; ++i){
+            const Link& link = links[i];
+            const Vector3 c = link.p + link.R * link.c;
+            const Matrix3 C = hat(c);
+            m[i] = link.m;
+            h[i] = link.m * c;
+            Io[i] = link.R * link.I * link.R.transpose() - link.m * C * C;
+        }
+        for(int i = n - 1; i > 0; --i){
+            const int parent = links[i].parent;
+            m[parent] += m[i];
+            h[parent] += h[i];
+            Io[parent] += Io[i];
+        }
+
+        BCTreeLTDL::MatrixX& H = ltdl.matrix();
+        for(int i=0; i < n; ++i){
+            const int numDofs = (i == 0) ? 6 : 1;
+            for(int a=0; a < numDofs; ++a){
+                int dof;
+                Vector3 sv, sw;
+                getDofAxis(i, a, dof, sv, sw);
+                const Vector3 f   = m[i] * sv - h[i].cross(sw);
+                const Vector3 tau = h[i].cross(sv) + Io[i] * sw;
+                int dof2;
+                Vector3 sv2, sw2;
+                for(int b=0; b <= a; ++b){
+                    getDofAxis(i, b, dof2, sv2, sw2);
+                    H(dof, dof2) = sv2.dot(f) + sw2.dot(tau);
+                }
+                for(int j = links[i].parent; j >= 0; j = links[j].parent){
+                    const int numDofs2 = (j == 0) ? 6 : 1;
+                    for(int b=0; b < numDofs2; ++b){
+                        getDofAxis(j, b, dof2, sv2, sw2);
+                        H(dof, dof2) = sv2.dot(f) + sw2.dot(tau);
+                    }
+                }
+            }
+        }
+    }
+
+    void addJacobianRow(int linkIndex, const Vector3& f, const Vector3& tau, int row) {
+        for(int i = linkIndex; i >= 0; i = links[i].parent){
+            if(i == 0){
+                for(int a=0; a < 3; ++a){
+                    J(row, a)     += f(a);
+                    J(row, a + 3) += tau(a);
+                }
+            } else {
+                J(row, i + 5) += links[i].sv.dot(f) + links[i].sw.dot(tau);
+            }
+        }
+    }
+};
+
+template<class Function>
+double measure(HumanoidScene& scene, Function function, MatrixX& M, int numRepeats)
+{
+    std::clock_t start = std::clock();
+    for(int i=0; i < numRepeats; ++i){
+        (scene.*function)(M);
+    }
+    return static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC / numRepeats * 1.0e6;
+}
+
+}
+
+
+int main(int argc, char* argv[])
+{
+    const int numRepeats = (argc > 1) ? std::atoi(argv[1]) : 20000;
+
+    std::srand(1);
+    HumanoidScene scene;
+    MatrixX M1;
+    MatrixX M2;
+    const double testForceTime = measure(scene, &HumanoidScene::assembleByTestForces, M1, numRepeats);
+    const double jacobianTime = measure(scene, &HumanoidScene::assembleByJacobians, M2, numRepeats);
+
+    std::printf("%d joints, %d constraints\n", scene.numJoints(), scene.numConstraints());
+    std::printf("test forces: %.2f us, Jacobians: %.2f us, ratio %.2f\n",
+                testForceTime, jacobianTime, testForceTime / jacobianTime);
+    std::printf("relative difference: %.3g\n",
+                (M1 - M2).cwiseAbs().maxCoeff() / M1.cwiseAbs().maxCoeff());
+
+    return 0;
+}
@@ -0,0 +1,355 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+/**
+   Compares the time of the sweeps of BCConstraintForceSolver over the link objects
+   with the time over a structure of arrays of the same quantities. For each link of a
+   chain, a test force is propagated from the link to the root and then the accelerations
+   of all the links are calculated, which is the pattern of the sweeps in the assembly of
+   the matrix. The arrays must be filled from the links at the start of each step because
+   ABM updates the quantities, so the time of the arrays is also given with that copy.
+
+   The solver keeps the sweeps over the links because of this measurement. With g++ -O2,
+   the arrays including the copy were 0.94-1.05 times as fast as the links for 10 and
+   50 links and 1.13-1.33 times as fast for 200 links, varying between the runs. The
+   bodies of the scenes of the plugin have a few tens of links, where there is no gain.
+*/
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include <vector>
+#include <algorithm>
+#include <ctime>
+#include <cstdlib>
+#include <cstdio>
+
+namespace {
+
+typedef Eigen::Vector3d Vector3;
+
+/*
+  The quantities of ABM which do not change while the test forces are applied, in
+  arrays in the traversal order of the links, each of which starts at a cache line
+*/
+class LinkArray
+{
+public:
+    static const int CACHE_LINE_SIZE = 64;
+    static const int NUM_DOUBLES_PER_CACHE_LINE = CACHE_LINE_SIZE / sizeof(double);
+
+    void resize(int numLinks) {
+        parents.assign(numLinks, -1);
+        isFixedJoints.assign(numLinks, false);
+        const int vectorArraySize = paddedSize(3 * numLinks);
+        buffer.assign(6 * vectorArraySize + paddedSize(numLinks) + NUM_DOUBLES_PER_CACHE_LINE, 0.0);
+        double* p = &buffer[0];
+        const size_t misalignment = reinterpret_cast<size_t>(p) % CACHE_LINE_SIZE;
+        if(misalignment > 0){
+            p += (CACHE_LINE_SIZE - misalignment) / sizeof(double);
+        }
+        svs  = p; p += vectorArraySize;
+        sws  = p; p += vectorArraySize;
+        cvs  = p; p += vectorArraySize;
+        cws  = p; p += vectorArraySize;
+        hhvs = p; p += vectorArraySize;
+        hhws = p; p += vectorArraySize;
+        dds  = p;
+    }
+
+    void setStructure(int index, int parent, bool isFixedJoint) {
+        parents[index] = parent;
+        isFixedJoints[index] = isFixedJoint;
+    }
+
+    void setDynamics(int index, const Vector3& sv, const Vector3& sw, const Vector3& cv, const Vector3& cw,
+                     const Vector3& hhv, const Vector3& hhw, double dd) {
+        Eigen::Map<Vector3>(svs + 3 * index) = sv;
+        Eigen::Map<Vector3>(sws + 3 * index) = sw;
+        Eigen::Map<Vector3>(cvs + 3 * index) = cv;
+        Eigen::Map<Vector3>(cws + 3 * index) = cw;
+        Eigen::Map<Vector3>(hhvs + 3 * index) = hhv;
+        Eigen::Map<Vector3>(hhws + 3 * index) = hhw;
+        dds[index] = dd;
+    }
+
+    int size() const { return parents.size(); }
+    int parent(int index) const { return parents[index]; }
+    bool isFixedJoint(int index) const { return isFixedJoints[index]; }
+    Eigen::Map<const Vector3> sv(int index) const { return Eigen::Map<const Vector3>(svs + 3 * index); }
+    Eigen::Map<const Vector3> sw(int index) const { return Eigen::Map<const Vector3>(sws + 3 * index); }
+    Eigen::Map<const Vector3> cv(int index) const { return Eigen::Map<const Vector3>(cvs + 3 * index); }
+    Eigen::Map<const Vector3> cw(int index) const { return Eigen::Map<const Vector3>(cws + 3 * index); }
+    Eigen::Map<const Vector3> hhv(int index) const { return Eigen::Map<const Vector3>(hhvs + 3 * index); }
+    Eigen::Map<const Vector3> hhw(int index) const { return Eigen::Map<const Vector3>(hhws + 3 * index); }
+    double dd(int index) const { return dds[index]; }
+
+private:
+    static int paddedSize(int size) {
+        return ((size + NUM_DOUBLES_PER_CACHE_LINE - 1) / NUM_DOUBLES_PER_CACHE_LINE) * NUM_DOUBLES_PER_CACHE_LINE;
+    }
+
+    std::vector<int> parents;
+    std::vector<char> isFixedJoints;
+    std::vector<double> buffer;
+    double* svs;
+    double* sws;
+    double* cvs;
+    double* cws;
+    double* hhvs;
+    double* hhws;
+    double* dds;
+};
+
+// a link object which has the quantities of ABM among the other members as DyLink
+struct Node
+{
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Node* parent;
+    int index;
+    bool isFixedJoint;
+    char otherMembers1[320];
+    Vector3 sv, sw, cv, cw;
+    char otherMembers2[256];
+    Vector3 hhv, hhw;
+    double dd;
+    char otherMembers3[384];
+};
+
+// the scratch data of the solver, which is common to both the versions
+struct LinkData
+{
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Vector3 dvo, dw;
+    double uu;
+    double ddq;
+    int parentIndex;
+};
+
+typedef std::vector<LinkData, Eigen::aligned_allocator<LinkData> > LinkDataArray;
+
+double random(double min, double max)
+{
+    return min + (max - min) * std::rand() / RAND_MAX;
+}
+
+Vector3 randomVector()
+{
+    return Vector3(random(-1.0, 1.0), random(-1.0, 1.0), random(-1.0, 1.0));
+}
+
+struct Chain
+{
+    std::vector<Node*> nodes;
+    std::vector<Node*> garbage;
+    LinkDataArray linksData;
+    LinkArray links;
+
+    // a branched chain whose nodes are allocated among other objects in a random order
+    Chain(int numLinks) : linksData(numLinks) {
+        nodes.resize(numLinks);
+        std::vector<int> order(numLinks);
+        for(int i=0; i < numLinks; ++i){
+            order[i] = i;
+        }
+        std::random_shuffle(order.begin(), order.end());
+        for(int i=0; i < numLinks; ++i){
+            nodes[order[i]] = new Node;
+            for(int j=0; j < 3; ++j){
+                garbage.push_back(new Node);
+            }
+        }
+        links.resize(numLinks);
+        for(int i=0; i < numLinks; ++i){
+            Node* node = nodes[i];
+            node->index = i;
+            node->parent = (i == 0) ? 0 : nodes[(i % 4 == 0) ? i / 2 : i - 1];
+            node->isFixedJoint = (i % 7 == 3);
+            node->sv = randomVector();
+            node->sw = randomVector();
+            node->cv = randomVector();
+            node->cw = randomVector();
+            node->hhv = randomVector();
+            node->hhw = randomVector();
+            node->dd = random(1.0, 2.0);
+            linksData[i].parentIndex = node->parent ? node->parent->index : -1;
+            links.setStructure(i, linksData[i].parentIndex, node->isFixedJoint);
+        }
+        copyToArray();
+    }
+
+    // the copy at the start of each step
+    void copyToArray() {
+        for(size_t i=0; i < nodes.size(); ++i){
+            const Node* node = nodes[i];
+            links.setDynamics(i, node->sv, node->sw, node->cv, node->cw, node->hhv, node->hhw, node->dd);
+        }
+    }
+
+    ~Chain() {
+        for(size_t i=0; i < nodes.size(); ++i){
+            delete nodes[i];
+        }
+        for(size_t i=0; i < garbage.size(); ++i){
+            delete garbage[i];
+        }
+    }
+
+    void reset() {
+        for(size_t i=0; i < linksData.size(); ++i){
+            linksData[i].uu = 0.1;
+        }
+        linksData[0].dvo.setZero();
+        linksData[0].dw.setZero();
+    }
+
+    double sweepOverNodes(const Vector3& f, const Vector3& tau) {
+        double sum = 0.0;
+        const int n = nodes.size();
+        for(int k=1; k < n; ++k){
+            reset();
+            Vector3 dpf = -f;
+            Vector3 dptau = -tau;
+            for(Node* node = nodes[k]; node->parent; node = node->parent){
+                if(!node->isFixedJoint){
+                    double duu = -(node->sv.dot(dpf) + node->sw.dot(dptau));
+                    linksData[node->index].uu += duu;
+                    double duudd = duu / node->dd;
+                    dpf   += duudd * node->hhv;
+                    dptau += duudd * node->hhw;
+                }
+            }
+            for(int i=1; i < n; ++i){
+                LinkData& data = linksData[i];
+                const Node* node = nodes[i];
+                const LinkData& parentData = linksData[node->parent->index];
+                if(!node->isFixedJoint){
+                    data.ddq = (data.uu - (node->hhv.dot(parentData.dvo) + node->hhw.dot(parentData.dw))) / node->dd;
+                    data.dvo = parentData.dvo + node->cv + node->sv * data.ddq;
+                    data.dw  = parentData.dw  + node->cw + node->sw * data.ddq;
+                } else {
+                    data.dvo = parentData.dvo;
+                    data.dw  = parentData.dw;
+                }
+            }
+            sum += linksData[n-1].dvo.sum() + linksData[n-1].dw.sum();
+        }
+        return sum;
+    }
+
+    double sweepOverArrayWithCopy(const Vector3& f, const Vector3& tau) {
+        copyToArray();
+        return sweepOverArray(f, tau);
+    }
+
+    double sweepOverArray(const Vector3& f, const Vector3& tau) {
+        double sum = 0.0;
+        const int n = links.size();
+        for(int k=1; k < n; ++k){
+            reset();
+            Vector3 dpf = -f;
+            Vector3 dptau = -tau;
+            for(int i = k; i > 0; i = links.parent(i)){
+                if(!links.isFixedJoint(i)){
+                    double duu = -(links.sv(i).dot(dpf) + links.sw(i).dot(dptau));
+                    linksData[i].uu += duu;
+                    double duudd = duu / links.dd(i);
+                    dpf   += duudd * links.hhv(i);
+                    dptau += duudd * links.hhw(i);
+                }
+            }
+            for(int i=1; i < n; ++i){
+                LinkData& data = linksData[i];
+                const LinkData& parentData = linksData[links.parent(i)];
+                if(!links.isFixedJoint(i)){
+                    data.ddq = (data.uu - (links.hhv(i).dot(parentData.dvo) + links.hhw(i).dot(parentData.dw))) / links.dd(i);
+                    data.dvo = parentData.dvo + links.cv(i) + links.sv(i) * data.ddq;
+                    data.dw  = parentData.dw  + links.cw(i) + links.sw(i) * data.ddq;
+                } else {
+                    data.dvo = parentData.dvo;
+                    data.dw  = parentData.dw;
+                }
+            }
+            sum += linksData[n-1].dvo.sum() + linksData[n-1].dw.sum();
+        }
+        return sum;
+    }
+};
+
+// seconds per sweep of all the links
+template<class Sweep>
+double measure(Chain& chain, Sweep sweep, int numRepetitions, double& result)
+{
+    const Vector3 f(1.0, 2.0, 3.0);
+    const Vector3 tau(0.3, 0.2, 0.1);
+    result = 0.0;
+    std::clock_t start = std::clock();
+    for(int i=0; i < numRepetitions; ++i){
+        result += (chain.*sweep)(f, tau);
+    }
+    return static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC / numRepetitions;
+}
+
+}
+
+
+int main(int argc, char* argv[])
+{
+    const int numLinksList[] = { 10, 50, 200 };
+    // the number of the link operations in each measurement is roughly constant
+    const double scale = (argc > 1) ? std::atof(argv[1]) : 1.0;
+
+    std::srand(1);
+
+    std::printf("%8s %16s %16s %8s %20s %8s\n", "links", "nodes [us]", "array [us]", "ratio", "array+copy [us]", "ratio");
+
+    for(int i=0; i < 3; ++i){
+        const int numLinks = numLinksList[i];
+        const int numRepetitions = std::max(1, static_cast<int>(scale * 4.0e7 / (numLinks * numLinks)));
+        Chain chain(numLinks);
+        double result1, result2, result3;
+        // warm up
+        measure(chain, &Chain::sweepOverNodes, 1, result1);
+        measure(chain, &Chain::sweepOverArray, 1, result2);
+        measure(chain, &Chain::sweepOverArrayWithCopy, 1, result3);
+
+        double time1 = measure(chain, &Chain::sweepOverNodes, numRepetitions, result1);
+        double time2 = measure(chain, &Chain::sweepOverArray, numRepetitions, result2);
+        double time3 = measure(chain, &Chain::sweepOverArrayWithCopy, numRepetitions, result3);
+
+        if(result1 != result2 || result1 != result3){
+            std::printf("the results of the sweeps differ: %g, %g, %g\n", result1, result2, result3);
+            return 1;
+        }
+        std::printf("%8d %16.3f %16.3f %8.2f %20.3f %8.2f\n", numLinks, time1 * 1.0e6, time2 * 1.0e6, time1 / time2,
+                    time3 * 1.0e6, time1 / time3);
+    }
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+/**
+   Compares the explicit and the implicit integration of the penalty-based contacts of
+   BCConstraintForceSolver in a scene of stacks of boxes on a static floor. The forces of the
+   contact points are calculated as in BCCFSImpl::calcPenaltyForcesOfLinkPair, including the
+   iterations over the forces of the other contacts in the implicit mode. The stiffness
+   is the one of the solver at the reference time step, and it is kept for the larger time
+   steps by scaling penaltyKpCoef, so the penetration at rest is the same for all the steps.
+   The largest time step at which the stacks come to rest is reported for each integration.
+
+   This is a model, not the plugin: the boxes move only vertically, the contacts have no
+   friction and the kernel is written again here in one dimension. The times are the ones
+   of the model and do not measure the kernel of the solver. At the same time step the
+   implicit integration takes about three times as long because of its iterations, so it
+   only pays when the larger stable time step is used.
+*/
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <cstdlib>
+#include <cstdio>
+
+namespace {
+
+const double gravity = 9.8;
+const double boxMass = 1.0;
+const double boxSize = 0.1;
+const int numPointsPerFace = 4;
+const double referenceTimeStep = 0.001;
+const double duration = 4.0;
+const double settlingTime = 3.0;
+const double maxSettledSpeed = 1.0e-2;
+const int numImplicitIterations = 4; // PENALTY_IMPLICIT_NUM_ITERATIONS
+
+struct Result
+{
+    bool isStable;
+    double maxDepth;
+    double maxSpeed;
+    double wallTime;
+};
+
+class StackScene
+{
+public:
+    // the stacks have the heights from one to maxHeight boxes
+    StackScene(int numStacks, int maxHeight) {
+        for(int i=0; i < numStacks; ++i){
+            stackHeights.push_back(1 + i % maxHeight);
+        }
+    }
+
+    Result simulate(double timeStep, double kpCoef, bool isImplicit) {
+        Result result;
+        result.isStable = true;
+        result.maxDepth = 0.0;
+        result.maxSpeed = 0.0;
+        std::clock_t start = std::clock();
+        for(size_t i=0; i < stackHeights.size(); ++i){
+            simulateStack(stackHeights[i], timeStep, kpCoef, isImplicit, result);
+        }
+        result.wallTime = static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+        if(result.maxSpeed > maxSettledSpeed){
+            result.isStable = false;
+        }
+        return result;
+    }
+
+private:
+    std::vector<int> stackHeights;
+    std::vector<double> heights;
+    std::vector<double> velocities;
+    std::vector<double> forces;
+    std::vector<double> contactForces; // to the box i from the floor or the box i - 1
+    std::vector<double> iteratedForces;
+
+    void simulateStack(int numBoxes, double T, double kpCoef, bool isImplicit, Result& result) {
+        heights.resize(numBoxes);
+        velocities.assign(numBoxes, 0.0);
+        forces.resize(numBoxes);
+        contactForces.resize(numBoxes);
+        iteratedForces.resize(numBoxes);
+        for(int i=0; i < numBoxes; ++i){
+            heights[i] = boxSize * i;
+        }
+
+        // the same stiffness and damping as the solver, where a box has the points of two faces
+        const double maxN = 2 * numPointsPerFace;
+        const double kp = (boxMass / (T * T * maxN) / 200) * kpCoef;
+        const double kd = 2.0 * std::sqrt(boxMass * kp) / 5;
+        const double c = kp * T + kd;
+
+        const int numSteps = static_cast<int>(duration / T);
+        for(int step=0; step < numSteps; ++step){
+            const bool isSettling = (step * T >= settlingTime);
+
+            // the contact of the box i with the floor or the box i - 1, where the implicit
+            // forces use the accelerations of the boxes by the other contacts
+            std::fill(contactForces.begin(), contactForces.end(), 0.0);
+            const int numIterations = isImplicit ? numImplicitIterations : 1;
+            for(int iteration=0; iteration < numIterations; ++iteration){
+                for(int i=0; i < numBoxes; ++i){
+                    const double lowerTop = (i == 0) ? 0.0 : heights[i-1] + boxSize;
+                    const double depth = lowerTop - heights[i];
+                    if(depth <= 0.0){
+                        iteratedForces[i] = 0.0;
+                        continue;
+                    }
+                    double normalVelocity = ((i == 0) ? 0.0 : velocities[i-1]) - velocities[i];
+                    double w = 0.0;
+                    if(isImplicit){
+                        // the accelerations of the upper and the lower boxes without this contact
+                        const double upperForce = (i + 1 < numBoxes) ? -contactForces[i+1] : 0.0;
+                        normalVelocity -= T * (-gravity + upperForce / boxMass);
+                        w = 1.0 / boxMass;
+                        if(i > 0){
+                            const double lowerForce = contactForces[i-1];
+                            normalVelocity += T * (-gravity + lowerForce / boxMass);
+                            w += 1.0 / boxMass;
+                        }
+                    }
+                    const double fn = (kp * depth + c * normalVelocity) / (1.0 + c * T * numPointsPerFace * w);
+                    iteratedForces[i] = numPointsPerFace * std::max(fn, 0.0);
+                    if(isSettling && iteration == 0){
+                        result.maxDepth = std::max(result.maxDepth, depth);
+                    }
+                }
+                contactForces.swap(iteratedForces);
+            }
+
+            for(int i=0; i < numBoxes; ++i){
+                forces[i] = -boxMass * gravity + contactForces[i];
+                if(i + 1 < numBoxes){
+                    forces[i] -= contactForces[i+1];
+                }
+            }
+
+            for(int i=0; i < numBoxes; ++i){
+                velocities[i] += T * forces[i] / boxMass;
+                heights[i] += T * velocities[i];
+                if(isSettling){
+                    result.maxSpeed = std::max(result.maxSpeed, std::fabs(velocities[i]));
+                }
+            }
+            if(!(std::fabs(heights[numBoxes-1]) < 1.0e3)){
+                result.isStable = false;
+                result.maxSpeed = HUGE_VAL;
+                return;
+            }
+        }
+    }
+};
+
+}
+
+
+int main(int argc, char* argv[])
+{
+    // the penaltyKpCoef at the reference time step and the number of the stacks
+    const double kpCoef = (argc > 1) ? std::atof(argv[1]) : 10.0;
+    const int numStacks = (argc > 2) ? std::atoi(argv[2]) : 1000;
+    const int maxHeight = 5;
+
+    StackScene scene(numStacks, maxHeight);
+
+    std::printf("one-dimensional frictionless model of the penalty contacts, %d stacks\n", numStacks);
+    std::printf("%10s %12s %12s %12s %12s %12s %12s\n",
+                "step [ms]", "exp. depth", "exp. stable", "exp. [s]", "imp. depth", "imp. stable", "imp. [s]");
+
+    double maxStableSteps[2] = { 0.0, 0.0 };
+    double wallTimes[2] = { 0.0, 0.0 };
+    for(int k=1; k <= 10; ++k){
+        const double timeStep = referenceTimeStep * k;
+        Result results[2];
+        for(int j=0; j < 2; ++j){
+            results[j] = scene.simulate(timeStep, kpCoef * k * k, j == 1);
+            if(results[j].isStable && maxStableSteps[j] == referenceTimeStep * (k - 1)){
+                maxStableSteps[j] = timeStep;
+                wallTimes[j] = results[j].wallTime;
+            }
+        }
+        std::printf("%10.1f %12.3g %12s %12.3f %12.3g %12s %12.3f\n", timeStep * 1.0e3,
+                    results[0].maxDepth, results[0].isStable ? "yes" : "no", results[0].wallTime,
+                    results[1].maxDepth, results[1].isStable ? "yes" : "no", results[1].wallTime);
+    }
+
+    std::printf("largest stable time step: explicit %.1f ms (%.3f s), implicit %.1f ms (%.3f s)\n",
+                maxStableSteps[0] * 1.0e3, wallTimes[0], maxStableSteps[1] * 1.0e3, wallTimes[1]);
+
+    return 0;
+}
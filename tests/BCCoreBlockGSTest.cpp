@@ -0,0 +1,296 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+/**
+   Solves random contact problems by BCCoreBlockGS and checks the conditions of the
+   solution: the normal forces and the normal velocities are complementary, the friction
+   forces are in the cones, the friction velocities of the sticking contacts and the
+   velocities of the bilateral constraints are zero. The layout of the unknowns is
+   [ normals | bilaterals | frictions ], as ENABLE_TRUE_FRICTION_CONE gives.
+   Usage: BCCoreBlockGSTest <case>
+*/
+
+#include "../BCCoreBlockGS.h"
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+using namespace cnoid;
+
+namespace {
+
+typedef BCCoreBlockGS::MatrixX MatrixX;
+typedef BCCoreBlockGS::VectorX VectorX;
+
+const int MAX_ITERATIONS = 1000;
+const double ERROR_CRITERION = 1.0e-10;
+const double TOLERANCE = 1.0e-6;
+
+
+bool check(bool condition, const char* message)
+{
+    if(!condition){
+        printf("%s\n", message);
+    }
+    return condition;
+}
+
+
+double randomValue(double min, double max)
+{
+    return min + (max - min) * rand() / RAND_MAX;
+}
+
+
+struct Problem
+{
+    int numContacts;
+    int numBilaterals;
+    MatrixX A;
+    VectorX b;
+    VectorX mu;
+
+    Problem(int numContacts, int numBilaterals)
+        : numContacts(numContacts),
+          numBilaterals(numBilaterals) {
+        const int n = size();
+        MatrixX B(n, n);
+        for(int i=0; i < n; ++i){
+            for(int j=0; j < n; ++j){
+                B(i, j) = randomValue(-1.0, 1.0);
+            }
+        }
+        // symmetric positive definite as the matrices of the rigid bodies
+        A = B * B.transpose() / n + MatrixX::Identity(n, n);
+        b.resize(n);
+        mu.resize(numContacts);
+        for(int i=0; i < numContacts; ++i){
+            b(i) = randomValue(-1.0, 0.5);
+            mu(i) = randomValue(0.0, 1.0);
+            b(frictionIndex(i, 0)) = randomValue(-1.0, 1.0);
+            b(frictionIndex(i, 1)) = randomValue(-1.0, 1.0);
+        }
+        for(int i=0; i < numBilaterals; ++i){
+            b(numContacts + i) = randomValue(-1.0, 1.0);
+        }
+    }
+
+    int size() const { return 3 * numContacts + numBilaterals; }
+    int frictionIndex(int contact, int k) const { return numContacts + numBilaterals + 2 * contact + k; }
+};
+
+
+bool checkSolution(const Problem& problem, const VectorX& x)
+{
+    const VectorX w = problem.A * x + problem.b;
+    for(int i=0; i < problem.numContacts; ++i){
+        const double fn = x(i);
+        const double ft = sqrt(x(problem.frictionIndex(i, 0)) * x(problem.frictionIndex(i, 0)) +
+                               x(problem.frictionIndex(i, 1)) * x(problem.frictionIndex(i, 1)));
+        if(fn < 0.0 || w(i) < -TOLERANCE || fabs(fn * w(i)) > TOLERANCE){
+            printf("The contact %d is not complementary: force %g, velocity %g\n", i, fn, w(i));
+            return false;
+        }
+        if(ft > problem.mu(i) * fn + TOLERANCE){
+            printf("The friction force of the contact %d is out of the cone: %g > %g\n", i, ft, problem.mu(i) * fn);
+            return false;
+        }
+        if(ft < problem.mu(i) * fn - TOLERANCE){
+            const double wt = std::max(fabs(w(problem.frictionIndex(i, 0))), fabs(w(problem.frictionIndex(i, 1))));
+            if(wt > TOLERANCE){
+                printf("The sticking contact %d slides with the velocity %g.\n", i, wt);
+                return false;
+            }
+        }
+    }
+    for(int i=0; i < problem.numBilaterals; ++i){
+        if(fabs(w(problem.numContacts + i)) > TOLERANCE){
+            printf("The bilateral constraint %d has the velocity %g.\n", i, w(problem.numContacts + i));
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void toSparseMatrix(const MatrixX& A, BCSparseMatrix& out_M)
+{
+    const int n = A.rows();
+    std::vector<int> rowToGroup(n, 0);
+    std::vector< std::vector<int> > groupColumns(1);
+    for(int j=0; j < n; ++j){
+        groupColumns[0].push_back(j);
+    }
+    out_M.setStructure(n, rowToGroup, groupColumns);
+    for(int i=0; i < n; ++i){
+        for(int j=0; j < n; ++j){
+            out_M.coeffRef(i, j) = A(i, j);
+        }
+    }
+}
+
+
+void toPackedSymmetricMatrix(const MatrixX& A, BCPackedSymmetricMatrix& out_M)
+{
+    const int n = A.rows();
+    std::vector<int> rowToPosition(n);
+    for(int i=0; i < n; ++i){
+        rowToPosition[i] = n - 1 - i;
+    }
+    out_M.setOrder(rowToPosition);
+    for(int i=0; i < n; ++i){
+        for(int j=i; j < n; ++j){
+            out_M.coeffRef(i, j) = A(i, j);
+        }
+    }
+}
+
+
+// the three storages of the matrix give the same solution
+bool testRandomProblems()
+{
+    srand(1);
+    std::ofstream os;
+    BCCoreBlockGS core(MAX_ITERATIONS, ERROR_CRITERION);
+    const int numContactsList[] = { 1, 2, 5, 20 };
+    const int numBilateralsList[] = { 0, 1, 3 };
+
+    for(int i=0; i < 4; ++i){
+        for(int j=0; j < 3; ++j){
+            for(int k=0; k < 5; ++k){
+                Problem problem(numContactsList[i], numBilateralsList[j]);
+                const int n = problem.size();
+                core.NewBuffer(n);
+
+                VectorX x = VectorX::Zero(n);
+                if(!check(core.callSolver(problem.A, problem.b, x, problem.mu, os), "The solver failed.") ||
+                   !check(core.isConverged(), "The solver did not converge.") ||
+                   !checkSolution(problem, x)){
+                    printf("%d contacts, %d bilateral constraints\n", problem.numContacts, problem.numBilaterals);
+                    return false;
+                }
+
+                BCSparseMatrix sparse;
+                toSparseMatrix(problem.A, sparse);
+                VectorX xs = VectorX::Zero(n);
+                core.callSolver(sparse, problem.b, xs, problem.mu, os);
+
+                BCPackedSymmetricMatrix packed;
+                toPackedSymmetricMatrix(problem.A, packed);
+                VectorX xp = VectorX::Zero(n);
+                core.callSolver(packed, problem.b, xp, problem.mu, os);
+
+                if(!check((xs - x).norm() <= TOLERANCE * (1.0 + x.norm()), "The sparse matrix gave another solution.") ||
+                   !check((xp - x).norm() <= TOLERANCE * (1.0 + x.norm()), "The packed symmetric matrix gave another solution.")){
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+
+// the last iterate is applied and the non-convergence is reported
+bool testNotConverged()
+{
+    srand(2);
+    std::ofstream os;
+    Problem problem(10, 2);
+    const int n = problem.size();
+    BCCoreBlockGS core(1, ERROR_CRITERION);
+    core.NewBuffer(n);
+    VectorX x = VectorX::Zero(n);
+    if(!check(core.callSolver(problem.A, problem.b, x, problem.mu, os), "The solver failed without the convergence.") ||
+       !check(!core.isConverged(), "The solver converged in one iteration.") ||
+       !check(core.numIterations() == 1, "The number of the iterations is wrong.") ||
+       !check(x.norm() > 0.0, "The last iterate was not applied.")){
+        return false;
+    }
+    // continued from the last iterate
+    core.setGaussSeidelMaxNumIterations(MAX_ITERATIONS);
+    return check(core.callSolver(problem.A, problem.b, x, problem.mu, os), "The solver failed.") &&
+        check(core.isConverged(), "The solver did not converge.") &&
+        checkSolution(problem, x);
+}
+
+
+// a row whose diagonal element is the largest double is cleared as singular
+bool testClearedRow()
+{
+    srand(3);
+    std::ofstream os;
+    Problem problem(4, 1);
+    const int n = problem.size();
+    const int clearedRow = problem.frictionIndex(2, 1);
+    problem.A(clearedRow, clearedRow) = std::numeric_limits<double>::max();
+    BCCoreBlockGS core(MAX_ITERATIONS, ERROR_CRITERION);
+    core.NewBuffer(n);
+    VectorX x = VectorX::Constant(n, 1.0);
+    core.callSolver(problem.A, problem.b, x, problem.mu, os);
+    return check(core.isConverged(), "The solver did not converge.") &&
+        check(x(clearedRow) == 0.0, "The force of the cleared row is not zero.");
+}
+
+
+struct TestCase
+{
+    const char* name;
+    bool (*test)();
+};
+
+const TestCase testCases[] = {
+    { "random", testRandomProblems },
+    { "unconverged", testNotConverged },
+    { "cleared", testClearedRow }
+};
+
+}
+
+
+int main(int argc, char** argv)
+{
+    const int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    for(int i=0; i < numTestCases; ++i){
+        if(argc >= 2 && strcmp(argv[1], testCases[i].name) == 0){
+            return testCases[i].test() ? 0 : 1;
+        }
+    }
+    printf("Usage: %s <case>\ncases:", argv[0]);
+    for(int i=0; i < numTestCases; ++i){
+        printf(" %s", testCases[i].name);
+    }
+    printf("\n");
+    return 2;
+}
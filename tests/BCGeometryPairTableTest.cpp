@@ -0,0 +1,228 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+/**
+   Compares BCGeometryPairTable with std::map by random insertions, searches and evictions
+   over many steps. The values must keep their addresses while they are in the table, the
+   evicted values must be reset, and the pool must only grow when no evicted entry is free.
+   Usage: BCGeometryPairTableTest <case>
+*/
+
+#include "../BCGeometryPairTable.h"
+#include <map>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+using namespace cnoid;
+
+namespace {
+
+const int NUM_IDS = 40;
+const int NUM_STEPS = 3000;
+
+struct Value
+{
+    Value() : data(0) { }
+    int data;                // non-zero while the value is in the table
+    std::vector<int> buffer; // memory owned by the value
+};
+
+struct ReferenceEntry
+{
+    int data;
+    int lastStep;
+    Value* address;
+};
+
+typedef std::map< std::pair<int, int>, ReferenceEntry > ReferenceMap;
+
+
+bool check(bool condition, const char* message)
+{
+    if(!condition){
+        printf("%s\n", message);
+    }
+    return condition;
+}
+
+
+bool checkPool(BCGeometryPairTable<Value>& table, int maxSize)
+{
+    int numUsedValues = 0;
+    for(int i=0; i < table.poolSize(); ++i){
+        if(table.valueAt(i).data != 0){
+            ++numUsedValues;
+        } else if(!table.valueAt(i).buffer.empty()){
+            printf("An unused value owns memory.\n");
+            return false;
+        }
+    }
+    const int chunkSize = BCGeometryPairTable<Value>::CHUNK_SIZE;
+    return check(numUsedValues == table.size(), "The values in the pool do not match the size.") &&
+        check(table.poolSize() <= (maxSize + chunkSize - 1) / chunkSize * chunkSize,
+              "The pool grew although evicted entries were free.");
+}
+
+
+bool testRandomOperations()
+{
+    BCGeometryPairTable<Value> table;
+    ReferenceMap reference;
+    long numEvicted = 0;
+    int maxSize = 0;
+    srand(1);
+
+    for(int step=0; step < NUM_STEPS; ++step){
+        const int numOperations = rand() % 30;
+        for(int i=0; i < numOperations; ++i){
+            const int id0 = rand() % NUM_IDS;
+            const int id1 = rand() % NUM_IDS;
+            ReferenceMap::iterator p = reference.find(std::make_pair(id0, id1));
+            Value* value = table.find(id0, id1, step);
+            if(p == reference.end()){
+                if(!check(value == 0, "A pair which is not in the table was found.")){
+                    return false;
+                }
+                Value& inserted = table.insert(id0, id1, step);
+                if(!check(inserted.data == 0 && inserted.buffer.empty(), "An inserted value was not initialized.")){
+                    return false;
+                }
+                inserted.data = 1 + rand() % 1000;
+                inserted.buffer.resize(1 + rand() % 8);
+                ReferenceEntry entry;
+                entry.data = inserted.data;
+                entry.lastStep = step;
+                entry.address = &inserted;
+                reference[std::make_pair(id0, id1)] = entry;
+            } else {
+                if(!check(value == p->second.address, "The address of a value changed.") ||
+                   !check(value->data == p->second.data, "A wrong value was found.")){
+                    return false;
+                }
+                p->second.lastStep = step;
+            }
+        }
+        maxSize = std::max(maxSize, static_cast<int>(reference.size()));
+
+        if(step % 10 == 9){
+            const int maxIdleSteps = rand() % 20;
+            int numStale = 0;
+            ReferenceMap::iterator p = reference.begin();
+            while(p != reference.end()){
+                if(p->second.lastStep < step - maxIdleSteps){
+                    reference.erase(p++);
+                    ++numStale;
+                } else {
+                    ++p;
+                }
+            }
+            numEvicted += numStale;
+            if(!check(table.evict(step, maxIdleSteps) == numStale, "A wrong number of values was evicted.") ||
+               !checkPool(table, maxSize)){
+                return false;
+            }
+        }
+        if(!check(table.size() == static_cast<int>(reference.size()), "The size differs from std::map.")){
+            return false;
+        }
+    }
+
+    // all the pairs in the reference must still be found
+    for(ReferenceMap::iterator p = reference.begin(); p != reference.end(); ++p){
+        Value* value = table.find(p->first.first, p->first.second, NUM_STEPS);
+        if(!check(value && value->data == p->second.data, "A pair of the reference was not found.")){
+            return false;
+        }
+    }
+    printf("size: %d, evicted: %ld, pool: %d\n", table.size(), numEvicted, table.poolSize());
+    return check(table.totalNumEvictedEntries() == numEvicted, "The total number of the evicted values is wrong.");
+}
+
+
+// the pairs are ordered, and the ids of the colliding geometries can be far apart
+bool testOrderedAndLargeIds()
+{
+    BCGeometryPairTable<Value> table;
+    const int ids[] = { 0, 1, 63, 64, 1023, 1024, 65535, 1000003 };
+    const int numIds = sizeof(ids) / sizeof(ids[0]);
+    for(int i=0; i < numIds; ++i){
+        for(int j=0; j < numIds; ++j){
+            table.insert(ids[i], ids[j], 0).data = 1 + i * numIds + j;
+        }
+    }
+    for(int i=0; i < numIds; ++i){
+        for(int j=0; j < numIds; ++j){
+            Value* value = table.find(ids[i], ids[j], 1);
+            if(!check(value && value->data == 1 + i * numIds + j, "A pair was not found by its order.")){
+                return false;
+            }
+        }
+    }
+    if(!check(table.find(2, 3, 1) == 0, "A pair which was not inserted was found.")){
+        return false;
+    }
+    table.clear();
+    return check(table.size() == 0 && table.find(ids[0], ids[1], 2) == 0, "The table was not cleared.");
+}
+
+
+struct TestCase
+{
+    const char* name;
+    bool (*test)();
+};
+
+const TestCase testCases[] = {
+    { "random", testRandomOperations },
+    { "ordered", testOrderedAndLargeIds }
+};
+
+}
+
+
+int main(int argc, char** argv)
+{
+    const int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    for(int i=0; i < numTestCases; ++i){
+        if(argc >= 2 && strcmp(argv[1], testCases[i].name) == 0){
+            return testCases[i].test() ? 0 : 1;
+        }
+    }
+    printf("Usage: %s <case>\ncases:", argv[0]);
+    for(int i=0; i < numTestCases; ++i){
+        printf(" %s", testCases[i].name);
+    }
+    printf("\n");
+    return 2;
+}
@@ -0,0 +1,225 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+/**
+   Compares BCPackedSymmetricMatrix with a dense symmetric matrix which has the same
+   elements, with the identity, the reversed and random orders of the rows.
+   Usage: BCPackedSymmetricMatrixTest <case>
+*/
+
+#include "../BCPackedSymmetricMatrix.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+using namespace cnoid;
+
+namespace {
+
+typedef BCPackedSymmetricMatrix::MatrixX MatrixX;
+typedef BCPackedSymmetricMatrix::VectorX VectorX;
+
+const double TOLERANCE = 1.0e-12;
+
+
+bool check(bool condition, const char* message)
+{
+    if(!condition){
+        printf("%s\n", message);
+    }
+    return condition;
+}
+
+
+double randomValue()
+{
+    return 2.0 * rand() / RAND_MAX - 1.0;
+}
+
+
+// 0: identity, 1: reversed, 2: random
+std::vector<int> makeOrder(int size, int type)
+{
+    std::vector<int> rowToPosition(size);
+    for(int i=0; i < size; ++i){
+        rowToPosition[i] = (type == 1) ? (size - 1 - i) : i;
+    }
+    if(type == 2){
+        for(int i = size - 1; i > 0; --i){
+            std::swap(rowToPosition[i], rowToPosition[rand() % (i + 1)]);
+        }
+    }
+    return rowToPosition;
+}
+
+
+// the elements are set from either triangle at random
+void setRandomMatrix(BCPackedSymmetricMatrix& M, MatrixX& dense)
+{
+    const int n = M.rows();
+    dense.setZero(n, n);
+    for(int i=0; i < n; ++i){
+        for(int j=i; j < n; ++j){
+            const double v = randomValue();
+            if(i == j){
+                M.diagonalRef(i) = v;
+            } else if(rand() % 2){
+                M.coeffRef(i, j) = v;
+            } else {
+                M.coeffRef(j, i) = v;
+            }
+            dense(i, j) = v;
+            dense(j, i) = v;
+        }
+    }
+}
+
+
+bool compare(const BCPackedSymmetricMatrix& M, const MatrixX& dense)
+{
+    const int n = dense.rows();
+    if(!check(M.rows() == n && M.numStoredElements() == n * (n + 1) / 2, "The size differs.")){
+        return false;
+    }
+    for(int i=0; i < n; ++i){
+        for(int j=0; j < n; ++j){
+            if(M.coeff(i, j) != dense(i, j)){
+                printf("The element (%d, %d) is %g instead of %g.\n", i, j, M.coeff(i, j), dense(i, j));
+                return false;
+            }
+        }
+        if(!check(M.diagonal(i) == dense(i, i), "A wrong diagonal element was given.")){
+            return false;
+        }
+    }
+
+    VectorX x(n);
+    for(int i=0; i < n; ++i){
+        x(i) = randomValue();
+    }
+    VectorX y(n);
+    M.multiply(x, y);
+    const VectorX y0 = dense * x;
+    if(!check((y - y0).norm() <= TOLERANCE * (1.0 + y0.norm()), "multiply() differs from the dense product.")){
+        return false;
+    }
+    for(int i=0; i < n; ++i){
+        const double offDiagonal = dense.row(i).dot(x) - dense(i, i) * x(i);
+        if(!check(fabs(M.calcOffDiagonalRowProduct(i, x) - offDiagonal) <= TOLERANCE * (1.0 + x.norm() * dense.row(i).norm()),
+                  "calcOffDiagonalRowProduct() differs from the dense product.")){
+            return false;
+        }
+    }
+    MatrixX copied;
+    M.copyTo(copied);
+    return check(copied == dense, "copyTo() differs from the dense matrix.");
+}
+
+
+bool testOrders()
+{
+    srand(1);
+    const int sizes[] = { 1, 2, 7, 40, 150 };
+    BCPackedSymmetricMatrix M;
+    MatrixX dense;
+    for(int i=0; i < 5; ++i){
+        for(int type=0; type < 3; ++type){
+            // the order is set again to the same object
+            M.setOrder(makeOrder(sizes[i], type));
+            setRandomMatrix(M, dense);
+            if(!compare(M, dense)){
+                printf("size %d, order %d\n", sizes[i], type);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+// the elements (i, j) and (j, i) are one value
+bool testSharedElements()
+{
+    srand(2);
+    BCPackedSymmetricMatrix M;
+    M.setOrder(makeOrder(30, 2));
+    M.setZero();
+    for(int k=0; k < 200; ++k){
+        const int i = rand() % 30;
+        const int j = rand() % 30;
+        M.coeffRef(i, j) += 1.0;
+        if(!check(M.coeff(j, i) == M.coeff(i, j), "The elements (i, j) and (j, i) differ.")){
+            return false;
+        }
+    }
+    MatrixX dense;
+    setRandomMatrix(M, dense);
+    M.setZero();
+    dense.setZero();
+    if(!compare(M, dense)){
+        return false;
+    }
+    M.clear();
+    return check(M.rows() == 0 && M.numStoredElements() == 0, "The matrix was not cleared.");
+}
+
+
+struct TestCase
+{
+    const char* name;
+    bool (*test)();
+};
+
+const TestCase testCases[] = {
+    { "orders", testOrders },
+    { "shared", testSharedElements }
+};
+
+}
+
+
+int main(int argc, char** argv)
+{
+    const int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    for(int i=0; i < numTestCases; ++i){
+        if(argc >= 2 && strcmp(argv[1], testCases[i].name) == 0){
+            return testCases[i].test() ? 0 : 1;
+        }
+    }
+    printf("Usage: %s <case>\ncases:", argv[0]);
+    for(int i=0; i < numTestCases; ++i){
+        printf(" %s", testCases[i].name);
+    }
+    printf("\n");
+    return 2;
+}
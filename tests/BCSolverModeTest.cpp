@@ -0,0 +1,518 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+/**
+   Runs a scene with the modes of BCConstraintForceSolver and compares it with the same
+   scene solved by the projected Gauss-Seidel method with the default settings. The scene
+   has a free box and a free foot with two servoed joints standing on a static floor, which
+   drop onto the floor and settle. The positions of the links are sampled every 10 ms, and
+   the largest difference from the baseline must be within the tolerance of the mode.
+   The test of a mode also checks that the mode was actually used in the run.
+   Usage: BCSolverModeTest <mode>
+*/
+
+#include "../BCConstraintForceSolver.h"
+#include "../BCForwardDynamicsABM.h"
+#include <cnoid/DyWorld>
+#include <cnoid/DyBody>
+#include <cnoid/SceneShape>
+#include <cnoid/SceneGraph>
+#include <cnoid/MeshGenerator>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+using namespace cnoid;
+
+namespace {
+
+const double TIME_STEP = 0.001;
+const double SIMULATION_TIME = 1.0;
+const double SAMPLING_INTERVAL = 0.01;
+
+// gains of the servo of the joints
+const double JOINT_KP = 100.0;
+const double JOINT_KD = 10.0;
+
+// tolerances of the largest difference of the link positions from the baseline
+const double SAME_MATRIX_TOLERANCE = 1.0e-6;  // modes which only store or calculate the matrix differently
+const double SOLVER_TOLERANCE = 2.0e-3;       // modes which solve the LCP in a different order
+const double PATCH_TOLERANCE = 5.0e-3;        // one point with the moments for the flat contacts
+const double PENALTY_TOLERANCE = 1.0e-2;      // penalty-based contacts, which penetrate up to 5 % of the size of the links
+
+
+void setBoxShape(Link* link, const Vector3& size, const Vector3& center)
+{
+    MeshGenerator meshGenerator;
+    SgShapePtr shape = new SgShape;
+    shape->setMesh(meshGenerator.generateBox(size));
+    SgPosTransformPtr transform = new SgPosTransform;
+    transform->setTranslation(center);
+    transform->addChild(shape);
+    link->setShape(transform);
+}
+
+
+void setBoxInertia(Link* link, double mass, const Vector3& size, const Vector3& center)
+{
+    link->setMass(mass);
+    link->setCenterOfMass(center);
+    Matrix3 I = Matrix3::Zero();
+    I(0, 0) = mass * (size.y() * size.y() + size.z() * size.z()) / 12.0;
+    I(1, 1) = mass * (size.z() * size.z() + size.x() * size.x()) / 12.0;
+    I(2, 2) = mass * (size.x() * size.x() + size.y() * size.y()) / 12.0;
+    link->setInertia(I);
+}
+
+
+DyBody* createFloor()
+{
+    DyBody* body = new DyBody;
+    body->setName("Floor");
+    body->setModelName("Floor");
+    DyLink* link = body->createLink();
+    link->setName("FLOOR");
+    link->setJointType(Link::FIXED_JOINT);
+    setBoxShape(link, Vector3(4.0, 4.0, 0.2), Vector3(0.0, 0.0, -0.1));
+    body->setRootLink(link);
+    body->updateLinkTree();
+    return body;
+}
+
+
+DyBody* createBox()
+{
+    DyBody* body = new DyBody;
+    body->setName("Box");
+    body->setModelName("Box");
+    DyLink* link = body->createLink();
+    link->setName("BOX");
+    link->setJointType(Link::FREE_JOINT);
+    const Vector3 size(0.2, 0.2, 0.2);
+    setBoxShape(link, size, Vector3::Zero());
+    setBoxInertia(link, 1.0, size, Vector3::Zero());
+    body->setRootLink(link);
+    body->updateLinkTree();
+    link->p() << -0.5, 0.0, 0.105;
+    link->R().setIdentity();
+    return body;
+}
+
+
+// a foot with two links on a pitch joint and a roll joint, which are bent a little initially
+DyBody* createArm()
+{
+    DyBody* body = new DyBody;
+    body->setName("Arm");
+    body->setModelName("Arm");
+
+    DyLink* foot = body->createLink();
+    foot->setName("FOOT");
+    foot->setJointType(Link::FREE_JOINT);
+    const Vector3 footSize(0.3, 0.3, 0.05);
+    setBoxShape(foot, footSize, Vector3::Zero());
+    setBoxInertia(foot, 2.0, footSize, Vector3::Zero());
+
+    const Vector3 rodSize(0.05, 0.05, 0.3);
+    const Vector3 rodCenter(0.0, 0.0, 0.15);
+    DyLink* parent = foot;
+    for(int i=0; i < 2; ++i){
+        DyLink* rod = body->createLink();
+        rod->setName(i == 0 ? "PITCH" : "ROLL");
+        rod->setJointType(Link::ROTATIONAL_JOINT);
+        rod->setJointId(i);
+        rod->setJointAxis(i == 0 ? Vector3::UnitY() : Vector3::UnitX());
+        rod->setOffsetTranslation(i == 0 ? Vector3(0.0, 0.0, 0.025) : Vector3(0.0, 0.0, 0.3));
+        setBoxShape(rod, rodSize, rodCenter);
+        setBoxInertia(rod, 0.5, rodSize, rodCenter);
+        parent->appendChild(rod);
+        parent = rod;
+    }
+    body->setRootLink(foot);
+    body->updateLinkTree();
+
+    foot->p() << 0.5, 0.0, 0.03;
+    foot->R().setIdentity();
+    for(int i=0; i < body->numJoints(); ++i){
+        body->joint(i)->q() = 0.1;
+    }
+    return body;
+}
+
+
+class Scene
+{
+public:
+    Scene(double timeStep = TIME_STEP, bool isFusedABMMode = false)
+        : timeStep(timeStep),
+          isFusedABMMode(isFusedABMMode) {
+        world.setEulerMethod();
+        world.setGravityAcceleration(Vector3(0.0, 0.0, -9.8));
+        world.setTimeStep(timeStep);
+        world.setCurrentTime(0.0);
+        world.constraintForceSolver.setSolverID(0);
+    }
+
+    // the settings of the solver must be given before run()
+    BCConstraintForceSolver& solver() { return world.constraintForceSolver; }
+
+    void run();
+
+    const std::vector<Vector3>& samples() const { return samples_; }
+
+private:
+    void addBody(DyBody* body);
+    void controlJoints();
+    void sample();
+
+    World<BCConstraintForceSolver> world;
+    std::vector<DyBodyPtr> movingBodies;
+    std::vector<Vector3> samples_;
+    double timeStep;
+    bool isFusedABMMode;
+};
+
+
+void Scene::addBody(DyBody* body)
+{
+    for(int i=0; i < body->numLinks(); ++i){
+        DyLink* link = body->link(i);
+        link->v().setZero();
+        link->w().setZero();
+        link->dq() = 0.0;
+        link->ddq() = 0.0;
+        link->u() = 0.0;
+    }
+    body->clearExternalForces();
+    body->calcForwardKinematics(true, true);
+
+    if(isFusedABMMode && !body->isStaticModel()){
+        BCForwardDynamicsABMPtr abm(
+            new BCForwardDynamicsABM(body, world.constraintForceSolver, world.numBodies()));
+        world.addBody(body, abm);
+    } else {
+        world.addBody(body);
+    }
+    if(!body->isStaticModel()){
+        movingBodies.push_back(body);
+    }
+}
+
+
+void Scene::controlJoints()
+{
+    for(size_t i=0; i < movingBodies.size(); ++i){
+        DyBody* body = movingBodies[i];
+        for(int j=0; j < body->numJoints(); ++j){
+            Link* joint = body->joint(j);
+            joint->u() = -JOINT_KP * joint->q() - JOINT_KD * joint->dq();
+        }
+    }
+}
+
+
+void Scene::sample()
+{
+    for(size_t i=0; i < movingBodies.size(); ++i){
+        DyBody* body = movingBodies[i];
+        for(int j=0; j < body->numLinks(); ++j){
+            samples_.push_back(body->link(j)->p());
+        }
+    }
+}
+
+
+void Scene::run()
+{
+    world.clearBodies();
+    addBody(createFloor());
+    addBody(createBox());
+    addBody(createArm());
+    world.initialize();
+
+    const int numSteps = static_cast<int>(SIMULATION_TIME / timeStep + 0.5);
+    const int samplingSteps = std::max(1, static_cast<int>(SAMPLING_INTERVAL / timeStep + 0.5));
+    sample();
+    for(int i=1; i <= numSteps; ++i){
+        world.constraintForceSolver.clearExternalForces();
+        controlJoints();
+        world.calcNextState();
+        if(i % samplingSteps == 0){
+            sample();
+        }
+    }
+}
+
+
+bool compareSamples(const Scene& scene, const Scene& reference, double tolerance, const char* referenceName)
+{
+    const std::vector<Vector3>& samples = scene.samples();
+    const std::vector<Vector3>& referenceSamples = reference.samples();
+    if(samples.size() != referenceSamples.size()){
+        printf("The number of the samples is %d instead of %d.\n",
+               (int)samples.size(), (int)referenceSamples.size());
+        return false;
+    }
+    double maxDiff = 0.0;
+    for(size_t i=0; i < samples.size(); ++i){
+        maxDiff = std::max(maxDiff, (samples[i] - referenceSamples[i]).norm());
+    }
+    printf("largest difference from %s: %g (tolerance %g)\n", referenceName, maxDiff, tolerance);
+    return maxDiff <= tolerance;
+}
+
+
+bool compareWithBaseline(const Scene& scene, double tolerance)
+{
+    Scene baseline;
+    baseline.run();
+    return compareSamples(scene, baseline, tolerance, "the baseline");
+}
+
+
+bool check(bool condition, const char* message)
+{
+    if(!condition){
+        printf("%s\n", message);
+    }
+    return condition;
+}
+
+
+bool testSparseMatrixMode()
+{
+    Scene scene;
+    scene.solver().setSparseMatrixMode(true);
+    scene.run();
+    return compareWithBaseline(scene, SAME_MATRIX_TOLERANCE);
+}
+
+
+bool testBlockGaussSeidelSolver()
+{
+    Scene scene;
+    scene.solver().setSolverID(3);
+    scene.run();
+    return check(scene.solver().numUnconvergedBlockGaussSeidelSolutions() == 0,
+                 "The block Gauss-Seidel solver did not converge.") &&
+        compareWithBaseline(scene, SOLVER_TOLERANCE);
+}
+
+
+// the box and the foot only touch the static floor, so they form two islands
+bool testIslandMode()
+{
+    Scene scene;
+    scene.solver().setIslandMode(true);
+    scene.solver().setNumThreads(2);
+    scene.run();
+    return check(scene.solver().maxNumIslands() == 2, "The contacts were not split into two islands.") &&
+        compareWithBaseline(scene, SOLVER_TOLERANCE);
+}
+
+
+bool testColoredGaussSeidelSolver()
+{
+    Scene scene;
+    scene.solver().setSolverID(4);
+    scene.solver().setNumThreads(2);
+    scene.run();
+    return check(scene.solver().maxNumColors() > 0, "No constraint was colored.") &&
+        compareWithBaseline(scene, SOLVER_TOLERANCE);
+}
+
+
+bool testMatrixFreeGaussSeidelSolver()
+{
+    Scene scene;
+    scene.solver().setSolverID(5);
+    scene.run();
+    return check(scene.solver().isMatrixFreeMode(), "The matrix-free mode was not used.") &&
+        compareWithBaseline(scene, SOLVER_TOLERANCE);
+}
+
+
+bool testJacobianAssemblyMode()
+{
+    Scene scene;
+    scene.solver().setJacobianAssemblyMode(true);
+    scene.run();
+    const BCConstraintForceSolver& solver = scene.solver();
+    return check(solver.numJacobianAssemblyChecks() > 0, "The Jacobian assembly was not checked.") &&
+        check(!solver.isJacobianAssemblyUnsafe(), "The Jacobian assembly did not agree with the test forces.") &&
+        compareWithBaseline(scene, SAME_MATRIX_TOLERANCE);
+}
+
+
+bool testSymmetricMatrixMode()
+{
+    Scene scene;
+    scene.solver().setSymmetricMatrixMode(true);
+    scene.run();
+    const BCConstraintForceSolver& solver = scene.solver();
+    return check(!solver.isSymmetricMatrixUnsafe(), "The half assembly did not agree with the full assembly.") &&
+        check(solver.numSymmetricMatrixFallbacks() == 0, "The matrix was assembled fully.") &&
+        compareWithBaseline(scene, SAME_MATRIX_TOLERANCE);
+}
+
+
+// the fused mode only works with the matrix-free mode, so it is also compared with the matrix-free mode alone
+bool testFusedABMMode()
+{
+    Scene scene(TIME_STEP, true);
+    scene.solver().setSolverID(5);
+    scene.solver().setFusedABMMode(true);
+    scene.run();
+    if(!check(scene.solver().totalNumFusedABMLinks() > 0, "No accelerations were given by the solver.")){
+        return false;
+    }
+    Scene matrixFree;
+    matrixFree.solver().setSolverID(5);
+    matrixFree.run();
+    return compareSamples(scene, matrixFree, SAME_MATRIX_TOLERANCE, "the matrix-free mode") &&
+        compareWithBaseline(scene, SOLVER_TOLERANCE);
+}
+
+
+bool testPatchContactMode()
+{
+    Scene scene;
+    scene.solver().setPatchContactMode(true);
+    scene.run();
+    return check(scene.solver().totalNumContactPatches() > 0, "No contact patch was made.") &&
+        compareWithBaseline(scene, PATCH_TOLERANCE);
+}
+
+
+// the box has the penalty-based contacts, which must also settle with a step ten times longer
+bool testPenaltyImplicitMode()
+{
+    const double timeSteps[] = { TIME_STEP, 10.0 * TIME_STEP };
+    for(int i=0; i < 2; ++i){
+        Scene scene(timeSteps[i]);
+        scene.solver().setPenaltyBodyNames(std::vector<std::string>(1, "Box"));
+        scene.solver().setPenaltyImplicitMode(true);
+        scene.run();
+        if(!check(scene.solver().totalNumImplicitPenaltyLinkPairs() > 0, "No penalty link pair was implicit.")){
+            return false;
+        }
+        printf("time step %g: ", timeSteps[i]);
+        if(!compareWithBaseline(scene, PENALTY_TOLERANCE)){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// the budget is less than the constraints of the box or the foot, so one of them is moved to the penalty-based contacts
+bool testAutoPenaltyMode()
+{
+    Scene scene;
+    scene.solver().setAutoPenaltyMaxNumConstraints(8);
+    scene.run();
+    return check(scene.solver().totalNumAutoPenaltyLinkPairs() > 0, "No link pair was moved to the penalty-based contacts.") &&
+        compareWithBaseline(scene, PENALTY_TOLERANCE);
+}
+
+
+// the bodies are solved by ABM, so the test forces are applied by the threads
+// and the result must be bitwise identical to the serial assembly
+bool testParallelAssemblyMode()
+{
+    Scene scene;
+    scene.solver().setParallelAssemblyMode(true);
+    scene.solver().setNumThreads(2);
+    scene.run();
+    const BCConstraintForceSolver& solver = scene.solver();
+    return check(solver.numParallelAssemblies() > 0 && solver.numParallelAssemblies() == solver.numAssemblies(),
+                 "The matrix was assembled serially.") &&
+        compareWithBaseline(scene, 0.0);
+}
+
+
+// the resting contacts keep their identities, so most of the points are warm-started,
+// also with the friction vectors kept from the previous step
+bool testWarmStart()
+{
+    Scene scene;
+    scene.solver().setStableFrictionBasisMode(true);
+    scene.run();
+    const BCConstraintForceSolver& solver = scene.solver();
+    printf("warm-started points: %ld, cold-started points: %ld\n",
+           solver.totalNumWarmStartedPoints(), solver.totalNumColdStartedPoints());
+    return check(solver.totalNumWarmStartedPoints() > solver.totalNumColdStartedPoints(),
+                 "Most of the points were not warm-started.") &&
+        compareWithBaseline(scene, SOLVER_TOLERANCE);
+}
+
+
+struct TestCase
+{
+    const char* mode;
+    bool (*test)();
+};
+
+const TestCase testCases[] = {
+    { "sparse", testSparseMatrixMode },
+    { "blockgs", testBlockGaussSeidelSolver },
+    { "islands", testIslandMode },
+    { "colored", testColoredGaussSeidelSolver },
+    { "matrixfree", testMatrixFreeGaussSeidelSolver },
+    { "jacobian", testJacobianAssemblyMode },
+    { "symmetric", testSymmetricMatrixMode },
+    { "fusedabm", testFusedABMMode },
+    { "patch", testPatchContactMode },
+    { "implicitpenalty", testPenaltyImplicitMode },
+    { "autopenalty", testAutoPenaltyMode },
+    { "parallel", testParallelAssemblyMode },
+    { "warmstart", testWarmStart }
+};
+
+}
+
+
+int main(int argc, char** argv)
+{
+    const int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    for(int i=0; i < numTestCases; ++i){
+        if(argc >= 2 && strcmp(argv[1], testCases[i].mode) == 0){
+            return testCases[i].test() ? 0 : 1;
+        }
+    }
+    printf("Usage: %s <mode>\nmodes:", argv[0]);
+    for(int i=0; i < numTestCases; ++i){
+        printf(" %s", testCases[i].mode);
+    }
+    printf("\n");
+    return 2;
+}
@@ -0,0 +1,227 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+/**
+   Compares BCSparseMatrix with a dense matrix which has the same elements. The rows
+   are grouped at random, and each group has a random sorted list of the columns which
+   includes the rows of the group, as the constrained link pairs give.
+   Usage: BCSparseMatrixTest <case>
+*/
+
+#include "../BCSparseMatrix.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+using namespace cnoid;
+
+namespace {
+
+typedef BCSparseMatrix::MatrixX MatrixX;
+typedef BCSparseMatrix::VectorX VectorX;
+
+const double TOLERANCE = 1.0e-12;
+
+
+bool check(bool condition, const char* message)
+{
+    if(!condition){
+        printf("%s\n", message);
+    }
+    return condition;
+}
+
+
+double randomValue()
+{
+    return 2.0 * rand() / RAND_MAX - 1.0;
+}
+
+
+// sets a random pattern to the matrix and random values to the pattern and the dense matrix
+void setRandomMatrix(int size, int numGroups, double density, BCSparseMatrix& M, MatrixX& dense)
+{
+    std::vector<int> rowToGroup(size);
+    std::vector< std::vector<char> > isColumnOfGroup(numGroups, std::vector<char>(size, 0));
+    for(int i=0; i < size; ++i){
+        rowToGroup[i] = rand() % numGroups;
+        isColumnOfGroup[rowToGroup[i]][i] = 1;
+    }
+    std::vector< std::vector<int> > groupColumns(numGroups);
+    for(int g=0; g < numGroups; ++g){
+        for(int j=0; j < size; ++j){
+            if(isColumnOfGroup[g][j] || rand() < density * RAND_MAX){
+                groupColumns[g].push_back(j);
+            }
+        }
+    }
+    M.setStructure(size, rowToGroup, groupColumns);
+
+    dense.setZero(size, size);
+    for(int i=0; i < size; ++i){
+        const std::vector<int>& columns = groupColumns[rowToGroup[i]];
+        for(size_t k=0; k < columns.size(); ++k){
+            const double v = randomValue();
+            M.coeffRef(i, columns[k]) = v;
+            dense(i, columns[k]) = v;
+        }
+    }
+}
+
+
+bool compare(const BCSparseMatrix& M, const MatrixX& dense)
+{
+    const int n = dense.rows();
+    if(!check(M.rows() == n && M.cols() == n, "The size differs.")){
+        return false;
+    }
+    int numNonZeros = 0;
+    for(int i=0; i < n; ++i){
+        for(int j=0; j < n; ++j){
+            if(M.coeff(i, j) != dense(i, j)){
+                printf("The element (%d, %d) is %g instead of %g.\n", i, j, M.coeff(i, j), dense(i, j));
+                return false;
+            }
+            const int k = M.findPosition(i, j);
+            if(k >= 0){
+                ++numNonZeros;
+                if(!check(M.columnIndex(k) == j && M.value(k) == dense(i, j), "A wrong position was found.")){
+                    return false;
+                }
+            } else if(!check(dense(i, j) == 0.0, "An element of the pattern was not found.")){
+                return false;
+            }
+        }
+        if(!check(M.diagonal(i) == dense(i, i), "A wrong diagonal element was given.")){
+            return false;
+        }
+    }
+    if(!check(numNonZeros == M.nonZeros(), "The number of the elements of the pattern is wrong.")){
+        return false;
+    }
+
+    VectorX x(n);
+    for(int i=0; i < n; ++i){
+        x(i) = randomValue();
+    }
+    VectorX y(n);
+    M.multiply(x, y);
+    const VectorX y0 = dense * x;
+    if(!check((y - y0).norm() <= TOLERANCE * (1.0 + y0.norm()), "multiply() differs from the dense product.")){
+        return false;
+    }
+    M.multiplyTransposed(x, y);
+    const VectorX yt0 = dense.transpose() * x;
+    if(!check((y - yt0).norm() <= TOLERANCE * (1.0 + yt0.norm()), "multiplyTransposed() differs from the dense product.")){
+        return false;
+    }
+    for(int i=0; i < n; ++i){
+        const double offDiagonal = dense.row(i).dot(x) - dense(i, i) * x(i);
+        if(!check(fabs(M.calcOffDiagonalRowProduct(i, x) - offDiagonal) <= TOLERANCE * (1.0 + x.norm() * dense.row(i).norm()),
+                  "calcOffDiagonalRowProduct() differs from the dense product.")){
+            return false;
+        }
+    }
+    MatrixX copied;
+    M.copyTo(copied);
+    return check(copied == dense, "copyTo() differs from the dense matrix.");
+}
+
+
+bool testRandomPatterns()
+{
+    srand(1);
+    const int sizes[] = { 1, 3, 12, 50, 120 };
+    BCSparseMatrix M;
+    MatrixX dense;
+    for(int i=0; i < 5; ++i){
+        // the structure is set again to the same object
+        for(int j=0; j < 10; ++j){
+            const int numGroups = 1 + rand() % sizes[i];
+            setRandomMatrix(sizes[i], numGroups, 0.2 * (j % 5), M, dense);
+            if(!compare(M, dense)){
+                printf("size %d, %d groups\n", sizes[i], numGroups);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+bool testSetZeroAndClear()
+{
+    srand(2);
+    BCSparseMatrix M;
+    MatrixX dense;
+    setRandomMatrix(40, 8, 0.3, M, dense);
+    const int numNonZeros = M.nonZeros();
+    M.setZero();
+    dense.setZero();
+    if(!compare(M, dense) || !check(M.nonZeros() == numNonZeros, "setZero() changed the pattern.")){
+        return false;
+    }
+    M.clear();
+    return check(M.rows() == 0 && M.nonZeros() == 0, "The matrix was not cleared.");
+}
+
+
+struct TestCase
+{
+    const char* name;
+    bool (*test)();
+};
+
+const TestCase testCases[] = {
+    { "random", testRandomPatterns },
+    { "zero", testSetZeroAndClear }
+};
+
+}
+
+
+int main(int argc, char** argv)
+{
+    const int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    for(int i=0; i < numTestCases; ++i){
+        if(argc >= 2 && strcmp(argv[1], testCases[i].name) == 0){
+            return testCases[i].test() ? 0 : 1;
+        }
+    }
+    printf("Usage: %s <case>\ncases:", argv[0]);
+    for(int i=0; i < numTestCases; ++i){
+        printf(" %s", testCases[i].name);
+    }
+    printf("\n");
+    return 2;
+}
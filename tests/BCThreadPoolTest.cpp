@@ -0,0 +1,225 @@
+/* 
+ This file is a part of BetterContactPlugin.
+ 
+ Author: Shin'ichiro Nakaoka
+ Author: Ryo Kikuuwe
+ 
+ Copyright (c) 2007-2015 Shin'ichiro Nakaoka
+ Copyright (c) 2014-2015 Ryo Kikuuwe
+ Copyright (c) 2007-2015 National Institute of Advanced Industrial
+                         Science and Technology (AIST)
+ Copyright (c) 2014-2015 Kyushu University
+
+ BetterContactPlugin is a plugin for better simulation of frictional contacts.
+ 
+ BetterContactPlugin is a free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ BetterContactPlugin is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with BetterContactPlugin; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ 
+ Contact: Ryo Kikuuwe, kikuuwe@ieee.org
+*/
+
+/**
+   Runs batches of tasks on BCThreadPool with the numbers of the threads and the tasks
+   around the boundaries. Each task must be run exactly once by a worker in the range,
+   the tasks of a busy worker must be stolen by the others, and the pool must be
+   reusable after the number of the threads is changed.
+   Usage: BCThreadPoolTest <case>
+*/
+
+#include "../BCThreadPool.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+
+using namespace cnoid;
+
+namespace {
+
+class TaskRecorder
+{
+public:
+    TaskRecorder(int numTasks)
+        : counts(numTasks, 0), workers(numTasks, -1), numFinishedTasks(0), isWaitTimedOut(false) { }
+
+    void run(int task, int worker) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        ++counts[task];
+        workers[task] = worker;
+        ++numFinishedTasks;
+    }
+
+    // the task 0 waits until the other tasks are finished, which needs the tasks queued
+    // after it for the same worker to be stolen
+    void runWaitingForOthers(int task, int worker) {
+        if(task == 0){
+            boost::posix_time::ptime timeout =
+                boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(10);
+            while(finishedTasks() < static_cast<int>(counts.size()) - 1){
+                if(boost::posix_time::microsec_clock::universal_time() > timeout){
+                    isWaitTimedOut = true;
+                    break;
+                }
+                boost::this_thread::yield();
+            }
+        }
+        run(task, worker);
+    }
+
+    int finishedTasks() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return numFinishedTasks;
+    }
+
+    bool check(int numThreads) const {
+        for(size_t i=0; i < counts.size(); ++i){
+            if(counts[i] != 1){
+                printf("The task %d of %d was run %d times with %d threads.\n",
+                       (int)i, (int)counts.size(), counts[i], numThreads);
+                return false;
+            }
+            if(workers[i] < 0 || workers[i] >= numThreads){
+                printf("The task %d was run by the worker %d with %d threads.\n", (int)i, workers[i], numThreads);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const std::vector<int>& taskWorkers() const { return workers; }
+    bool hasWaitTimedOut() const { return isWaitTimedOut; }
+
+private:
+    boost::mutex mutex;
+    std::vector<int> counts;
+    std::vector<int> workers;
+    int numFinishedTasks;
+    bool isWaitTimedOut;
+};
+
+
+bool testEachTaskOnce()
+{
+    const int numTasksList[] = { 0, 1, 2, 3, 7, 64, 1000 };
+    BCThreadPool pool;
+    for(int numThreads=1; numThreads <= 4; ++numThreads){
+        pool.setNumThreads(numThreads);
+        for(int i=0; i < 7; ++i){
+            // repeated batches reuse the threads waiting for the next job
+            for(int j=0; j < 20; ++j){
+                TaskRecorder recorder(numTasksList[i]);
+                pool.run(numTasksList[i], boost::bind(&TaskRecorder::run, &recorder, _1, _2));
+                if(!recorder.check(numThreads)){
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+
+bool testSequential()
+{
+    BCThreadPool pool;
+    pool.setNumThreads(1);
+    TaskRecorder recorder(100);
+    pool.run(100, boost::bind(&TaskRecorder::run, &recorder, _1, _2));
+    const std::vector<int>& workers = recorder.taskWorkers();
+    for(size_t i=0; i < workers.size(); ++i){
+        if(workers[i] != 0){
+            printf("The task %d was not run by the calling thread.\n", (int)i);
+            return false;
+        }
+    }
+    return recorder.check(1);
+}
+
+
+bool testStealing()
+{
+    BCThreadPool pool;
+    for(int numThreads=2; numThreads <= 4; ++numThreads){
+        pool.setNumThreads(numThreads);
+        const int numTasks = 10 * numThreads;
+        TaskRecorder recorder(numTasks);
+        pool.run(numTasks, boost::bind(&TaskRecorder::runWaitingForOthers, &recorder, _1, _2));
+        if(!recorder.check(numThreads)){
+            return false;
+        }
+        if(recorder.hasWaitTimedOut()){
+            printf("The tasks of the busy worker were not stolen with %d threads.\n", numThreads);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool testNumThreads()
+{
+    BCThreadPool pool;
+    if(pool.numThreads() != 1){
+        printf("The pool does not start with one thread.\n");
+        return false;
+    }
+    const int numThreadsList[] = { 3, 3, 1, 0, -2, 5, 2 };
+    const int expected[] = { 3, 3, 1, 1, 1, 5, 2 };
+    for(int i=0; i < 7; ++i){
+        pool.setNumThreads(numThreadsList[i]);
+        if(pool.numThreads() != expected[i]){
+            printf("setNumThreads(%d) gave %d threads.\n", numThreadsList[i], pool.numThreads());
+            return false;
+        }
+        TaskRecorder recorder(50);
+        pool.run(50, boost::bind(&TaskRecorder::run, &recorder, _1, _2));
+        if(!recorder.check(expected[i])){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+struct TestCase
+{
+    const char* name;
+    bool (*test)();
+};
+
+const TestCase testCases[] = {
+    { "once", testEachTaskOnce },
+    { "sequential", testSequential },
+    { "stealing", testStealing },
+    { "threads", testNumThreads }
+};
+
+}
+
+
+int main(int argc, char** argv)
+{
+    const int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    for(int i=0; i < numTestCases; ++i){
+        if(argc >= 2 && strcmp(argv[1], testCases[i].name) == 0){
+            return testCases[i].test() ? 0 : 1;
+        }
+    }
+    printf("Usage: %s <case>\ncases:", argv[0]);
+    for(int i=0; i < numTestCases; ++i){
+        printf(" %s", testCases[i].name);
+    }
+    printf("\n");
+    return 2;
+}